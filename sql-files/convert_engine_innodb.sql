@@ -36,6 +36,7 @@ ALTER TABLE `pet` ENGINE = InnoDB;
 ALTER TABLE `quest` ENGINE = InnoDB;
 ALTER TABLE `ragsrvinfo` ENGINE = InnoDB;
 ALTER TABLE `sc_data` ENGINE = InnoDB;
+ALTER TABLE `section_blob` ENGINE = InnoDB;
 ALTER TABLE `skill` ENGINE = InnoDB;
 ALTER TABLE `skill_homunculus` ENGINE = InnoDB;
 ALTER TABLE `sstatus` ENGINE = InnoDB;
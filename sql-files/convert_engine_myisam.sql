@@ -36,6 +36,7 @@ ALTER TABLE `pet` ENGINE = MyISAM;
 ALTER TABLE `quest` ENGINE = MyISAM;
 ALTER TABLE `ragsrvinfo` ENGINE = MyISAM;
 ALTER TABLE `sc_data` ENGINE = MyISAM;
+ALTER TABLE `section_blob` ENGINE = MyISAM;
 ALTER TABLE `skill` ENGINE = MyISAM;
 ALTER TABLE `skill_homunculus` ENGINE = MyISAM;
 ALTER TABLE `sstatus` ENGINE = MyISAM;
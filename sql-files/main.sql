@@ -447,6 +447,17 @@ CREATE TABLE IF NOT EXISTS `sc_data` (
   KEY (`char_id`)
 ) ENGINE=MyISAM;
 
+--
+-- Table structure for table `section_blob`
+--
+
+CREATE TABLE IF NOT EXISTS `section_blob` (
+  `type` tinyint(1) unsigned NOT NULL,
+  `id` int(11) unsigned NOT NULL,
+  `data` mediumblob NOT NULL,
+  PRIMARY KEY  (`type`,`id`)
+) ENGINE=MyISAM;
+
 --
 -- Table structure for table `mail`
 --
@@ -0,0 +1,6 @@
+CREATE TABLE IF NOT EXISTS `section_blob` (
+  `type` tinyint(1) unsigned NOT NULL,
+  `id` int(11) unsigned NOT NULL,
+  `data` mediumblob NOT NULL,
+  PRIMARY KEY  (`type`,`id`)
+) ENGINE=MyISAM;
@@ -4,6 +4,7 @@
 #include "../common/cbasetypes.h"
 #include "../common/core.h"
 #include "../common/db.h"
+#include "../common/ers.h"
 #include "../common/lock.h"
 #include "../common/malloc.h"
 #include "../common/mapindex.h"
@@ -30,6 +31,7 @@
 #include <stdarg.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <zlib.h>
 
 // private declarations
 #define CHAR_CONF_NAME	"conf/char_athena.conf"
@@ -123,6 +125,7 @@ int start_zeny = 0;
 int start_weapon = 1201;
 int start_armor = 2301;
 int guild_exp_rate = 100;
+int mapif_compress_size = 1024; // packets to the map-servers from this size on are compressed (0: never)
 
 //Custom limits for the fame lists. [Skotlex]
 int fame_list_size_chemist = MAX_FAME_LIST;
@@ -4185,21 +4188,65 @@ int parse_console(const char* command)
 		runflag = SERVER_STATE_STOP;
 	else if( strcmpi("alive", command) == 0 || strcmpi("status", command) == 0 )
 		ShowInfo(CL_CYAN"Console: "CL_BOLD"I'm Alive."CL_RESET"\n");
+	else if( strcmpi("memory", command) == 0 )
+	{
+		ShowInfo("Memory usage: %u KB\n", (unsigned int)malloc_usage());
+		ers_report();
+		arena_report();
+	}
+	else if( strcmpi("timers", command) == 0 )
+		timer_stats_report(20);
+	else if( strcmpi("timersreset", command) == 0 )
+		timer_stats_reset();
 	else if( strcmpi("help", command) == 0 )
 	{
 		ShowInfo("To shutdown the server:\n");
 		ShowInfo("  'shutdown|exit|quit|end'\n");
 		ShowInfo("To know if server is alive:\n");
 		ShowInfo("  'alive|status'\n");
+		ShowInfo("To show the memory usage of each subsystem:\n");
+		ShowInfo("  'memory'\n");
+		ShowInfo("To show or reset the time used by the timer functions:\n");
+		ShowInfo("  'timers|timersreset'\n");
 	}
 
 	return 0;
 }
 
+/// Wraps a packet in a zlib compressed envelope (0x3807), when it is big
+/// enough and compresses well. Returns the envelope length or 0 if the
+/// packet should be sent as it is.
+/// R 3807 <packet len>.W <original len>.W <compressed packet>.?B
+static unsigned int mapif_compress(unsigned char* out, unsigned char* buf, unsigned int len)
+{
+	unsigned long size;
+
+	if( mapif_compress_size <= 0 || len < (unsigned int)mapif_compress_size || len < 8 )
+		return 0;
+
+	size = len - 7;// must save at least one byte
+	if( compress2((Bytef*)WBUFP(out,6), &size, (const Bytef*)buf, len, Z_DEFAULT_COMPRESSION) != Z_OK )
+		return 0;// does not fit
+
+	WBUFW(out,0) = 0x3807;
+	WBUFW(out,2) = (uint16)(size + 6);
+	WBUFW(out,4) = (uint16)len;
+	return (unsigned int)size + 6;
+}
+
 int mapif_sendall(unsigned char *buf, unsigned int len)
 {
+	static unsigned char zbuf[UINT16_MAX];
+	unsigned int zlen;
 	int i, c;
 
+	// compressed once for all map-servers
+	if( (zlen = mapif_compress(zbuf, buf, len)) > 0 )
+	{
+		buf = zbuf;
+		len = zlen;
+	}
+
 	c = 0;
 	for(i = 0; i < ARRAYLENGTH(server); i++) {
 		int fd;
@@ -4216,8 +4263,17 @@ int mapif_sendall(unsigned char *buf, unsigned int len)
 
 int mapif_sendallwos(int sfd, unsigned char *buf, unsigned int len)
 {
+	static unsigned char zbuf[UINT16_MAX];
+	unsigned int zlen;
 	int i, c;
 
+	// compressed once for all map-servers
+	if( (zlen = mapif_compress(zbuf, buf, len)) > 0 )
+	{
+		buf = zbuf;
+		len = zlen;
+	}
+
 	c = 0;
 	for(i = 0; i < ARRAYLENGTH(server); i++) {
 		int fd;
@@ -4234,12 +4290,19 @@ int mapif_sendallwos(int sfd, unsigned char *buf, unsigned int len)
 
 int mapif_send(int fd, unsigned char *buf, unsigned int len)
 {
+	static unsigned char zbuf[UINT16_MAX];
+	unsigned int zlen;
 	int i;
 
 	if (fd >= 0) {
 		ARR_FIND( 0, ARRAYLENGTH(server), i, fd == server[i].fd );
 		if( i < ARRAYLENGTH(server) )
 		{
+			if( (zlen = mapif_compress(zbuf, buf, len)) > 0 )
+			{
+				buf = zbuf;
+				len = zlen;
+			}
 			WFIFOHEAD(fd,len);
 			memcpy(WFIFOP(fd,0), buf, len);
 			WFIFOSET(fd,len);
@@ -4627,6 +4690,8 @@ int char_config_read(const char *cfgName)
 			}
 		} else if (strcmpi(w1, "guild_exp_rate") == 0) {
 			guild_exp_rate = atoi(w2);
+		} else if (strcmpi(w1, "mapif_compress_size") == 0) {
+			mapif_compress_size = atoi(w2);
 #endif //TXT_SQL_CONVERT
 		} else if (strcmpi(w1, "import") == 0) {
 			char_config_read(w2);
@@ -4,6 +4,7 @@
 #include "../common/cbasetypes.h"
 #include "../common/core.h"
 #include "../common/db.h"
+#include "../common/ers.h"
 #include "../common/malloc.h"
 #include "../common/mapindex.h"
 #include "../common/mmo.h"
@@ -28,6 +29,7 @@
 #include <stdarg.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <zlib.h>
 
 // private declarations
 #define CHAR_CONF_NAME	"conf/char_athena.conf"
@@ -42,6 +44,7 @@ char charlog_db[256] = "charlog";
 char storage_db[256] = "storage";
 char interlog_db[256] = "interlog";
 char reg_db[256] = "global_reg_value";
+char blob_db[256] = "section_blob";
 char skill_db[256] = "skill";
 char memo_db[256] = "memo";
 char guild_db[256] = "guild";
@@ -70,7 +73,17 @@ int save_log = 1;
 //If your code editor is having problems syntax highlighting this file, uncomment this and RECOMMENT IT BEFORE COMPILING
 //#undef TXT_SQL_CONVERT
 #ifndef TXT_SQL_CONVERT
-static DBMap* char_db_; // int char_id -> struct mmo_charstatus*
+static DBMap* char_db_; // int char_id -> struct char_cache*
+
+/// Character in char_db_, as it was last saved to or loaded from SQL.
+/// mmo_char_tosql compares against it to save only what changed.
+struct char_cache {
+	struct mmo_charstatus status;
+	unsigned int tick; // last use
+};
+static unsigned int char_cache_hits = 0;
+static unsigned int char_cache_misses = 0;
+static unsigned int char_cache_evictions = 0;
 
 char db_path[1024] = "db";
 
@@ -144,16 +157,26 @@ int start_zeny = 0;
 int start_weapon = 1201;
 int start_armor = 2301;
 int guild_exp_rate = 100;
+int mapif_compress_size = 1024; // packets to the map-servers from this size on are compressed (0: never)
+int char_cache_timeout = 600; // offline characters unused for this many seconds are evicted from char_db_
 
 //Custom limits for the fame lists. [Skotlex]
 int fame_list_size_chemist = MAX_FAME_LIST;
 int fame_list_size_smith = MAX_FAME_LIST;
 int fame_list_size_taekwon = MAX_FAME_LIST;
 
-// Char-server-side stored fame lists [DracoRPG]
-struct fame_list smith_fame_list[MAX_FAME_LIST];
-struct fame_list chemist_fame_list[MAX_FAME_LIST];
-struct fame_list taekwon_fame_list[MAX_FAME_LIST];
+// Char-server-side fame ladders [DracoRPG]
+// Every character with fame, highest fame first. The map-servers get the
+// first fame_list_size_* entries of each ladder.
+struct fame_ladder {
+	struct fame_list* list;
+	int count;
+	int max;
+};
+static struct fame_ladder smith_fame_ladder;
+static struct fame_ladder chemist_fame_ladder;
+static struct fame_ladder taekwon_fame_ladder;
+static DBMap* fame_db = NULL; // int char_id -> int fame, of the characters in a ladder
 
 // check for exit signal
 // 0 is saving complete
@@ -210,6 +233,77 @@ static void* create_online_char_data(DBKey key, va_list args)
 	return character;
 }
 
+/// Returns the cached character or NULL if it is not cached.
+static struct mmo_charstatus* char_cache_get(int char_id)
+{
+	struct char_cache* cc = (struct char_cache*)idb_get(char_db_, char_id);
+
+	if( cc == NULL )
+	{
+		char_cache_misses++;
+		return NULL;
+	}
+	char_cache_hits++;
+	cc->tick = gettick();
+	return &cc->status;
+}
+
+/// Returns the cached character, adding an empty one if it is not cached.
+static struct mmo_charstatus* char_cache_ensure(int char_id)
+{
+	struct char_cache* cc = (struct char_cache*)idb_get(char_db_, char_id);
+
+	if( cc == NULL )
+	{
+		char_cache_misses++;
+		CREATE(cc, struct char_cache, 1);
+		cc->status.char_id = char_id;
+		idb_put(char_db_, char_id, cc);
+	}
+	else
+		char_cache_hits++;
+	cc->tick = gettick();
+	return &cc->status;
+}
+
+/// Evicts the offline characters that have not been used for char_cache_timeout seconds.
+/// Entries are normally removed when the character goes offline, this catches the
+/// characters that were loaded or saved without ever being set offline.
+static int char_cache_timer(int tid, unsigned int tick, int id, intptr_t data)
+{
+	DBIterator* iter;
+	struct char_cache* cc;
+
+	iter = char_db_->iterator(char_db_);
+	for( cc = (struct char_cache*)iter->first(iter,NULL); iter->exists(iter); cc = (struct char_cache*)iter->next(iter,NULL) )
+	{
+		struct online_char_data* character;
+
+		if( DIFF_TICK(tick, cc->tick) < char_cache_timeout * 1000 )
+			continue;
+		character = (struct online_char_data*)idb_get(online_char_db, cc->status.account_id);
+		if( character != NULL && character->char_id == cc->status.char_id )
+			continue;// still online
+		iter->remove(iter);
+		char_cache_evictions++;
+	}
+	iter->destroy(iter);
+
+	return 0;
+}
+
+/// Shows the size and the hit rate of the character cache.
+static void char_cache_report(void)
+{
+	unsigned int count = char_db_->size(char_db_);
+	unsigned int lookups = char_cache_hits + char_cache_misses;
+
+	ShowInfo("Character cache: %u characters (%u KB), %u hits, %u misses (%u%% hit rate), %u evicted\n",
+		count, (unsigned int)(count * sizeof(struct char_cache) / 1024),
+		char_cache_hits, char_cache_misses, lookups ? (unsigned int)((uint64)char_cache_hits * 100 / lookups) : 0,
+		char_cache_evictions);
+}
+
 void set_char_charselect(int account_id)
 {
 	struct online_char_data* character;
@@ -270,7 +364,7 @@ void set_char_online(int map_id, int char_id, int account_id)
 	}
 
 	//Set char online in guild cache. If char is in memory, use the guild id on it, otherwise seek it.
-	cp = (struct mmo_charstatus*)idb_get(char_db_,char_id);
+	cp = char_cache_get(char_id);
 	inter_guild_CharOnline(char_id, cp?cp->guild_id:-1);
 
 	//Notify login server
@@ -294,7 +388,7 @@ void set_char_offline(int char_id, int account_id)
 	}
 	else
 	{
-		struct mmo_charstatus* cp = (struct mmo_charstatus*)idb_get(char_db_,char_id);
+		struct mmo_charstatus* cp = char_cache_get(char_id);
 		inter_guild_CharOffline(char_id, cp?cp->guild_id:-1);
 		if (cp)
 			idb_remove(char_db_,char_id);
@@ -395,13 +489,6 @@ void set_all_offline_sql(void)
 		Sql_ShowDebug(sql_handle);
 }
 
-static void* create_charstatus(DBKey key, va_list args)
-{
-	struct mmo_charstatus *cp;
-	cp = (struct mmo_charstatus *) aCalloc(1,sizeof(struct mmo_charstatus));
-	cp->char_id = key.i;
-	return cp;
-}
 #endif //TXT_SQL_CONVERT
 
 int mmo_char_tosql(int char_id, struct mmo_charstatus* p)
@@ -417,7 +504,7 @@ int mmo_char_tosql(int char_id, struct mmo_charstatus* p)
 	if (char_id!=p->char_id) return 0;
 
 #ifndef TXT_SQL_CONVERT
-	cp = (struct mmo_charstatus*)idb_ensure(char_db_, char_id, create_charstatus);
+	cp = char_cache_ensure(char_id);
 #else
 	cp = (struct mmo_charstatus*)aCalloc(1, sizeof(struct mmo_charstatus));
 #endif
@@ -945,21 +1032,49 @@ int mmo_chars_fromsql(struct char_session_data* sd, uint8* buf)
 	return j;
 }
 
+/// Appends a SELECT of the item columns of a table, read with mmo_item_fromsql.
+static void mmo_items_selectsql(StringBuf* buf, const char* table, const char* key, int id)
+{
+	int i;
+
+	StringBuf_AppendStr(buf, "SELECT `id`, `nameid`, `amount`, `equip`, `identify`, `refine`, `attribute`, `expire_time`");
+	for( i = 0; i < MAX_SLOTS; ++i )
+		StringBuf_Printf(buf, ", `card%d`", i);
+	StringBuf_Printf(buf, " FROM `%s` WHERE `%s`='%d'", table, key, id);
+}
+
+/// Reads the item in the current row of a mmo_items_selectsql result.
+static void mmo_item_fromsql(struct item* item)
+{
+	char* data;
+	int i;
+
+	Sql_GetData(sql_handle, 0, &data, NULL); item->id = atoi(data);
+	Sql_GetData(sql_handle, 1, &data, NULL); item->nameid = atoi(data);
+	Sql_GetData(sql_handle, 2, &data, NULL); item->amount = atoi(data);
+	Sql_GetData(sql_handle, 3, &data, NULL); item->equip = atoi(data);
+	Sql_GetData(sql_handle, 4, &data, NULL); item->identify = atoi(data);
+	Sql_GetData(sql_handle, 5, &data, NULL); item->refine = atoi(data);
+	Sql_GetData(sql_handle, 6, &data, NULL); item->attribute = atoi(data);
+	Sql_GetData(sql_handle, 7, &data, NULL); item->expire_time = (unsigned int)strtoul(data, NULL, 10);
+	for( i = 0; i < MAX_SLOTS; ++i )
+	{
+		Sql_GetData(sql_handle, 8+i, &data, NULL); item->card[i] = atoi(data);
+	}
+}
+
 //=====================================================================================================
 int mmo_char_fromsql(int char_id, struct mmo_charstatus* p, bool load_everything)
 {
-	int i,j;
+	int i;
 	char t_msg[128] = "";
 	struct mmo_charstatus* cp;
 	StringBuf buf;
 	SqlStmt* stmt;
+	char* data;
 	char last_map[MAP_NAME_LENGTH_EXT];
 	char save_map[MAP_NAME_LENGTH_EXT];
-	char point_map[MAP_NAME_LENGTH_EXT];
-	struct point tmp_point;
-	struct item tmp_item;
 	struct s_skill tmp_skill;
-	struct s_friend tmp_friend;
 #ifdef HOTKEY_SAVING
 	struct hotkey tmp_hotkey;
 	int hotkey_num;
@@ -1060,96 +1175,79 @@ int mmo_char_fromsql(int char_id, struct mmo_charstatus* p, bool load_everything
 		return 1;
 	}
 
-	//read memo data
+	SqlStmt_Free(stmt);
+
+	// read the other sections in one round-trip, one result per section
+	StringBuf_Init(&buf);
 	//`memo` (`memo_id`,`char_id`,`map`,`x`,`y`)
-	if( SQL_ERROR == SqlStmt_Prepare(stmt, "SELECT `map`,`x`,`y` FROM `%s` WHERE `char_id`=? ORDER by `memo_id` LIMIT %d", memo_db, MAX_MEMOPOINTS)
-	||	SQL_ERROR == SqlStmt_BindParam(stmt, 0, SQLDT_INT, &char_id, 0)
-	||	SQL_ERROR == SqlStmt_Execute(stmt)
-	||	SQL_ERROR == SqlStmt_BindColumn(stmt, 0, SQLDT_STRING, &point_map, sizeof(point_map), NULL, NULL)
-	||	SQL_ERROR == SqlStmt_BindColumn(stmt, 1, SQLDT_SHORT,  &tmp_point.x, 0, NULL, NULL)
-	||	SQL_ERROR == SqlStmt_BindColumn(stmt, 2, SQLDT_SHORT,  &tmp_point.y, 0, NULL, NULL) )
-		SqlStmt_ShowDebug(stmt);
+	StringBuf_Printf(&buf, "SELECT `map`,`x`,`y` FROM `%s` WHERE `char_id`='%d' ORDER by `memo_id` LIMIT %d;", memo_db, char_id, MAX_MEMOPOINTS);
+	//`inventory` (`id`,`char_id`, `nameid`, `amount`, `equip`, `identify`, `refine`, `attribute`, `card0`, `card1`, `card2`, `card3`)
+	mmo_items_selectsql(&buf, inventory_db, "char_id", char_id);
+	StringBuf_Printf(&buf, " LIMIT %d;", MAX_INVENTORY);
+	//`cart_inventory` (`id`,`char_id`, `nameid`, `amount`, `equip`, `identify`, `refine`, `attribute`, `card0`, `card1`, `card2`, `card3`)
+	mmo_items_selectsql(&buf, cart_db, "char_id", char_id);
+	StringBuf_Printf(&buf, " LIMIT %d;", MAX_CART);
+	//`storage` (`id`,`account_id`, `nameid`, `amount`, `equip`, `identify`, `refine`, `attribute`, `card0`, `card1`, `card2`, `card3`)
+	mmo_items_selectsql(&buf, storage_db, "account_id", p->account_id);
+	StringBuf_AppendStr(&buf, " ORDER BY `nameid`;");
+	//`skill` (`char_id`, `id`, `lv`)
+	StringBuf_Printf(&buf, "SELECT `id`, `lv` FROM `%s` WHERE `char_id`='%d' LIMIT %d;", skill_db, char_id, MAX_SKILL);
+	//`friends` (`char_id`, `friend_account`, `friend_id`)
+	StringBuf_Printf(&buf, "SELECT c.`account_id`, c.`char_id`, c.`name` FROM `%s` c LEFT JOIN `%s` f ON f.`friend_account` = c.`account_id` AND f.`friend_id` = c.`char_id` WHERE f.`char_id`='%d' LIMIT %d;", char_db, friend_db, char_id, MAX_FRIENDS);
+	//`mercenary_owner` (`char_id`, `merc_id`, `arch_calls`, `arch_faith`, `spear_calls`, `spear_faith`, `sword_calls`, `sword_faith`)
+	StringBuf_Printf(&buf, "SELECT `merc_id`, `arch_calls`, `arch_faith`, `spear_calls`, `spear_faith`, `sword_calls`, `sword_faith` FROM `mercenary_owner` WHERE `char_id`='%d'", char_id);
+#ifdef HOTKEY_SAVING
+	//`hotkey` (`char_id`, `hotkey`, `type`, `itemskill_id`, `skill_lvl`
+	StringBuf_Printf(&buf, ";SELECT `hotkey`, `type`, `itemskill_id`, `skill_lvl` FROM `%s` WHERE `char_id`='%d'", hotkey_db, char_id);
+#endif
 
-	for( i = 0; i < MAX_MEMOPOINTS && SQL_SUCCESS == SqlStmt_NextRow(stmt); ++i )
+	if( SQL_ERROR == Sql_SetMultiStatements(sql_handle, true)
+	||  SQL_ERROR == Sql_QueryStr(sql_handle, StringBuf_Value(&buf)) )
 	{
-		tmp_point.map = mapindex_name2id(point_map);
-		memcpy(&p->memo_point[i], &tmp_point, sizeof(tmp_point));
+		StringBuf_Destroy(&buf);
+		goto load_failed;
+	}
+	StringBuf_Destroy(&buf);
+
+	//read memo data
+	for( i = 0; i < MAX_MEMOPOINTS && SQL_SUCCESS == Sql_NextRow(sql_handle); ++i )
+	{
+		Sql_GetData(sql_handle, 0, &data, NULL); p->memo_point[i].map = mapindex_name2id(data);
+		Sql_GetData(sql_handle, 1, &data, NULL); p->memo_point[i].x = atoi(data);
+		Sql_GetData(sql_handle, 2, &data, NULL); p->memo_point[i].y = atoi(data);
 	}
 	strcat(t_msg, " memo");
 
 	//read inventory
-	//`inventory` (`id`,`char_id`, `nameid`, `amount`, `equip`, `identify`, `refine`, `attribute`, `card0`, `card1`, `card2`, `card3`)
-	StringBuf_Init(&buf);
-	StringBuf_AppendStr(&buf, "SELECT `id`, `nameid`, `amount`, `equip`, `identify`, `refine`, `attribute`, `expire_time`");
-	for( i = 0; i < MAX_SLOTS; ++i )
-		StringBuf_Printf(&buf, ", `card%d`", i);
-	StringBuf_Printf(&buf, " FROM `%s` WHERE `char_id`=? LIMIT %d", inventory_db, MAX_INVENTORY);
-
-	if( SQL_ERROR == SqlStmt_PrepareStr(stmt, StringBuf_Value(&buf))
-	||	SQL_ERROR == SqlStmt_BindParam(stmt, 0, SQLDT_INT, &char_id, 0)
-	||	SQL_ERROR == SqlStmt_Execute(stmt)
-	||	SQL_ERROR == SqlStmt_BindColumn(stmt, 0, SQLDT_INT,       &tmp_item.id, 0, NULL, NULL)
-	||	SQL_ERROR == SqlStmt_BindColumn(stmt, 1, SQLDT_SHORT,     &tmp_item.nameid, 0, NULL, NULL)
-	||	SQL_ERROR == SqlStmt_BindColumn(stmt, 2, SQLDT_SHORT,     &tmp_item.amount, 0, NULL, NULL)
-	||	SQL_ERROR == SqlStmt_BindColumn(stmt, 3, SQLDT_USHORT,    &tmp_item.equip, 0, NULL, NULL)
-	||	SQL_ERROR == SqlStmt_BindColumn(stmt, 4, SQLDT_CHAR,      &tmp_item.identify, 0, NULL, NULL)
-	||	SQL_ERROR == SqlStmt_BindColumn(stmt, 5, SQLDT_CHAR,      &tmp_item.refine, 0, NULL, NULL)
-	||	SQL_ERROR == SqlStmt_BindColumn(stmt, 6, SQLDT_CHAR,      &tmp_item.attribute, 0, NULL, NULL)
-	||	SQL_ERROR == SqlStmt_BindColumn(stmt, 7, SQLDT_UINT,      &tmp_item.expire_time, 0, NULL, NULL) )
-		SqlStmt_ShowDebug(stmt);
-	for( i = 0; i < MAX_SLOTS; ++i )
-		if( SQL_ERROR == SqlStmt_BindColumn(stmt, 8+i, SQLDT_SHORT, &tmp_item.card[i], 0, NULL, NULL) )
-			SqlStmt_ShowDebug(stmt);
-
-	for( i = 0; i < MAX_INVENTORY && SQL_SUCCESS == SqlStmt_NextRow(stmt); ++i )
-		memcpy(&p->inventory[i], &tmp_item, sizeof(tmp_item));
-
+	if( SQL_SUCCESS != Sql_NextResult(sql_handle) )
+		goto load_failed;
+	for( i = 0; i < MAX_INVENTORY && SQL_SUCCESS == Sql_NextRow(sql_handle); ++i )
+		mmo_item_fromsql(&p->inventory[i]);
 	strcat(t_msg, " inventory");
 
 	//read cart
-	//`cart_inventory` (`id`,`char_id`, `nameid`, `amount`, `equip`, `identify`, `refine`, `attribute`, `card0`, `card1`, `card2`, `card3`)
-	StringBuf_Clear(&buf);
-	StringBuf_AppendStr(&buf, "SELECT `id`, `nameid`, `amount`, `equip`, `identify`, `refine`, `attribute`, `expire_time`");
-	for( j = 0; j < MAX_SLOTS; ++j )
-		StringBuf_Printf(&buf, ", `card%d`", j);
-	StringBuf_Printf(&buf, " FROM `%s` WHERE `char_id`=? LIMIT %d", cart_db, MAX_CART);
-
-	if( SQL_ERROR == SqlStmt_PrepareStr(stmt, StringBuf_Value(&buf))
-	||	SQL_ERROR == SqlStmt_BindParam(stmt, 0, SQLDT_INT, &char_id, 0)
-	||	SQL_ERROR == SqlStmt_Execute(stmt)
-	||	SQL_ERROR == SqlStmt_BindColumn(stmt, 0, SQLDT_INT,         &tmp_item.id, 0, NULL, NULL)
-	||	SQL_ERROR == SqlStmt_BindColumn(stmt, 1, SQLDT_SHORT,       &tmp_item.nameid, 0, NULL, NULL)
-	||	SQL_ERROR == SqlStmt_BindColumn(stmt, 2, SQLDT_SHORT,       &tmp_item.amount, 0, NULL, NULL)
-	||	SQL_ERROR == SqlStmt_BindColumn(stmt, 3, SQLDT_USHORT,      &tmp_item.equip, 0, NULL, NULL)
-	||	SQL_ERROR == SqlStmt_BindColumn(stmt, 4, SQLDT_CHAR,        &tmp_item.identify, 0, NULL, NULL)
-	||	SQL_ERROR == SqlStmt_BindColumn(stmt, 5, SQLDT_CHAR,        &tmp_item.refine, 0, NULL, NULL)
-	||	SQL_ERROR == SqlStmt_BindColumn(stmt, 6, SQLDT_CHAR,        &tmp_item.attribute, 0, NULL, NULL)
-	||	SQL_ERROR == SqlStmt_BindColumn(stmt, 7, SQLDT_UINT,        &tmp_item.expire_time, 0, NULL, NULL) )
-		SqlStmt_ShowDebug(stmt);
-	for( i = 0; i < MAX_SLOTS; ++i )
-		if( SQL_ERROR == SqlStmt_BindColumn(stmt, 8+i, SQLDT_SHORT, &tmp_item.card[i], 0, NULL, NULL) )
-			SqlStmt_ShowDebug(stmt);
-
-	for( i = 0; i < MAX_CART && SQL_SUCCESS == SqlStmt_NextRow(stmt); ++i )
-		memcpy(&p->cart[i], &tmp_item, sizeof(tmp_item));
+	if( SQL_SUCCESS != Sql_NextResult(sql_handle) )
+		goto load_failed;
+	for( i = 0; i < MAX_CART && SQL_SUCCESS == Sql_NextRow(sql_handle); ++i )
+		mmo_item_fromsql(&p->cart[i]);
 	strcat(t_msg, " cart");
 
 	//read storage
-	storage_fromsql(p->account_id, &p->storage);
+	if( SQL_SUCCESS != Sql_NextResult(sql_handle) )
+		goto load_failed;
+	for( i = 0; i < MAX_STORAGE && SQL_SUCCESS == Sql_NextRow(sql_handle); ++i )
+		mmo_item_fromsql(&p->storage.items[i]);
+	p->storage.storage_amount = i;
 	strcat(t_msg, " storage");
 
 	//read skill
-	//`skill` (`char_id`, `id`, `lv`)
-	if( SQL_ERROR == SqlStmt_Prepare(stmt, "SELECT `id`, `lv` FROM `%s` WHERE `char_id`=? LIMIT %d", skill_db, MAX_SKILL)
-	||	SQL_ERROR == SqlStmt_BindParam(stmt, 0, SQLDT_INT, &char_id, 0)
-	||	SQL_ERROR == SqlStmt_Execute(stmt)
-	||	SQL_ERROR == SqlStmt_BindColumn(stmt, 0, SQLDT_USHORT, &tmp_skill.id, 0, NULL, NULL)
-	||	SQL_ERROR == SqlStmt_BindColumn(stmt, 1, SQLDT_USHORT, &tmp_skill.lv, 0, NULL, NULL) )
-		SqlStmt_ShowDebug(stmt);
-	tmp_skill.flag = SKILL_FLAG_PERMANENT;
-
-	for( i = 0; i < MAX_SKILL && SQL_SUCCESS == SqlStmt_NextRow(stmt); ++i )
+	if( SQL_SUCCESS != Sql_NextResult(sql_handle) )
+		goto load_failed;
+	for( i = 0; i < MAX_SKILL && SQL_SUCCESS == Sql_NextRow(sql_handle); ++i )
 	{
+		Sql_GetData(sql_handle, 0, &data, NULL); tmp_skill.id = atoi(data);
+		Sql_GetData(sql_handle, 1, &data, NULL); tmp_skill.lv = atoi(data);
+		tmp_skill.flag = SKILL_FLAG_PERMANENT;
 		if( tmp_skill.id < ARRAYLENGTH(p->skill) )
 			memcpy(&p->skill[tmp_skill.id], &tmp_skill, sizeof(tmp_skill));
 		else
@@ -1158,33 +1256,41 @@ int mmo_char_fromsql(int char_id, struct mmo_charstatus* p, bool load_everything
 	strcat(t_msg, " skills");
 
 	//read friends
-	//`friends` (`char_id`, `friend_account`, `friend_id`)
-	if( SQL_ERROR == SqlStmt_Prepare(stmt, "SELECT c.`account_id`, c.`char_id`, c.`name` FROM `%s` c LEFT JOIN `%s` f ON f.`friend_account` = c.`account_id` AND f.`friend_id` = c.`char_id` WHERE f.`char_id`=? LIMIT %d", char_db, friend_db, MAX_FRIENDS)
-	||	SQL_ERROR == SqlStmt_BindParam(stmt, 0, SQLDT_INT, &char_id, 0)
-	||	SQL_ERROR == SqlStmt_Execute(stmt)
-	||	SQL_ERROR == SqlStmt_BindColumn(stmt, 0, SQLDT_INT,    &tmp_friend.account_id, 0, NULL, NULL)
-	||	SQL_ERROR == SqlStmt_BindColumn(stmt, 1, SQLDT_INT,    &tmp_friend.char_id, 0, NULL, NULL)
-	||	SQL_ERROR == SqlStmt_BindColumn(stmt, 2, SQLDT_STRING, &tmp_friend.name, sizeof(tmp_friend.name), NULL, NULL) )
-		SqlStmt_ShowDebug(stmt);
-
-	for( i = 0; i < MAX_FRIENDS && SQL_SUCCESS == SqlStmt_NextRow(stmt); ++i )
-		memcpy(&p->friends[i], &tmp_friend, sizeof(tmp_friend));
+	if( SQL_SUCCESS != Sql_NextResult(sql_handle) )
+		goto load_failed;
+	for( i = 0; i < MAX_FRIENDS && SQL_SUCCESS == Sql_NextRow(sql_handle); ++i )
+	{
+		Sql_GetData(sql_handle, 0, &data, NULL); p->friends[i].account_id = atoi(data);
+		Sql_GetData(sql_handle, 1, &data, NULL); p->friends[i].char_id = atoi(data);
+		Sql_GetData(sql_handle, 2, &data, NULL); safestrncpy(p->friends[i].name, data, sizeof(p->friends[i].name));
+	}
 	strcat(t_msg, " friends");
 
+	/* Mercenary Owner DataBase */
+	if( SQL_SUCCESS != Sql_NextResult(sql_handle) )
+		goto load_failed;
+	if( SQL_SUCCESS == Sql_NextRow(sql_handle) )
+	{
+		Sql_GetData(sql_handle, 0, &data, NULL); p->mer_id = atoi(data);
+		Sql_GetData(sql_handle, 1, &data, NULL); p->arch_calls = atoi(data);
+		Sql_GetData(sql_handle, 2, &data, NULL); p->arch_faith = atoi(data);
+		Sql_GetData(sql_handle, 3, &data, NULL); p->spear_calls = atoi(data);
+		Sql_GetData(sql_handle, 4, &data, NULL); p->spear_faith = atoi(data);
+		Sql_GetData(sql_handle, 5, &data, NULL); p->sword_calls = atoi(data);
+		Sql_GetData(sql_handle, 6, &data, NULL); p->sword_faith = atoi(data);
+	}
+	strcat(t_msg, " mercenary");
+
 #ifdef HOTKEY_SAVING
 	//read hotkeys
-	//`hotkey` (`char_id`, `hotkey`, `type`, `itemskill_id`, `skill_lvl`
-	if( SQL_ERROR == SqlStmt_Prepare(stmt, "SELECT `hotkey`, `type`, `itemskill_id`, `skill_lvl` FROM `%s` WHERE `char_id`=?", hotkey_db)
-	||	SQL_ERROR == SqlStmt_BindParam(stmt, 0, SQLDT_INT, &char_id, 0)
-	||	SQL_ERROR == SqlStmt_Execute(stmt)
-	||	SQL_ERROR == SqlStmt_BindColumn(stmt, 0, SQLDT_INT,    &hotkey_num, 0, NULL, NULL)
-	||	SQL_ERROR == SqlStmt_BindColumn(stmt, 1, SQLDT_UCHAR,  &tmp_hotkey.type, 0, NULL, NULL)
-	||	SQL_ERROR == SqlStmt_BindColumn(stmt, 2, SQLDT_UINT,   &tmp_hotkey.id, 0, NULL, NULL)
-	||	SQL_ERROR == SqlStmt_BindColumn(stmt, 3, SQLDT_USHORT, &tmp_hotkey.lv, 0, NULL, NULL) )
-		SqlStmt_ShowDebug(stmt);
-
-	while( SQL_SUCCESS == SqlStmt_NextRow(stmt) )
+	if( SQL_SUCCESS != Sql_NextResult(sql_handle) )
+		goto load_failed;
+	while( SQL_SUCCESS == Sql_NextRow(sql_handle) )
 	{
+		Sql_GetData(sql_handle, 0, &data, NULL); hotkey_num = atoi(data);
+		Sql_GetData(sql_handle, 1, &data, NULL); tmp_hotkey.type = atoi(data);
+		Sql_GetData(sql_handle, 2, &data, NULL); tmp_hotkey.id = (unsigned int)strtoul(data, NULL, 10);
+		Sql_GetData(sql_handle, 3, &data, NULL); tmp_hotkey.lv = atoi(data);
 		if( hotkey_num >= 0 && hotkey_num < MAX_HOTKEYS )
 			memcpy(&p->hotkeys[hotkey_num], &tmp_hotkey, sizeof(tmp_hotkey));
 		else
@@ -1192,19 +1298,24 @@ int mmo_char_fromsql(int char_id, struct mmo_charstatus* p, bool load_everything
 	}
 	strcat(t_msg, " hotkeys");
 #endif
-
-	/* Mercenary Owner DataBase */
-	mercenary_owner_fromsql(char_id, p);
-	strcat(t_msg, " mercenary");
-
+	Sql_FreeResult(sql_handle);// discards the unread results, so the option can be changed
+	if( SQL_ERROR == Sql_SetMultiStatements(sql_handle, false) )
+		Sql_ShowDebug(sql_handle);
 
 	if (save_log) ShowInfo("Loaded char (%d - %s): %s\n", char_id, p->name, t_msg);	//ok. all data load successfuly!
-	SqlStmt_Free(stmt);
-	StringBuf_Destroy(&buf);
 
-	cp = (struct mmo_charstatus*)idb_ensure(char_db_, char_id, create_charstatus);
+	cp = char_cache_ensure(char_id);
 	memcpy(cp, p, sizeof(struct mmo_charstatus));
 	return 1;
+
+load_failed:
+	// a partial character would delete the missing items on its next save
+	Sql_ShowDebug(sql_handle);
+	Sql_FreeResult(sql_handle);
+	if( SQL_ERROR == Sql_SetMultiStatements(sql_handle, false) )
+		Sql_ShowDebug(sql_handle);
+	ShowError("mmo_char_fromsql: Failed to load character %d (%s), the load is aborted.\n", char_id, p->name);
+	return 0;
 }
 
 //==========================================================================================================
@@ -1549,6 +1660,10 @@ int delete_char_sql(int char_id)
 		Sql_ShowDebug(sql_handle);
 #endif
 
+	/* character registry and status change blobs */
+	if( blob_storage && SQL_ERROR == Sql_Query(sql_handle, "DELETE FROM `%s` WHERE (`type`='%d' OR `type`='%d') AND `id`='%d'", blob_db, SECTION_BLOB_CHARREG, SECTION_BLOB_SCDATA, char_id) )
+		Sql_ShowDebug(sql_handle);
+
 	if (log_char) {
 		if( SQL_ERROR == Sql_Query(sql_handle, "INSERT INTO `%s`(`time`, `account_id`,`char_num`,`char_msg`,`name`) VALUES (NOW(), '%d', '%d', 'Deleted char (CID %d)', '%s')",
 			charlog_db, account_id, 0, char_id, esc_name) )
@@ -2254,62 +2369,101 @@ int save_accreg2(unsigned char* buf, int len)
 	return 0;
 }
 
-void char_read_fame_list(void)
+/// Returns the ladder of the fame type (1: smith, 2: chemist, 3: taekwon) and its broadcast size.
+static struct fame_ladder* char_fame_ladder(int type, int* size)
+{
+	switch( type )
+	{
+	case 1:  *size = fame_list_size_smith;   return &smith_fame_ladder;
+	case 2:  *size = fame_list_size_chemist; return &chemist_fame_ladder;
+	case 3:  *size = fame_list_size_taekwon; return &taekwon_fame_ladder;
+	default: *size = 0;                      return NULL;
+	}
+}
+
+/// Returns the first position of the ladder with at most this much fame.
+static int char_fame_ladder_search(struct fame_ladder* ladder, int fame)
+{
+	int lo = 0, hi = ladder->count;
+
+	while( lo < hi )
+	{
+		int mid = (lo + hi) / 2;
+		if( ladder->list[mid].fame > fame )
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	return lo;
+}
+
+/// Loads one fame ladder from the result of a fame query.
+static void char_read_fame_ladder(struct fame_ladder* ladder)
 {
-	int i;
 	char* data;
 	size_t len;
 
-	// Empty ranking lists
-	memset(smith_fame_list, 0, sizeof(smith_fame_list));
-	memset(chemist_fame_list, 0, sizeof(chemist_fame_list));
-	memset(taekwon_fame_list, 0, sizeof(taekwon_fame_list));
-	// Build Blacksmith ranking list
-	if( SQL_ERROR == Sql_Query(sql_handle, "SELECT `char_id`,`fame`,`name` FROM `%s` WHERE `fame`>0 AND (`class`='%d' OR `class`='%d' OR `class`='%d') ORDER BY `fame` DESC LIMIT 0,%d", char_db, JOB_BLACKSMITH, JOB_WHITESMITH, JOB_BABY_BLACKSMITH, fame_list_size_smith) )
-		Sql_ShowDebug(sql_handle);
-	for( i = 0; i < fame_list_size_smith && SQL_SUCCESS == Sql_NextRow(sql_handle); ++i )
+	ladder->count = 0;
+	while( SQL_SUCCESS == Sql_NextRow(sql_handle) )
 	{
+		struct fame_list* entry;
+
+		if( ladder->count == ladder->max )
+		{
+			ladder->max = ladder->max ? 2*ladder->max : 64;
+			RECREATE(ladder->list, struct fame_list, ladder->max);
+		}
+		entry = &ladder->list[ladder->count++];
+		memset(entry, 0, sizeof(struct fame_list));
 		// char_id
 		Sql_GetData(sql_handle, 0, &data, NULL);
-		smith_fame_list[i].id = atoi(data);
+		entry->id = atoi(data);
 		// fame
 		Sql_GetData(sql_handle, 1, &data, &len);
-		smith_fame_list[i].fame = atoi(data);
+		entry->fame = atoi(data);
 		// name
 		Sql_GetData(sql_handle, 2, &data, &len);
-		memcpy(smith_fame_list[i].name, data, min(len, NAME_LENGTH));
+		memcpy(entry->name, data, min(len, NAME_LENGTH));
+
+		idb_put(fame_db, entry->id, (void*)(intptr)entry->fame);
 	}
+	Sql_FreeResult(sql_handle);
+}
+
+void char_read_fame_list(void)
+{
+	if( fame_db == NULL )
+		fame_db = idb_alloc(DB_OPT_BASE);
+	else
+		db_clear(fame_db);
+
+	// Build Blacksmith ranking list
+	if( SQL_ERROR == Sql_Query(sql_handle, "SELECT `char_id`,`fame`,`name` FROM `%s` WHERE `fame`>0 AND (`class`='%d' OR `class`='%d' OR `class`='%d') ORDER BY `fame` DESC", char_db, JOB_BLACKSMITH, JOB_WHITESMITH, JOB_BABY_BLACKSMITH) )
+		Sql_ShowDebug(sql_handle);
+	char_read_fame_ladder(&smith_fame_ladder);
 	// Build Alchemist ranking list
-	if( SQL_ERROR == Sql_Query(sql_handle, "SELECT `char_id`,`fame`,`name` FROM `%s` WHERE `fame`>0 AND (`class`='%d' OR `class`='%d' OR `class`='%d') ORDER BY `fame` DESC LIMIT 0,%d", char_db, JOB_ALCHEMIST, JOB_CREATOR, JOB_BABY_ALCHEMIST, fame_list_size_chemist) )
+	if( SQL_ERROR == Sql_Query(sql_handle, "SELECT `char_id`,`fame`,`name` FROM `%s` WHERE `fame`>0 AND (`class`='%d' OR `class`='%d' OR `class`='%d') ORDER BY `fame` DESC", char_db, JOB_ALCHEMIST, JOB_CREATOR, JOB_BABY_ALCHEMIST) )
 		Sql_ShowDebug(sql_handle);
-	for( i = 0; i < fame_list_size_chemist && SQL_SUCCESS == Sql_NextRow(sql_handle); ++i )
-	{
-		// char_id
-		Sql_GetData(sql_handle, 0, &data, NULL);
-		chemist_fame_list[i].id = atoi(data);
-		// fame
-		Sql_GetData(sql_handle, 1, &data, &len);
-		chemist_fame_list[i].fame = atoi(data);
-		// name
-		Sql_GetData(sql_handle, 2, &data, &len);
-		memcpy(chemist_fame_list[i].name, data, min(len, NAME_LENGTH));
-	}
+	char_read_fame_ladder(&chemist_fame_ladder);
 	// Build Taekwon ranking list
-	if( SQL_ERROR == Sql_Query(sql_handle, "SELECT `char_id`,`fame`,`name` FROM `%s` WHERE `fame`>0 AND (`class`='%d') ORDER BY `fame` DESC LIMIT 0,%d", char_db, JOB_TAEKWON, fame_list_size_taekwon) )
+	if( SQL_ERROR == Sql_Query(sql_handle, "SELECT `char_id`,`fame`,`name` FROM `%s` WHERE `fame`>0 AND (`class`='%d') ORDER BY `fame` DESC", char_db, JOB_TAEKWON) )
 		Sql_ShowDebug(sql_handle);
-	for( i = 0; i < fame_list_size_taekwon && SQL_SUCCESS == Sql_NextRow(sql_handle); ++i )
+	char_read_fame_ladder(&taekwon_fame_ladder);
+}
+
+void char_final_fame_list(void)
+{
+	aFree(smith_fame_ladder.list);
+	aFree(chemist_fame_ladder.list);
+	aFree(taekwon_fame_ladder.list);
+	memset(&smith_fame_ladder, 0, sizeof(smith_fame_ladder));
+	memset(&chemist_fame_ladder, 0, sizeof(chemist_fame_ladder));
+	memset(&taekwon_fame_ladder, 0, sizeof(taekwon_fame_ladder));
+	if( fame_db )
 	{
-		// char_id
-		Sql_GetData(sql_handle, 0, &data, NULL);
-		taekwon_fame_list[i].id = atoi(data);
-		// fame
-		Sql_GetData(sql_handle, 1, &data, &len);
-		taekwon_fame_list[i].fame = atoi(data);
-		// name
-		Sql_GetData(sql_handle, 2, &data, &len);
-		memcpy(taekwon_fame_list[i].name, data, min(len, NAME_LENGTH));
+		db_destroy(fame_db);
+		fame_db = NULL;
 	}
-	Sql_FreeResult(sql_handle);
 }
 
 // Send map-servers the fame ranking lists
@@ -2320,22 +2474,22 @@ int char_send_fame_list(int fd)
 	
 	WBUFW(buf,0) = 0x2b1b;
 
-	for(i = 0; i < fame_list_size_smith && smith_fame_list[i].id; i++) {
-		memcpy(WBUFP(buf, len), &smith_fame_list[i], sizeof(struct fame_list));
+	for(i = 0; i < fame_list_size_smith && i < smith_fame_ladder.count; i++) {
+		memcpy(WBUFP(buf, len), &smith_fame_ladder.list[i], sizeof(struct fame_list));
 		len += sizeof(struct fame_list);
 	}
 	// add blacksmith's block length
 	WBUFW(buf, 6) = len;
 
-	for(i = 0; i < fame_list_size_chemist && chemist_fame_list[i].id; i++) {
-		memcpy(WBUFP(buf, len), &chemist_fame_list[i], sizeof(struct fame_list));
+	for(i = 0; i < fame_list_size_chemist && i < chemist_fame_ladder.count; i++) {
+		memcpy(WBUFP(buf, len), &chemist_fame_ladder.list[i], sizeof(struct fame_list));
 		len += sizeof(struct fame_list);
 	}
 	// add alchemist's block length
 	WBUFW(buf, 4) = len;
 
-	for(i = 0; i < fame_list_size_taekwon && taekwon_fame_list[i].id; i++) {
-		memcpy(WBUFP(buf, len), &taekwon_fame_list[i], sizeof(struct fame_list));
+	for(i = 0; i < fame_list_size_taekwon && i < taekwon_fame_ladder.count; i++) {
+		memcpy(WBUFP(buf, len), &taekwon_fame_ladder.list[i], sizeof(struct fame_list));
 		len += sizeof(struct fame_list);
 	}
 	// add total packet length
@@ -2381,6 +2535,98 @@ int char_loadName(int char_id, char* name)
 	return 0;
 }
 
+/// Tells the map-servers that a fame list entry moved and sends its new contents.
+/// An entry past the end of the ladder is sent empty.
+static void char_move_fame_list(int type, int from, int to, struct fame_ladder* ladder)
+{
+	unsigned char buf[37];
+	WBUFW(buf,0) = 0x2b13;
+	WBUFB(buf,2) = type;
+	WBUFB(buf,3) = from;
+	WBUFB(buf,4) = to;
+	if( to < ladder->count )
+		memcpy(WBUFP(buf,5), &ladder->list[to], sizeof(struct fame_list));
+	else
+		memset(WBUFP(buf,5), 0, sizeof(struct fame_list));
+	mapif_sendall(buf, 37);
+}
+
+/// Updates the fame of a character in its ladder and sends the changed
+/// positions to the map-servers.
+static void char_update_fame(int char_id, int fame, int type)
+{
+	struct fame_ladder* ladder;
+	int size;
+	int old_fame;
+	int player_pos;
+	int fame_pos;
+	bool new_ranker = false;
+
+	ladder = char_fame_ladder(type, &size);
+	if( ladder == NULL || size <= 0 )
+		return;
+
+	// position of the player
+	old_fame = (int)(intptr)idb_get(fame_db, char_id);
+	player_pos = ladder->count;
+	if( old_fame > 0 )
+	{
+		player_pos = char_fame_ladder_search(ladder, old_fame);
+		while( player_pos < ladder->count && ladder->list[player_pos].fame == old_fame && ladder->list[player_pos].id != char_id )
+			++player_pos;
+		if( player_pos < ladder->count && ladder->list[player_pos].id != char_id )
+			player_pos = ladder->count;
+	}
+
+	// where the player should be
+	if( fame <= 0 )
+	{// leaves the ladder
+		if( player_pos == ladder->count )
+			return;
+		fame_pos = ladder->count - 1;
+		ARR_MOVE(player_pos, fame_pos, ladder->list, struct fame_list);
+		--ladder->count;
+		idb_remove(fame_db, char_id);
+	}
+	else if( player_pos == ladder->count )
+	{// new ranker - not in the ladder
+		if( ladder->count == ladder->max )
+		{
+			ladder->max = ladder->max ? 2*ladder->max : 64;
+			RECREATE(ladder->list, struct fame_list, ladder->max);
+		}
+		fame_pos = char_fame_ladder_search(ladder, fame);
+		memmove(&ladder->list[fame_pos+1], &ladder->list[fame_pos], (ladder->count - fame_pos)*sizeof(struct fame_list));
+		++ladder->count;
+		memset(&ladder->list[fame_pos], 0, sizeof(struct fame_list));
+		ladder->list[fame_pos].id = char_id;
+		ladder->list[fame_pos].fame = fame;
+		char_loadName(char_id, ladder->list[fame_pos].name);
+		idb_put(fame_db, char_id, (void*)(intptr)fame);
+		new_ranker = true;
+	}
+	else
+	{// already in the ladder
+		fame_pos = char_fame_ladder_search(ladder, fame);
+		if( fame_pos > player_pos )
+			--fame_pos;// the player leaves its old position first
+		else if( fame == old_fame )
+			fame_pos = player_pos;
+		ARR_MOVE(player_pos, fame_pos, ladder->list, struct fame_list);
+		ladder->list[fame_pos].fame = fame;
+		idb_put(fame_db, char_id, (void*)(intptr)fame);
+	}
+
+	if( player_pos >= size && fame_pos >= size )
+		;// not on the broadcast list before nor after
+	else if( fame <= 0 )
+		char_move_fame_list(type, player_pos, min(ladder->count, size - 1), ladder);
+	else if( player_pos == fame_pos && !new_ranker )
+		char_update_fame_list(type, fame_pos, fame);
+	else
+		char_move_fame_list(type, min(player_pos, size - 1), min(fame_pos, size - 1), ladder);
+}
+
 int search_mapserver(unsigned short map, uint32 ip, uint16 port);
 
 
@@ -2436,6 +2682,125 @@ void mapif_on_disconnect(int id)
 	mapif_server_reset(id);
 }
 
+#ifdef ENABLE_SC_SAVING
+#define SCDATA_BLOB_ENTRY 22 // <type>.W <tick>.L <val1>.L <val2>.L <val3>.L <val4>.L
+#define SCDATA_BLOB_MAX ((UINT16_MAX-14)/sizeof(struct status_change_data)) // most status changes that fit in a 0x2b1c/0x2b1d packet
+
+/// Saves the status changes of a character as a section blob.
+static int char_scdata_toblob(int cid, const struct status_change_data* data, int count)
+{
+	static uint8 buf[SCDATA_BLOB_MAX*SCDATA_BLOB_ENTRY];
+	uint8* p;
+	int i;
+
+	if( count > (int)SCDATA_BLOB_MAX )
+	{
+		ShowWarning("char_scdata_toblob: Character %d has %d status changes, only the first %d are saved.\n", cid, count, (int)SCDATA_BLOB_MAX);
+		count = (int)SCDATA_BLOB_MAX;
+	}
+	for( i = 0; i < count; ++i )
+	{
+		p = WBUFP(buf, i*SCDATA_BLOB_ENTRY);
+		WBUFW(p,0) = data[i].type;
+		WBUFL(p,2) = (uint32)data[i].tick;
+		WBUFL(p,6) = (uint32)data[i].val1;
+		WBUFL(p,10) = (uint32)data[i].val2;
+		WBUFL(p,14) = (uint32)data[i].val3;
+		WBUFL(p,18) = (uint32)data[i].val4;
+	}
+	return inter_blob_tosql(SECTION_BLOB_SCDATA, cid, buf, count*SCDATA_BLOB_ENTRY, count);
+}
+
+/// Sends the status changes saved in the blob of a character to the map-server and clears them.
+/// Returns the number of status changes sent.
+static int char_scdata_fromblob(int fd, int aid, int cid)
+{
+	static uint8 buf[SCDATA_BLOB_MAX*SCDATA_BLOB_ENTRY];
+	struct status_change_data scdata;
+	uint8* p;
+	size_t len;
+	int i, count;
+
+	count = inter_blob_fromsql(SECTION_BLOB_SCDATA, cid, buf, sizeof(buf), &len);
+	if( count <= 0 )
+		return 0;
+	count = min(count, (int)(len/SCDATA_BLOB_ENTRY));
+
+	WFIFOHEAD(fd,14+count*sizeof(struct status_change_data));
+	WFIFOW(fd,0) = 0x2b1d;
+	WFIFOW(fd,2) = 14 + count*sizeof(struct status_change_data);
+	WFIFOL(fd,4) = aid;
+	WFIFOL(fd,8) = cid;
+	WFIFOW(fd,12) = count;
+	for( i = 0; i < count; ++i )
+	{
+		p = WBUFP(buf, i*SCDATA_BLOB_ENTRY);
+		scdata.type = RBUFW(p,0);
+		scdata.tick = (int)RBUFL(p,2);
+		scdata.val1 = (int)RBUFL(p,6);
+		scdata.val2 = (int)RBUFL(p,10);
+		scdata.val3 = (int)RBUFL(p,14);
+		scdata.val4 = (int)RBUFL(p,18);
+		memcpy(WFIFOP(fd, 14+i*sizeof(struct status_change_data)), &scdata, sizeof(struct status_change_data));
+	}
+	WFIFOSET(fd,WFIFOW(fd,2));
+
+	//Clear the data once loaded.
+	inter_blob_tosql(SECTION_BLOB_SCDATA, cid, NULL, 0, 0);
+	return count;
+}
+
+/// Moves all status change rows into section blobs.
+static void char_scdata_migrate(void)
+{
+	struct scdata_row { int aid, cid; struct status_change_data data; }* list = NULL;
+	static struct status_change_data scdata[SCDATA_BLOB_MAX];
+	char* data;
+	int i, j, n, count = 0, max = 0, chars = 0;
+
+	if( SQL_ERROR == Sql_Query(sql_handle, "SELECT `account_id`, `char_id`, `type`, `tick`, `val1`, `val2`, `val3`, `val4` FROM `%s` ORDER BY `char_id`", scdata_db) )
+	{
+		Sql_ShowDebug(sql_handle);
+		return;
+	}
+	while( SQL_SUCCESS == Sql_NextRow(sql_handle) )
+	{
+		if( count == max )
+		{
+			max += 256;
+			RECREATE(list, struct scdata_row, max);
+		}
+		Sql_GetData(sql_handle, 0, &data, NULL); list[count].aid = atoi(data);
+		Sql_GetData(sql_handle, 1, &data, NULL); list[count].cid = atoi(data);
+		Sql_GetData(sql_handle, 2, &data, NULL); list[count].data.type = atoi(data);
+		Sql_GetData(sql_handle, 3, &data, NULL); list[count].data.tick = atoi(data);
+		Sql_GetData(sql_handle, 4, &data, NULL); list[count].data.val1 = atoi(data);
+		Sql_GetData(sql_handle, 5, &data, NULL); list[count].data.val2 = atoi(data);
+		Sql_GetData(sql_handle, 6, &data, NULL); list[count].data.val3 = atoi(data);
+		Sql_GetData(sql_handle, 7, &data, NULL); list[count].data.val4 = atoi(data);
+		++count;
+	}
+	Sql_FreeResult(sql_handle);
+
+	for( i = 0; i < count; i = j )
+	{
+		for( j = i, n = 0; j < count && list[j].cid == list[i].cid; ++j )
+			if( n < (int)ARRAYLENGTH(scdata) )
+				scdata[n++] = list[j].data;
+		if( j - i > n )
+			ShowWarning("char_scdata_migrate: Character %d has %d status changes, only the first %d are moved.\n", list[i].cid, j - i, n);
+		if( !char_scdata_toblob(list[i].cid, scdata, n) )
+			continue;
+		if( SQL_ERROR == Sql_Query(sql_handle, "DELETE FROM `%s` WHERE `account_id` = '%d' AND `char_id`='%d'", scdata_db, list[i].aid, list[i].cid) )
+			Sql_ShowDebug(sql_handle);
+		++chars;
+	}
+
+	if( list )
+		aFree(list);
+	ShowStatus("Moved the status changes of %d characters into blobs.\n", chars);
+}
+#endif
 
 int parse_frommap(int fd)
 {
@@ -2529,6 +2894,11 @@ int parse_frommap(int fd)
 			int aid, cid;
 			aid = RFIFOL(fd,2);
 			cid = RFIFOL(fd,6);
+			if( blob_storage && char_scdata_fromblob(fd, aid, cid) > 0 )
+			{// status changes saved before blob storage was enabled are still read from the rows below
+				RFIFOSKIP(fd, 10);
+				break;
+			}
 			if( SQL_ERROR == Sql_Query(sql_handle, "SELECT type, tick, val1, val2, val3, val4 from `%s` WHERE `account_id` = '%d' AND `char_id`='%d'",
 				scdata_db, aid, cid) )
 			{
@@ -2710,11 +3080,11 @@ int parse_frommap(int fd)
 			if (map_id >= 0)
 				map_fd = server[map_id].fd;
 			//Char should just had been saved before this packet, so this should be safe. [Skotlex]
-			char_data = (struct mmo_charstatus*)uidb_get(char_db_,RFIFOL(fd,14));
+			char_data = char_cache_get(RFIFOL(fd,14));
 			if (char_data == NULL) 
 			{	//Really shouldn't happen.
 				mmo_char_fromsql(RFIFOL(fd,14), &char_dat, true);
-				char_data = (struct mmo_charstatus*)uidb_get(char_db_,RFIFOL(fd,14));
+				char_data = char_cache_get(RFIFOL(fd,14));
 			}
 			
 			if( runflag == SERVER_STATE_RUN &&
@@ -2891,54 +3261,8 @@ int parse_frommap(int fd)
 		case 0x2b10: // Update and send fame ranking list
 			if (RFIFOREST(fd) < 11)
 				return 0;
-		{
-			int cid = RFIFOL(fd, 2);
-			int fame = RFIFOL(fd, 6);
-			char type = RFIFOB(fd, 10);
-			int size;
-			struct fame_list* list;
-			int player_pos;
-			int fame_pos;
-
-			switch(type)
-			{
-				case 1:  size = fame_list_size_smith;   list = smith_fame_list;   break;
-				case 2:  size = fame_list_size_chemist; list = chemist_fame_list; break;
-				case 3:  size = fame_list_size_taekwon; list = taekwon_fame_list; break;
-				default: size = 0;                      list = NULL;              break;
-			}
-
-			ARR_FIND(0, size, player_pos, list[player_pos].id == cid);// position of the player
-			ARR_FIND(0, size, fame_pos, list[fame_pos].fame <= fame);// where the player should be
-
-			if( player_pos == size && fame_pos == size )
-				;// not on list and not enough fame to get on it
-			else if( fame_pos == player_pos )
-			{// same position
-				list[player_pos].fame = fame;
-				char_update_fame_list(type, player_pos, fame);
-			}
-			else
-			{// move in the list
-				if( player_pos == size )
-				{// new ranker - not in the list
-					ARR_MOVE(size - 1, fame_pos, list, struct fame_list);
-					list[fame_pos].id = cid;
-					list[fame_pos].fame = fame;
-					char_loadName(cid, list[fame_pos].name);
-				}
-				else
-				{// already in the list
-					if( fame_pos == size )
-						--fame_pos;// move to the end of the list
-					ARR_MOVE(player_pos, fame_pos, list, struct fame_list);
-					list[fame_pos].fame = fame;
-				}
-				char_send_fame_list(-1);
-			}
-
+			char_update_fame(RFIFOL(fd,2), RFIFOL(fd,6), RFIFOB(fd,10));
 			RFIFOSKIP(fd,11);
-		}
 		break;
 
 		// Divorce chars
@@ -3003,7 +3327,15 @@ int parse_frommap(int fd)
 			cid = RFIFOL(fd, 8);
 			count = RFIFOW(fd, 12);
 
-			if( count > 0 )
+			if( count > 0 && blob_storage )
+			{
+				static struct status_change_data data[SCDATA_BLOB_MAX];
+
+				count = min(count, (int)ARRAYLENGTH(data));// the packet length bounds it already
+				memcpy(data, RFIFOP(fd, 14), count*sizeof(struct status_change_data));
+				char_scdata_toblob(cid, data, count);
+			}
+			else if( count > 0 )
 			{
 				struct status_change_data data;
 				StringBuf buf;
@@ -3057,11 +3389,11 @@ int parse_frommap(int fd)
 			RFIFOSKIP(fd,19);
 
 			node = (struct auth_node*)idb_get(auth_db, account_id);
-			cd = (struct mmo_charstatus*)uidb_get(char_db_,char_id);
+			cd = char_cache_get(char_id);
 			if( cd == NULL )
 			{	//Really shouldn't happen.
 				mmo_char_fromsql(char_id, &char_dat, true);
-				cd = (struct mmo_charstatus*)uidb_get(char_db_,char_id);
+				cd = char_cache_get(char_id);
 			}
 			if( runflag == SERVER_STATE_RUN &&
 				cd != NULL &&
@@ -3561,10 +3893,17 @@ int parse_char(int fd)
 
 			char_id = atoi(data);
 			Sql_FreeResult(sql_handle);
-			mmo_char_fromsql(char_id, &char_dat, true);
+			if( !mmo_char_fromsql(char_id, &char_dat, true) )
+			{	//Failed to load, don't let it play with incomplete data.
+				WFIFOHEAD(fd,3);
+				WFIFOW(fd,0) = 0x6c;
+				WFIFOB(fd,2) = 0; // rejected from server
+				WFIFOSET(fd,3);
+				break;
+			}
 
 			//Have to switch over to the DB instance otherwise data won't propagate [Kevin]
-			cd = (struct mmo_charstatus *)idb_get(char_db_, char_id);
+			cd = char_cache_get(char_id);
 			cd->sex = sd->sex;
 
 			if (log_char) {
@@ -3948,21 +4287,76 @@ int parse_console(const char* command)
 		runflag = SERVER_STATE_STOP;
 	else if( strcmpi("alive", command) == 0 || strcmpi("status", command) == 0 )
 		ShowInfo(CL_CYAN"Console: "CL_BOLD"I'm Alive."CL_RESET"\n");
+	else if( strcmpi("memory", command) == 0 )
+	{
+		ShowInfo("Memory usage: %u KB\n", (unsigned int)malloc_usage());
+		char_cache_report();
+		ers_report();
+		arena_report();
+	}
+	else if( strcmpi("timers", command) == 0 )
+		timer_stats_report(20);
+	else if( strcmpi("timersreset", command) == 0 )
+		timer_stats_reset();
+	else if( strcmpi("blobmigrate", command) == 0 )
+	{
+		inter_accreg_migrate();
+#ifdef ENABLE_SC_SAVING
+		if( blob_storage )
+			char_scdata_migrate();
+#endif
+	}
 	else if( strcmpi("help", command) == 0 )
 	{
 		ShowInfo("To shutdown the server:\n");
 		ShowInfo("  'shutdown|exit|quit|end'\n");
 		ShowInfo("To know if server is alive:\n");
 		ShowInfo("  'alive|status'\n");
+		ShowInfo("To show the memory usage of each subsystem:\n");
+		ShowInfo("  'memory'\n");
+		ShowInfo("To show or reset the time used by the timer functions:\n");
+		ShowInfo("  'timers|timersreset'\n");
+		ShowInfo("To move registry and status change rows into blobs ('blob_storage'):\n");
+		ShowInfo("  'blobmigrate'\n");
 	}
 
 	return 0;
 }
 
+/// Wraps a packet in a zlib compressed envelope (0x3807), when it is big
+/// enough and compresses well. Returns the envelope length or 0 if the
+/// packet should be sent as it is.
+/// R 3807 <packet len>.W <original len>.W <compressed packet>.?B
+static unsigned int mapif_compress(unsigned char* out, unsigned char* buf, unsigned int len)
+{
+	unsigned long size;
+
+	if( mapif_compress_size <= 0 || len < (unsigned int)mapif_compress_size || len < 8 )
+		return 0;
+
+	size = len - 7;// must save at least one byte
+	if( compress2((Bytef*)WBUFP(out,6), &size, (const Bytef*)buf, len, Z_DEFAULT_COMPRESSION) != Z_OK )
+		return 0;// does not fit
+
+	WBUFW(out,0) = 0x3807;
+	WBUFW(out,2) = (uint16)(size + 6);
+	WBUFW(out,4) = (uint16)len;
+	return (unsigned int)size + 6;
+}
+
 int mapif_sendall(unsigned char *buf, unsigned int len)
 {
+	static unsigned char zbuf[UINT16_MAX];
+	unsigned int zlen;
 	int i, c;
 
+	// compressed once for all map-servers
+	if( (zlen = mapif_compress(zbuf, buf, len)) > 0 )
+	{
+		buf = zbuf;
+		len = zlen;
+	}
+
 	c = 0;
 	for(i = 0; i < ARRAYLENGTH(server); i++) {
 		int fd;
@@ -3979,8 +4373,17 @@ int mapif_sendall(unsigned char *buf, unsigned int len)
 
 int mapif_sendallwos(int sfd, unsigned char *buf, unsigned int len)
 {
+	static unsigned char zbuf[UINT16_MAX];
+	unsigned int zlen;
 	int i, c;
 
+	// compressed once for all map-servers
+	if( (zlen = mapif_compress(zbuf, buf, len)) > 0 )
+	{
+		buf = zbuf;
+		len = zlen;
+	}
+
 	c = 0;
 	for(i = 0; i < ARRAYLENGTH(server); i++) {
 		int fd;
@@ -3997,12 +4400,19 @@ int mapif_sendallwos(int sfd, unsigned char *buf, unsigned int len)
 
 int mapif_send(int fd, unsigned char *buf, unsigned int len)
 {
+	static unsigned char zbuf[UINT16_MAX];
+	unsigned int zlen;
 	int i;
 
 	if (fd >= 0) {
 		ARR_FIND( 0, ARRAYLENGTH(server), i, fd == server[i].fd );
 		if( i < ARRAYLENGTH(server) )
 		{
+			if( (zlen = mapif_compress(zbuf, buf, len)) > 0 )
+			{
+				buf = zbuf;
+				len = zlen;
+			}
 			WFIFOHEAD(fd,len);
 			memcpy(WFIFOP(fd,0), buf, len);
 			WFIFOSET(fd,len);
@@ -4242,6 +4652,8 @@ void sql_config_read(const char* cfgName)
 			safestrncpy(storage_db, w2, sizeof(storage_db));
 		else if(!strcmpi(w1,"reg_db"))
 			safestrncpy(reg_db, w2, sizeof(reg_db));
+		else if(!strcmpi(w1,"blob_db"))
+			safestrncpy(blob_db, w2, sizeof(blob_db));
 		else if(!strcmpi(w1,"skill_db"))
 			safestrncpy(skill_db, w2, sizeof(skill_db));
 		else if(!strcmpi(w1,"interlog_db"))
@@ -4434,6 +4846,10 @@ int char_config_read(const char* cfgName)
 			}
 		} else if (strcmpi(w1, "guild_exp_rate") == 0) {
 			guild_exp_rate = atoi(w2);
+		} else if (strcmpi(w1, "mapif_compress_size") == 0) {
+			mapif_compress_size = atoi(w2);
+		} else if (strcmpi(w1, "char_cache_timeout") == 0) {
+			char_cache_timeout = max(atoi(w2), 1);
 		} else if (strcmpi(w1, "import") == 0) {
 			char_config_read(w2);
 		}
@@ -4462,6 +4878,7 @@ void do_final(void)
 		Sql_ShowDebug(sql_handle);
 
 	char_db_->destroy(char_db_, NULL);
+	char_final_fame_list();
 	online_char_db->destroy(online_char_db, NULL);
 	auth_db->destroy(auth_db, NULL);
 
@@ -4570,6 +4987,10 @@ int do_init(int argc, char **argv)
 	add_timer_func_list(online_data_cleanup, "online_data_cleanup");
 	add_timer_interval(gettick() + 1000, online_data_cleanup, 0, 0, 600 * 1000);
 
+	// drop characters that stayed in the cache after going offline
+	add_timer_func_list(char_cache_timer, "char_cache_timer");
+	add_timer_interval(gettick() + 60 * 1000, char_cache_timer, 0, 0, 60 * 1000);
+
 	if( console )
 	{
 		//##TODO invoke a CONSOLE_START plugin event
@@ -46,6 +46,7 @@ extern char charlog_db[256];
 extern char storage_db[256];
 extern char interlog_db[256];
 extern char reg_db[256];
+extern char blob_db[256];
 extern char skill_db[256];
 extern char memo_db[256];
 extern char guild_db[256];
@@ -20,25 +20,208 @@
 
 static DBMap* auction_db_ = NULL; // int auction_id -> struct auction_data*
 
+/// Ordered list of auctions, used to answer the auction searches a page at a time.
+struct auction_index {
+	struct auction_data** data;
+	int count;
+	int max;
+};
+
+/// Auctions of one item name.
+struct auction_name_index {
+	char name[ITEM_NAME_LENGTH];
+	struct auction_index index;
+};
+
+typedef int (*AuctionCmp)(const struct auction_data* a, const struct auction_data* b);
+
+static struct auction_index auction_all_index;     // every auction, by auction_id
+static struct auction_index auction_type_index[4]; // armors, weapons, cards, etc items, by auction_id
+static struct auction_index auction_price_index;   // every auction, by price and auction_id
+static DBMap* auction_seller_db = NULL; // int char_id -> struct auction_index*, by auction_id
+static DBMap* auction_buyer_db = NULL;  // int char_id -> struct auction_index*, by auction_id
+static struct auction_name_index* auction_names = NULL; // item names in strcmp order
+static int auction_names_count = 0;
+static int auction_names_max = 0;
+
 void auction_delete(struct auction_data *auction);
 static int auction_end_timer(int tid, unsigned int tick, int id, intptr_t data);
 
-static int auction_count(int char_id, bool buy)
+static int auction_cmp_id(const struct auction_data* a, const struct auction_data* b)
 {
-	int i = 0;
-	struct auction_data *auction;
-	DBIterator* iter;
-	DBKey key;
+	if( a->auction_id != b->auction_id )
+		return ( a->auction_id < b->auction_id ) ? -1 : 1;
+	return 0;
+}
+
+static int auction_cmp_price(const struct auction_data* a, const struct auction_data* b)
+{
+	if( a->price != b->price )
+		return ( a->price < b->price ) ? -1 : 1;
+	return auction_cmp_id(a, b);
+}
+
+/// Returns the first position of the index that does not sort before the auction.
+static int auction_index_search(struct auction_index* idx, const struct auction_data* auction, AuctionCmp cmp)
+{
+	int lo = 0, hi = idx->count;
+
+	while( lo < hi )
+	{
+		int mid = (lo + hi) / 2;
+		if( cmp(idx->data[mid], auction) < 0 )
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	return lo;
+}
+
+static void auction_index_add(struct auction_index* idx, struct auction_data* auction, AuctionCmp cmp)
+{
+	int i;
+
+	if( idx->count == idx->max )
+	{
+		idx->max = idx->max ? 2*idx->max : 8;
+		RECREATE(idx->data, struct auction_data*, idx->max);
+	}
+	i = auction_index_search(idx, auction, cmp);
+	memmove(&idx->data[i+1], &idx->data[i], (idx->count - i)*sizeof(struct auction_data*));
+	idx->data[i] = auction;
+	idx->count++;
+}
+
+static void auction_index_remove(struct auction_index* idx, struct auction_data* auction, AuctionCmp cmp)
+{
+	int i = auction_index_search(idx, auction, cmp);
+
+	if( i < idx->count && idx->data[i] == auction )
+	{
+		idx->count--;
+		memmove(&idx->data[i], &idx->data[i+1], (idx->count - i)*sizeof(struct auction_data*));
+	}
+}
 
-	iter = auction_db_->iterator(auction_db_);
-	for( auction = (struct auction_data*)iter->first(iter,&key); iter->exists(iter); auction = (struct auction_data*)iter->next(iter,&key) )
+static struct auction_index* auction_type_search(short type)
+{
+	switch( type )
 	{
-		if( (buy && auction->buyer_id == char_id) || (!buy && auction->seller_id == char_id) )
-			i++;
+	case IT_ARMOR:
+	case IT_PETARMOR: return &auction_type_index[0];
+	case IT_WEAPON:   return &auction_type_index[1];
+	case IT_CARD:     return &auction_type_index[2];
+	case IT_ETC:      return &auction_type_index[3];
+	default:          return NULL;
 	}
-	iter->destroy(iter);
+}
+
+/// Returns the position of the item name in auction_names, or where it should be inserted.
+static int auction_name_search(const char* name)
+{
+	int lo = 0, hi = auction_names_count;
 
-	return i;
+	while( lo < hi )
+	{
+		int mid = (lo + hi) / 2;
+		if( strncmp(auction_names[mid].name, name, ITEM_NAME_LENGTH) < 0 )
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	return lo;
+}
+
+static void auction_char_add(DBMap* db, int char_id, struct auction_data* auction)
+{
+	struct auction_index* idx;
+
+	if( char_id <= 0 )
+		return;
+	if( (idx = (struct auction_index*)idb_get(db, char_id)) == NULL )
+	{
+		CREATE(idx, struct auction_index, 1);
+		idb_put(db, char_id, idx);
+	}
+	auction_index_add(idx, auction, auction_cmp_id);
+}
+
+static void auction_char_remove(DBMap* db, int char_id, struct auction_data* auction)
+{
+	struct auction_index* idx;
+
+	if( char_id <= 0 || (idx = (struct auction_index*)idb_get(db, char_id)) == NULL )
+		return;
+	auction_index_remove(idx, auction, auction_cmp_id);
+	if( idx->count == 0 )
+	{
+		idb_remove(db, char_id);
+		aFree(idx->data);
+		aFree(idx);
+	}
+}
+
+/// Adds the auction to the search indexes.
+static void auction_index_link(struct auction_data* auction)
+{
+	struct auction_index* idx;
+	int i;
+
+	auction_index_add(&auction_all_index, auction, auction_cmp_id);
+	auction_index_add(&auction_price_index, auction, auction_cmp_price);
+	if( (idx = auction_type_search(auction->type)) != NULL )
+		auction_index_add(idx, auction, auction_cmp_id);
+	auction_char_add(auction_seller_db, auction->seller_id, auction);
+	auction_char_add(auction_buyer_db, auction->buyer_id, auction);
+
+	i = auction_name_search(auction->item_name);
+	if( i == auction_names_count || strncmp(auction_names[i].name, auction->item_name, ITEM_NAME_LENGTH) != 0 )
+	{// new item name
+		if( auction_names_count == auction_names_max )
+		{
+			auction_names_max = auction_names_max ? 2*auction_names_max : 32;
+			RECREATE(auction_names, struct auction_name_index, auction_names_max);
+		}
+		memmove(&auction_names[i+1], &auction_names[i], (auction_names_count - i)*sizeof(struct auction_name_index));
+		memset(&auction_names[i], 0, sizeof(struct auction_name_index));
+		safestrncpy(auction_names[i].name, auction->item_name, ITEM_NAME_LENGTH);
+		auction_names_count++;
+	}
+	auction_index_add(&auction_names[i].index, auction, auction_cmp_id);
+}
+
+/// Removes the auction from the search indexes.
+/// Must be called before changing any of the indexed fields.
+static void auction_index_unlink(struct auction_data* auction)
+{
+	struct auction_index* idx;
+	int i;
+
+	auction_index_remove(&auction_all_index, auction, auction_cmp_id);
+	auction_index_remove(&auction_price_index, auction, auction_cmp_price);
+	if( (idx = auction_type_search(auction->type)) != NULL )
+		auction_index_remove(idx, auction, auction_cmp_id);
+	auction_char_remove(auction_seller_db, auction->seller_id, auction);
+	auction_char_remove(auction_buyer_db, auction->buyer_id, auction);
+
+	i = auction_name_search(auction->item_name);
+	if( i < auction_names_count && strncmp(auction_names[i].name, auction->item_name, ITEM_NAME_LENGTH) == 0 )
+	{
+		auction_index_remove(&auction_names[i].index, auction, auction_cmp_id);
+		if( auction_names[i].index.count == 0 )
+		{// last auction of this item name
+			aFree(auction_names[i].index.data);
+			auction_names_count--;
+			memmove(&auction_names[i], &auction_names[i+1], (auction_names_count - i)*sizeof(struct auction_name_index));
+		}
+	}
+}
+
+static int auction_count(int char_id, bool buy)
+{
+	struct auction_index* idx = (struct auction_index*)idb_get(buy ? auction_buyer_db : auction_seller_db, char_id);
+
+	return idx ? idx->count : 0;
 }
 
 void auction_save(struct auction_data *auction)
@@ -118,6 +301,7 @@ unsigned int auction_create(struct auction_data *auction)
 		CREATE(auction_, struct auction_data, 1);
 		memcpy(auction_, auction, sizeof(struct auction_data));
 		idb_put(auction_db_, auction_->auction_id, auction_);
+		auction_index_link(auction_);
 	}
 
 	SqlStmt_Free(stmt);
@@ -169,6 +353,7 @@ void auction_delete(struct auction_data *auction)
 	if( auction->auction_end_timer != INVALID_TIMER )
 		delete_timer(auction->auction_end_timer, auction_end_timer);
 
+	auction_index_unlink(auction);
 	idb_remove(auction_db_, auction_id);
 }
 
@@ -232,6 +417,7 @@ void inter_auctions_fromsql(void)
 
 		auction->auction_end_timer = add_timer(endtick, auction_end_timer, auction->auction_id, 0);
 		idb_put(auction_db_, auction->auction_id, auction);
+		auction_index_link(auction);
 	}
 
 	Sql_FreeResult(sql_handle);
@@ -258,40 +444,63 @@ static void mapif_parse_Auction_requestlist(int fd)
 	int price = RFIFOL(fd,10);
 	short type = RFIFOW(fd,8), page = max(1,RFIFOW(fd,14));
 	unsigned char buf[5 * sizeof(struct auction_data)];
-	DBIterator* iter;
-	DBKey key;
-	struct auction_data *auction;
-	short i = 0, j = 0, pages = 1;
+	struct auction_index* idx = NULL;
+	int count = 0, start = (page - 1) * 5;
+	int i, n;
+	short j = 0, pages;
 
 	memcpy(searchtext, RFIFOP(fd,16), NAME_LENGTH);
+	searchtext[NAME_LENGTH-1] = '\0';
 
-	iter = auction_db_->iterator(auction_db_);
-	for( auction = (struct auction_data*)iter->first(iter,&key); iter->exists(iter); auction = (struct auction_data*)iter->next(iter,&key) )
+	switch( type )
 	{
-		if( (type == 0 && auction->type != IT_ARMOR && auction->type != IT_PETARMOR) || 
-			(type == 1 && auction->type != IT_WEAPON) ||
-			(type == 2 && auction->type != IT_CARD) ||
-			(type == 3 && auction->type != IT_ETC) ||
-			(type == 4 && !strstr(auction->item_name, searchtext)) ||
-			(type == 5 && auction->price > price) ||
-			(type == 6 && auction->seller_id != char_id) ||
-			(type == 7 && auction->buyer_id != char_id) )
-			continue;
-
-		i++;
-		if( i > 5 )
-		{ // Counting Pages of Total Results (5 Results per Page)
-			pages++;
-			i = 1; // First Result of This Page
-		}
-
-		if( page != pages )
-			continue; // This is not the requested Page
+	case 0:  idx = &auction_type_index[0]; break;
+	case 1:  idx = &auction_type_index[1]; break;
+	case 2:  idx = &auction_type_index[2]; break;
+	case 3:  idx = &auction_type_index[3]; break;
+	case 4:  break; // item names below
+	case 5:  idx = &auction_price_index; break;
+	case 6:  idx = (struct auction_index*)idb_get(auction_seller_db, char_id); break;
+	case 7:  idx = (struct auction_index*)idb_get(auction_buyer_db, char_id); break;
+	default: idx = &auction_all_index; break;
+	}
 
-		memcpy(WBUFP(buf, j * len), auction, len);
-		j++; // Found Results
+	if( type == 4 )
+	{// Auctions of every item name containing the search text
+		for( n = 0; n < auction_names_count; n++ )
+		{
+			struct auction_index* name_idx = &auction_names[n].index;
+
+			if( !strstr(auction_names[n].name, searchtext) )
+				continue;
+			for( i = max(0, start - count); i < name_idx->count && j < 5; i++ )
+			{
+				memcpy(WBUFP(buf, j * len), name_idx->data[i], len);
+				j++; // Found Results
+			}
+			count += name_idx->count;
+		}
+	}
+	else if( idx != NULL )
+	{
+		if( type == 5 )
+		{// Cheapest auctions up to the price
+			struct auction_data key;
+			key.auction_id = UINT_MAX;
+			key.price = price;
+			count = auction_index_search(idx, &key, auction_cmp_price);
+		}
+		else
+			count = idx->count;
+		for( i = start; i < count && j < 5; i++ )
+		{
+			memcpy(WBUFP(buf, j * len), idx->data[i], len);
+			j++; // Found Results
+		}
 	}
-	iter->destroy(iter);
+
+	// 5 Results per Page
+	pages = ( count > 0 ) ? (count + 4) / 5 : 1;
 
 	mapif_Auction_sendlist(fd, char_id, j, pages, buf);
 }
@@ -439,9 +648,11 @@ static void mapif_parse_Auction_bid(int fd)
 			mail_sendmail(0, "Auction Manager", auction->buyer_id, auction->buyer_name, "Auction", "You have placed a higher bid.", auction->price, NULL);
 	}
 
+	auction_index_unlink(auction);
 	auction->buyer_id = char_id;
 	safestrncpy(auction->buyer_name, (char*)RFIFOP(fd,16), NAME_LENGTH);
 	auction->price = bid;
+	auction_index_link(auction);
 
 	if( bid >= auction->buynow )
 	{ // Automatic won the auction
@@ -481,14 +692,37 @@ int inter_auction_parse_frommap(int fd)
 int inter_auction_sql_init(void)
 {
 	auction_db_ = idb_alloc(DB_OPT_RELEASE_DATA);
+	auction_seller_db = idb_alloc(DB_OPT_BASE);
+	auction_buyer_db = idb_alloc(DB_OPT_BASE);
 	inter_auctions_fromsql();
 
 	return 0;
 }
 
+static int auction_char_final(DBKey key, void* data, va_list ap)
+{
+	struct auction_index* idx = (struct auction_index*)data;
+
+	aFree(idx->data);
+	aFree(idx);
+	return 0;
+}
+
 void inter_auction_sql_final(void)
 {
+	int i;
+
 	auction_db_->destroy(auction_db_,NULL);
+	auction_seller_db->destroy(auction_seller_db, auction_char_final);
+	auction_buyer_db->destroy(auction_buyer_db, auction_char_final);
+
+	aFree(auction_all_index.data);
+	aFree(auction_price_index.data);
+	for( i = 0; i < ARRAYLENGTH(auction_type_index); i++ )
+		aFree(auction_type_index[i].data);
+	for( i = 0; i < auction_names_count; i++ )
+		aFree(auction_names[i].index.data);
+	aFree(auction_names);
 
 	return;
 }
@@ -24,6 +24,8 @@
 #define GS_POSITION_UNMODIFIED 0x00
 #define GS_POSITION_MODIFIED 0x01
 
+#define GUILD_SAVE_INTERVAL 1000 // interval of the queued guild saves (ms)
+
 // LSB = 0 => Alliance, LSB = 1 => Opposition
 #define GUILD_ALLIANCE_TYPE_MASK 0x01
 #define GUILD_ALLIANCE_REMOVE 0x08
@@ -34,6 +36,12 @@ static const char dataToHex[] = {'0', '1', '2', '3', '4', '5', '6', '7', '8', '9
 //Guild cache
 static DBMap* guild_db_; // int guild_id -> struct guild*
 
+// Ring buffer of guild ids waiting to be saved, see guild_queue_save
+static int* save_queue = NULL;
+static int save_queue_head = 0;
+static int save_queue_len = 0;
+static int save_queue_max = 0;
+
 struct guild_castle castles[MAX_GUILDCASTLE];
 
 static unsigned int guild_exp[100];
@@ -47,33 +55,67 @@ int mapif_guild_info(int fd,struct guild *g);
 int guild_break_sub(int key,void *data,va_list ap);
 int inter_guild_tosql(struct guild *g,int flag);
 
-static int guild_save_timer(int tid, unsigned int tick, int id, intptr_t data)
+/// Queues the guild for saving the given GS_* data.
+static void guild_queue_save(struct guild* g, int flag)
 {
-	static int last_id = 0; //To know in which guild we were.
-	int state = 0; //0: Have not reached last guild. 1: Reached last guild, ready for save. 2: Some guild saved, don't do further saving.
-	DBIterator* iter;
-	DBKey key;
-	struct guild* g;
+	g->save_flag |= flag;
+	if( g->save_flag&GS_QUEUED || !(flag&GS_MASK) )
+		return;
+	g->save_flag |= GS_QUEUED;
+
+	if( save_queue_len == save_queue_max )
+	{// grow the ring buffer, unwrapping its contents
+		int i, max = save_queue_max + 64;
+		int* queue;
+
+		CREATE(queue, int, max);
+		for( i = 0; i < save_queue_len; i++ )
+			queue[i] = save_queue[(save_queue_head + i)%save_queue_max];
+		if( save_queue )
+			aFree(save_queue);
+		save_queue = queue;
+		save_queue_head = 0;
+		save_queue_max = max;
+	}
+	save_queue[(save_queue_head + save_queue_len)%save_queue_max] = g->guild_id;
+	save_queue_len++;
+}
 
-	if( last_id == 0 ) //Save the first guild in the list.
-		state = 1;
+/// Saves the queued guilds, at most guild_save_count per call.
+static int guild_save_timer(int tid, unsigned int tick, int id, intptr_t data)
+{
+	int saved = 0;
 
-	iter = guild_db_->iterator(guild_db_);
-	for( g = (struct guild*)iter->first(iter,&key); iter->exists(iter); g = (struct guild*)iter->next(iter,&key) )
+	while( save_queue_len > 0 && saved < guild_save_count )
 	{
-		if( state == 0 && g->guild_id == last_id )
-			state++; //Save next guild in the list.
-		else
-		if( state == 1 && g->save_flag&GS_MASK )
+		struct guild* g = (struct guild*)idb_get(guild_db_, save_queue[save_queue_head]);
+
+		save_queue_head = (save_queue_head + 1)%save_queue_max;
+		save_queue_len--;
+		if( g == NULL || !(g->save_flag&GS_QUEUED) )
+			continue;// unloaded or broken meanwhile
+
+		g->save_flag &= ~GS_QUEUED;
+		if( g->save_flag&GS_MASK )
 		{
 			inter_guild_tosql(g, g->save_flag&GS_MASK);
 			g->save_flag &= ~GS_MASK;
-
-			//Some guild saved.
-			last_id = g->guild_id;
-			state++;
+			saved++;
 		}
+	}
+	return 0;
+}
 
+/// Unloads the guilds that have nothing to save and no members online.
+static int guild_unload_timer(int tid, unsigned int tick, int id, intptr_t data)
+{
+	DBIterator* iter;
+	DBKey key;
+	struct guild* g;
+
+	iter = guild_db_->iterator(guild_db_);
+	for( g = (struct guild*)iter->first(iter,&key); iter->exists(iter); g = (struct guild*)iter->next(iter,&key) )
+	{
 		if( g->save_flag == GS_REMOVE )
 		{// Nothing to save, guild is ready for removal.
 			if (save_log)
@@ -82,13 +124,6 @@ static int guild_save_timer(int tid, unsigned int tick, int id, intptr_t data)
 		}
 	}
 	iter->destroy(iter);
-
-	if( state != 2 ) //Reached the end of the guild db without saving.
-		last_id = 0; //Reset guild saved, return to beginning.
-
-	state = guild_db_->size(guild_db_);
-	if( state < 1 ) state = 1; //Calculate the time slot for the next save.
-	add_timer(tick  + autosave_interval/state, guild_save_timer, 0, 0);
 	return 0;
 }
 
@@ -252,9 +287,15 @@ int inter_guild_tosql(struct guild *g,int flag)
 	if (flag&GS_MEMBER)
 	{
 		struct guild_member *m;
+		StringBuf buf, new_buf;
+		int count = 0, new_count = 0;
 
 		strcat(t_info, " members");
-		// Update only needed players
+		// Update only needed players, all in one statement
+		//Since nothing references guild member table as foreign keys, it's safe to use REPLACE INTO
+		StringBuf_Init(&buf);
+		StringBuf_Init(&new_buf);
+		StringBuf_Printf(&buf, "REPLACE INTO `%s` (`guild_id`,`account_id`,`char_id`,`hair`,`hair_color`,`gender`,`class`,`lv`,`exp`,`exp_payper`,`online`,`position`,`name`) VALUES ", guild_member_db);
 		for(i=0;i<g->max_member;i++){
 			m = &g->member[i];
 #ifndef TXT_SQL_CONVERT
@@ -262,23 +303,25 @@ int inter_guild_tosql(struct guild *g,int flag)
 				continue;
 #endif
 			if(m->account_id) {
-				//Since nothing references guild member table as foreign keys, it's safe to use REPLACE INTO
 				Sql_EscapeStringLen(sql_handle, esc_name, m->name, strnlen(m->name, NAME_LENGTH));
-				if( SQL_ERROR == Sql_Query(sql_handle, "REPLACE INTO `%s` (`guild_id`,`account_id`,`char_id`,`hair`,`hair_color`,`gender`,`class`,`lv`,`exp`,`exp_payper`,`online`,`position`,`name`) "
-					"VALUES ('%d','%d','%d','%d','%d','%d','%d','%d','%"PRIu64"','%d','%d','%d','%s')",
-					guild_member_db, g->guild_id, m->account_id, m->char_id,
+				if( count++ )
+					StringBuf_AppendStr(&buf, ",");
+				StringBuf_Printf(&buf, "('%d','%d','%d','%d','%d','%d','%d','%d','%"PRIu64"','%d','%d','%d','%s')",
+					g->guild_id, m->account_id, m->char_id,
 					m->hair, m->hair_color, m->gender,
-					m->class_, m->lv, m->exp, m->exp_payper, m->online, m->position, esc_name) )
-					Sql_ShowDebug(sql_handle);
+					m->class_, m->lv, m->exp, m->exp_payper, m->online, m->position, esc_name);
 				if (m->modified & GS_MEMBER_NEW)
-				{
-					if( SQL_ERROR == Sql_Query(sql_handle, "UPDATE `%s` SET `guild_id` = '%d' WHERE `char_id` = '%d'",
-						char_db, g->guild_id, m->char_id) )
-						Sql_ShowDebug(sql_handle);
-				}
+					StringBuf_Printf(&new_buf, new_count++ ? ",'%d'" : "'%d'", m->char_id);
 				m->modified = GS_MEMBER_UNMODIFIED;
 			}
 		}
+		if( count && SQL_ERROR == Sql_Query(sql_handle, "%s", StringBuf_Value(&buf)) )
+			Sql_ShowDebug(sql_handle);
+		if( new_count && SQL_ERROR == Sql_Query(sql_handle, "UPDATE `%s` SET `guild_id` = '%d' WHERE `char_id` IN (%s)",
+			char_db, g->guild_id, StringBuf_Value(&new_buf)) )
+			Sql_ShowDebug(sql_handle);
+		StringBuf_Destroy(&buf);
+		StringBuf_Destroy(&new_buf);
 	}
 
 	if (flag&GS_POSITION){
@@ -787,7 +830,9 @@ int inter_guild_sql_init(void)
 	inter_guild_ReadEXP();
    
 	add_timer_func_list(guild_save_timer, "guild_save_timer");
-	add_timer(gettick() + 10000, guild_save_timer, 0, 0);
+	add_timer_func_list(guild_unload_timer, "guild_unload_timer");
+	add_timer_interval(gettick() + 10000, guild_save_timer, 0, 0, GUILD_SAVE_INTERVAL);
+	add_timer_interval(gettick() + 10000, guild_unload_timer, 0, 0, autosave_interval);
 	return 0;
 }
 
@@ -804,6 +849,8 @@ static int guild_db_final(DBKey key, void *data, va_list ap)
 void inter_guild_sql_final(void)
 {
 	guild_db_->destroy(guild_db_, guild_db_final);
+	if( save_queue )
+		aFree(save_queue);
 	return;
 }
 
@@ -925,7 +972,7 @@ int guild_calcinfo(struct guild *g)
 	// Check if guild stats has change
 	if(g->max_member != before.max_member || g->guild_lv != before.guild_lv || g->skill_point != before.skill_point	)
 	{
-		g->save_flag |= GS_LEVEL;
+		guild_queue_save(g, GS_LEVEL);
 		mapif_guild_info(-1,g);
 		return 1;
 	}
@@ -1353,7 +1400,7 @@ int mapif_parse_GuildAddMember(int fd,int guild_id,struct guild_member *m)
 			if (!guild_calcinfo(g)) //Send members if it was not invoked.
 				mapif_guild_info(-1,g);
 
-			g->save_flag |= GS_MEMBER;
+			guild_queue_save(g, GS_MEMBER);
 			if (g->save_flag&GS_REMOVE)
 				g->save_flag&=~GS_REMOVE;
 			return 0;
@@ -1416,7 +1463,7 @@ int mapif_parse_GuildLeave(int fd, int guild_id, int account_id, int char_id, in
 		//Update member info.
 		if (!guild_calcinfo(g))
 			mapif_guild_info(fd,g);
-		g->save_flag |= GS_EXPULSION;
+		guild_queue_save(g, GS_EXPULSION);
 	}
 
 	return 0;
@@ -1467,11 +1514,11 @@ int mapif_parse_GuildChangeMemberInfoShort(int fd,int guild_id,int account_id,in
 	{
 		g->average_lv = sum / c;
 		if( g->connect_member != prev_count || g->average_lv != prev_alv )
-			g->save_flag |= GS_CONNECT;
+			guild_queue_save(g, GS_CONNECT);
 		if( g->save_flag & GS_REMOVE )
 			g->save_flag &= ~GS_REMOVE;
 	}
-	g->save_flag |= GS_MEMBER; //Update guild member data
+	guild_queue_save(g, GS_MEMBER); //Update guild member data
 	return 0;
 }
 
@@ -1550,7 +1597,7 @@ int mapif_parse_GuildBasicInfoChange(int fd,int guild_id,int type,const char *da
 			else if(dw<0 && g->guild_lv+dw>=1)
 				g->guild_lv+=dw;
 			mapif_guild_info(-1,g);
-			g->save_flag |= GS_LEVEL;
+			guild_queue_save(g, GS_LEVEL);
 			return 0;
 		default:
 			ShowError("int_guild: GuildBasicInfoChange: Unknown type %d\n",type);
@@ -1591,7 +1638,7 @@ int mapif_parse_GuildMemberInfoChange(int fd,int guild_id,int account_id,int cha
 			g->member[i].position=*((short *)data);
 			g->member[i].modified = GS_MEMBER_MODIFIED;
 			mapif_guild_memberinfochanged(guild_id,account_id,char_id,type,data,len);
-			g->save_flag |= GS_MEMBER;
+			guild_queue_save(g, GS_MEMBER);
 			break;
 		  }
 		case GMI_EXP:
@@ -1615,10 +1662,10 @@ int mapif_parse_GuildMemberInfoChange(int fd,int guild_id,int account_id,int cha
 
 				guild_calcinfo(g);
 				mapif_guild_basicinfochanged(guild_id,GBI_EXP,&g->exp,sizeof(g->exp));
-				g->save_flag |= GS_LEVEL;
+				guild_queue_save(g, GS_LEVEL);
 			}
 			mapif_guild_memberinfochanged(guild_id,account_id,char_id,type,data,len);
-			g->save_flag |= GS_MEMBER;
+			guild_queue_save(g, GS_MEMBER);
 			break;
 		}
 		case GMI_HAIR:
@@ -1626,7 +1673,7 @@ int mapif_parse_GuildMemberInfoChange(int fd,int guild_id,int account_id,int cha
 			g->member[i].hair=*((short *)data);
 			g->member[i].modified = GS_MEMBER_MODIFIED;
 			mapif_guild_memberinfochanged(guild_id,account_id,char_id,type,data,len);
-			g->save_flag |= GS_MEMBER; //Save new data.
+			guild_queue_save(g, GS_MEMBER); //Save new data.
 			break;
 		}
 		case GMI_HAIR_COLOR:
@@ -1634,7 +1681,7 @@ int mapif_parse_GuildMemberInfoChange(int fd,int guild_id,int account_id,int cha
 			g->member[i].hair_color=*((short *)data);
 			g->member[i].modified = GS_MEMBER_MODIFIED;
 			mapif_guild_memberinfochanged(guild_id,account_id,char_id,type,data,len);
-			g->save_flag |= GS_MEMBER; //Save new data.
+			guild_queue_save(g, GS_MEMBER); //Save new data.
 			break;
 		}
 		case GMI_GENDER:
@@ -1642,7 +1689,7 @@ int mapif_parse_GuildMemberInfoChange(int fd,int guild_id,int account_id,int cha
 			g->member[i].gender=*((short *)data);
 			g->member[i].modified = GS_MEMBER_MODIFIED;
 			mapif_guild_memberinfochanged(guild_id,account_id,char_id,type,data,len);
-			g->save_flag |= GS_MEMBER; //Save new data.
+			guild_queue_save(g, GS_MEMBER); //Save new data.
 			break;
 		}
 		case GMI_CLASS:
@@ -1650,7 +1697,7 @@ int mapif_parse_GuildMemberInfoChange(int fd,int guild_id,int account_id,int cha
 			g->member[i].class_=*((short *)data);
 			g->member[i].modified = GS_MEMBER_MODIFIED;
 			mapif_guild_memberinfochanged(guild_id,account_id,char_id,type,data,len);
-			g->save_flag |= GS_MEMBER; //Save new data.
+			guild_queue_save(g, GS_MEMBER); //Save new data.
 			break;
 		}
 		case GMI_LEVEL:
@@ -1658,7 +1705,7 @@ int mapif_parse_GuildMemberInfoChange(int fd,int guild_id,int account_id,int cha
 			g->member[i].lv=*((short *)data);
 			g->member[i].modified = GS_MEMBER_MODIFIED;
 			mapif_guild_memberinfochanged(guild_id,account_id,char_id,type,data,len);
-			g->save_flag |= GS_MEMBER; //Save new data.
+			guild_queue_save(g, GS_MEMBER); //Save new data.
 			break;
 		}
 		default:
@@ -1722,7 +1769,7 @@ int mapif_parse_GuildPosition(int fd,int guild_id,int idx,struct guild_position
 	memcpy(&g->position[idx],p,sizeof(struct guild_position));
 	mapif_guild_position(g,idx);
 	g->position[idx].modified = GS_POSITION_MODIFIED;
-	g->save_flag |= GS_POSITION; // Change guild_position
+	guild_queue_save(g, GS_POSITION); // Change guild_position
 	return 0;
 }
 
@@ -1743,7 +1790,7 @@ int mapif_parse_GuildSkillUp(int fd,int guild_id,int skill_num,int account_id,in
 		if (!guild_calcinfo(g))
 			mapif_guild_info(-1,g);
 		mapif_guild_skillupack(guild_id,skill_num,account_id);
-		g->save_flag |= (GS_LEVEL|GS_SKILL); // Change guild & guild_skill
+		guild_queue_save(g, GS_LEVEL|GS_SKILL); // Change guild & guild_skill
 	}
 	return 0;
 }
@@ -1762,7 +1809,7 @@ static int mapif_parse_GuildDeleteAlliance(struct guild *g, int guild_id, int ac
 	g->alliance[i].guild_id=0;
 	
 	mapif_guild_alliance(g->guild_id,guild_id,account_id1,account_id2,flag,g->name,name);
-	g->save_flag |= GS_ALLIANCE;
+	guild_queue_save(g, GS_ALLIANCE);
 	return 0;
 }
 
@@ -1812,8 +1859,8 @@ int mapif_parse_GuildAlliance(int fd,int guild_id1,int guild_id2,int account_id1
 	mapif_guild_alliance(guild_id1,guild_id2,account_id1,account_id2,flag,g[0]->name,g[1]->name);
 
 	// Mark the two guild to be saved
-	g[0]->save_flag |= GS_ALLIANCE;
-	g[1]->save_flag |= GS_ALLIANCE;
+	guild_queue_save(g[0], GS_ALLIANCE);
+	guild_queue_save(g[1], GS_ALLIANCE);
 	return 0;
 }
 
@@ -1828,7 +1875,7 @@ int mapif_parse_GuildNotice(int fd,int guild_id,const char *mes1,const char *mes
 
 	memcpy(g->mes1,mes1,MAX_GUILDMES1);
 	memcpy(g->mes2,mes2,MAX_GUILDMES2);
-	g->save_flag |= GS_MES;	//Change mes of guild
+	guild_queue_save(g, GS_MES);	//Change mes of guild
 	return mapif_guild_notice(g);
 }
 
@@ -1846,7 +1893,7 @@ int mapif_parse_GuildEmblem(int fd,int len,int guild_id,int dummy,const char *da
 	memcpy(g->emblem_data,data,len);
 	g->emblem_len=len;
 	g->emblem_id++;
-	g->save_flag |= GS_EMBLEM;	//Change guild
+	guild_queue_save(g, GS_EMBLEM);	//Change guild
 	return mapif_guild_emblem(g);
 }
 
@@ -1961,7 +2008,7 @@ int mapif_parse_GuildMasterChange(int fd, int guild_id, const char* name, int le
 		g->master[len] = '\0';
 
 	ShowInfo("int_guild: Guildmaster Changed to %s (Guild %d - %s)\n",g->master, guild_id, g->name);
-	g->save_flag |= (GS_BASIC|GS_MEMBER); //Save main data and member data.
+	guild_queue_save(g, GS_BASIC|GS_MEMBER); //Save main data and member data.
 	return mapif_guild_master_changed(g, g->member[0].account_id, g->member[0].char_id);
 }
 
@@ -16,6 +16,7 @@
 #define GS_MES 0x0200
 #define GS_MASK 0x03FF
 #define GS_BASIC_MASK (GS_BASIC | GS_EMBLEM | GS_CONNECT | GS_LEVEL | GS_MES)
+#define GS_QUEUED 0x4000 // waiting in the save queue
 #define GS_REMOVE 0x8000
 
 struct guild;
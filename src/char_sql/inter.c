@@ -23,6 +23,7 @@
 #include <stdio.h>
 #include <string.h>
 #include <stdlib.h>
+#include <zlib.h>
 
 #define WISDATA_TTL (60*1000)	// Wisf[^̐(60b)
 #define WISDELLIST_MAX 256			// Wisf[^폜Xg̗vf
@@ -36,11 +37,17 @@ char char_server_id[32] = "ragnarok";
 char char_server_pw[32] = "ragnarok";
 char char_server_db[32] = "ragnarok";
 char default_codepage[32] = ""; //Feature by irmin.
+bool blob_storage = false; // save registries and status changes as binary blobs
+
+#define SECTION_BLOB_VERSION 1
+#define SECTION_BLOB_HEADER 8 // <version>.W <count>.W <crc32>.L
+#define REG_BLOB_SIZE (MAX_REG_NUM*(1+32+2+256)) // <str len>.B <str>.?B <value len>.W <value>.?B
 
 #ifndef TXT_SQL_CONVERT
 
 static struct accreg *accreg_pt;
 unsigned int party_share_level = 10;
+int guild_save_count = 10; // guilds saved per second
 char main_chat_nick[16] = "Main";
 
 // recv. packet list
@@ -66,6 +73,115 @@ static DBMap* wis_db = NULL; // int wis_id -> struct WisData*
 static int wis_dellist[WISDELLIST_MAX], wis_delnum;
 
 #endif //TXT_SQL_CONVERT
+//--------------------------------------------------------
+// Section blobs
+
+static DBMap* accreg_badblob_db = NULL; // int id -> bitmask of the registry types whose blob failed to load
+
+/// Saves a section of an account or character as one versioned and checksummed blob.
+/// Saving an empty section removes the blob.
+int inter_blob_tosql(enum section_blob_type type, int id, const uint8* data, size_t len, int count)
+{
+	SqlStmt* stmt;
+	uint8* buf;
+	int result = 1;
+
+	if( count <= 0 )
+	{
+		if( SQL_ERROR == Sql_Query(sql_handle, "DELETE FROM `%s` WHERE `type`='%d' AND `id`='%d'", blob_db, type, id) )
+		{
+			Sql_ShowDebug(sql_handle);
+			return 0;
+		}
+		return 1;
+	}
+
+	buf = (uint8*)aMalloc(SECTION_BLOB_HEADER + len);
+	WBUFW(buf,0) = SECTION_BLOB_VERSION;
+	WBUFW(buf,2) = count;
+	WBUFL(buf,4) = (uint32)crc32(crc32(0L, Z_NULL, 0), data, (uInt)len);
+	memcpy(WBUFP(buf,SECTION_BLOB_HEADER), data, len);
+
+	stmt = SqlStmt_Malloc(sql_handle);
+	if( SQL_ERROR == SqlStmt_Prepare(stmt, "REPLACE INTO `%s` (`type`, `id`, `data`) VALUES ('%d','%d',?)", blob_db, type, id)
+	||  SQL_ERROR == SqlStmt_BindParam(stmt, 0, SQLDT_BLOB, buf, SECTION_BLOB_HEADER + len)
+	||  SQL_ERROR == SqlStmt_Execute(stmt) )
+	{
+		SqlStmt_ShowDebug(stmt);
+		result = 0;
+	}
+	SqlStmt_Free(stmt);
+	aFree(buf);
+	return result;
+}
+
+/// Loads the blob of a section into data (at most max bytes).
+/// Returns the number of entries, 0 if there is no blob or -1 if the blob is invalid.
+int inter_blob_fromsql(enum section_blob_type type, int id, uint8* data, size_t max, size_t* len)
+{
+	char* blob;
+	size_t bloblen;
+	int count;
+
+	if( SQL_ERROR == Sql_Query(sql_handle, "SELECT `data` FROM `%s` WHERE `type`='%d' AND `id`='%d'", blob_db, type, id) )
+	{
+		Sql_ShowDebug(sql_handle);
+		return -1;
+	}
+	if( SQL_SUCCESS != Sql_NextRow(sql_handle) )
+	{
+		Sql_FreeResult(sql_handle);
+		return 0;
+	}
+
+	Sql_GetData(sql_handle, 0, &blob, &bloblen);
+	if( bloblen < SECTION_BLOB_HEADER || RBUFW(blob,0) != SECTION_BLOB_VERSION || bloblen - SECTION_BLOB_HEADER > max
+	||  RBUFL(blob,4) != (uint32)crc32(crc32(0L, Z_NULL, 0), (uint8*)RBUFP(blob,SECTION_BLOB_HEADER), (uInt)(bloblen - SECTION_BLOB_HEADER)) )
+	{
+		ShowError("inter_blob_fromsql: Invalid blob for section %d of id %d (length %u), ignoring it.\n", type, id, (unsigned int)bloblen);
+		Sql_FreeResult(sql_handle);
+		return -1;
+	}
+
+	count = RBUFW(blob,2);
+	*len = bloblen - SECTION_BLOB_HEADER;
+	memcpy(data, RBUFP(blob,SECTION_BLOB_HEADER), *len);
+	Sql_FreeResult(sql_handle);
+	return count;
+}
+
+/// Saves a registry as a section blob.
+static int inter_accreg_toblob(int id, struct accreg* reg, int type)
+{
+	static uint8 buf[REG_BLOB_SIZE];
+	struct global_reg* r;
+	size_t len = 0, slen, vlen;
+	int i, count = 0;
+
+	if( accreg_badblob_db && ((intptr_t)idb_get(accreg_badblob_db, id))&(1<<type) )
+	{// the registry that was sent out is incomplete, keep the blob for inspection
+		ShowError("inter_accreg_toblob: Not saving registry type %d of id %d over a blob that failed to load.\n", type, id);
+		return 0;
+	}
+
+	for( i = 0; i < reg->reg_num; ++i )
+	{
+		r = &reg->reg[i];
+		if( r->str[0] == '\0' || r->value[0] == '\0' )
+			continue;
+		slen = strnlen(r->str, sizeof(r->str));
+		vlen = strnlen(r->value, sizeof(r->value));
+		WBUFB(buf,len) = (uint8)slen;
+		memcpy(WBUFP(buf,len+1), r->str, slen);
+		len += 1 + slen;
+		WBUFW(buf,len) = (uint16)vlen;
+		memcpy(WBUFP(buf,len+2), r->value, vlen);
+		len += 2 + vlen;
+		++count;
+	}
+	return inter_blob_tosql((enum section_blob_type)type, id, buf, len, count);
+}
+
 //--------------------------------------------------------
 // Save registry to sql
 int inter_accreg_tosql(int account_id, int char_id, struct accreg* reg, int type)
@@ -79,6 +195,9 @@ int inter_accreg_tosql(int account_id, int char_id, struct accreg* reg, int type
 	reg->account_id = account_id;
 	reg->char_id = char_id;
 
+	if( blob_storage && (type == 2 || type == 3) )
+		return inter_accreg_toblob(type == 3 ? char_id : account_id, reg, type);
+
 	//`global_reg_value` (`type`, `account_id`, `char_id`, `str`, `value`)
 	switch( type )
 	{
@@ -125,6 +244,43 @@ int inter_accreg_tosql(int account_id, int char_id, struct accreg* reg, int type
 }
 #ifndef TXT_SQL_CONVERT
 
+/// Loads a registry from its section blob.
+/// Returns 0 if there is no blob or it couldn't be loaded.
+static int inter_accreg_fromblob(int id, struct accreg* reg, int type)
+{
+	static uint8 buf[REG_BLOB_SIZE];
+	struct global_reg* r;
+	size_t len, pos = 0, slen, vlen;
+	int i, count;
+
+	count = inter_blob_fromsql((enum section_blob_type)type, id, buf, sizeof(buf), &len);
+	if( count == 0 )
+		return 0;
+	if( count < 0 )
+	{// saving would overwrite the blob with whatever is loaded instead of it
+		ShowError("inter_accreg_fromblob: Failed to load registry type %d of id %d, it won't be saved until the blob is fixed.\n", type, id);
+		idb_put(accreg_badblob_db, id, (void*)(((intptr_t)idb_get(accreg_badblob_db, id))|(1<<type)));
+		return 0;
+	}
+
+	for( i = 0; i < count && i < MAX_REG_NUM && pos < len; ++i )
+	{
+		r = &reg->reg[i];
+		slen = RBUFB(buf,pos);
+		if( pos + 1 + slen + 2 > len )
+			break;
+		memcpy(r->str, RBUFP(buf,pos+1), min(slen, sizeof(r->str)-1));
+		pos += 1 + slen;
+		vlen = RBUFW(buf,pos);
+		if( pos + 2 + vlen > len )
+			break;
+		memcpy(r->value, RBUFP(buf,pos+2), min(vlen, sizeof(r->value)-1));
+		pos += 2 + vlen;
+	}
+	reg->reg_num = i;
+	return 1;
+}
+
 // Load account_reg from sql (type=2)
 int inter_accreg_fromsql(int account_id,int char_id, struct accreg *reg, int type)
 {
@@ -140,6 +296,9 @@ int inter_accreg_fromsql(int account_id,int char_id, struct accreg *reg, int typ
 	reg->account_id = account_id;
 	reg->char_id = char_id;
 
+	if( blob_storage && (type == 2 || type == 3) && inter_accreg_fromblob(type == 3 ? char_id : account_id, reg, type) )
+		return 1;
+
 	//`global_reg_value` (`type`, `account_id`, `char_id`, `str`, `value`)
 	switch( type )
 	{
@@ -170,9 +329,56 @@ int inter_accreg_fromsql(int account_id,int char_id, struct accreg *reg, int typ
 	}
 	reg->reg_num = i;
 	Sql_FreeResult(sql_handle);
+
+	if( blob_storage && reg->reg_num > 0 && inter_accreg_toblob(type == 3 ? char_id : account_id, reg, type) )
+	{// rows saved before blob storage was enabled, move them into the blob
+		if( SQL_ERROR == Sql_Query(sql_handle, "DELETE FROM `%s` WHERE `type`='%d' AND `%s`='%d'", reg_db, type, type == 3 ? "char_id" : "account_id", type == 3 ? char_id : account_id) )
+			Sql_ShowDebug(sql_handle);
+	}
 	return 1;
 }
 
+/// Moves all registry rows into section blobs.
+/// Status change rows are moved by char_scdata_migrate.
+void inter_accreg_migrate(void)
+{
+	struct reg_owner { int type, id; }* list = NULL;
+	char* data;
+	int i, count = 0, max = 0;
+
+	if( !blob_storage )
+	{
+		ShowError("inter_accreg_migrate: 'blob_storage' is disabled.\n");
+		return;
+	}
+
+	if( SQL_ERROR == Sql_Query(sql_handle, "SELECT DISTINCT `type`, IF(`type`=3,`char_id`,`account_id`) FROM `%s` WHERE `type`=2 OR `type`=3", reg_db) )
+	{
+		Sql_ShowDebug(sql_handle);
+		return;
+	}
+	while( SQL_SUCCESS == Sql_NextRow(sql_handle) )
+	{
+		if( count == max )
+		{
+			max += 256;
+			RECREATE(list, struct reg_owner, max);
+		}
+		Sql_GetData(sql_handle, 0, &data, NULL); list[count].type = atoi(data);
+		Sql_GetData(sql_handle, 1, &data, NULL); list[count].id = atoi(data);
+		++count;
+	}
+	Sql_FreeResult(sql_handle);
+
+	// loading a registry moves its rows into a blob
+	for( i = 0; i < count; ++i )
+		inter_accreg_fromsql(list[i].type == 2 ? list[i].id : 0, list[i].type == 3 ? list[i].id : 0, accreg_pt, list[i].type);
+
+	if( list )
+		aFree(list);
+	ShowStatus("Moved the registries of %d accounts and characters into blobs.\n", count);
+}
+
 // Initialize
 int inter_accreg_sql_init(void)
 {
@@ -234,9 +440,13 @@ static int inter_config_read(const char* cfgName)
 			party_share_level = atoi(w2);
 		else if(!strcmpi(w1,"log_inter"))
 			log_inter = atoi(w2);
+		else if(!strcmpi(w1,"guild_save_count"))
+			guild_save_count = max(atoi(w2), 1);
 		else if(!strcmpi(w1,"main_chat_nick"))
 			safestrncpy(main_chat_nick, w2, sizeof(main_chat_nick));
 #endif //TXT_SQL_CONVERT
+		else if(!strcmpi(w1,"blob_storage"))
+			blob_storage = config_switch(w2);
 		else if(!strcmpi(w1,"import"))
 			inter_config_read(w2);
 	}
@@ -296,6 +506,7 @@ int inter_init_sql(const char *file)
 
 #ifndef TXT_SQL_CONVERT
 	wis_db = idb_alloc(DB_OPT_RELEASE_DATA);
+	accreg_badblob_db = idb_alloc(DB_OPT_BASE);
 	inter_guild_sql_init();
 	inter_storage_sql_init();
 	inter_party_sql_init();
@@ -315,6 +526,7 @@ int inter_init_sql(const char *file)
 void inter_final(void)
 {
 	wis_db->destroy(wis_db, NULL);
+	accreg_badblob_db->destroy(accreg_badblob_db, NULL);
 
 	inter_guild_sql_final();
 	inter_storage_sql_final();
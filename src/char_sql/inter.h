@@ -19,12 +19,26 @@ int inter_log(char *fmt,...);
 #define inter_cfgName "conf/inter_athena.conf"
 
 extern unsigned int party_share_level;
+extern int guild_save_count;
 
 extern Sql* sql_handle;
 extern Sql* lsql_handle;
 
 extern char main_chat_nick[16];
+extern bool blob_storage;
+
+/// Sections stored as blobs, the values of the registries match their types.
+enum section_blob_type
+{
+	SECTION_BLOB_ACCREG = 2, // account registry (id = account_id)
+	SECTION_BLOB_CHARREG = 3, // character registry (id = char_id)
+	SECTION_BLOB_SCDATA = 4 // status changes (id = char_id)
+};
+
+int inter_blob_tosql(enum section_blob_type type, int id, const uint8* data, size_t len, int count);
+int inter_blob_fromsql(enum section_blob_type type, int id, uint8* data, size_t max, size_t* len);
 
 int inter_accreg_tosql(int account_id, int char_id, struct accreg *reg, int type);
+void inter_accreg_migrate(void);
 
 #endif /* _INTER_SQL_H_ */
@@ -32,13 +32,16 @@
  *                                                                           *
  *  HISTORY:                                                                 *
  *    0.1 - Initial version                                                  *
+ *    0.2 - Instances are tagged with the name of the owner subsystem and    *
+ *          keep track of their own usage and high-water mark.               *
  *                                                                           *
- * @version 0.1 - Initial version                                            *
+ * @version 0.2 - Tagged instances                                           *
  * @author Flavio @ Amazon Project                                           *
  * @encoding US-ASCII                                                        *
  * @see common#ers.h                                                         *
 \*****************************************************************************/
 #include <stdlib.h>
+#include <string.h>
 
 #include "../common/cbasetypes.h"
 #include "../common/malloc.h" // CREATE, RECREATE, aMalloc, aFree
@@ -52,13 +55,14 @@
  *  ERS_ROOT_SIZE     - Maximum number of root entry managers.               *
  *  ERLinkedList      - Structure of a linked list of reusable entries.      *
  *  ERS_impl          - Class of an entry manager.                           *
+ *  ERS_instance      - Class of a tagged instance of an entry manager.      *
  *  ers_root          - Array of root entry managers.                        *
  *  ers_num           - Number of root entry managers in the array.          *
 \*****************************************************************************/
 
 /**
  * Number of entries in each block.
- * @see #ers_obj_alloc_entry(ERS eri)
+ * @see #ers_root_alloc_entry(ERS_impl obj)
  */
 #define ERS_BLOCK_ENTRIES 4096
 
@@ -82,7 +86,6 @@ typedef struct ers_ll {
 
 /**
  * Class of the object that manages entries of a certain size.
- * @param eri Public interface of the object
  * @param reuse Linked list of reusable data entries
  * @param blocks Array with blocks of entries
  * @param free Number of unused entries in the last block
@@ -90,20 +93,11 @@ typedef struct ers_ll {
  * @param max Current maximum capacity of the array
  * @param destroy Destroy lock
  * @param size Size of the entries of the manager
+ * @param instances Linked list of the instances of the manager
  * @private
  */
 typedef struct ers_impl {
 
-	/**
-	 * Public interface of the entry manager.
-	 * @param alloc Allocate an entry from this manager
-	 * @param free Free an entry allocated from this manager
-	 * @param entry_size Return the size of the entries of this manager
-	 * @param destroy Destroy this instance of the manager
-	 * @public
-	 */
-	struct eri vtable;
-
 	/**
 	 * Linked list of reusable entries.
 	 */
@@ -139,8 +133,65 @@ typedef struct ers_impl {
 	 */
 	size_t size;
 
+	/**
+	 * Linked list of the instances of the manager.
+	 */
+	struct ers_instance *instances;
+
 } *ERS_impl;
 
+/**
+ * Class of an instance of an entry manager.
+ * Every call to ers_new gets its own instance, tagged with the name of the 
+ * subsystem that owns the entries, while the entries themselves are shared 
+ * with all the instances of the same size through the root manager.
+ * @param eri Public interface of the object
+ * @param root Root manager that holds the entries
+ * @param name Name of the subsystem that owns the entries
+ * @param used Number of entries in use by this instance
+ * @param peak Highest number of entries in use by this instance
+ * @param next Next instance of the same root manager
+ * @private
+ */
+typedef struct ers_instance {
+
+	/**
+	 * Public interface of the entry manager.
+	 * @param alloc Allocate an entry from this manager
+	 * @param free Free an entry allocated from this manager
+	 * @param entry_size Return the size of the entries of this manager
+	 * @param destroy Destroy this instance of the manager
+	 * @public
+	 */
+	struct eri vtable;
+
+	/**
+	 * Root manager that holds the entries.
+	 */
+	ERS_impl root;
+
+	/**
+	 * Name of the subsystem that owns the entries.
+	 */
+	const char *name;
+
+	/**
+	 * Number of entries in use by this instance.
+	 */
+	uint32 used;
+
+	/**
+	 * Highest number of entries in use by this instance.
+	 */
+	uint32 peak;
+
+	/**
+	 * Next instance of the same root manager.
+	 */
+	struct ers_instance *next;
+
+} *ERS_instance;
+
 /**
  * Root array with entry managers.
  * @private
@@ -161,31 +212,25 @@ static uint32 ers_num = 0;
 
 /*****************************************************************************\
  *  (2) Object functions.                                                 *
- *  ers_obj_alloc_entry - Allocate an entry from the manager.                *
- *  ers_obj_free_entry  - Free an entry allocated from the manager.          *
- *  ers_obj_entry_size  - Return the size of the entries of the manager.     *
- *  ers_obj_destroy     - Destroy the instance of the manager.               *
+ *  ers_root_alloc_entry - Allocate an entry from the root manager.          *
+ *  ers_obj_alloc_entry  - Allocate an entry from the manager.               *
+ *  ers_obj_free_entry   - Free an entry allocated from the manager.         *
+ *  ers_obj_entry_size   - Return the size of the entries of the manager.    *
+ *  ers_obj_destroy      - Destroy the instance of the manager.              *
 \*****************************************************************************/
 
 /**
- * Allocate an entry from this entry manager.
+ * Allocate an entry from the root entry manager.
  * If there are reusable entries available, it reuses one instead.
- * @param self Interface of the entry manager
+ * @param obj Root entry manager
  * @return An entry
  * @see #ERS_BLOCK_ENTRIES
  * @see #ERLinkedList
- * @see ERS_impl::vtable#alloc
  */
-static void *ers_obj_alloc_entry(ERS self)
+static void *ers_root_alloc_entry(ERS_impl obj)
 {
-	ERS_impl obj = (ERS_impl)self;
 	void *ret;
 
-	if (obj == NULL) {
-		ShowError("ers::alloc : NULL object, aborting entry allocation.\n");
-		return NULL;
-	}
-
 	if (obj->reuse) { // Reusable entry
 		ret = obj->reuse;
 		obj->reuse = obj->reuse->next;
@@ -210,6 +255,29 @@ static void *ers_obj_alloc_entry(ERS self)
 	return ret;
 }
 
+/**
+ * Allocate an entry from this entry manager.
+ * If there are reusable entries available, it reuses one instead.
+ * The entry is accounted to the instance.
+ * @param self Interface of the entry manager
+ * @return An entry
+ * @see #ers_root_alloc_entry(ERS_impl obj)
+ * @see ERS_instance::vtable#alloc
+ */
+static void *ers_obj_alloc_entry(ERS self)
+{
+	ERS_instance inst = (ERS_instance)self;
+
+	if (inst == NULL) {
+		ShowError("ers::alloc : NULL object, aborting entry allocation.\n");
+		return NULL;
+	}
+
+	if (++inst->used > inst->peak)
+		inst->peak = inst->used;
+	return ers_root_alloc_entry(inst->root);
+}
+
 /**
  * Free an entry allocated from this manager.
  * WARNING: Does not check if the entry was allocated by this manager.
@@ -218,14 +286,15 @@ static void *ers_obj_alloc_entry(ERS self)
  * @param entry Entry to be freed
  * @see #ERLinkedList
  * @see ERS_impl#reuse
- * @see ERS_impl::vtable#free
+ * @see ERS_instance::vtable#free
  */
 static void ers_obj_free_entry(ERS self, void *entry)
 {
-	ERS_impl obj = (ERS_impl)self;
+	ERS_instance inst = (ERS_instance)self;
+	ERS_impl obj;
 	ERLinkedList reuse;
 
-	if (obj == NULL) {
+	if (inst == NULL) {
 		ShowError("ers::free : NULL object, aborting entry freeing.\n");
 		return;
 	} else if (entry == NULL) {
@@ -233,6 +302,13 @@ static void ers_obj_free_entry(ERS self, void *entry)
 		return;
 	}
 
+	if (inst->used)
+		inst->used--;
+	else
+		ShowWarning("ers::free : '%s' is freeing more entries than it allocated (entry size=%u).\n",
+				inst->name, inst->root->size);
+
+	obj = inst->root;
 	reuse = (ERLinkedList)entry;
 	reuse->next = obj->reuse;
 	obj->reuse = reuse;
@@ -243,41 +319,57 @@ static void ers_obj_free_entry(ERS self, void *entry)
  * @param self Interface of the entry manager
  * @return Size of the entries of this manager in bytes
  * @see ERS_impl#size
- * @see ERS_impl::vtable#entry_size
+ * @see ERS_instance::vtable#entry_size
  */
 static size_t ers_obj_entry_size(ERS self)
 {
-	ERS_impl obj = (ERS_impl)self;
+	ERS_instance inst = (ERS_instance)self;
 
-	if (obj == NULL) {
+	if (inst == NULL) {
 		ShowError("ers::entry_size : NULL object, returning 0.\n");
 		return 0;
 	}
 
-	return obj->size;
+	return inst->root->size;
 }
 
 /**
  * Destroy this instance of the manager.
  * The manager is actually only destroyed when all the instances are destroyed.
+ * A warning is shown if the instance still has entries in use.
  * When destroying the manager a warning is shown if the manager has 
  * missing/extra entries.
  * @param self Interface of the entry manager
  * @see #ERLinkedList
- * @see ERS_impl::vtable#destroy
+ * @see ERS_instance::vtable#destroy
  */
 static void ers_obj_destroy(ERS self)
 {
-	ERS_impl obj = (ERS_impl)self;
+	ERS_instance inst = (ERS_instance)self;
+	ERS_instance *link;
+	ERS_impl obj;
 	ERLinkedList reuse,old;
 	uint32 i;
 	uint32 count;
 
-	if (obj == NULL) {
+	if (inst == NULL) {
 		ShowError("ers::destroy: NULL object, aborting instance destruction.\n");
 		return;
 	}
 
+	// Remove instance from the manager
+	obj = inst->root;
+	for (link = &obj->instances; *link; link = &(*link)->next) {
+		if (*link == inst) {
+			*link = inst->next;
+			break;
+		}
+	}
+	if (inst->used)
+		ShowWarning("ers::destroy : '%s' still has %u entries in use (entry size=%u).\n",
+				inst->name, inst->used, obj->size);
+	aFree(inst); // release instance
+
 	obj->destroy--;
 	if (obj->destroy)
 		return; // Not last instance
@@ -333,6 +425,8 @@ static void ers_obj_destroy(ERS self)
 /*****************************************************************************\
  *  (3) Public functions.                                                    *
  *  ers_new               - Get a new instance of an entry manager.          *
+ *  ers_instance_used     - Number of entries in use by an instance.         *
+ *  ers_instance_peak     - Highest number of entries used by an instance.   *
  *  ers_report            - Print a report about the current state.          *
  *  ers_force_destroy_all - Force the destruction of all the managers.       *
 \*****************************************************************************/
@@ -344,15 +438,18 @@ static void ers_obj_destroy(ERS self)
  * used instead.
  * It's also aligned to ERS_ALIGNED bytes, so the smallest multiple of 
  * ERS_ALIGNED that is greater or equal to size is what's actually used.
- * @param The requested size of the entry in bytes
+ * @param size The requested size of the entry in bytes
+ * @param name Name of the subsystem that owns the entries
  * @return Interface of the object
  * @see #ERS_impl
+ * @see #ERS_instance
  * @see #ers_root
  * @see #ers_num
  */
-ERS ers_new(uint32 size)
+ERS ers_new(uint32 size, const char* name)
 {
-	ERS_impl obj;
+	ERS_impl obj = NULL;
+	ERS_instance inst;
 	uint32 i;
 
 	if (size == 0) {
@@ -367,36 +464,71 @@ ERS ers_new(uint32 size)
 		size += ERS_ALIGNED -size%ERS_ALIGNED;
 
 	for (i = 0; i < ers_num; i++) {
-		obj = ers_root[i];
-		if (obj->size == size) {
+		if (ers_root[i]->size == size) {
 			// found a manager that handles the entry size
+			obj = ers_root[i];
 			obj->destroy++;
-			return &obj->vtable;
+			break;
 		}
 	}
-	// create a new manager to handle the entry size
-	if (ers_num == ERS_ROOT_SIZE) {
-		ShowFatalError("ers_alloc: too many root objects, increase ERS_ROOT_SIZE.\n"
-				"exiting the program...\n");
-		exit(EXIT_FAILURE);
+	if (obj == NULL) {
+		// create a new manager to handle the entry size
+		if (ers_num == ERS_ROOT_SIZE) {
+			ShowFatalError("ers_alloc: too many root objects, increase ERS_ROOT_SIZE.\n"
+					"exiting the program...\n");
+			exit(EXIT_FAILURE);
+		}
+		obj = (ERS_impl)aMalloc(sizeof(struct ers_impl));
+		// Block reusage system
+		obj->reuse   = NULL;
+		obj->blocks  = NULL;
+		obj->free    = 0;
+		obj->num     = 0;
+		obj->max     = 0;
+		obj->destroy = 1;
+		// Properties
+		obj->size = size;
+		obj->instances = NULL;
+		ers_root[ers_num++] = obj;
 	}
-	obj = (ERS_impl)aMalloc(sizeof(struct ers_impl));
+
+	inst = (ERS_instance)aMalloc(sizeof(struct ers_instance));
 	// Public interface
-	obj->vtable.alloc      = ers_obj_alloc_entry;
-	obj->vtable.free       = ers_obj_free_entry;
-	obj->vtable.entry_size = ers_obj_entry_size;
-	obj->vtable.destroy    = ers_obj_destroy;
-	// Block reusage system
-	obj->reuse   = NULL;
-	obj->blocks  = NULL;
-	obj->free    = 0;
-	obj->num     = 0;
-	obj->max     = 0;
-	obj->destroy = 1;
-	// Properties
-	obj->size = size;
-	ers_root[ers_num++] = obj;
-	return &obj->vtable;
+	inst->vtable.alloc      = ers_obj_alloc_entry;
+	inst->vtable.free       = ers_obj_free_entry;
+	inst->vtable.entry_size = ers_obj_entry_size;
+	inst->vtable.destroy    = ers_obj_destroy;
+	// Accounting
+	inst->root = obj;
+	inst->name = ( name ? name : "unknown" );
+	inst->used = 0;
+	inst->peak = 0;
+	inst->next = obj->instances;
+	obj->instances = inst;
+	return &inst->vtable;
+}
+
+/**
+ * Return the number of entries currently allocated through this instance.
+ * @param self Interface of the entry manager
+ * @return Number of entries in use
+ * @see ERS_instance#used
+ */
+uint32 ers_instance_used(ERS self)
+{
+	return ( self ? ((ERS_instance)self)->used : 0 );
+}
+
+/**
+ * Return the highest number of entries that were allocated at the same time 
+ * through this instance.
+ * @param self Interface of the entry manager
+ * @return Peak number of entries in use
+ * @see ERS_instance#peak
+ */
+uint32 ers_instance_peak(ERS self)
+{
+	return ( self ? ((ERS_instance)self)->peak : 0 );
 }
 
 /**
@@ -405,8 +537,13 @@ ERS ers_new(uint32 size)
  * The number of entries are checked and a warning is shown if extra reusable 
  * entries are found.
  * The extra entries are included in the count of reusable entries.
+ * The usage of the instances is summed by name, so every subsystem shows up 
+ * once per entry manager with its entries in use and high-water mark.
+ * For names with several instances the high-water mark is the sum of the 
+ * instance peaks, the real peak of the entry manager is reported separately.
  * @see #ERLinkedList
  * @see #ERS_impl
+ * @see #ERS_instance
  * @see #ers_root
  * @see #ers_num
  */
@@ -419,6 +556,8 @@ void ers_report(void)
 	uint32 extra;
 	ERLinkedList reuse;
 	ERS_impl obj;
+	ERS_instance inst;
+	ERS_instance other;
 
 	// Root system report
 	ShowMessage(CL_BOLD"Entry Reusage System report:\n"CL_NORMAL);
@@ -466,10 +605,36 @@ void ers_report(void)
 		ShowMessage("\tblock array size   : %u\n", obj->max);
 		ShowMessage("\tallocated blocks   : %u\n", obj->num);
 		ShowMessage("\tentries being used : %u\n", used);
+		// entries are never given back to the blocks, so the carved ones are the high-water mark
+		ShowMessage("\tpeak entries used  : %u\n", (obj->num ? obj->num*ERS_BLOCK_ENTRIES -obj->free : 0));
 		ShowMessage("\tunused entries     : %u\n", obj->free);
 		ShowMessage("\treusable entries   : %u\n", reusable);
 		if (extra)
 			ShowMessage("\tWARNING - %u extra reusable entries were found.\n", extra);
+		// Subsystem report (instances with the same name are summed)
+		for (inst = obj->instances; inst; inst = inst->next) {
+			uint32 count = 0;
+			uint32 inuse = 0;
+			uint32 peak = 0;
+			for (other = obj->instances; other != inst; other = other->next)
+				if (strcmp(other->name, inst->name) == 0)
+					break;
+			if (other != inst)
+				continue; // already reported
+			for (other = inst; other; other = other->next) {
+				if (strcmp(other->name, inst->name) != 0)
+					continue;
+				count++;
+				inuse += other->used;
+				peak += other->peak;
+			}
+			if (count == 1)
+				ShowMessage("\t  %-32s: %u in use, %u peak (%u KB)\n",
+						inst->name, inuse, peak, (uint32)(inuse*obj->size/1024));
+			else // the instances peaked at different times, so this overstates the real peak
+				ShowMessage("\t  %-32s: %u in use, %u sum of instance peaks (%u instances, %u KB)\n",
+						inst->name, inuse, peak, count, (uint32)(inuse*obj->size/1024));
+		}
 	}
 	ShowMessage("End of report\n");
 }
@@ -482,6 +647,7 @@ void ers_report(void)
  * It should only be used in extreme situations to make shure all the memory 
  * allocated by this system is released.
  * @see #ERS_impl
+ * @see #ERS_instance
  * @see #ers_root
  * @see #ers_num
  */
@@ -490,6 +656,7 @@ void ers_force_destroy_all(void)
 	uint32 i;
 	uint32 j;
 	ERS_impl obj;
+	ERS_instance inst;
 
 	for (i = 0; i < ers_num; i++) {
 		obj = ers_root[i];
@@ -498,6 +665,10 @@ void ers_force_destroy_all(void)
 				aFree(obj->blocks[j]); // block of entries
 			aFree(obj->blocks); // array of blocks
 		}
+		while ((inst = obj->instances) != NULL) {
+			obj->instances = inst->next;
+			aFree(inst); // instance of the entry manager
+		}
 		aFree(obj); // entry manager object
 	}
 	ers_num = 0;
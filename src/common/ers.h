@@ -32,8 +32,10 @@
  *                                                                           *
  *  HISTORY:                                                                 *
  *    0.1 - Initial version                                                  *
+ *    0.2 - Instances are tagged with the name of the owner subsystem and    *
+ *          keep track of their own usage and high-water mark.               *
  *                                                                           *
- * @version 0.1 - Initial version                                            *
+ * @version 0.2 - Tagged instances                                           *
  * @author Flavio @ Amazon Project                                           *
  * @encoding US-ASCII                                                        *
 \*****************************************************************************/
@@ -48,6 +50,8 @@
  *  ERS_ALIGNED           - Alignment of the entries in the blocks.          *
  *  ERS                   - Entry manager.                                   *
  *  ers_new               - Allocate an instance of an entry manager.        *
+ *  ers_instance_used     - Number of entries in use by an instance.         *
+ *  ers_instance_peak     - Highest number of entries ever used by an inst.  *
  *  ers_report            - Print a report about the current state.          *
  *  ers_force_destroy_all - Force the destruction of all the managers.       *
 \*****************************************************************************/
@@ -121,7 +125,9 @@ typedef struct eri {
 #	define ers_entry_size(obj) (size_t)0
 #	define ers_destroy(obj)
 // Disable the public functions
-#	define ers_new(size) NULL
+#	define ers_new(size,name) NULL
+#	define ers_instance_used(obj) (uint32)0
+#	define ers_instance_peak(obj) (uint32)0
 #	define ers_report()
 #	define ers_force_destroy_all()
 #else /* not DISABLE_ERS */
@@ -139,14 +145,34 @@ typedef struct eri {
  * used instead.
  * It's also aligned to ERS_ALIGNED bytes, so the smallest multiple of 
  * ERS_ALIGNED that is greater or equal to size is what's actually used.
- * @param The requested size of the entry in bytes
+ * The name tags the instance with the subsystem that owns the entries, it 
+ * is used to account the entries in ers_report and must remain valid until 
+ * the instance is destroyed (use a string literal).
+ * @param size The requested size of the entry in bytes
+ * @param name Name of the subsystem that owns the entries
  * @return Interface of the object
  */
-ERS ers_new(uint32 size);
+ERS ers_new(uint32 size, const char* name);
+
+/**
+ * Return the number of entries currently allocated through this instance.
+ * @param self Interface of the entry manager
+ * @return Number of entries in use
+ */
+uint32 ers_instance_used(ERS self);
+
+/**
+ * Return the highest number of entries that were allocated at the same time 
+ * through this instance (high-water mark).
+ * @param self Interface of the entry manager
+ * @return Peak number of entries in use
+ */
+uint32 ers_instance_peak(ERS self);
 
 /**
  * Print a report about the current state of the Entry Reusage System.
- * Shows information about the global system and each entry manager.
+ * Shows information about the global system and each entry manager, 
+ * including the entries in use and the high-water mark of each subsystem.
  * The number of entries are checked and a warning is shown if extra reusable 
  * entries are found.
  * The extra entries are included in the count of reusable entries.
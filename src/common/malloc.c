@@ -845,6 +845,243 @@ static void memmgr_init(void)
 #endif /* USE_MEMMGR */
 
 
+/*======================================
+ * Arenas
+ *--------------------------------------
+ */
+
+/// Alignment of the memory returned by the arenas.
+#define ARENA_ALIGNMENT 16
+
+/// Default size of the chunks of an arena.
+#define ARENA_CHUNK_SIZE 65536
+
+#define ARENA_ALIGN(n) ( ((n) + ARENA_ALIGNMENT - 1) & ~(size_t)(ARENA_ALIGNMENT - 1) )
+
+/// Chunk of memory of an arena.
+/// The data follows the (aligned) header.
+struct arena_chunk
+{
+	struct arena_chunk* next;
+	size_t size; // size of the data
+	size_t used; // bytes handed out from the data
+};
+
+#define ARENA_CHUNK_HEADER ARENA_ALIGN(sizeof(struct arena_chunk))
+#ifdef USE_MEMMGR
+#define arena_chunk_malloc(n,file,line,func) _mmalloc((n),(file),(line),(func))
+#else
+#define arena_chunk_malloc(n,file,line,func) aMalloc_((n),(file),(line),(func))
+#endif
+#define arena_chunk_data(chunk) ( (char*)(chunk) + ARENA_CHUNK_HEADER )
+
+struct arena
+{
+	const char* name;
+	size_t chunk_size;
+	struct arena_chunk* chunk; // chunks in use, newest first
+	struct arena_chunk* spare; // released chunks, kept for reuse
+	size_t used;     // bytes handed out
+	size_t peak;     // highest value of used
+	size_t reserved; // bytes held in chunks (in use and spare)
+	unsigned int nchunks;
+	unsigned int allocs; // number of allocations
+	unsigned int rewinds; // number of bulk releases
+	struct arena* next;
+};
+
+/// All the arenas, for the report
+static struct arena* arena_first = NULL;
+
+/// Creates an arena.
+/// The name must remain valid until the arena is destroyed (use a string literal).
+///
+/// @param name Name of the subsystem that owns the arena
+/// @param chunk_size Size of the chunks or 0 for the default
+/// @return The arena
+ARENA arena_create(const char* name, size_t chunk_size)
+{
+	struct arena* self;
+
+	CREATE(self, struct arena, 1);
+	self->name = ( name ? name : "unknown" );
+	self->chunk_size = ARENA_ALIGN( chunk_size ? chunk_size : ARENA_CHUNK_SIZE );
+	self->next = arena_first;
+	arena_first = self;
+	return self;
+}
+
+/// Releases an arena and all the memory allocated from it.
+void arena_destroy(ARENA self)
+{
+	struct arena** link;
+	struct arena_chunk* chunk;
+
+	if( self == NULL )
+		return;
+
+	for( link = &arena_first; *link; link = &(*link)->next )
+	{
+		if( *link == self )
+		{
+			*link = self->next;
+			break;
+		}
+	}
+
+	while( (chunk = self->chunk) != NULL )
+	{
+		self->chunk = chunk->next;
+		aFree(chunk);
+	}
+	while( (chunk = self->spare) != NULL )
+	{
+		self->spare = chunk->next;
+		aFree(chunk);
+	}
+	aFree(self);
+}
+
+/// Allocates memory from the arena.
+/// The memory is aligned to ARENA_ALIGNMENT and is released by arena_rewind/arena_clear.
+void* arena_alloc_(ARENA self, size_t size, const char *file, int line, const char *func)
+{
+	struct arena_chunk* chunk = self->chunk;
+	void* ret;
+
+	size = ARENA_ALIGN( size ? size : 1 );
+
+	if( chunk == NULL || chunk->size - chunk->used < size )
+	{// get another chunk
+		struct arena_chunk** link = &self->spare;
+
+		if( size <= self->chunk_size )
+		{// reuse a spare chunk
+			while( *link && (*link)->size < size )
+				link = &(*link)->next;
+		}
+		else
+			link = NULL;
+
+		if( link && *link )
+		{
+			chunk = *link;
+			*link = chunk->next;
+		}
+		else
+		{// oversized requests get a chunk of their own
+			size_t chunk_size = max(size, self->chunk_size);
+			chunk = (struct arena_chunk*)arena_chunk_malloc(ARENA_CHUNK_HEADER + chunk_size, file, line, func);
+			chunk->size = chunk_size;
+			self->reserved += chunk_size;
+			self->nchunks++;
+		}
+		chunk->used = 0;
+		chunk->next = self->chunk;
+		self->chunk = chunk;
+	}
+
+	ret = arena_chunk_data(chunk) + chunk->used;
+	chunk->used += size;
+	self->used += size;
+	if( self->used > self->peak )
+		self->peak = self->used;
+	self->allocs++;
+	return ret;
+}
+
+/// Allocates zero-initialized memory from the arena.
+void* arena_calloc_(ARENA self, size_t num, size_t size, const char *file, int line, const char *func)
+{
+	void* ret;
+
+	if( num && SIZE_MAX/num < size )
+	{
+		ShowFatalError("%s:%d: in func %s: arena_calloc error size overflow!\n", file, line, func);
+		exit(EXIT_FAILURE);
+	}
+
+	ret = arena_alloc_(self, num * size, file, line, func);
+	memset(ret, 0, num * size);
+	return ret;
+}
+
+/// Returns a mark of the current position of the arena.
+/// Everything allocated after it is released by arena_rewind(self, mark).
+size_t arena_mark(ARENA self)
+{
+	return self->used;
+}
+
+/// Releases everything that was allocated after the mark.
+void arena_rewind(ARENA self, size_t mark)
+{
+	if( mark >= self->used )
+		return;
+
+	while( self->used > mark )
+	{
+		struct arena_chunk* chunk = self->chunk;
+		size_t n = min(chunk->used, self->used - mark);
+
+		chunk->used -= n;
+		self->used -= n;
+		if( chunk->used == 0 )
+		{// chunk is empty
+			self->chunk = chunk->next;
+			if( chunk->size > self->chunk_size )
+			{// oversized chunks are not kept
+				self->reserved -= chunk->size;
+				self->nchunks--;
+				aFree(chunk);
+			}
+			else
+			{
+				chunk->next = self->spare;
+				self->spare = chunk;
+			}
+		}
+	}
+	self->rewinds++;
+}
+
+/// Releases everything that was allocated from the arena.
+void arena_clear(ARENA self)
+{
+	arena_rewind(self, 0);
+}
+
+/// Returns the number of bytes in use in the arena.
+size_t arena_usage(ARENA self)
+{
+	return self->used;
+}
+
+/// Returns the highest number of bytes that were in use in the arena.
+size_t arena_peak(ARENA self)
+{
+	return self->peak;
+}
+
+/// Prints the usage of all the arenas.
+void arena_report(void)
+{
+	struct arena* self;
+
+	ShowMessage(CL_BOLD"Arena report:\n"CL_NORMAL);
+	for( self = arena_first; self; self = self->next )
+	{
+		ShowMessage(CL_BOLD"[%s]\n"CL_NORMAL, self->name);
+		ShowMessage("\tin use       : %u KB\n", (unsigned int)(self->used/1024));
+		ShowMessage("\tpeak         : %u KB\n", (unsigned int)(self->peak/1024));
+		ShowMessage("\treserved     : %u KB in %u chunks\n", (unsigned int)(self->reserved/1024), self->nchunks);
+		ShowMessage("\tallocations  : %u\n", self->allocs);
+		ShowMessage("\tbulk releases: %u\n", self->rewinds);
+	}
+	ShowMessage("End of report\n");
+}
+
+
 /*======================================
  * Initialise
  *--------------------------------------
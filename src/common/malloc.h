@@ -81,6 +81,30 @@
 #define CREATE(result, type, number) (result) = (type *) aCalloc ((number), sizeof(type))
 #define RECREATE(result, type, number) (result) = (type *) aRealloc ((result), sizeof(type) * (number))
 
+////////////// Arenas //////////////////////////
+// Region allocators for short-lived data that dies together.
+// Memory is handed out sequentially from big chunks and can't be freed
+// individually, instead everything allocated after a mark is released at once
+// with arena_rewind (or arena_clear). Released chunks are kept for reuse.
+// Each arena is named after the subsystem that owns it, its usage and
+// high-water mark are shown by arena_report.
+
+typedef struct arena* ARENA;
+
+#define arena_alloc(a,n)    arena_alloc_((a),(n),ALC_MARK)
+#define arena_calloc(a,m,n) arena_calloc_((a),(m),(n),ALC_MARK)
+
+ARENA  arena_create(const char* name, size_t chunk_size);
+void   arena_destroy(ARENA self);
+void*  arena_alloc_(ARENA self, size_t size, const char *file, int line, const char *func);
+void*  arena_calloc_(ARENA self, size_t num, size_t size, const char *file, int line, const char *func);
+size_t arena_mark(ARENA self);
+void   arena_rewind(ARENA self, size_t mark);
+void   arena_clear(ARENA self);
+size_t arena_usage(ARENA self);
+size_t arena_peak(ARENA self);
+void   arena_report(void);
+
 ////////////////////////////////////////////////
 
 void malloc_memory_check(void);
@@ -617,6 +617,35 @@ int RFIFOSKIP(int fd, size_t len)
 	return 0;
 }
 
+/// insert 'len' bytes in front of the unprocessed RFIFO data, so they are parsed next
+int RFIFOINSERT(int fd, const void* data, size_t len)
+{
+	struct socket_data *s;
+
+	if ( !session_isActive(fd) )
+		return 0;
+
+	s = session[fd];
+
+	if( s->rdata_pos < len )
+	{// make room in front of the unprocessed data
+		size_t rest = s->rdata_size - s->rdata_pos;
+
+		if( rest + len > s->max_rdata )
+		{
+			RECREATE(s->rdata, unsigned char, rest + len);
+			s->max_rdata = rest + len;
+		}
+		memmove(s->rdata + len, s->rdata + s->rdata_pos, rest);
+		s->rdata_pos = len;
+		s->rdata_size = rest + len;
+	}
+
+	s->rdata_pos -= len;
+	memcpy(s->rdata + s->rdata_pos, data, len);
+	return 1;
+}
+
 /// advance the WFIFO cursor (marking 'len' bytes for sending)
 int WFIFOSET(int fd, size_t len)
 {
@@ -125,6 +125,7 @@ int realloc_fifo(int fd, unsigned int rfifo_size, unsigned int wfifo_size);
 int realloc_writefifo(int fd, size_t addition);
 int WFIFOSET(int fd, size_t len);
 int RFIFOSKIP(int fd, size_t len);
+int RFIFOINSERT(int fd, const void* data, size_t len);
 
 int do_sockets(int next);
 void do_close(int fd);
@@ -180,6 +180,16 @@ int Sql_SetEncoding(Sql* self, const char* encoding)
 
 
 
+/// Allows or disallows multi-statement queries on the connection.
+int Sql_SetMultiStatements(Sql* self, bool on)
+{
+	if( self && mysql_set_server_option(&self->handle, on ? MYSQL_OPTION_MULTI_STATEMENTS_ON : MYSQL_OPTION_MULTI_STATEMENTS_OFF) == 0 )
+		return SQL_SUCCESS;
+	return SQL_ERROR;
+}
+
+
+
 /// Pings the connection.
 int Sql_Ping(Sql* self)
 {
@@ -416,6 +426,40 @@ int Sql_GetData(Sql* self, size_t col, char** out_buf, size_t* out_len)
 
 
 
+/// Fetches the next result of a multi-statement query.
+int Sql_NextResult(Sql* self)
+{
+	int res;
+
+	if( self == NULL )
+		return SQL_ERROR;
+
+	if( self->result )
+	{
+		mysql_free_result(self->result);
+		self->result = NULL;
+		self->row = NULL;
+		self->lengths = NULL;
+	}
+	res = mysql_next_result(&self->handle);
+	if( res < 0 )
+		return SQL_NO_DATA;
+	if( res > 0 )
+	{
+		ShowSQL("DB error - %s\n", mysql_error(&self->handle));
+		return SQL_ERROR;
+	}
+	self->result = mysql_store_result(&self->handle);
+	if( mysql_errno(&self->handle) != 0 )
+	{
+		ShowSQL("DB error - %s\n", mysql_error(&self->handle));
+		return SQL_ERROR;
+	}
+	return SQL_SUCCESS;
+}
+
+
+
 /// Frees the result of the query.
 void Sql_FreeResult(Sql* self)
 {
@@ -426,6 +470,13 @@ void Sql_FreeResult(Sql* self)
 		self->row = NULL;
 		self->lengths = NULL;
 	}
+	// discard the unread results of a multi-statement query
+	while( self && mysql_more_results(&self->handle) && mysql_next_result(&self->handle) == 0 )
+	{
+		MYSQL_RES* result = mysql_store_result(&self->handle);
+		if( result )
+			mysql_free_result(result);
+	}
 }
 
 
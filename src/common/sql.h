@@ -99,6 +99,15 @@ int Sql_SetEncoding(Sql* self, const char* encoding);
 
 
 
+/// Allows or disallows multi-statement queries on the connection.
+/// Connections start without them, only turn them on around the queries that need it.
+/// Can't be changed while results of a query are pending.
+///
+/// @return SQL_SUCCESS or SQL_ERROR
+int Sql_SetMultiStatements(Sql* self, bool on);
+
+
+
 /// Pings the connection.
 ///
 /// @return SQL_SUCCESS or SQL_ERROR
@@ -193,7 +202,16 @@ int Sql_GetData(Sql* self, size_t col, char** out_buf, size_t* out_len);
 
 
 
+/// Fetches the next result of a multi-statement query.
+/// The previous result is freed.
+///
+/// @return SQL_SUCCESS, SQL_ERROR or SQL_NO_DATA
+int Sql_NextResult(Sql* self);
+
+
+
 /// Frees the result of the query.
+/// Unread results of a multi-statement query are discarded.
 void Sql_FreeResult(Sql* self);
 
 
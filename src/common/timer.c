@@ -52,16 +52,60 @@ static BHEAP_VAR(int, timer_heap);
 // server startup time
 time_t start_time;
 
+// timer profiling
+bool timer_stats_enabled = true;
+int tick_budget = 0;
+int timer_stats_interval = 0;
+char timer_stats_file[256] = "log/timer_stats.log";
+static unsigned int timer_stats_next_dump = 0;
+static uint32 tick_count = 0;
+static uint32 tick_over_budget = 0;
+static uint32 tick_max = 0; // us
+
 
 /*----------------------------
  * 	Timer debugging
  *----------------------------*/
+
+/// Latency histogram: bucket i counts the calls that took [2^i,2^(i+1)) microseconds (bucket 0 includes 0).
+#define TIMER_STATS_BUCKETS 25
+#define TFL_HASH_SIZE 256
+#define TFL_HASH(func) ( (unsigned int)(((uintptr)(func) >> 4) % TFL_HASH_SIZE) )
+
 struct timer_func_list {
 	struct timer_func_list* next;
+	struct timer_func_list* hash_next;
 	TimerFunc func;
-	char* name;
+	char* name; // NULL if the function was never named
+
+	// statistics
+	uint32 calls;
+	uint64 total; // us
+	uint32 max; // us
+	uint32 histogram[TIMER_STATS_BUCKETS];
 } *tfl_root = NULL;
 
+static struct timer_func_list* tfl_hash[TFL_HASH_SIZE];
+
+/// Returns the entry of a timer function, creating it if it doesn't exist.
+static struct timer_func_list* get_timer_func_list(TimerFunc func)
+{
+	struct timer_func_list* tfl;
+	unsigned int hash = TFL_HASH(func);
+
+	for( tfl = tfl_hash[hash]; tfl != NULL; tfl = tfl->hash_next )
+		if( tfl->func == func )
+			return tfl;
+
+	CREATE(tfl,struct timer_func_list,1);
+	tfl->next = tfl_root;
+	tfl->hash_next = tfl_hash[hash];
+	tfl->func = func;
+	tfl_root = tfl;
+	tfl_hash[hash] = tfl;
+	return tfl;
+}
+
 /// Sets the name of a timer function.
 int add_timer_func_list(TimerFunc func, char* name)
 {
@@ -70,16 +114,17 @@ int add_timer_func_list(TimerFunc func, char* name)
 	if (name) {
 		for( tfl=tfl_root; tfl != NULL; tfl=tfl->next )
 		{// check suspicious cases
+			if( tfl->name == NULL )
+				continue;
 			if( func == tfl->func )
 				ShowWarning("add_timer_func_list: duplicating function %p(%s) as %s.\n",tfl->func,tfl->name,name);
 			else if( strcmp(name,tfl->name) == 0 )
 				ShowWarning("add_timer_func_list: function %p has the same name as %p(%s)\n",func,tfl->func,tfl->name);
 		}
-		CREATE(tfl,struct timer_func_list,1);
-		tfl->next = tfl_root;
-		tfl->func = func;
+		tfl = get_timer_func_list(func);
+		if( tfl->name )
+			aFree(tfl->name);
 		tfl->name = aStrdup(name);
-		tfl_root = tfl;
 	}
 	return 0;
 }
@@ -89,8 +134,8 @@ const char* search_timer_func_list(TimerFunc func)
 {
 	struct timer_func_list* tfl;
 
-	for( tfl=tfl_root; tfl != NULL; tfl=tfl->next )
-		if (func == tfl->func)
+	for( tfl = tfl_hash[TFL_HASH(func)]; tfl != NULL; tfl = tfl->hash_next )
+		if( func == tfl->func && tfl->name )
 			return tfl->name;
 
 	return "unknown timer function";
@@ -157,6 +202,44 @@ static unsigned int tick(void)
 #endif
 }
 
+/// platform-abstracted high resolution counter, used to profile the timer functions
+static uint64 perf_counter(void)
+{
+#if defined(WIN32)
+	LARGE_INTEGER count;
+	QueryPerformanceCounter(&count);
+	return (uint64)count.QuadPart;
+#elif defined(ENABLE_RDTSC)
+	return _rdtsc();
+#elif defined(HAVE_MONOTONIC_CLOCK)
+	struct timespec tval;
+	clock_gettime(CLOCK_MONOTONIC, &tval);
+	return (uint64)tval.tv_sec * 1000000 + tval.tv_nsec / 1000;
+#else
+	struct timeval tval;
+	gettimeofday(&tval, NULL);
+	return (uint64)tval.tv_sec * 1000000 + tval.tv_usec;
+#endif
+}
+
+/// Converts a difference of perf_counter() values to microseconds.
+static uint32 perf_counter_usec(uint64 diff)
+{
+#if defined(WIN32)
+	static uint64 frequency = 0;
+	if( frequency == 0 )
+	{
+		LARGE_INTEGER freq;
+		QueryPerformanceFrequency(&freq);
+		frequency = (uint64)freq.QuadPart;
+	}
+	diff = diff * 1000000 / frequency;
+#elif defined(ENABLE_RDTSC)
+	diff = diff * 1000 / RDTSC_CLOCK;
+#endif
+	return (uint32)min(diff, UINT32_MAX);
+}
+
 //////////////////////////////////////////////////////////////////////////
 #if defined(TICK_CACHE) && TICK_CACHE > 1
 //////////////////////////////////////////////////////////////////////////
@@ -340,11 +423,154 @@ int settick_timer(int tid, unsigned int tick)
 	return (int)tick;
 }
 
+/*==========================
+ * 	Timer Profiling
+ *--------------------------*/
+
+/// Returns the name of a timer function, or its address if it was never named.
+static const char* timer_stats_name(const struct timer_func_list* tfl)
+{
+	static char buf[32];
+
+	if( tfl->name )
+		return tfl->name;
+	snprintf(buf, sizeof(buf), "%p", tfl->func);
+	return buf;
+}
+
+/// Records a call of a timer function.
+static void timer_stats_add(struct timer_func_list* tfl, uint32 usec)
+{
+	int i;
+
+	for( i = 0; i < TIMER_STATS_BUCKETS-1 && (usec >> (i+1)) != 0; ++i )
+		;// find the bucket
+	tfl->histogram[i]++;
+	tfl->calls++;
+	tfl->total += usec;
+	if( usec > tfl->max )
+		tfl->max = usec;
+}
+
+/// Returns the time (us) below which pct percent of the calls of a timer function took.
+/// The histogram only gives the upper bound of the bucket.
+static uint32 timer_stats_percentile(const struct timer_func_list* tfl, int pct)
+{
+	uint32 want, seen = 0;
+	int i;
+
+	if( tfl->calls == 0 )
+		return 0;
+
+	want = (uint32)(((uint64)tfl->calls * pct + 99) / 100);
+	for( i = 0; i < TIMER_STATS_BUCKETS; ++i )
+	{
+		seen += tfl->histogram[i];
+		if( seen >= want )
+			return min(((uint32)2 << i) - 1, tfl->max);
+	}
+	return tfl->max;
+}
+
+static int timer_stats_cmp(const void* a, const void* b)
+{
+	const struct timer_func_list* tfl1 = *(const struct timer_func_list**)a;
+	const struct timer_func_list* tfl2 = *(const struct timer_func_list**)b;
+
+	if( tfl1->total != tfl2->total )
+		return ( tfl1->total < tfl2->total ) ? 1 : -1;
+	return 0;
+}
+
+/// Shows the timer functions that used the most time.
+void timer_stats_report(int count)
+{
+	struct timer_func_list* tfl;
+	struct timer_func_list** list;
+	int i, n = 0;
+
+	if( !timer_stats_enabled )
+	{
+		ShowInfo("Timer statistics are disabled.\n");
+		return;
+	}
+
+	for( tfl = tfl_root; tfl != NULL; tfl = tfl->next )
+		if( tfl->calls )
+			++n;
+	ShowInfo("Timer statistics: %u ticks, longest %u.%03u ms, %u over the budget of %d ms\n", tick_count, tick_max/1000, tick_max%1000, tick_over_budget, tick_budget);
+	if( n == 0 )
+		return;
+
+	CREATE(list, struct timer_func_list*, n);
+	for( i = 0, tfl = tfl_root; tfl != NULL; tfl = tfl->next )
+		if( tfl->calls )
+			list[i++] = tfl;
+	qsort(list, n, sizeof(list[0]), timer_stats_cmp);
+
+	ShowMessage("  %-32s %10s %12s %8s %8s %8s %8s\n", "function", "calls", "total us", "avg us", "p50 us", "p99 us", "max us");
+	for( i = 0; i < n && i < count; ++i )
+	{
+		tfl = list[i];
+		ShowMessage("  %-32s %10u %12"PRIu64" %8u %8u %8u %8u\n", timer_stats_name(tfl),
+			tfl->calls, tfl->total, (uint32)(tfl->total/tfl->calls),
+			timer_stats_percentile(tfl, 50), timer_stats_percentile(tfl, 99), tfl->max);
+	}
+	aFree(list);
+}
+
+/// Appends the statistics of all the timer functions to a file, one line per function.
+/// The values are cumulative, consumers should use the difference between two dumps.
+void timer_stats_dump(const char* filename)
+{
+	struct timer_func_list* tfl;
+	time_t now = time(NULL);
+	FILE* fp;
+	int i;
+
+	if( !timer_stats_enabled || (fp = fopen(filename, "a")) == NULL )
+		return;
+
+	fprintf(fp, "time=%lu ticks=%u tick_max_us=%u over_budget=%u\n", (unsigned long)now, tick_count, tick_max, tick_over_budget);
+	for( tfl = tfl_root; tfl != NULL; tfl = tfl->next )
+	{
+		if( tfl->calls == 0 )
+			continue;
+		fprintf(fp, "time=%lu func=%s calls=%u total_us=%"PRIu64" max_us=%u p50_us=%u p90_us=%u p99_us=%u histogram=",
+			(unsigned long)now, timer_stats_name(tfl), tfl->calls, tfl->total, tfl->max,
+			timer_stats_percentile(tfl, 50), timer_stats_percentile(tfl, 90), timer_stats_percentile(tfl, 99));
+		for( i = 0; i < TIMER_STATS_BUCKETS; ++i )
+			fprintf(fp, i ? ",%u" : "%u", tfl->histogram[i]);
+		fprintf(fp, "\n");
+	}
+	fclose(fp);
+}
+
+/// Clears the statistics of the timer functions.
+void timer_stats_reset(void)
+{
+	struct timer_func_list* tfl;
+
+	for( tfl = tfl_root; tfl != NULL; tfl = tfl->next )
+	{
+		tfl->calls = 0;
+		tfl->total = 0;
+		tfl->max = 0;
+		memset(tfl->histogram, 0, sizeof(tfl->histogram));
+	}
+	tick_count = 0;
+	tick_over_budget = 0;
+	tick_max = 0;
+}
+
 /// Executes all expired timers.
 /// Returns the value of the smallest non-expired timer (or 1 second if there aren't any).
 int do_timer(unsigned int tick)
 {
 	int diff = TIMER_MAX_INTERVAL; // return value
+	uint64 tick_start = ( timer_stats_enabled ? perf_counter() : 0 );
+	struct timer_func_list* slowest = NULL;
+	uint32 slowest_usec = 0;
 
 	// process all timers one by one
 	while( BHEAP_LENGTH(timer_heap) )
@@ -359,7 +585,23 @@ int do_timer(unsigned int tick)
 		BHEAP_POP(timer_heap, DIFFTICK_MINTOPCMP);
 		timer_data[tid].type |= TIMER_REMOVE_HEAP;
 
-		if( timer_data[tid].func )
+		if( timer_data[tid].func && timer_stats_enabled )
+		{
+			struct timer_func_list* tfl = get_timer_func_list(timer_data[tid].func);
+			uint64 start = perf_counter();
+			uint32 usec;
+
+			timer_data[tid].func(tid, ( diff < -1000 ) ? tick : timer_data[tid].tick, timer_data[tid].id, timer_data[tid].data);
+
+			usec = perf_counter_usec(perf_counter() - start);
+			timer_stats_add(tfl, usec);
+			if( slowest == NULL || usec > slowest_usec )
+			{
+				slowest = tfl;
+				slowest_usec = usec;
+			}
+		}
+		else if( timer_data[tid].func )
 		{
 			// timer was delayed for more than 1 second, use current tick instead
 			timer_data[tid].func(tid, ( diff < -1000 ) ? tick : timer_data[tid].tick, timer_data[tid].id, timer_data[tid].data);
@@ -393,6 +635,28 @@ int do_timer(unsigned int tick)
 		}
 	}
 
+	if( timer_stats_enabled && slowest != NULL )
+	{// a tick was processed
+		uint32 usec = perf_counter_usec(perf_counter() - tick_start);
+
+		tick_count++;
+		if( usec > tick_max )
+			tick_max = usec;
+		if( tick_budget > 0 && usec > (uint32)tick_budget*1000 )
+		{
+			tick_over_budget++;
+			ShowWarning("do_timer: tick took %u.%03u ms, over the budget of %d ms (slowest timer function: %s, %u.%03u ms).\n",
+				usec/1000, usec%1000, tick_budget, timer_stats_name(slowest), slowest_usec/1000, slowest_usec%1000);
+		}
+	}
+
+	if( timer_stats_interval > 0 && DIFF_TICK(tick, timer_stats_next_dump) >= 0 )
+	{
+		if( timer_stats_next_dump != 0 )
+			timer_stats_dump(timer_stats_file);
+		timer_stats_next_dump = tick + timer_stats_interval*1000;
+	}
+
 	return cap_value(diff, TIMER_MIN_INTERVAL, TIMER_MAX_INTERVAL);
 }
 
@@ -417,9 +681,11 @@ void timer_final(void)
 
 	for( tfl=tfl_root; tfl != NULL; tfl = next ) {
 		next = tfl->next;	// copy next pointer
-		aFree(tfl->name);	// free structures
+		if (tfl->name) aFree(tfl->name);	// free structures
 		aFree(tfl);
 	}
+	tfl_root = NULL;
+	memset(tfl_hash, 0, sizeof(tfl_hash));
 
 	if (timer_data) aFree(timer_data);
 	BHEAP_CLEAR(timer_heap);
@@ -46,6 +46,16 @@ int settick_timer(int tid, unsigned int tick);
 
 int add_timer_func_list(TimerFunc func, char* name);
 
+// timer profiling
+extern bool timer_stats_enabled; // measure the time used by each timer function
+extern int tick_budget; // warn when processing the timers of a tick takes longer than this (ms, 0 = disabled)
+extern int timer_stats_interval; // interval of the periodic dumps (s, 0 = disabled)
+extern char timer_stats_file[256]; // file of the periodic dumps
+
+void timer_stats_report(int count);
+void timer_stats_dump(const char* filename);
+void timer_stats_reset(void);
+
 unsigned long get_uptime(void);
 
 int do_timer(unsigned int tick);
@@ -4217,6 +4217,7 @@ ACMD_FUNC(reloadbattleconf)
 	||  prev_config.item_rate_treasure     != battle_config.item_rate_treasure
 	||  prev_config.item_rate_adddrop      != battle_config.item_rate_adddrop
 	||  prev_config.logarithmic_drops      != battle_config.logarithmic_drops
+	||  prev_config.drop_rate0item         != battle_config.drop_rate0item
 	||  prev_config.item_drop_common_min   != battle_config.item_drop_common_min
 	||  prev_config.item_drop_common_max   != battle_config.item_drop_common_max
 	||  prev_config.item_drop_card_min     != battle_config.item_drop_card_min
@@ -704,18 +704,26 @@ static int battle_calc_drain(int damage, int rate, int per)
 	return diff;
 }
 
+static int battle_addmastery_race(struct map_session_data *sd,struct block_list *target,int dmg);
+static int battle_weapon_mastery(struct map_session_data *sd,int type);
+
 /*==========================================
  * ?C_??[W
  *------------------------------------------*/
 int battle_addmastery(struct map_session_data *sd,struct block_list *target,int dmg,int type)
+{
+	nullpo_ret(sd);
+
+	return battle_addmastery_race(sd,target,dmg) + battle_weapon_mastery(sd,type);
+}
+
+/// Adds the mastery damage that depends on the target's race.
+static int battle_addmastery_race(struct map_session_data *sd,struct block_list *target,int dmg)
 {
 	int damage,skill;
 	struct status_data *status = status_get_status_data(target);
-	int weapon;
 	damage = dmg;
 
-	nullpo_ret(sd);
-
 	if((skill = pc_checkskill(sd,AL_DEMONBANE)) > 0 &&
 		target->type == BL_MOB && //This bonus doesnt work against players.
 		(battle_check_undead(status->race,status->def_ele) || status->race==RC_DEMON) )
@@ -728,6 +736,15 @@ int battle_addmastery(struct map_session_data *sd,struct block_list *target,int
 			damage += sd->status.str;
 	}
 
+	return damage;
+}
+
+/// Returns the mastery damage of the weapon in the right (type 0) or left hand.
+static int battle_weapon_mastery(struct map_session_data *sd,int type)
+{
+	int damage = 0,skill;
+	int weapon;
+
 	if(type == 0)
 		weapon = sd->weapontype1;
 	else
@@ -940,6 +957,77 @@ static int battle_blewcount_bonus(struct map_session_data *sd, int skill_num)
 	return 0;
 }
 
+/// Casts in progress, innermost first.
+static struct battle_cast* battle_cast_list = NULL;
+
+static void battle_cast_init(struct battle_cast* bc, struct block_list* src, int skill_num, int skill_lv)
+{
+	struct map_session_data* sd = BL_CAST(BL_PC, src);
+
+	bc->src = src;
+	bc->skill_num = skill_num;
+	bc->skill_lv = skill_lv;
+	bc->nk = skill_get_nk(skill_num);
+	bc->inf = skill_get_inf(skill_num);
+	bc->div_ = skill_get_num(skill_num,skill_lv);
+	bc->blewcount = skill_get_blewcount(skill_num,skill_lv);
+	bc->ele = skill_get_ele(skill_num,skill_lv);
+	bc->ammotype = skill_num?skill_get_ammotype(skill_num):0;
+	if( !skill_num || battle_config.skillrange_by_distance&src->type )
+		bc->range = 0;
+	else
+		bc->range = skill_get_range2(src,skill_num,skill_lv) < 5 ? BF_SHORT : BF_LONG;
+	bc->skillatk = 0;
+	bc->mastery[0] = bc->mastery[1] = 0;
+	if( sd )
+	{
+		bc->blewcount += battle_blewcount_bonus(sd,skill_num);
+		bc->skillatk = pc_skillatk_bonus(sd,skill_num);
+		bc->mastery[0] = battle_weapon_mastery(sd,0);
+		bc->mastery[1] = battle_weapon_mastery(sd,1);
+	}
+}
+
+/// Starts a cast of the skill by src.
+/// Until battle_cast_end(), the damage calculations of the skill reuse the
+/// attacker's terms computed here.
+void battle_cast_begin(struct battle_cast* bc, struct block_list* src, int skill_num, int skill_lv)
+{
+	battle_cast_init(bc, src, skill_num, skill_lv);
+	bc->prev = battle_cast_list;
+	battle_cast_list = bc;
+}
+
+/// Ends a cast started by battle_cast_begin().
+void battle_cast_end(struct battle_cast* bc)
+{
+	battle_cast_list = bc->prev;
+}
+
+/// Stops sharing the terms of the casts of src, whose status changed.
+void battle_cast_reset(struct block_list* src)
+{
+	struct battle_cast* bc;
+
+	for( bc = battle_cast_list; bc != NULL; bc = bc->prev )
+		if( bc->src == src )
+			bc->src = NULL;
+}
+
+/// Returns the terms of the cast in progress of the skill by src, or
+/// computes them in bc if there is none.
+static const struct battle_cast* battle_cast_get(struct battle_cast* bc, struct block_list* src, int skill_num, int skill_lv)
+{
+	struct battle_cast* cur;
+
+	for( cur = battle_cast_list; cur != NULL; cur = cur->prev )
+		if( cur->src == src && cur->skill_num == skill_num && cur->skill_lv == skill_lv )
+			return cur;
+
+	battle_cast_init(bc, src, skill_num, skill_lv);
+	return bc;
+}
+
 struct Damage battle_calc_magic_attack(struct block_list *src,struct block_list *target,int skill_num,int skill_lv,int mflag);
 struct Damage battle_calc_misc_attack(struct block_list *src,struct block_list *target,int skill_num,int skill_lv,int mflag);
 
@@ -957,6 +1045,8 @@ static struct Damage battle_calc_weapon_attack(struct block_list *src,struct blo
 	bool n_ele = false; // non-elemental
 
 	struct map_session_data *sd, *tsd;
+	struct battle_cast bc_;
+	const struct battle_cast *bc;
 	struct Damage wd;
 	struct status_change *sc = status_get_sc(src);
 	struct status_change *tsc = status_get_sc(target);
@@ -982,6 +1072,8 @@ static struct Damage battle_calc_weapon_attack(struct block_list *src,struct blo
 	nullpo_retr(wd, src);
 	nullpo_retr(wd, target);
 
+	bc = battle_cast_get(&bc_, src, skill_num, skill_lv);
+
 	//Initial flag
 	flag.rh=1;
 	flag.weapon=1;
@@ -989,16 +1081,16 @@ static struct Damage battle_calc_weapon_attack(struct block_list *src,struct blo
 
 	//Initial Values
 	wd.type=0; //Normal attack
-	wd.div_=skill_num?skill_get_num(skill_num,skill_lv):1;
-	wd.amotion=(skill_num && skill_get_inf(skill_num)&INF_GROUND_SKILL)?0:sstatus->amotion; //Amotion should be 0 for ground skills.
+	wd.div_=skill_num?bc->div_:1;
+	wd.amotion=(skill_num && bc->inf&INF_GROUND_SKILL)?0:sstatus->amotion; //Amotion should be 0 for ground skills.
 	if(skill_num == KN_AUTOCOUNTER)
 		wd.amotion >>= 1;
 	wd.dmotion=tstatus->dmotion;
-	wd.blewcount=skill_get_blewcount(skill_num,skill_lv);
+	wd.blewcount=bc->blewcount; // includes battle_blewcount_bonus
 	wd.flag = BF_WEAPON; //Initial Flag
 	wd.flag |= (skill_num||wflag)?BF_SKILL:BF_NORMAL; // Baphomet card's splash damage is counted as a skill. [Inkfish]
 	wd.dmg_lv=ATK_DEF;	//This assumption simplifies the assignation later
-	nk = skill_get_nk(skill_num);
+	nk = bc->nk;
 	if( !skill_num && wflag ) //If flag, this is splash damage from Baphomet Card and it always hits.
 		nk |= NK_NO_CARDFIX_ATK|NK_IGNORE_FLEE;
 	flag.hit = nk&NK_IGNORE_FLEE?1:0;
@@ -1012,18 +1104,15 @@ static struct Damage battle_calc_weapon_attack(struct block_list *src,struct blo
 	sd = BL_CAST(BL_PC, src);
 	tsd = BL_CAST(BL_PC, target);
 
-	if(sd)
-		wd.blewcount += battle_blewcount_bonus(sd, skill_num);
-
 	//Set miscellaneous data that needs be filled regardless of hit/miss
 	if(
 		(sd && sd->state.arrow_atk) ||
-		(!sd && ((skill_num && skill_get_ammotype(skill_num)) || sstatus->rhw.range>3))
+		(!sd && (bc->ammotype || sstatus->rhw.range>3))
 	)
 		flag.arrow = 1;
 	
 	if(skill_num){
-		wd.flag |= battle_range_type(src, target, skill_num, skill_lv);
+		wd.flag |= bc->range?bc->range:battle_range_type(src, target, skill_num, skill_lv);
 		switch(skill_num)
 		{
 			case MO_FINGEROFFENSIVE:
@@ -1087,7 +1176,7 @@ static struct Damage battle_calc_weapon_attack(struct block_list *src,struct blo
 	}
 
 	t_class = status_get_class(target);
-	s_ele = s_ele_ = skill_get_ele(skill_num, skill_lv);
+	s_ele = s_ele_ = bc->ele;
 	if( !skill_num || s_ele == -1 )
 	{ //Take weapon's element
 		s_ele = sstatus->rhw.ele;
@@ -1790,7 +1879,7 @@ static struct Damage battle_calc_weapon_attack(struct block_list *src,struct blo
 		
 		if( sd )
 		{
-			if (skill_num && (i = pc_skillatk_bonus(sd, skill_num)))
+			if (skill_num && (i = bc->skillatk))
 				ATK_ADDRATE(i);
 
 			if( skill_num != PA_SACRIFICE && skill_num != MO_INVESTIGATE && skill_num != CR_GRANDCROSS && skill_num != NPC_GRANDDARKNESS && skill_num != PA_SHIELDCHAIN && !flag.cri )
@@ -1935,9 +2024,9 @@ static struct Damage battle_calc_weapon_attack(struct block_list *src,struct blo
 				ATK_ADDRATE(10+ 2*skill);
 			}
 
-			wd.damage = battle_addmastery(sd,target,wd.damage,0);
+			wd.damage = battle_addmastery_race(sd,target,wd.damage) + bc->mastery[0];
 			if (flag.lh)
-				wd.damage2 = battle_addmastery(sd,target,wd.damage2,1);
+				wd.damage2 = battle_addmastery_race(sd,target,wd.damage2) + bc->mastery[1];
 
 			if (sc && sc->data[SC_MIRACLE]) i = 2; //Star anger
 			else
@@ -2319,6 +2408,8 @@ struct Damage battle_calc_magic_attack(struct block_list *src,struct block_list
 	unsigned int skillratio = 100;	//Skill dmg modifiers.
 
 	struct map_session_data *sd, *tsd;
+	struct battle_cast bc_;
+	const struct battle_cast *bc;
 	struct Damage ad;
 	struct status_data *sstatus = status_get_status_data(src);
 	struct status_data *tstatus = status_get_status_data(target);
@@ -2333,22 +2424,24 @@ struct Damage battle_calc_magic_attack(struct block_list *src,struct block_list
 	nullpo_retr(ad, src);
 	nullpo_retr(ad, target);
 
+	bc = battle_cast_get(&bc_, src, skill_num, skill_lv);
+
 	//Initial Values
 	ad.damage = 1;
-	ad.div_=skill_get_num(skill_num,skill_lv);
-	ad.amotion=skill_get_inf(skill_num)&INF_GROUND_SKILL?0:sstatus->amotion; //Amotion should be 0 for ground skills.
+	ad.div_=bc->div_;
+	ad.amotion=bc->inf&INF_GROUND_SKILL?0:sstatus->amotion; //Amotion should be 0 for ground skills.
 	ad.dmotion=tstatus->dmotion;
-	ad.blewcount = skill_get_blewcount(skill_num,skill_lv);
+	ad.blewcount = bc->blewcount; // includes battle_blewcount_bonus
 	ad.flag=BF_MAGIC|BF_SKILL;
 	ad.dmg_lv=ATK_DEF;
-	nk = skill_get_nk(skill_num);
+	nk = bc->nk;
 	flag.imdef = nk&NK_IGNORE_DEF?1:0;
 
 	sd = BL_CAST(BL_PC, src);
 	tsd = BL_CAST(BL_PC, target);
 
 	//Initialize variables that will be used afterwards
-	s_ele = skill_get_ele(skill_num, skill_lv);
+	s_ele = bc->ele;
 
 	if (s_ele == -1) // pl=-1 : the skill takes the weapon's element
 		s_ele = sstatus->rhw.ele;
@@ -2358,13 +2451,11 @@ struct Damage battle_calc_magic_attack(struct block_list *src,struct block_list
 		s_ele = rand()%ELE_MAX;
 	
 	//Set miscellaneous data that needs be filled
-	if(sd) {
+	if(sd)
 		sd->state.arrow_atk = 0;
-		ad.blewcount += battle_blewcount_bonus(sd, skill_num);
-	}
 
 	//Skill Range Criteria
-	ad.flag |= battle_range_type(src, target, skill_num, skill_lv);
+	ad.flag |= bc->range?bc->range:battle_range_type(src, target, skill_num, skill_lv);
 	flag.infdef=(tstatus->mode&MD_PLANT?1:0);
 		
 	switch(skill_num)
@@ -2522,7 +2613,7 @@ struct Damage battle_calc_magic_attack(struct block_list *src,struct block_list
 
 		if(sd) {
 			//Damage bonuses
-			if ((i = pc_skillatk_bonus(sd, skill_num)))
+			if ((i = bc->skillatk))
 				ad.damage += ad.damage*i/100;
 
 			//Ignore Defense?
@@ -2672,6 +2763,8 @@ struct Damage battle_calc_misc_attack(struct block_list *src,struct block_list *
 	short s_ele;
 
 	struct map_session_data *sd, *tsd;
+	struct battle_cast bc_;
+	const struct battle_cast *bc;
 	struct Damage md; //DO NOT CONFUSE with md of mob_data!
 	struct status_data *sstatus = status_get_status_data(src);
 	struct status_data *tstatus = status_get_status_data(target);
@@ -2681,32 +2774,32 @@ struct Damage battle_calc_misc_attack(struct block_list *src,struct block_list *
 	nullpo_retr(md, src);
 	nullpo_retr(md, target);
 
+	bc = battle_cast_get(&bc_, src, skill_num, skill_lv);
+
 	//Some initial values
-	md.amotion=skill_get_inf(skill_num)&INF_GROUND_SKILL?0:sstatus->amotion;
+	md.amotion=bc->inf&INF_GROUND_SKILL?0:sstatus->amotion;
 	md.dmotion=tstatus->dmotion;
-	md.div_=skill_get_num( skill_num,skill_lv );
-	md.blewcount=skill_get_blewcount(skill_num,skill_lv);
+	md.div_=bc->div_;
+	md.blewcount=bc->blewcount; // includes battle_blewcount_bonus
 	md.dmg_lv=ATK_DEF;
 	md.flag=BF_MISC|BF_SKILL;
 
-	nk = skill_get_nk(skill_num);
+	nk = bc->nk;
 	
 	sd = BL_CAST(BL_PC, src);
 	tsd = BL_CAST(BL_PC, target);
 	
-	if(sd) {
+	if(sd)
 		sd->state.arrow_atk = 0;
-		md.blewcount += battle_blewcount_bonus(sd, skill_num);
-	}
 
-	s_ele = skill_get_ele(skill_num, skill_lv);
+	s_ele = bc->ele;
 	if (s_ele < 0 && s_ele != -3) //Attack that takes weapon's element for misc attacks? Make it neutral [Skotlex]
 		s_ele = ELE_NEUTRAL;
 	else if (s_ele == -3) //Use random element
 		s_ele = rand()%ELE_MAX;
 
 	//Skill Range Criteria
-	md.flag |= battle_range_type(src, target, skill_num, skill_lv);
+	md.flag |= bc->range?bc->range:battle_range_type(src, target, skill_num, skill_lv);
 
 	switch( skill_num )
 	{
@@ -4126,7 +4219,7 @@ int battle_config_read(const char* cfgName)
 
 void do_init_battle(void)
 {
-	delay_damage_ers = ers_new(sizeof(struct delay_damage));
+	delay_damage_ers = ers_new(sizeof(struct delay_damage), "battle.c::delay_damage_ers");
 	add_timer_func_list(battle_delay_damage_sub, "battle_delay_damage_sub");
 }
 
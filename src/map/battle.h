@@ -24,6 +24,24 @@ struct Damage {
 	enum damage_lv dmg_lv;	//ATK_LUCKY,ATK_FLEE,ATK_DEF
 };
 
+/// Terms of a skill's damage that only depend on the attacker.
+/// Between battle_cast_begin() and battle_cast_end() they are computed once
+/// and shared by the damage calculations of all the targets of the cast.
+struct battle_cast {
+	struct battle_cast* prev;
+	struct block_list* src; // NULL once the attacker's status was recalculated
+	int skill_num, skill_lv;
+	int nk; // skill_get_nk
+	int inf; // skill_get_inf
+	int div_; // skill_get_num
+	int blewcount; // skill_get_blewcount, with the attacker's bonus
+	int ele; // skill_get_ele
+	int ammotype; // skill_get_ammotype
+	int range; // BF_SHORT or BF_LONG, 0 if it depends on the target
+	int skillatk; // pc_skillatk_bonus
+	int mastery[2]; // weapon mastery damage of each hand
+};
+
 // \iǂݍ݂pc.cAbattle_attr_fixŎgpj
 extern int attr_fix_table[4][10][10];
 
@@ -34,6 +52,9 @@ struct block_list;
 // _[WvZ
 
 struct Damage battle_calc_attack(int attack_type,struct block_list *bl,struct block_list *target,int skill_num,int skill_lv,int count);
+void battle_cast_begin(struct battle_cast* bc, struct block_list* src, int skill_num, int skill_lv);
+void battle_cast_end(struct battle_cast* bc);
+void battle_cast_reset(struct block_list* src);
 
 int battle_calc_return_damage(struct block_list *bl, int damage, int flag);
 
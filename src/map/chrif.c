@@ -41,7 +41,7 @@ static const int packet_len_table[0x3d] = { // U - used, F - free
 	60, 3,-1,27,10,-1, 6,-1,	// 2af8-2aff: U->2af8, U->2af9, U->2afa, U->2afb, U->2afc, U->2afd, U->2afe, U->2aff
 	 6,-1,18, 7,-1,35,30, 0,	// 2b00-2b07: U->2b00, U->2b01, U->2b02, U->2b03, U->2b04, U->2b05, U->2b06, F->2b07
 	 6,30, 0, 0,86, 7,44,34,	// 2b08-2b0f: U->2b08, U->2b09, F->2b0a, F->2b0b, U->2b0c, U->2b0d, U->2b0e, U->2b0f
-	11,10,10, 0,11, 0,266,10,	// 2b10-2b17: U->2b10, U->2b11, U->2b12, F->2b13, U->2b14, F->2b15, U->2b16, U->2b17
+	11,10,10,37,11, 0,266,10,	// 2b10-2b17: U->2b10, U->2b11, U->2b12, U->2b13, U->2b14, F->2b15, U->2b16, U->2b17
 	 2,10, 2,-1,-1,-1, 2, 7,	// 2b18-2b1f: U->2b18, U->2b19, U->2b1a, U->2b1b, U->2b1c, U->2b1d, U->2b1e, U->2b1f
 	-1,10, 8, 2, 2,14,19,19,	// 2b20-2b27: U->2b20, U->2b21, U->2b22, U->2b23, U->2b24, U->2b25, U->2b26, U->2b27
 };
@@ -74,7 +74,7 @@ static const int packet_len_table[0x3d] = { // U - used, F - free
 //2b10: Outgoing, chrif_updatefamelist -> 'Update the fame ranking lists and send them'
 //2b11: Outgoing, chrif_divorce -> 'tell the charserver to do divorce'
 //2b12: Incoming, chrif_divorceack -> 'divorce chars
-//2b13: FREE
+//2b13: Incoming, chrif_movefamelist_ack. Moved one entry of the fame list.
 //2b14: Incoming, chrif_accountban -> 'not sure: kick the player with message XY'
 //2b15: FREE
 //2b16: Outgoing, chrif_ragsrvinfo -> 'sends base / job / drop rates ....'
@@ -1162,6 +1162,28 @@ int chrif_updatefamelist_ack(int fd)
 	return 1;
 }
 
+/// fame ranking move confirmation
+/// R 2b13 <table>.B <from>.B <to>.B <entry>.32B
+int chrif_movefamelist_ack(int fd)
+{
+	struct fame_list* list;
+	uint8 from, to;
+	switch (RFIFOB(fd,2))
+	{
+		case 1: list = smith_fame_list;   break;
+		case 2: list = chemist_fame_list; break;
+		case 3: list = taekwon_fame_list; break;
+		default: return 0;
+	}
+	from = RFIFOB(fd,3);
+	to = RFIFOB(fd,4);
+	if (from >= MAX_FAME_LIST || to >= MAX_FAME_LIST)
+		return 0;
+	ARR_MOVE(from, to, list, struct fame_list);
+	memcpy(&list[to], RFIFOP(fd,5), sizeof(struct fame_list));
+	return 1;
+}
+
 int chrif_save_scdata(struct map_session_data *sd)
 {	//parses the sc_data of the player and sends it to the char-server for saving. [Skotlex]
 #ifdef ENABLE_SC_SAVING
@@ -1178,10 +1200,8 @@ int chrif_save_scdata(struct map_session_data *sd)
 	WFIFOW(char_fd,0) = 0x2b1c;
 	WFIFOL(char_fd,4) = sd->status.account_id;
 	WFIFOL(char_fd,8) = sd->status.char_id;
-	for (i = 0; i < SC_MAX; i++)
+	for( i = status_next_sc(sc, SC_NONE); i != SC_NONE; i = status_next_sc(sc, i) )
 	{
-		if (!sc->data[i])
-			continue;
 		if (sc->data[i]->timer != INVALID_TIMER)
 		{
 			timer = get_timer(sc->data[i]->timer);
@@ -1438,6 +1458,7 @@ int chrif_parse(int fd)
 		case 0x2b0d: chrif_changedsex(fd); break;
 		case 0x2b0f: chrif_char_ask_name_answer(RFIFOL(fd,2), (char*)RFIFOP(fd,6), RFIFOW(fd,30), RFIFOW(fd,32)); break;
 		case 0x2b12: chrif_divorceack(RFIFOL(fd,2), RFIFOL(fd,6)); break;
+		case 0x2b13: chrif_movefamelist_ack(fd); break;
 		case 0x2b14: chrif_accountban(fd); break;
 		case 0x2b1b: chrif_recvfamelist(fd); break;
 		case 0x2b1d: chrif_load_scdata(fd); break;
@@ -1586,7 +1607,7 @@ int do_final_chrif(void)
 int do_init_chrif(void)
 {
 	auth_db = idb_alloc(DB_OPT_BASE);
-	auth_db_ers = ers_new(sizeof(struct auth_node));
+	auth_db_ers = ers_new(sizeof(struct auth_node), "chrif.c::auth_db_ers");
 
 	add_timer_func_list(check_connect_char_server, "check_connect_char_server");
 	add_timer_func_list(ping_char_server, "ping_char_server");
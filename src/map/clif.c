@@ -282,12 +282,10 @@ static inline unsigned char clif_bl_type(struct block_list *bl) {
 /*==========================================
  * clif_sendAREA*w莞p
  *------------------------------------------*/
-static int clif_send_sub(struct block_list *bl, va_list ap)
+static int clif_send_sub(struct block_list *bl, const uint8* buf, int len, struct block_list* src_bl, int type)
 {
-	struct block_list *src_bl;
 	struct map_session_data *sd;
-	unsigned char *buf;
-	int len, type, fd;
+	int fd;
 
 	nullpo_ret(bl);
 	nullpo_ret(sd = (struct map_session_data *)bl);
@@ -296,10 +294,7 @@ static int clif_send_sub(struct block_list *bl, va_list ap)
 	if (!fd) //Don't send to disconnected clients.
 		return 0;
 
-	buf = va_arg(ap,unsigned char*);
-	len = va_arg(ap,int);
-	nullpo_ret(src_bl = va_arg(ap,struct block_list*));
-	type = va_arg(ap,int);
+	nullpo_ret(src_bl);
 
 	switch(type)
 	{
@@ -354,6 +349,7 @@ int clif_send(const uint8* buf, int len, struct block_list* bl, enum send_target
 	struct battleground_data *bg = NULL;
 	int x0 = 0, x1 = 0, y0 = 0, y1 = 0, fd;
 	struct s_mapiterator* iter;
+	struct map_query q;
 
 	if( type != ALL_CLIENT && type != CHAT_MAINCHAT )
 		nullpo_ret(bl);
@@ -396,12 +392,18 @@ int clif_send(const uint8* buf, int len, struct block_list* bl, enum send_target
 			clif_send (buf, len, bl, SELF);
 	case AREA_WOC:
 	case AREA_WOS:
-		map_foreachinarea(clif_send_sub, bl->m, bl->x-AREA_SIZE, bl->y-AREA_SIZE, bl->x+AREA_SIZE, bl->y+AREA_SIZE,
-			BL_PC, buf, len, bl, type);
+		map_query_inarea(&q, bl->m, bl->x-AREA_SIZE, bl->y-AREA_SIZE, bl->x+AREA_SIZE, bl->y+AREA_SIZE, BL_PC);
+		for( i = 0; i < q.count; i++ )
+			if( q.bl[i]->prev )
+				clif_send_sub(q.bl[i], buf, len, bl, type);
+		map_query_end(&q);
 		break;
 	case AREA_CHAT_WOC:
-		map_foreachinarea(clif_send_sub, bl->m, bl->x-(AREA_SIZE-5), bl->y-(AREA_SIZE-5),
-			bl->x+(AREA_SIZE-5), bl->y+(AREA_SIZE-5), BL_PC, buf, len, bl, AREA_WOC);
+		map_query_inarea(&q, bl->m, bl->x-(AREA_SIZE-5), bl->y-(AREA_SIZE-5), bl->x+(AREA_SIZE-5), bl->y+(AREA_SIZE-5), BL_PC);
+		for( i = 0; i < q.count; i++ )
+			if( q.bl[i]->prev )
+				clif_send_sub(q.bl[i], buf, len, bl, AREA_WOC);
+		map_query_end(&q);
 		break;
 
 	case CHAT:
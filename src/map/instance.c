@@ -101,7 +101,7 @@ int instance_create(int party_id, const char *name)
 int instance_add_map(const char *name, int instance_id, bool usebasename)
 {
 	int m = map_mapname2mapid(name), i, im = -1;
-	size_t num_cell, size;
+	size_t num_cell;
 
 	if( m < 0 )
 		return -1; // source map not found
@@ -143,16 +143,21 @@ int instance_add_map(const char *name, int instance_id, bool usebasename)
 	}	
 
 	// Reallocate cells
-	num_cell = map[im].xs * map[im].ys;
-	CREATE( map[im].cell, struct mapcell, num_cell );
-	memcpy( map[im].cell, map[m].cell, num_cell * sizeof(struct mapcell) );
-
-	size = map[im].bxs * map[im].bys * sizeof(struct block_list*);
-	map[im].block = (struct block_list**)aCalloc(size, 1);
-	map[im].block_mob = (struct block_list**)aCalloc(size, 1);
+	num_cell = CELL_PLANES * map[im].ys * map[im].cwords;
+	CREATE( map[im].cell, uint64, num_cell );
+	memcpy( map[im].cell, map[m].cell, num_cell * sizeof(uint64) );
+	map_cell_changed(im);
+#ifdef CELL_NOSTACK
+	// No chars on the new map yet
+	CREATE( map[im].cell_bl, unsigned char, map[im].xs * map[im].ys );
+	memset( &CELL_WORD(&map[im],CELL_NOSTACK_PLANE,0,0), 0, map[im].ys * map[im].cwords * sizeof(uint64) );
+#endif
+
+	map_block_init(im);
 
 	memset(map[im].npc, 0x00, sizeof(map[i].npc));
 	map[im].npc_num = 0;
+	map[im].npc_touch = NULL;
 
 	memset(map[im].moblist, 0x00, sizeof(map[im].moblist));
 	map[im].mob_delete_timer = INVALID_TIMER;
@@ -277,9 +282,9 @@ void instance_del_map(int m)
 	mapindex_removemap( map[m].index );
 
 	// Free memory
-	aFree(map[m].cell);
-	aFree(map[m].block);
-	aFree(map[m].block_mob);
+	map_cell_final(m);
+	map_block_final(m);
+	if( map[m].npc_touch ) aFree(map[m].npc_touch);
 
 	// Remove from instance
 	for( i = 0; i < instance[map[m].instance_id].num_map; i++ )
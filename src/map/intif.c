@@ -31,10 +31,11 @@
 #include <signal.h>
 #include <fcntl.h>
 #include <string.h>
+#include <zlib.h>
 
 
 static const int packet_len_table[]={
-	-1,-1,27,-1, -1, 0,37, 0,  0, 0, 0, 0,  0, 0,  0, 0, //0x3800-0x380f
+	-1,-1,27,-1, -1, 0,37,-1,  0, 0, 0, 0,  0, 0,  0, 0, //0x3800-0x380f
 	 0, 0, 0, 0,  0, 0, 0, 0, -1,11, 0, 0,  0, 0,  0, 0, //0x3810
 	39,-1,15,15, 14,19, 7,-1,  0, 0, 0, 0,  0, 0,  0, 0, //0x3820
 	10,-1,15, 0, 79,19, 7,-1,  0,-1,-1,-1, 14,67,186,-1, //0x3830
@@ -811,6 +812,25 @@ int intif_homunculus_requestdelete(int homun_id)
 //-----------------------------------------------------------------
 // Packets receive from inter server
 
+/// Compressed packet from the char-server, put back into the fifo uncompressed to be parsed next.
+/// R 3807 <packet len>.W <original len>.W <compressed packet>.?B
+static void intif_parse_Compressed(int fd)
+{
+	static unsigned char buf[UINT16_MAX];
+	int packet_len = RFIFOW(fd,2);
+	unsigned long len = RFIFOW(fd,4);
+
+	if( packet_len < 6 || uncompress((Bytef*)buf, &len, (const Bytef*)RFIFOP(fd,6), packet_len - 6) != Z_OK || len != RFIFOW(fd,4) || len < 2 )
+	{
+		ShowError("intif_parse_Compressed: failed to uncompress a packet from the char-server (len=%d).\n", packet_len);
+		RFIFOSKIP(fd,packet_len);
+		return;
+	}
+
+	RFIFOSKIP(fd,packet_len);
+	RFIFOINSERT(fd, buf, len);
+}
+
 // Wisp/Page reception // rewritten by [Yor]
 int intif_parse_WisMessage(int fd)
 { 
@@ -2034,6 +2054,7 @@ int intif_parse(int fd)
 	case 0x3803:	mapif_parse_WisToGM(fd); break;
 	case 0x3804:	intif_parse_Registers(fd); break;
 	case 0x3806:	intif_parse_ChangeNameOk(fd); break;
+	case 0x3807:	intif_parse_Compressed(fd); return 1; // skips the packet itself
 	case 0x3818:	intif_parse_LoadGuildStorage(fd); break;
 	case 0x3819:	intif_parse_SaveGuildStorage(fd); break;
 	case 0x3820:	intif_parse_PartyCreated(fd); break;
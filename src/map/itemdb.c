@@ -5,6 +5,7 @@
 #include "../common/malloc.h"
 #include "../common/showmsg.h"
 #include "../common/strlib.h"
+#include "../common/random.h"
 #include "itemdb.h"
 #include "map.h"
 #include "battle.h" // struct battle_config
@@ -143,8 +144,15 @@ int itemdb_searchrandomid(int group)
 		ShowError("itemdb_searchrandomid: Invalid group id %d\n", group);
 		return UNKNOWN_ITEM_ID;
 	}
-	if (itemgroup_db[group].qty)
-		return itemgroup_db[group].nameid[rand()%itemgroup_db[group].qty];
+	if (itemgroup_db[group].qty) {
+		struct item_group* ig = &itemgroup_db[group];
+		uint32 roll = rnd_roll((uint32)(ig->qty*ig->total));
+		int slot = roll/ig->total;
+
+		if( (int)(roll%ig->total) < ig->alias_rate[slot] )
+			return ig->nameid[slot];
+		return ig->nameid[ig->alias[slot]];
+	}
 	
 	ShowError("itemdb_searchrandomid: No item entries for group id %d\n", group);
 	return UNKNOWN_ITEM_ID;
@@ -508,6 +516,7 @@ static void itemdb_read_itemgroup_sub(const char* filename)
 	char line[1024];
 	int ln=0;
 	int groupid,j,k,nameid;
+	struct item_group* group;
 	char *str[3],*p;
 	char w1[1024], w2[1024];
 	
@@ -552,24 +561,99 @@ static void itemdb_read_itemgroup_sub(const char* filename)
 			continue;
 		}
 		k = atoi(str[2]);
-		if (itemgroup_db[groupid].qty+k >= MAX_RANDITEM) {
+		if (k <= 0)
+			continue;
+		group = &itemgroup_db[groupid];
+		if (group->total+k >= MAX_RANDITEM) {
 			ShowWarning("itemdb_read_itemgroup: Group %d is full (%d entries) in %s:%d\n", groupid, MAX_RANDITEM, filename, ln);
 			continue;
 		}
-		for(j=0;j<k;j++)
-			itemgroup_db[groupid].nameid[itemgroup_db[groupid].qty++] = nameid;
+		group->total += k;
+		ARR_FIND(0, group->qty, j, group->nameid[j] == nameid);
+		if (j < group->qty) {
+			group->rate[j] += k;
+			continue;
+		}
+		if (group->qty == group->max) {
+			group->max += 32;
+			RECREATE(group->nameid, int, group->max);
+			RECREATE(group->rate, int, group->max);
+		}
+		group->nameid[group->qty] = nameid;
+		group->rate[group->qty] = k;
+		group->qty++;
 	}
 	fclose(fp);
 	return;
 }
 
+/// Builds the alias table of an item group (Vose's variant of Walker's alias method).
+/// Every slot is hit with chance 1/qty and keeps its own item with chance alias_rate/total.
+static void itemdb_group_alias(struct item_group* group)
+{
+	int* work;
+	int i, small = 0, large = 0, qty = group->qty;
+
+	if( qty == 0 )
+		return;
+	CREATE(group->alias, int, qty);
+	CREATE(group->alias_rate, int, qty);
+	CREATE(work, int, qty); // small slots grow from the front, large ones from the back
+
+	for( i = 0; i < qty; i++ )
+	{
+		group->alias[i] = i;
+		group->alias_rate[i] = group->rate[i]*qty;
+		if( group->alias_rate[i] < group->total )
+			work[small++] = i;
+		else
+			work[qty - ++large] = i;
+	}
+	while( small && large )
+	{
+		int s = work[--small];
+		int l = work[qty - large];
+
+		group->alias[s] = l;
+		group->alias_rate[l] -= group->total - group->alias_rate[s];
+		if( group->alias_rate[l] < group->total )
+		{
+			large--;
+			work[small++] = l;
+		}
+	}
+	// leftovers keep their own item
+	while( small )
+		group->alias_rate[work[--small]] = group->total;
+	while( large )
+		group->alias_rate[work[qty - large--]] = group->total;
+	aFree(work);
+}
+
+static void itemdb_free_itemgroup(void)
+{
+	int i;
+
+	for( i = 0; i < MAX_ITEMGROUP; i++ )
+	{
+		if( itemgroup_db[i].nameid ) aFree(itemgroup_db[i].nameid);
+		if( itemgroup_db[i].rate ) aFree(itemgroup_db[i].rate);
+		if( itemgroup_db[i].alias ) aFree(itemgroup_db[i].alias);
+		if( itemgroup_db[i].alias_rate ) aFree(itemgroup_db[i].alias_rate);
+	}
+	memset(&itemgroup_db, 0, sizeof(itemgroup_db));
+}
+
 static void itemdb_read_itemgroup(void)
 {
 	char path[256];
+	int i;
 	snprintf(path, 255, "%s/item_group_db.txt", db_path);
 
-	memset(&itemgroup_db, 0, sizeof(itemgroup_db));
+	itemdb_free_itemgroup();
 	itemdb_read_itemgroup_sub(path);
+	for( i = 0; i < MAX_ITEMGROUP; i++ )
+		itemdb_group_alias(&itemgroup_db[i]);
 	ShowStatus("Done reading '"CL_WHITE"%s"CL_RESET"'.\n", "item_group_db.txt");
 	return;
 }
@@ -821,7 +905,10 @@ static bool itemdb_parse_dbrow(char** str, const char* source, int line, int scr
 	}
 
 	if (*str[19])
+	{
 		id->script = parse_script(str[19], source, line, scriptopt);
+		script_bonus_compile(id->script);
+	}
 	if (*str[20])
 		id->equip_script = parse_script(str[20], source, line, scriptopt);
 	if (*str[21])
@@ -1083,6 +1170,7 @@ void do_final_itemdb(void)
 
 	itemdb_other->destroy(itemdb_other, itemdb_final_sub);
 	destroy_item_data(&dummy_item, 0);
+	itemdb_free_itemgroup();
 }
 
 int do_init_itemdb(void)
@@ -87,9 +87,15 @@ struct item_data {
 	short gm_lv_trade_override;	//GM-level to override trade_restriction
 };
 
+/// Item group, sampled with Walker's alias method (see itemdb_searchrandomid).
 struct item_group {
-	int nameid[MAX_RANDITEM];
-	int qty; //Counts amount of items in the group.
+	int* nameid; // distinct items of the group
+	int* rate; // number of entries of each item
+	int* alias; // item used when the roll exceeds alias_rate
+	int* alias_rate; // threshold of each slot (0-total)
+	int qty; //Counts amount of distinct items in the group.
+	int max; // allocated size of the arrays
+	int total; // sum of the rates, at most MAX_RANDITEM
 };
 
 struct item_data* itemdb_searchname(const char *name);
@@ -3,6 +3,7 @@
 
 #include "../common/cbasetypes.h"
 #include "../common/core.h"
+#include "../common/ers.h"
 #include "../common/timer.h"
 #include "../common/grfio.h"
 #include "../common/malloc.h"
@@ -12,6 +13,7 @@
 #include "../common/nullpo.h"
 #include "../common/strlib.h"
 #include "../common/utils.h"
+#include "../common/random.h"
 
 #include "map.h"
 #include "path.h"
@@ -46,6 +48,9 @@
 #ifndef TXT_ONLY
 #include "mail.h"
 #endif
+#ifdef BATTLE_REPLAY
+#include "../test/battle_replay.h"
+#endif
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -260,34 +265,141 @@ int map_freeblock_timer(int tid, unsigned int tick, int id, intptr_t data)
  *------------------------------------------*/
 static struct block_list bl_head;
 
+static unsigned int map_cellver = 0; // last cell version given to a map
+
 #ifdef CELL_NOSTACK
+static int map_cellstack_limit = 1; // cell_stack_limit the nostack planes were built with
+
+/// Rebuilds the nostack planes of all maps when cell_stack_limit was changed.
+static void map_cellstack_sync(void)
+{
+	int i, x, y;
+
+	if( map_cellstack_limit == battle_config.cell_stack_limit )
+		return;
+	map_cellstack_limit = battle_config.cell_stack_limit;
+	for( i = 0; i < map_num; ++i )
+	{
+		struct map_data* md = &map[i];
+		if( md->cell == NULL )
+			continue;
+		md->cellver = ++map_cellver;
+		memset(&CELL_WORD(md,CELL_NOSTACK_PLANE,0,0), 0, md->ys*md->cwords*sizeof(uint64));
+		for( y = 0; y < md->ys; ++y )
+			for( x = 0; x < md->xs; ++x )
+				if( md->cell_bl[x+y*md->xs] >= map_cellstack_limit )
+					CELL_WORD(md,CELL_NOSTACK_PLANE,y,x/64) |= UINT64_C(1)<<(x%64);
+	}
+}
+
 /*==========================================
  * These pair of functions update the counter of how many objects
  * lie on a tile.
  *------------------------------------------*/
 static void map_addblcell(struct block_list *bl)
 {
+	struct map_data* md;
+
 	if( bl->m<0 || bl->x<0 || bl->x>=map[bl->m].xs || bl->y<0 || bl->y>=map[bl->m].ys || !(bl->type&BL_CHAR) )
 		return;
-	map[bl->m].cell[bl->x+bl->y*map[bl->m].xs].cell_bl++;
+	map_cellstack_sync();
+	md = &map[bl->m];
+	if( ++md->cell_bl[bl->x+bl->y*md->xs] == map_cellstack_limit )
+	{
+		CELL_WORD(md,CELL_NOSTACK_PLANE,bl->y,bl->x/64) |= UINT64_C(1)<<(bl->x%64);
+		md->cellver = ++map_cellver;
+	}
 	return;
 }
 
 static void map_delblcell(struct block_list *bl)
 {
+	struct map_data* md;
+
 	if( bl->m <0 || bl->x<0 || bl->x>=map[bl->m].xs || bl->y<0 || bl->y>=map[bl->m].ys || !(bl->type&BL_CHAR) )
 		return;
-	map[bl->m].cell[bl->x+bl->y*map[bl->m].xs].cell_bl--;
+	map_cellstack_sync();
+	md = &map[bl->m];
+	if( md->cell_bl[bl->x+bl->y*md->xs]-- == map_cellstack_limit )
+	{
+		CELL_WORD(md,CELL_NOSTACK_PLANE,bl->y,bl->x/64) &= ~(UINT64_C(1)<<(bl->x%64));
+		md->cellver = ++map_cellver;
+	}
 }
 #endif
 
+/// Allocates the (empty) blocks of a map.
+void map_block_init(int m)
+{
+	CREATE(map[m].block, struct map_block, map[m].bxs*map[m].bys);
+	CREATE(map[m].block_mob, struct map_block, map[m].bxs*map[m].bys);
+	CREATE(map[m].block_pc, struct map_block, map[m].bxs*map[m].bys);
+}
+
+/// Frees one of the block lists of a map.
+static void map_block_free(struct map_block** list, int size)
+{
+	int i;
+
+	if( *list == NULL )
+		return;
+	for( i = 0; i < size; ++i )
+		if( (*list)[i].bl )
+			aFree((*list)[i].bl);
+	aFree(*list);
+	*list = NULL;
+}
+
+/// Frees the blocks of a map.
+void map_block_final(int m)
+{
+	map_block_free(&map[m].block, map[m].bxs*map[m].bys);
+	map_block_free(&map[m].block_mob, map[m].bxs*map[m].bys);
+	map_block_free(&map[m].block_pc, map[m].bxs*map[m].bys);
+}
+
+/// Returns the block that holds an object at (x,y).
+/// Players and mobs have lists of their own, so queries for one of them skip the other objects.
+static struct map_block* map_block_get(struct block_list* bl, int x, int y)
+{
+	int pos = x/BLOCK_SIZE+(y/BLOCK_SIZE)*map[bl->m].bxs;
+
+	if( bl->type == BL_MOB )
+		return &map[bl->m].block_mob[pos];
+	if( bl->type == BL_PC )
+		return &map[bl->m].block_pc[pos];
+	return &map[bl->m].block[pos];
+}
+
+/// Makes room for one more object in a block.
+/// The arrays of a block share one allocation.
+static void map_block_grow(struct map_block* b)
+{
+	struct map_block old = *b;
+
+	b->max = ( old.max ? old.max*2 : 4 );
+	b->bl = (struct block_list**)aMalloc(b->max*(sizeof(struct block_list*) + sizeof(unsigned short) + 2*sizeof(short)));
+	b->type = (unsigned short*)(b->bl + b->max);
+	b->x = (short*)(b->type + b->max);
+	b->y = b->x + b->max;
+	if( old.bl )
+	{
+		memcpy(b->bl, old.bl, old.count*sizeof(struct block_list*));
+		memcpy(b->type, old.type, old.count*sizeof(unsigned short));
+		memcpy(b->x, old.x, old.count*sizeof(short));
+		memcpy(b->y, old.y, old.count*sizeof(short));
+		aFree(old.bl);
+	}
+}
+
 /*==========================================
  * Adds a block to the map.
  * Returns 0 on success, 1 on failure (illegal coordinates).
  *------------------------------------------*/
 int map_addblock(struct block_list* bl)
 {
-	int m, x, y, pos;
+	struct map_block* b;
+	int m, x, y, i;
 
 	nullpo_ret(bl);
 
@@ -310,19 +422,16 @@ int map_addblock(struct block_list* bl)
 		return 1;
 	}
 
-	pos = x/BLOCK_SIZE+(y/BLOCK_SIZE)*map[m].bxs;
-
-	if (bl->type == BL_MOB) {
-		bl->next = map[m].block_mob[pos];
-		bl->prev = &bl_head;
-		if (bl->next) bl->next->prev = bl;
-		map[m].block_mob[pos] = bl;
-	} else {
-		bl->next = map[m].block[pos];
-		bl->prev = &bl_head;
-		if (bl->next) bl->next->prev = bl;
-		map[m].block[pos] = bl;
-	}
+	b = map_block_get(bl, x, y);
+	if( b->count == b->max )
+		map_block_grow(b);
+	i = b->count++;
+	b->bl[i] = bl;
+	b->type[i] = bl->type;
+	b->x[i] = x;
+	b->y[i] = y;
+	bl->block_idx = i;
+	bl->prev = &bl_head;
 
 #ifdef CELL_NOSTACK
 	map_addblcell(bl);
@@ -336,37 +445,36 @@ int map_addblock(struct block_list* bl)
  *------------------------------------------*/
 int map_delblock(struct block_list* bl)
 {
-	int pos;
+	struct map_block* b;
+	int i;
 	nullpo_ret(bl);
 
-	// ?blocklist?Ă
-	if (bl->prev == NULL) {
-		if (bl->next != NULL) {
-			// prevNULLnextNULLłȂ̂͗LĂ͂ȂȂ
-			ShowError("map_delblock error : bl->next!=NULL\n");
-		}
+	// not on a map
+	if (bl->prev == NULL)
 		return 0;
-	}
 
 #ifdef CELL_NOSTACK
 	map_delblcell(bl);
 #endif
 	
-	pos = bl->x/BLOCK_SIZE+(bl->y/BLOCK_SIZE)*map[bl->m].bxs;
-
-	if (bl->next)
-		bl->next->prev = bl->prev;
-	if (bl->prev == &bl_head) {
-		// Xg̓Ȃ̂ŁAmap[]block_listXV
-		if (bl->type == BL_MOB) {
-			map[bl->m].block_mob[pos] = bl->next;
-		} else {
-			map[bl->m].block[pos] = bl->next;
-		}
-	} else {
-		bl->prev->next = bl->next;
+	// the last object of the block takes its place
+	b = map_block_get(bl, bl->x, bl->y);
+	i = bl->block_idx;
+	if( i >= b->count || b->bl[i] != bl )
+	{
+		ShowError("map_delblock: object %d is not in its block (\"%s\",%d,%d).\n", bl->id, map[bl->m].name, bl->x, bl->y);
+		bl->prev = NULL;
+		return 0;
+	}
+	--b->count;
+	if( i != b->count )
+	{
+		b->bl[i] = b->bl[b->count];
+		b->type[i] = b->type[b->count];
+		b->x[i] = b->x[b->count];
+		b->y[i] = b->y[b->count];
+		b->bl[i]->block_idx = i;
 	}
-	bl->next = NULL;
 	bl->prev = NULL;
 
 	return 0;
@@ -409,9 +517,14 @@ int map_moveblock(struct block_list *bl, int x1, int y1, unsigned int tick)
 	bl->x = x1;
 	bl->y = y1;
 	if (moveblock) map_addblock(bl);
+	else {
+		struct map_block* b = map_block_get(bl, x1, y1);
+		b->x[bl->block_idx] = x1;
+		b->y[bl->block_idx] = y1;
 #ifdef CELL_NOSTACK
-	else map_addblcell(bl);
+		map_addblcell(bl);
 #endif
+	}
 
 	if (bl->type&BL_CHAR) {
 		skill_unit_move(bl,tick,3);
@@ -433,30 +546,95 @@ int map_moveblock(struct block_list *bl, int x1, int y1, unsigned int tick)
 	return 0;
 }
 	
+/// Appends the objects of the given types in the area (x0,y0)-(x1,y1) of a
+/// block list to bl_list, except the ones in the area (ex0,ey0)-(ex1,ey1).
+/// Only the block index is read, and the filter has no branches so that it
+/// can be vectorized.
+static void map_collect_blocks(int m, const struct map_block* list, int x0, int y0, int x1, int y1, int ex0, int ey0, int ex1, int ey1, int type)
+{
+	const struct map_block* b;
+	int bx, by, i, n, count, x, y;
+
+	for( by = y0/BLOCK_SIZE; by <= y1/BLOCK_SIZE; ++by )
+	{
+		for( bx = x0/BLOCK_SIZE; bx <= x1/BLOCK_SIZE; ++bx )
+		{
+			b = &list[bx+by*map[m].bxs];
+			n = bl_list_count;
+			count = min(b->count, BL_LIST_MAX - n);
+			for( i = 0; i < count; ++i )
+			{
+				x = b->x[i];
+				y = b->y[i];
+				bl_list[n] = b->bl[i];
+				n += ((b->type[i]&type) != 0) & (x >= x0) & (x <= x1) & (y >= y0) & (y <= y1)
+					& !((x >= ex0) & (x <= ex1) & (y >= ey0) & (y <= ey1));
+			}
+			bl_list_count = n;
+		}
+	}
+}
+
+/// Appends the objects of the given types in the area (x0,y0)-(x1,y1) to
+/// bl_list, except the ones in the area (ex0,ey0)-(ex1,ey1).
+static void map_collect_area_except(int m, int x0, int y0, int x1, int y1, int ex0, int ey0, int ex1, int ey1, int type)
+{
+	if( type&~(BL_MOB|BL_PC) )
+		map_collect_blocks(m, map[m].block, x0, y0, x1, y1, ex0, ey0, ex1, ey1, type);
+	if( type&BL_PC )
+		map_collect_blocks(m, map[m].block_pc, x0, y0, x1, y1, ex0, ey0, ex1, ey1, type);
+	if( type&BL_MOB )
+		map_collect_blocks(m, map[m].block_mob, x0, y0, x1, y1, ex0, ey0, ex1, ey1, type);
+}
+
+/// Appends the objects of the given types in the area (x0,y0)-(x1,y1) to bl_list.
+#define map_collect_area(m,x0,y0,x1,y1,type) map_collect_area_except((m),(x0),(y0),(x1),(y1),1,1,0,0,(type))
+
+/// Removes the objects from bl_list[start..] that are out of range of center
+/// (with CIRCULAR_AREA) or, if shoot is set, out of its line of sight.
+static void map_filter_range(int start, struct block_list* center, int range, bool shoot)
+{
+	struct block_list* bl;
+	int i, n = start;
+
+	for( i = start; i < bl_list_count; ++i )
+	{
+		bl = bl_list[i];
+#ifdef CIRCULAR_AREA
+		if( !check_distance_bl(center, bl, range) )
+			continue;
+#endif
+		if( shoot && !path_search_long(NULL,center->m,center->x,center->y,bl->x,bl->y,CELL_CHKWALL) )
+			continue;
+		bl_list[n++] = bl;
+	}
+	bl_list_count = n;
+}
+
 /*==========================================
  * Counts specified number of objects on given cell.
  *------------------------------------------*/
 int map_count_oncell(int m, int x, int y, int type)
 {
-	int bx,by;
-	struct block_list *bl;
-	int count = 0;
+	const struct map_block* b;
+	int i, pos, count = 0;
 
 	if (x < 0 || y < 0 || (x >= map[m].xs) || (y >= map[m].ys))
 		return 0;
 
-	bx = x/BLOCK_SIZE;
-	by = y/BLOCK_SIZE;
+	pos = x/BLOCK_SIZE+(y/BLOCK_SIZE)*map[m].bxs;
+
+	if (type&~(BL_MOB|BL_PC))
+		for( b = &map[m].block[pos], i = 0; i < b->count; ++i )
+			count += ((b->type[i]&type) != 0) & (b->x[i] == x) & (b->y[i] == y);
+
+	if (type&BL_PC)
+		for( b = &map[m].block_pc[pos], i = 0; i < b->count; ++i )
+			count += (b->x[i] == x) & (b->y[i] == y);
 
-	if (type&~BL_MOB)
-		for( bl = map[m].block[bx+by*map[m].bxs] ; bl != NULL ; bl = bl->next )
-			if(bl->x == x && bl->y == y && bl->type&type)
-				count++;
-	
 	if (type&BL_MOB)
-		for( bl = map[m].block_mob[bx+by*map[m].bxs] ; bl != NULL ; bl = bl->next )
-			if(bl->x == x && bl->y == y)
-				count++;
+		for( b = &map[m].block_mob[pos], i = 0; i < b->count; ++i )
+			count += (b->x[i] == x) & (b->y[i] == y);
 
 	return count;
 }
@@ -465,23 +643,21 @@ int map_count_oncell(int m, int x, int y, int type)
  */
 struct skill_unit* map_find_skill_unit_oncell(struct block_list* target,int x,int y,int skill_id,struct skill_unit* out_unit)
 {
-	int m,bx,by;
-	struct block_list *bl;
+	const struct map_block* b;
+	int m,i;
 	struct skill_unit *unit;
 	m = target->m;
 
 	if (x < 0 || y < 0 || (x >= map[m].xs) || (y >= map[m].ys))
 		return NULL;
 
-	bx = x/BLOCK_SIZE;
-	by = y/BLOCK_SIZE;
-
-	for( bl = map[m].block[bx+by*map[m].bxs] ; bl != NULL ; bl = bl->next )
+	b = &map[m].block[x/BLOCK_SIZE+(y/BLOCK_SIZE)*map[m].bxs];
+	for( i = 0; i < b->count; ++i )
 	{
-		if (bl->x != x || bl->y != y || bl->type != BL_SKILL)
+		if (b->x[i] != x || b->y[i] != y || b->type[i] != BL_SKILL)
 			continue;
 
-		unit = (struct skill_unit *) bl;
+		unit = (struct skill_unit *) b->bl[i];
 		if( unit == out_unit || !unit->alive || !unit->group || unit->group->skill_id != skill_id )
 			continue;
 		if( battle_check_target(&unit->bl,target,unit->group->target_flag) > 0 )
@@ -490,70 +666,105 @@ struct skill_unit* map_find_skill_unit_oncell(struct block_list* target,int x,in
 	return NULL;
 }
 
-/*==========================================
- * Adapted from foreachinarea for an easier invocation. [Skotlex]
- *------------------------------------------*/
-int map_foreachinrange(int (*func)(struct block_list*,va_list), struct block_list* center, int range, int type, ...)
+/// Starts a query on the top of the object stack.
+/// Freeing is locked until map_query_end() so that the objects stay valid.
+static void map_query_begin(struct map_query* q)
 {
-	int bx,by,m;
-	int returnCount =0;	//total sum of returned values of func() [Skotlex]
-	struct block_list *bl;
-	int blockcount=bl_list_count,i;
-	int x0,x1,y0,y1;
+	q->start = bl_list_count;
+	q->bl = &bl_list[q->start];
+	q->count = 0;
+	map_freeblock_lock();
+}
 
-	m = center->m;
-	x0 = max(center->x-range, 0);
-	y0 = max(center->y-range, 0);
-	x1 = min(center->x+range, map[m].xs-1);
-	y1 = min(center->y+range, map[m].ys-1);
-	
-	if (type&~BL_MOB)
-		for (by = y0 / BLOCK_SIZE; by <= y1 / BLOCK_SIZE; by++) {
-			for(bx = x0 / BLOCK_SIZE; bx <= x1 / BLOCK_SIZE; bx++) {
-				for( bl = map[m].block[bx+by*map[m].bxs] ; bl != NULL ; bl = bl->next )
-				{
-					if( bl->type&type
-						&& bl->x>=x0 && bl->x<=x1 && bl->y>=y0 && bl->y<=y1
-#ifdef CIRCULAR_AREA
-						&& check_distance_bl(center, bl, range)
-#endif
-					  	&& bl_list_count<BL_LIST_MAX)
-						bl_list[bl_list_count++]=bl;
-				}
-			}
-		}
-	if(type&BL_MOB)
-		for(by=y0/BLOCK_SIZE;by<=y1/BLOCK_SIZE;by++){
-			for(bx=x0/BLOCK_SIZE;bx<=x1/BLOCK_SIZE;bx++){
-				for( bl = map[m].block_mob[bx+by*map[m].bxs] ; bl != NULL ; bl = bl->next )
-				{
-					if( bl->x>=x0 && bl->x<=x1 && bl->y>=y0 && bl->y<=y1
+/// Finishes collecting the objects of a query.
+static int map_query_finish(struct map_query* q, const char* caller)
+{
+	if( bl_list_count >= BL_LIST_MAX )
+		ShowWarning("%s: block count too many!\n", caller);
+	q->count = bl_list_count - q->start;
+	return q->count;
+}
+
+/// Returns in q the objects of the given types in range of center.
+int map_query_inrange(struct map_query* q, struct block_list* center, int range, int type)
+{
+	int m = center->m;
+
+	map_query_begin(q);
+	if( m < 0 )
+		return 0;
+	map_collect_area(m, max(center->x-range, 0), max(center->y-range, 0), min(center->x+range, map[m].xs-1), min(center->y+range, map[m].ys-1), type);
 #ifdef CIRCULAR_AREA
-						&& check_distance_bl(center, bl, range)
+	map_filter_range(q->start, center, range, false);
 #endif
-						&& bl_list_count<BL_LIST_MAX)
-						bl_list[bl_list_count++]=bl;
-				}
-			}
-		}
+	return map_query_finish(q, "map_query_inrange");
+}
 
-	if(bl_list_count>=BL_LIST_MAX)
-		ShowWarning("map_foreachinrange: block count too many!\n");
+/// Returns in q the objects of the given types in range and in line of sight of center.
+int map_query_inshootrange(struct map_query* q, struct block_list* center, int range, int type)
+{
+	int m = center->m;
 
-	map_freeblock_lock();	// ̉֎~
+	map_query_begin(q);
+	if( m < 0 )
+		return 0;
+	map_collect_area(m, max(center->x-range, 0), max(center->y-range, 0), min(center->x+range, map[m].xs-1), min(center->y+range, map[m].ys-1), type);
+	map_filter_range(q->start, center, range, true);
+	return map_query_finish(q, "map_query_inshootrange");
+}
 
-	for(i=blockcount;i<bl_list_count;i++)
-		if(bl_list[i]->prev)	// L?ǂ`FbN
+/// Returns in q the objects of the given types in the area (x0,y0)-(x1,y1).
+int map_query_inarea(struct map_query* q, int m, int x0, int y0, int x1, int y1, int type)
+{
+	map_query_begin(q);
+	if( m < 0 )
+		return 0;
+	if( x1 < x0 )
+		swap(x0, x1);
+	if( y1 < y0 )
+		swap(y0, y1);
+	map_collect_area(m, max(x0, 0), max(y0, 0), min(x1, map[m].xs-1), min(y1, map[m].ys-1), type);
+	return map_query_finish(q, "map_query_inarea");
+}
+
+/// Returns in q the objects of the given types on the cell (x,y).
+int map_query_incell(struct map_query* q, int m, int x, int y, int type)
+{
+	map_query_begin(q);
+	if( m < 0 || x < 0 || y < 0 || x >= map[m].xs || y >= map[m].ys )
+		return 0;
+	map_collect_area(m, x, y, x, y, type);
+	return map_query_finish(q, "map_query_incell");
+}
+
+/// Releases the objects of a query.
+void map_query_end(struct map_query* q)
+{
+	bl_list_count = q->start;
+	q->count = 0;
+	map_freeblock_unlock();
+}
+
+/*==========================================
+ * Adapted from foreachinarea for an easier invocation. [Skotlex]
+ *------------------------------------------*/
+int map_foreachinrange(int (*func)(struct block_list*,va_list), struct block_list* center, int range, int type, ...)
+{
+	struct map_query q;
+	int returnCount = 0;	//total sum of returned values of func() [Skotlex]
+	int i;
+
+	map_query_inrange(&q, center, range, type);
+	for( i = 0; i < q.count; ++i )
+		if( q.bl[i]->prev )	// L?ǂ`FbN
 		{
 			va_list ap;
 			va_start(ap, type);
-			returnCount += func(bl_list[i], ap);
+			returnCount += func(q.bl[i], ap);
 			va_end(ap);
 		}
+	map_query_end(&q);
 
-	map_freeblock_unlock();	// 
-
-	bl_list_count = blockcount;
 	return returnCount;	//[Skotlex]
 }
 
@@ -562,70 +773,21 @@ int map_foreachinrange(int (*func)(struct block_list*,va_list), struct block_lis
  *------------------------------------------*/
 int map_foreachinshootrange(int (*func)(struct block_list*,va_list),struct block_list* center, int range, int type,...)
 {
-	int bx,by,m;
-	int returnCount =0;	//total sum of returned values of func() [Skotlex]
-	struct block_list *bl;
-	int blockcount=bl_list_count,i;
-	int x0,x1,y0,y1;
-
-	m = center->m;
-	if (m < 0)
-		return 0;
-
-	x0 = max(center->x-range, 0);
-	y0 = max(center->y-range, 0);
-	x1 = min(center->x+range, map[m].xs-1);
-	y1 = min(center->y+range, map[m].ys-1);
-
-	if (type&~BL_MOB)
-		for(by = y0 / BLOCK_SIZE; by <= y1 / BLOCK_SIZE; by++) {
-			for(bx = x0 / BLOCK_SIZE; bx <= x1 / BLOCK_SIZE; bx++) {
-				for( bl = map[m].block[bx+by*map[m].bxs] ; bl != NULL ; bl = bl->next )
-				{
-					if( bl->type&type
-						&& bl->x>=x0 && bl->x<=x1 && bl->y>=y0 && bl->y<=y1
-#ifdef CIRCULAR_AREA
-						&& check_distance_bl(center, bl, range)
-#endif
-						&& path_search_long(NULL,center->m,center->x,center->y,bl->x,bl->y,CELL_CHKWALL)
-					  	&& bl_list_count<BL_LIST_MAX)
-						bl_list[bl_list_count++]=bl;
-				}
-			}
-		}
-	if(type&BL_MOB)
-		for(by=y0/BLOCK_SIZE;by<=y1/BLOCK_SIZE;by++){
-			for(bx=x0/BLOCK_SIZE;bx<=x1/BLOCK_SIZE;bx++){
-				for( bl = map[m].block_mob[bx+by*map[m].bxs] ; bl != NULL ; bl = bl->next )
-				{
-					if( bl->x>=x0 && bl->x<=x1 && bl->y>=y0 && bl->y<=y1
-#ifdef CIRCULAR_AREA
-						&& check_distance_bl(center, bl, range)
-#endif
-						&& path_search_long(NULL,center->m,center->x,center->y,bl->x,bl->y,CELL_CHKWALL)
-						&& bl_list_count<BL_LIST_MAX)
-						bl_list[bl_list_count++]=bl;
-				}
-			}
-		}
-
-	if(bl_list_count>=BL_LIST_MAX)
-			ShowWarning("map_foreachinrange: block count too many!\n");
-
-	map_freeblock_lock();	// ̉֎~
+	struct map_query q;
+	int returnCount = 0;	//total sum of returned values of func() [Skotlex]
+	int i;
 
-	for(i=blockcount;i<bl_list_count;i++)
-		if(bl_list[i]->prev)	// L?ǂ`FbN
+	map_query_inshootrange(&q, center, range, type);
+	for( i = 0; i < q.count; ++i )
+		if( q.bl[i]->prev )	// L?ǂ`FbN
 		{
 			va_list ap;
 			va_start(ap, type);
-			returnCount += func(bl_list[i], ap);
+			returnCount += func(q.bl[i], ap);
 			va_end(ap);
 		}
+	map_query_end(&q);
 
-	map_freeblock_unlock();	// 
-
-	bl_list_count = blockcount;
 	return returnCount;	//[Skotlex]
 }
 
@@ -636,114 +798,43 @@ int map_foreachinshootrange(int (*func)(struct block_list*,va_list),struct block
  *------------------------------------------*/
 int map_foreachinarea(int (*func)(struct block_list*,va_list), int m, int x0, int y0, int x1, int y1, int type, ...)
 {
-	int bx,by;
-	int returnCount =0;	//total sum of returned values of func() [Skotlex]
-	struct block_list *bl;
-	int blockcount=bl_list_count,i;
-
-	if (m < 0)
-		return 0;
-	if (x1 < x0)
-	{	//Swap range
-		swap(x0, x1);
-	}
-	if (y1 < y0)
-	{
-		swap(y0, y1);
-	}
-	x0 = max(x0, 0);
-	y0 = max(y0, 0);
-	x1 = min(x1, map[m].xs-1);
-	y1 = min(y1, map[m].ys-1);
-	if (type&~BL_MOB)
-		for(by = y0 / BLOCK_SIZE; by <= y1 / BLOCK_SIZE; by++)
-			for(bx = x0 / BLOCK_SIZE; bx <= x1 / BLOCK_SIZE; bx++)
-				for( bl = map[m].block[bx+by*map[m].bxs] ; bl != NULL ; bl = bl->next )
-					if(bl->type&type && bl->x>=x0 && bl->x<=x1 && bl->y>=y0 && bl->y<=y1 && bl_list_count<BL_LIST_MAX)
-						bl_list[bl_list_count++]=bl;
-
-	if(type&BL_MOB)
-		for(by=y0/BLOCK_SIZE;by<=y1/BLOCK_SIZE;by++)
-			for(bx=x0/BLOCK_SIZE;bx<=x1/BLOCK_SIZE;bx++)
-				for( bl = map[m].block_mob[bx+by*map[m].bxs] ; bl != NULL ; bl = bl->next )
-					if(bl->x>=x0 && bl->x<=x1 && bl->y>=y0 && bl->y<=y1 && bl_list_count<BL_LIST_MAX)
-						bl_list[bl_list_count++]=bl;
-
-	if(bl_list_count>=BL_LIST_MAX)
-		ShowWarning("map_foreachinarea: block count too many!\n");
-
-	map_freeblock_lock();	// ̉֎~
+	struct map_query q;
+	int returnCount = 0;	//total sum of returned values of func() [Skotlex]
+	int i;
 
-	for(i=blockcount;i<bl_list_count;i++)
-		if(bl_list[i]->prev)	// L?ǂ`FbN
+	map_query_inarea(&q, m, x0, y0, x1, y1, type);
+	for( i = 0; i < q.count; ++i )
+		if( q.bl[i]->prev )	// L?ǂ`FbN
 		{
 			va_list ap;
 			va_start(ap, type);
-			returnCount += func(bl_list[i], ap);
+			returnCount += func(q.bl[i], ap);
 			va_end(ap);
 		}
+	map_query_end(&q);
 
-	map_freeblock_unlock();	// 
-
-	bl_list_count = blockcount;
 	return returnCount;	//[Skotlex]
 }
 
 int map_forcountinarea(int (*func)(struct block_list*,va_list), int m, int x0, int y0, int x1, int y1, int count, int type, ...)
 {
-	int bx,by;
-	int returnCount =0;	//total sum of returned values of func() [Skotlex]
-	struct block_list *bl;
-	int blockcount=bl_list_count,i;
-
-	if (m < 0)
-		return 0;
-	if (x1 < x0)
-	{	//Swap range
-		swap(x0, x1);
-	}
-	if (y1 < y0)
-	{
-		swap(y0, y1);
-	}
-	x0 = max(x0, 0);
-	y0 = max(y0, 0);
-	x1 = min(x1, map[m].xs-1);
-	y1 = min(y1, map[m].ys-1);
-
-	if (type&~BL_MOB)
-		for(by = y0 / BLOCK_SIZE; by <= y1 / BLOCK_SIZE; by++)
-			for(bx = x0 / BLOCK_SIZE; bx <= x1 / BLOCK_SIZE; bx++)
-				for( bl = map[m].block[bx+by*map[m].bxs] ; bl != NULL ; bl = bl->next )
-					if(bl->type&type && bl->x>=x0 && bl->x<=x1 && bl->y>=y0 && bl->y<=y1 && bl_list_count<BL_LIST_MAX)
-						bl_list[bl_list_count++]=bl;
-
-	if(type&BL_MOB)
-		for(by=y0/BLOCK_SIZE;by<=y1/BLOCK_SIZE;by++)
-			for(bx=x0/BLOCK_SIZE;bx<=x1/BLOCK_SIZE;bx++)
-				for( bl = map[m].block_mob[bx+by*map[m].bxs] ; bl != NULL ; bl = bl->next )
-					if(bl->x>=x0 && bl->x<=x1 && bl->y>=y0 && bl->y<=y1 && bl_list_count<BL_LIST_MAX)
-						bl_list[bl_list_count++]=bl;
-
-	if(bl_list_count>=BL_LIST_MAX)
-		ShowWarning("map_foreachinarea: block count too many!\n");
-
-	map_freeblock_lock();	// ̉֎~
+	struct map_query q;
+	int returnCount = 0;	//total sum of returned values of func() [Skotlex]
+	int i;
 
-	for(i=blockcount;i<bl_list_count;i++)
-		if(bl_list[i]->prev)	// L?ǂ`FbN
+	map_query_inarea(&q, m, x0, y0, x1, y1, type);
+	for( i = 0; i < q.count; ++i )
+		if( q.bl[i]->prev )	// L?ǂ`FbN
 		{
 			va_list ap;
 			va_start(ap, type);
-			returnCount += func(bl_list[i], ap);
+			returnCount += func(q.bl[i], ap);
 			va_end(ap);
 			if( count && returnCount >= count )
 				break;
 		}
+	map_query_end(&q);
 
-	map_freeblock_unlock();	// 
-
-	bl_list_count = blockcount;
 	return returnCount;	//[Skotlex]
 }
 
@@ -756,9 +847,8 @@ int map_forcountinarea(int (*func)(struct block_list*,va_list), int m, int x0, i
  *------------------------------------------*/
 int map_foreachinmovearea(int (*func)(struct block_list*,va_list), struct block_list* center, int range, int dx, int dy, int type, ...)
 {
-	int bx,by,m;
+	int m;
 	int returnCount =0;  //total sum of returned values of func() [Skotlex]
-	struct block_list *bl;
 	int blockcount=bl_list_count,i;
 	int x0, x1, y0, y1;
 
@@ -796,67 +886,17 @@ int map_foreachinmovearea(int (*func)(struct block_list*,va_list), struct block_
 		y0 = max(y0, 0);
 		x1 = min(x1, map[m].xs-1);
 		y1 = min(y1, map[m].ys-1);
-		for(by=y0/BLOCK_SIZE;by<=y1/BLOCK_SIZE;by++){
-			for(bx=x0/BLOCK_SIZE;bx<=x1/BLOCK_SIZE;bx++){
-				if (type&~BL_MOB) {
-					for( bl = map[m].block[bx+by*map[m].bxs] ; bl != NULL ; bl = bl->next )
-					{
-						if(bl->type&type &&
-							bl->x>=x0 && bl->x<=x1 &&
-							bl->y>=y0 && bl->y<=y1 &&
-							bl_list_count<BL_LIST_MAX)
-							bl_list[bl_list_count++]=bl;
-					}
-				}
-				if (type&BL_MOB) {
-					for( bl = map[m].block_mob[bx+by*map[m].bxs] ; bl != NULL ; bl = bl->next )
-					{
-						if(bl->x>=x0 && bl->x<=x1 &&
-							bl->y>=y0 && bl->y<=y1 &&
-							bl_list_count<BL_LIST_MAX)
-							bl_list[bl_list_count++]=bl;
-					}
-				}
-			}
-		}
+		map_collect_area(m, x0, y0, x1, y1, type);
 	}else{
 		// Diagonal movement
 		x0 = max(x0, 0);
 		y0 = max(y0, 0);
 		x1 = min(x1, map[m].xs-1);
 		y1 = min(y1, map[m].ys-1);
-		for(by=y0/BLOCK_SIZE;by<=y1/BLOCK_SIZE;by++){
-			for(bx=x0/BLOCK_SIZE;bx<=x1/BLOCK_SIZE;bx++){
-				if (type & ~BL_MOB) {
-					for( bl = map[m].block[bx+by*map[m].bxs] ; bl != NULL ; bl = bl->next )
-					{
-						if( bl->type&type &&
-							bl->x>=x0 && bl->x<=x1 &&
-							bl->y>=y0 && bl->y<=y1 &&
-							bl_list_count<BL_LIST_MAX )
-						if((dx>0 && bl->x<x0+dx) ||
-							(dx<0 && bl->x>x1+dx) ||
-							(dy>0 && bl->y<y0+dy) ||
-							(dy<0 && bl->y>y1+dy))
-							bl_list[bl_list_count++]=bl;
-					}
-				}
-				if (type & BL_MOB) {
-					for( bl = map[m].block_mob[bx+by*map[m].bxs] ; bl != NULL ; bl = bl->next )
-					{
-						if( bl->x>=x0 && bl->x<=x1 &&
-							bl->y>=y0 && bl->y<=y1 &&
-							bl_list_count<BL_LIST_MAX)
-						if((dx>0 && bl->x<x0+dx) ||
-							(dx<0 && bl->x>x1+dx) ||
-							(dy>0 && bl->y<y0+dy) ||
-							(dy<0 && bl->y>y1+dy))
-							bl_list[bl_list_count++]=bl;
-					}
-				}
-			}
-		}
-
+		// skip the part of the area that was already in range before the move
+		map_collect_area_except(m, x0, y0, x1, y1,
+			dx > 0 ? x0+dx : x0, dy > 0 ? y0+dy : y0,
+			dx < 0 ? x1+dx : x1, dy < 0 ? y1+dy : y1, type);
 	}
 
 	if(bl_list_count>=BL_LIST_MAX)
@@ -885,44 +925,22 @@ int map_foreachinmovearea(int (*func)(struct block_list*,va_list), struct block_
 //
 int map_foreachincell(int (*func)(struct block_list*,va_list), int m, int x, int y, int type, ...)
 {
-	int bx,by;
-	int returnCount =0;  //total sum of returned values of func() [Skotlex]
-	struct block_list *bl;
-	int blockcount=bl_list_count,i;
-
-	if (x < 0 || y < 0 || x >= map[m].xs || y >= map[m].ys) return 0;
-
-	by=y/BLOCK_SIZE;
-	bx=x/BLOCK_SIZE;
-
-	if(type&~BL_MOB)
-		for( bl = map[m].block[bx+by*map[m].bxs] ; bl != NULL ; bl = bl->next )
-			if(bl->type&type && bl->x==x && bl->y==y && bl_list_count<BL_LIST_MAX)
-				bl_list[bl_list_count++]=bl;
-
-	if(type&BL_MOB)
-		for( bl = map[m].block_mob[bx+by*map[m].bxs] ; bl != NULL ; bl = bl->next )
-			if(bl->x==x && bl->y==y && bl_list_count<BL_LIST_MAX)
-				bl_list[bl_list_count++]=bl;
-
-	if(bl_list_count>=BL_LIST_MAX)
-		ShowWarning("map_foreachincell: block count too many!\n");
-
-	map_freeblock_lock();	// ̉֎~
+	struct map_query q;
+	int returnCount = 0;	//total sum of returned values of func() [Skotlex]
+	int i;
 
-	for(i=blockcount;i<bl_list_count;i++)
-		if(bl_list[i]->prev)	// L?ǂ`FbN
+	map_query_incell(&q, m, x, y, type);
+	for( i = 0; i < q.count; ++i )
+		if( q.bl[i]->prev )	// L?ǂ`FbN
 		{
 			va_list ap;
 			va_start(ap, type);
-			returnCount += func(bl_list[i], ap);
+			returnCount += func(q.bl[i], ap);
 			va_end(ap);
 		}
+	map_query_end(&q);
 
-	map_freeblock_unlock();	// 
-
-	bl_list_count = blockcount;
-	return returnCount;
+	return returnCount;	//[Skotlex]
 }
 
 /*============================================================
@@ -965,9 +983,8 @@ int map_foreachinpath(int (*func)(struct block_list*,va_list),int m,int x0,int y
 // kRO.
 
 	//Generic map_foreach* variables.
-	int i, blockcount = bl_list_count;
+	int i, j, blockcount = bl_list_count;
 	struct block_list *bl;
-	int bx, by;
 	//method specific variables
 	int magnitude2, len_limit; //The square of the magnitude
 	int k, xi, yi, xu, yu;
@@ -1026,74 +1043,37 @@ int map_foreachinpath(int (*func)(struct block_list*,va_list),int m,int x0,int y
 	
 	range*=range<<8; //Values are shifted later on for higher precision using int math.
 	
-	if (type & ~BL_MOB)
-		for (by = my0 / BLOCK_SIZE; by <= my1 / BLOCK_SIZE; by++) {
-			for(bx=mx0/BLOCK_SIZE;bx<=mx1/BLOCK_SIZE;bx++){
-				for( bl = map[m].block[bx+by*map[m].bxs] ; bl != NULL ; bl = bl->next )
-				{
-					if(bl->prev && bl->type&type && bl_list_count<BL_LIST_MAX)
-					{
-						xi = bl->x;
-						yi = bl->y;
-					
-						k = (xi-x0)*(x1-x0) + (yi-y0)*(y1-y0);
-						if (k < 0 || k > len_limit) //Since more skills use this, check for ending point as well.
-							continue;
-						
-						if (k > magnitude2 && !path_search_long(NULL,m,x0,y0,xi,yi,CELL_CHKWALL))
-							continue; //Targets beyond the initial ending point need the wall check.
-
-						//All these shifts are to increase the precision of the intersection point and distance considering how it's
-						//int math.
-						k = (k<<4)/magnitude2; //k will be between 1~16 instead of 0~1
-						xi<<=4;
-						yi<<=4;
-						xu= (x0<<4) +k*(x1-x0);
-						yu= (y0<<4) +k*(y1-y0);
-						k = MAGNITUDE2(xi, yi, xu, yu);
-						
-						//If all dot coordinates were <<4 the square of the magnitude is <<8
-						if (k > range)
-							continue;
-
-						bl_list[bl_list_count++]=bl;
-					}
-				}
-			}
-		}
+	map_collect_area(m, mx0, my0, mx1, my1, type);
 
-	if(type&BL_MOB)
-		for(by=my0/BLOCK_SIZE;by<=my1/BLOCK_SIZE;by++){
-			for(bx=mx0/BLOCK_SIZE;bx<=mx1/BLOCK_SIZE;bx++){
-				for( bl = map[m].block_mob[bx+by*map[m].bxs] ; bl != NULL ; bl = bl->next )
-				{
-					if(bl->prev && bl_list_count<BL_LIST_MAX)
-					{
-						xi = bl->x;
-						yi = bl->y;
-						k = (xi-x0)*(x1-x0) + (yi-y0)*(y1-y0);
-						if (k < 0 || k > len_limit)
-							continue;
-				
-						if (k > magnitude2 && !path_search_long(NULL,m,x0,y0,xi,yi,CELL_CHKWALL))
-							continue; //Targets beyond the initial ending point need the wall check.
+	for( i = j = blockcount; i < bl_list_count; i++ )
+	{
+		bl = bl_list[i];
+		xi = bl->x;
+		yi = bl->y;
 	
-						k = (k<<4)/magnitude2; //k will be between 1~16 instead of 0~1
-						xi<<=4;
-						yi<<=4;
-						xu= (x0<<4) +k*(x1-x0);
-						yu= (y0<<4) +k*(y1-y0);
-						k = MAGNITUDE2(xi, yi, xu, yu);
-						
-						//If all dot coordinates were <<4 the square of the magnitude is <<8
-						if (k > range)
-							continue;
-
-						bl_list[bl_list_count++]=bl;
-					}
-				}
-			}
-		}
+		k = (xi-x0)*(x1-x0) + (yi-y0)*(y1-y0);
+		if (k < 0 || k > len_limit) //Since more skills use this, check for ending point as well.
+			continue;
+		
+		if (k > magnitude2 && !path_search_long(NULL,m,x0,y0,xi,yi,CELL_CHKWALL))
+			continue; //Targets beyond the initial ending point need the wall check.
+
+		//All these shifts are to increase the precision of the intersection point and distance considering how it's
+		//int math.
+		k = (k<<4)/magnitude2; //k will be between 1~16 instead of 0~1
+		xi<<=4;
+		yi<<=4;
+		xu= (x0<<4) +k*(x1-x0);
+		yu= (y0<<4) +k*(y1-y0);
+		k = MAGNITUDE2(xi, yi, xu, yu);
+		
+		//If all dot coordinates were <<4 the square of the magnitude is <<8
+		if (k > range)
+			continue;
+
+		bl_list[j++] = bl;
+	}
+	bl_list_count = j;
 
 	if(bl_list_count>=BL_LIST_MAX)
 		ShowWarning("map_foreachinpath: block count too many!\n");
@@ -1119,24 +1099,10 @@ int map_foreachinpath(int (*func)(struct block_list*,va_list),int m,int x0,int y
 // Copy of map_foreachincell, but applied to the whole map. [Skotlex]
 int map_foreachinmap(int (*func)(struct block_list*,va_list), int m, int type,...)
 {
-	int b, bsize;
 	int returnCount =0;  //total sum of returned values of func() [Skotlex]
-	struct block_list *bl;
 	int blockcount=bl_list_count,i;
 
-	bsize = map[m].bxs * map[m].bys;
-
-	if(type&~BL_MOB)
-		for(b=0;b<bsize;b++)
-			for( bl = map[m].block[b] ; bl != NULL ; bl = bl->next )
-				if(bl->type&type && bl_list_count<BL_LIST_MAX)
-					bl_list[bl_list_count++]=bl;
-
-	if(type&BL_MOB)
-		for(b=0;b<bsize;b++)
-			for( bl = map[m].block_mob[b] ; bl != NULL ; bl = bl->next )
-				if(bl_list_count<BL_LIST_MAX)
-					bl_list[bl_list_count++]=bl;
+	map_collect_area(m, 0, 0, map[m].xs-1, map[m].ys-1, type);
 
 	if(bl_list_count>=BL_LIST_MAX)
 		ShowWarning("map_foreachinmap: block count too many!\n");
@@ -1262,6 +1228,33 @@ static int map_count_sub(struct block_list *bl,va_list ap)
 	return 1;
 }
 
+/// Number of set bits.
+static int map_popcount(uint64 b)
+{
+	b = b - ((b >> 1) & UINT64_C(0x5555555555555555));
+	b = (b & UINT64_C(0x3333333333333333)) + ((b >> 2) & UINT64_C(0x3333333333333333));
+	b = (b + (b >> 4)) & UINT64_C(0x0F0F0F0F0F0F0F0F);
+	return (int)((b * UINT64_C(0x0101010101010101)) >> 56);
+}
+
+/// Checks the flag&2 and flag&4 conditions of map_search_freecell on a reachable cell.
+/// Returns 1 if the cell is accepted, 0 to try another one, -1 to give up.
+static int map_search_freecell_check(struct block_list *src, int m, short x, short y, int flag, int *spawn)
+{
+	if(flag&2 && !unit_can_reach_pos(src, x, y, 1))
+		return 0;
+	if(flag&4) {
+		if (*spawn >= 100) return -1; //Limit of retries reached.
+		if ((*spawn)++ < battle_config.no_spawn_on_player &&
+			map_foreachinarea(map_count_sub, m,
+				x-AREA_SIZE, y-AREA_SIZE,
+			  	x+AREA_SIZE, y+AREA_SIZE, BL_PC)
+		)
+		return 0;
+	}
+	return 1;
+}
+
 /*==========================================
  * Locates a random spare cell around the object given, using range as max 
  * distance from that spot. Used for warping functions. Use range < 0 for 
@@ -1276,7 +1269,7 @@ static int map_count_sub(struct block_list *bl,va_list ap)
  *------------------------------------------*/
 int map_search_freecell(struct block_list *src, int m, short *x,short *y, int rx, int ry, int flag)
 {
-	int tries, spawn=0;
+	int tries, spawn=0, r;
 	int bx, by;
 	int rx2 = 2*rx+1;
 	int ry2 = 2*ry+1;
@@ -1309,6 +1302,40 @@ int map_search_freecell(struct block_list *src, int m, short *x,short *y, int rx
 		tries = map[m].xs*map[m].ys;
 		if (tries > 500) tries = 500;
 	}
+
+	if( rx >= 0 && ry >= 0 && rx2 < 64 && ry2 <= 64 && m >= 0 && m < map_num )
+	{// draw from the reachable cells of the area, which are read a row at a time
+		uint64 rows[64], b;
+		int free_cells = 0, i, j, n;
+
+		for( i = 0; i < ry2; i++ )
+		{
+			rows[i] = map_getcellrow(&map[m], bx-rx, by-ry+i, CELL_CHKREACH) & ((UINT64_C(1)<<rx2)-1);
+			if( i == ry )
+				rows[i] &= ~(UINT64_C(1)<<rx); //Avoid picking the same target tile.
+			free_cells += map_popcount(rows[i]);
+		}
+
+		while( tries-- && free_cells > 0 ) {
+			n = rand()%free_cells;
+			for( i = 0; n >= map_popcount(rows[i]); i++ )
+				n -= map_popcount(rows[i]);
+			for( b = rows[i]; n > 0; n-- )
+				b &= b-1; // drop the lowest cells
+			for( j = 0; !((b>>j)&1); j++ );
+			rows[i] &= ~(UINT64_C(1)<<j);
+			free_cells--;
+
+			*x = bx-rx+j;
+			*y = by-ry+i;
+			r = map_search_freecell_check(src, m, *x, *y, flag, &spawn);
+			if( r < 0 ) return 0;
+			if( r > 0 ) return 1;
+		}
+		*x = bx;
+		*y = by;
+		return 0;
+	}
 	
 	while(tries--) {
 		*x = (rx >= 0)?(rand()%rx2-rx+bx):(rand()%(map[m].xs-2)+1);
@@ -1319,18 +1346,9 @@ int map_search_freecell(struct block_list *src, int m, short *x,short *y, int rx
 		
 		if (map_getcell(m,*x,*y,CELL_CHKREACH))
 		{
-			if(flag&2 && !unit_can_reach_pos(src, *x, *y, 1))
-				continue;
-			if(flag&4) {
-				if (spawn >= 100) return 0; //Limit of retries reached.
-				if (spawn++ < battle_config.no_spawn_on_player &&
-					map_foreachinarea(map_count_sub, m,
-						*x-AREA_SIZE, *y-AREA_SIZE,
-					  	*x+AREA_SIZE, *y+AREA_SIZE, BL_PC)
-				)
-				continue;
-			}
-			return 1;
+			r = map_search_freecell_check(src, m, *x, *y, flag, &spawn);
+			if( r < 0 ) return 0;
+			if( r > 0 ) return 1;
 		}
 	}
 	*x = bx;
@@ -1357,7 +1375,7 @@ int map_addflooritem(struct item *item_data,int amount,int m,int x,int y,int fir
 
 	CREATE(fitem, struct flooritem_data, 1);
 	fitem->bl.type=BL_ITEM;
-	fitem->bl.prev = fitem->bl.next = NULL;
+	fitem->bl.prev = NULL;
 	fitem->bl.m=m;
 	fitem->bl.x=x;
 	fitem->bl.y=y;
@@ -2305,33 +2323,102 @@ int map_random_dir(struct block_list *bl, short *x, short *y)
 	return 0;
 }
 
+/// Allocates the (empty) cell planes of a map whose dimensions are known.
+static void map_cell_init(struct map_data* m)
+{
+	m->cwords = CELL_ROWWORDS(m->xs);
+	m->cellver = ++map_cellver;
+	CREATE(m->cell, uint64, CELL_PLANES*m->ys*m->cwords);
+#ifdef CELL_NOSTACK
+	CREATE(m->cell_bl, unsigned char, m->xs*m->ys);
+#endif
+}
+
+/// Frees the cell planes of a map.
+void map_cell_final(int m)
+{
+	if( map[m].cell )
+	{
+		aFree(map[m].cell);
+		map[m].cell = NULL;
+	}
+#ifdef CELL_NOSTACK
+	if( map[m].cell_bl )
+	{
+		aFree(map[m].cell_bl);
+		map[m].cell_bl = NULL;
+	}
+#endif
+}
+
+/// Gives the cells of a map a new version, after they were changed.
+void map_cell_changed(int m)
+{
+	map[m].cellver = ++map_cellver;
+}
+
+/// Tests the bit of cell (x,y) in a plane. The cell must be inside the map.
+static inline bool map_cellbit(struct map_data* m, int plane, int x, int y)
+{
+	return (bool)( (CELL_WORD(m,plane,y,x/64) >> (x%64)) & 1 );
+}
+
+/// Sets or clears the bit of cell (x,y) in a plane. The cell must be inside the map.
+static inline void map_setcellbit(struct map_data* m, int plane, int x, int y, bool flag)
+{
+	if( flag )
+		CELL_WORD(m,plane,y,x/64) |= UINT64_C(1)<<(x%64);
+	else
+		CELL_WORD(m,plane,y,x/64) &= ~(UINT64_C(1)<<(x%64));
+}
+
+/// Returns the bits of cells x..x+63 of row y in a plane (bit i is cell x+i).
+/// Requires x < cwords*64; cells left of the row read as 0.
+static inline uint64 map_cellbits(struct map_data* m, int plane, int x, int y)
+{
+	uint64* row = &CELL_WORD(m,plane,y,0);
+	int w, b;
+
+	if( x < 0 )
+		return ( x <= -64 ) ? 0 : row[0] << -x;
+	w = x/64;
+	b = x%64;
+	if( b == 0 )
+		return row[w];
+	return (row[w] >> b) | ( w+1 < m->cwords ? row[w+1] << (64-b) : 0 );
+}
+
 // gatn
-inline static struct mapcell map_gat2cell(int gat)
+/// Sets the terrain planes of cell (x,y) from a gat type.
+static void map_gat2cell(struct map_data* m, int x, int y, int gat)
 {
-	struct mapcell cell = {0};
+	bool walkable = false, shootable = false, water = false;
+
 	switch( gat )
 	{
-	case 0: cell.walkable = 1; cell.shootable = 1; cell.water = 0; break; // walkable ground
-	case 1: cell.walkable = 0; cell.shootable = 0; cell.water = 0; break; // non-walkable ground
-	case 2: cell.walkable = 1; cell.shootable = 1; cell.water = 0; break; // ???
-	case 3: cell.walkable = 1; cell.shootable = 1; cell.water = 1; break; // walkable water
-	case 4: cell.walkable = 1; cell.shootable = 1; cell.water = 0; break; // ???
-	case 5: cell.walkable = 0; cell.shootable = 1; cell.water = 0; break; // gap (snipable)
-	case 6: cell.walkable = 1; cell.shootable = 1; cell.water = 0; break; // ???
+	case 0: walkable = true;  shootable = true;  water = false; break; // walkable ground
+	case 1: walkable = false; shootable = false; water = false; break; // non-walkable ground
+	case 2: walkable = true;  shootable = true;  water = false; break; // ???
+	case 3: walkable = true;  shootable = true;  water = true;  break; // walkable water
+	case 4: walkable = true;  shootable = true;  water = false; break; // ???
+	case 5: walkable = false; shootable = true;  water = false; break; // gap (snipable)
+	case 6: walkable = true;  shootable = true;  water = false; break; // ???
 	default:
 		ShowWarning("map_gat2cell: unrecognized gat type '%d'\n", gat);
 		break;
 	}
 
-	return cell;
+	map_setcellbit(m, CELL_WALKABLE, x, y, walkable);
+	map_setcellbit(m, CELL_SHOOTABLE, x, y, shootable);
+	map_setcellbit(m, CELL_WATER, x, y, water);
 }
 
-static int map_cell2gat(struct mapcell cell)
+static int map_cell2gat(bool walkable, bool shootable, bool water)
 {
-	if( cell.walkable == 1 && cell.shootable == 1 && cell.water == 0 ) return 0;
-	if( cell.walkable == 0 && cell.shootable == 0 && cell.water == 0 ) return 1;
-	if( cell.walkable == 1 && cell.shootable == 1 && cell.water == 1 ) return 3;
-	if( cell.walkable == 0 && cell.shootable == 1 && cell.water == 0 ) return 5;
+	if( walkable && shootable && !water ) return 0;
+	if( !walkable && !shootable && !water ) return 1;
+	if( walkable && shootable && water ) return 3;
+	if( !walkable && shootable && !water ) return 5;
 
 	ShowWarning("map_cell2gat: cell has no matching gat type\n");
 	return 1; // default to 'wall'
@@ -2347,63 +2434,124 @@ int map_getcell(int m,int x,int y,cell_chk cellchk)
 
 int map_getcellp(struct map_data* m,int x,int y,cell_chk cellchk)
 {
-	struct mapcell cell;
-
 	nullpo_ret(m);
 
 	//NOTE: this intentionally overrides the last row and column
 	if(x<0 || x>=m->xs-1 || y<0 || y>=m->ys-1)
 		return( cellchk == CELL_CHKNOPASS );
 
-	cell = m->cell[x + y*m->xs];
+#ifdef CELL_NOSTACK
+	map_cellstack_sync();
+#endif
 
 	switch(cellchk)
 	{
 		// gat type retrieval
 		case CELL_GETTYPE:
-			return map_cell2gat(cell);
+			return map_cell2gat(map_cellbit(m,CELL_WALKABLE,x,y), map_cellbit(m,CELL_SHOOTABLE,x,y), map_cellbit(m,CELL_WATER,x,y));
 
 		// base gat type checks
 		case CELL_CHKWALL:
-			return (!cell.walkable && !cell.shootable);
-			//return (map_cell2gat(cell) == 1);
+			return (!map_cellbit(m,CELL_WALKABLE,x,y) && !map_cellbit(m,CELL_SHOOTABLE,x,y));
 		case CELL_CHKWATER:
-			return (cell.water);
-			//return (map_cell2gat(cell) == 3);
+			return (map_cellbit(m,CELL_WATER,x,y));
 		case CELL_CHKCLIFF:
-			return (!cell.walkable && cell.shootable);
-			//return (map_cell2gat(cell) == 5);
+			return (!map_cellbit(m,CELL_WALKABLE,x,y) && map_cellbit(m,CELL_SHOOTABLE,x,y));
 
 		// base cell type checks
 		case CELL_CHKNPC:
-			return (cell.npc);
+			return (map_cellbit(m,CELL_NPC,x,y));
 		case CELL_CHKBASILICA:
-			return (cell.basilica);
+			return (map_cellbit(m,CELL_BASILICA,x,y));
 		case CELL_CHKLANDPROTECTOR:
-			return (cell.landprotector);
+			return (map_cellbit(m,CELL_LANDPROTECTOR,x,y));
 		case CELL_CHKNOVENDING:
-			return (cell.novending);
+			return (map_cellbit(m,CELL_NOVENDING,x,y));
 		case CELL_CHKNOCHAT:
-			return (cell.nochat);
+			return (map_cellbit(m,CELL_NOCHAT,x,y));
 
 		// special checks
 		case CELL_CHKPASS:
 #ifdef CELL_NOSTACK
-			if (cell.cell_bl >= battle_config.cell_stack_limit) return 0;
+			if (map_cellbit(m,CELL_NOSTACK_PLANE,x,y)) return 0;
 #endif
 		case CELL_CHKREACH:
-			return (cell.walkable);
+			return (map_cellbit(m,CELL_WALKABLE,x,y));
 
 		case CELL_CHKNOPASS:
 #ifdef CELL_NOSTACK
-			if (cell.cell_bl >= battle_config.cell_stack_limit) return 1;
+			if (map_cellbit(m,CELL_NOSTACK_PLANE,x,y)) return 1;
 #endif
 		case CELL_CHKNOREACH:
-			return (!cell.walkable);
+			return (!map_cellbit(m,CELL_WALKABLE,x,y));
 
 		case CELL_CHKSTACK:
 #ifdef CELL_NOSTACK
-			return (cell.cell_bl >= battle_config.cell_stack_limit);
+			return (map_cellbit(m,CELL_NOSTACK_PLANE,x,y));
+#else
+			return 0;
+#endif
+
+		default:
+			return 0;
+	}
+}
+
+/// Checks cells x..x+63 of row y at once.
+/// Bit i of the result is map_getcellp(m,x+i,y,cellchk) (CELL_GETTYPE is not supported).
+uint64 map_getcellrow(struct map_data* m, int x, int y, cell_chk cellchk)
+{
+	uint64 in, walkable;
+	int lo, hi;
+
+	nullpo_ret(m);
+
+	//NOTE: same bounds as map_getcellp, the last row and column are outside
+	lo = ( x < 0 ) ? -x : 0;
+	hi = ( m->xs-1-x < 64 ) ? m->xs-1-x : 64;
+	if( y < 0 || y >= m->ys-1 || lo >= hi )
+		return ( cellchk == CELL_CHKNOPASS ) ? UINT64_MAX : 0;
+	in = ( hi == 64 ? UINT64_MAX : (UINT64_C(1)<<hi)-1 ) & ~((UINT64_C(1)<<lo)-1); // cells inside the map
+
+#ifdef CELL_NOSTACK
+	map_cellstack_sync();
+#endif
+
+	switch(cellchk)
+	{
+		case CELL_CHKWALL:
+			return ~(map_cellbits(m,CELL_WALKABLE,x,y) | map_cellbits(m,CELL_SHOOTABLE,x,y)) & in;
+		case CELL_CHKWATER:
+			return map_cellbits(m,CELL_WATER,x,y) & in;
+		case CELL_CHKCLIFF:
+			return ~map_cellbits(m,CELL_WALKABLE,x,y) & map_cellbits(m,CELL_SHOOTABLE,x,y) & in;
+
+		case CELL_CHKNPC:
+			return map_cellbits(m,CELL_NPC,x,y) & in;
+		case CELL_CHKBASILICA:
+			return map_cellbits(m,CELL_BASILICA,x,y) & in;
+		case CELL_CHKLANDPROTECTOR:
+			return map_cellbits(m,CELL_LANDPROTECTOR,x,y) & in;
+		case CELL_CHKNOVENDING:
+			return map_cellbits(m,CELL_NOVENDING,x,y) & in;
+		case CELL_CHKNOCHAT:
+			return map_cellbits(m,CELL_NOCHAT,x,y) & in;
+
+		case CELL_CHKPASS:
+		case CELL_CHKNOPASS:
+			walkable = map_cellbits(m,CELL_WALKABLE,x,y) & in;
+#ifdef CELL_NOSTACK
+			walkable &= ~map_cellbits(m,CELL_NOSTACK_PLANE,x,y);
+#endif
+			return ( cellchk == CELL_CHKPASS ) ? walkable : ~walkable;
+		case CELL_CHKREACH:
+			return map_cellbits(m,CELL_WALKABLE,x,y) & in;
+		case CELL_CHKNOREACH:
+			return ~map_cellbits(m,CELL_WALKABLE,x,y) & in;
+
+		case CELL_CHKSTACK:
+#ifdef CELL_NOSTACK
+			return map_cellbits(m,CELL_NOSTACK_PLANE,x,y) & in;
 #else
 			return 0;
 #endif
@@ -2420,43 +2568,29 @@ int map_getcellp(struct map_data* m,int x,int y,cell_chk cellchk)
  *------------------------------------------*/
 void map_setcell(int m, int x, int y, cell_t cell, bool flag)
 {
-	int j;
-
 	if( m < 0 || m >= map_num || x < 0 || x >= map[m].xs || y < 0 || y >= map[m].ys )
 		return;
 
-	j = x + y*map[m].xs;
-
-	switch( cell ) {
-		case CELL_WALKABLE:      map[m].cell[j].walkable = flag;      break;
-		case CELL_SHOOTABLE:     map[m].cell[j].shootable = flag;     break;
-		case CELL_WATER:         map[m].cell[j].water = flag;         break;
+	if( cell < 0 || cell >= CELL_MAX )
+	{
+		ShowWarning("map_setcell: invalid cell type '%d'\n", (int)cell);
+		return;
+	}
 
-		case CELL_NPC:           map[m].cell[j].npc = flag;           break;
-		case CELL_BASILICA:      map[m].cell[j].basilica = flag;      break;
-		case CELL_LANDPROTECTOR: map[m].cell[j].landprotector = flag; break;
-		case CELL_NOVENDING:     map[m].cell[j].novending = flag;     break;
-		case CELL_NOCHAT:        map[m].cell[j].nochat = flag;        break;
-		default:
-			ShowWarning("map_setcell: invalid cell type '%d'\n", (int)cell);
-			break;
+	if( map_cellbit(&map[m], cell, x, y) != flag )
+	{
+		map_setcellbit(&map[m], cell, x, y, flag);
+		map_cell_changed(m);
 	}
 }
 
 void map_setgatcell(int m, int x, int y, int gat)
 {
-	int j;
-	struct mapcell cell;
-
 	if( m < 0 || m >= map_num || x < 0 || x >= map[m].xs || y < 0 || y >= map[m].ys )
 		return;
 
-	j = x + y*map[m].xs;
-
-	cell = map_gat2cell(gat);
-	map[m].cell[j].walkable = cell.walkable;
-	map[m].cell[j].shootable = cell.shootable;
-	map[m].cell[j].water = cell.water;
+	map_gat2cell(&map[m], x, y, gat);
+	map_cell_changed(m);
 }
 
 /*==========================================
@@ -2710,11 +2844,9 @@ int map_readfromcache(struct map_data *m, char *buffer, char *decode_buffer)
 		// TO-DO: Maybe handle the scenario, if the decoded buffer isn't the same size as expected? [Shinryo]
 		decode_zip(decode_buffer, &size, p+sizeof(struct map_cache_map_info), info->len);
 
-		CREATE(m->cell, struct mapcell, size);
-
-
+		map_cell_init(m);
 		for( xy = 0; xy < size; ++xy )
-			m->cell[xy] = map_gat2cell(decode_buffer[xy]);
+			map_gat2cell(m, xy%m->xs, xy/m->xs, (uint8)decode_buffer[xy]);
 
 		return 1;
 	}
@@ -2842,7 +2974,7 @@ int map_readgat (struct map_data* m)
 	m->xs = *(int32*)(gat+6);
 	m->ys = *(int32*)(gat+10);
 	num_cells = m->xs * m->ys;
-	CREATE(m->cell, struct mapcell, num_cells);
+	map_cell_init(m);
 
 	water_height = map_waterheight(m->name);
 
@@ -2858,7 +2990,7 @@ int map_readgat (struct map_data* m)
 		if( type == 0 && water_height != NO_WATER && height > water_height )
 			type = 3; // Cell is 0 (walkable) but under water level, set to 3 (walkable water)
 
-		m->cell[xy] = map_gat2cell(type);
+		map_gat2cell(m, xy%m->xs, xy/m->xs, type);
 	}
 	
 	aFree(gat);
@@ -2915,8 +3047,6 @@ int map_readallmaps (void)
 
 	for(i = 0; i < map_num; i++)
 	{
-		size_t size;
-
 		// show progress
 		if(enable_grf)
 			ShowStatus("Loading maps [%i/%i]: %s"CL_CLL"\r", i, map_num, map[i].name);
@@ -2938,10 +3068,7 @@ int map_readallmaps (void)
 		if (uidb_get(map_db,(unsigned int)map[i].index) != NULL)
 		{
 			ShowWarning("Map %s already loaded!"CL_CLL"\n", map[i].name);
-			if (map[i].cell) {
-				aFree(map[i].cell);
-				map[i].cell = NULL;	
-			}
+			map_cell_final(i);
 			map_delmapid(i);
 			maps_removed++;
 			i--;
@@ -2957,9 +3084,7 @@ int map_readallmaps (void)
 		map[i].bxs = (map[i].xs + BLOCK_SIZE - 1) / BLOCK_SIZE;
 		map[i].bys = (map[i].ys + BLOCK_SIZE - 1) / BLOCK_SIZE;
 
-		size = map[i].bxs * map[i].bys * sizeof(struct block_list*);
-		map[i].block = (struct block_list**)aCalloc(size, 1);
-		map[i].block_mob = (struct block_list**)aCalloc(size, 1);
+		map_block_init(i);
 	}
 
 	// intialization and configuration-dependent adjustments of mapflags
@@ -3002,6 +3127,8 @@ int parse_console(const char* buf)
 
 	memset(&sd, 0, sizeof(struct map_session_data));
 	strcpy(sd.status.name, "console");
+	sd.bl.type = BL_PC;
+	status_change_init(&sd.bl);
 
 	if( ( n = sscanf(buf, "%63[^:]:%63[^:]:%63s %d %d[^\n]", type, command, map, &x, &y) ) < 5 )
 	{
@@ -3048,6 +3175,25 @@ int parse_console(const char* buf)
 		{
 			runflag = SERVER_STATE_STOP;
 		}
+		else if( strcmpi("memory", command) == 0 )
+		{
+			ShowInfo("Memory usage: %u KB\n", (unsigned int)malloc_usage());
+			ers_report();
+			arena_report();
+		}
+		else if( strcmpi("timers", command) == 0 )
+		{
+			timer_stats_report(20);
+		}
+		else if( strcmpi("timersdump", command) == 0 )
+		{
+			timer_stats_dump(timer_stats_file);
+			ShowInfo("Timer statistics written to '%s'.\n", timer_stats_file);
+		}
+		else if( strcmpi("timersreset", command) == 0 )
+		{
+			timer_stats_reset();
+		}
 	}
 	else if( strcmpi("help", type) == 0 )
 	{
@@ -3059,6 +3205,10 @@ int parse_console(const char* buf)
 		ShowInfo("IE: @spawn\n");
 		ShowInfo("To shutdown the server:\n");
 		ShowInfo("  server:shutdown\n");
+		ShowInfo("To show the memory usage of each subsystem:\n");
+		ShowInfo("  server:memory\n");
+		ShowInfo("To show, dump or reset the time used by the timer functions:\n");
+		ShowInfo("  server:timers, server:timersdump, server:timersreset\n");
 	}
 
 	return 0;
@@ -3106,6 +3256,18 @@ int map_config_read(char *cfgName)
 			ShowInfo("Console Silent Setting: %d\n", atoi(w2));
 			msg_silent = atoi(w2);
 		} else
+		if(strcmpi(w1,"timer_stats")==0)
+			timer_stats_enabled = (bool)config_switch(w2);
+		else
+		if(strcmpi(w1,"tick_budget")==0)
+			tick_budget = atoi(w2);
+		else
+		if(strcmpi(w1,"timer_stats_interval")==0)
+			timer_stats_interval = atoi(w2);
+		else
+		if(strcmpi(w1,"timer_stats_file")==0)
+			safestrncpy(timer_stats_file, w2, sizeof(timer_stats_file));
+		else
 		if (strcmpi(w1, "userid")==0)
 			chrif_setuserid(w2);
 		else
@@ -3449,9 +3611,9 @@ void do_final(void)
 	map_db->destroy(map_db, map_db_final);
 	
 	for (i=0; i<map_num; i++) {
-		if(map[i].cell) aFree(map[i].cell);
-		if(map[i].block) aFree(map[i].block);
-		if(map[i].block_mob) aFree(map[i].block_mob);
+		map_cell_final(i);
+		map_block_final(i);
+		if(map[i].npc_touch) aFree(map[i].npc_touch);
 		if(battle_config.dynamic_mobs) { //Dynamic mobs flag by [random]
 			for (j=0; j<MAX_MOB_LIST_PER_MAP; j++)
 				if (map[i].moblist[j]) aFree(map[i].moblist[j]);
@@ -3527,6 +3689,9 @@ static void map_helpscreen(bool do_exit)
 	ShowInfo("  --grf-path <file>\t\tAlternative GRF path configuration.\n");
 	ShowInfo("  --inter-config <file>\t\tAlternative inter-server configuration.\n");
 	ShowInfo("  --log-config <file>\t\tAlternative logging configuration.\n");
+#ifdef BATTLE_REPLAY
+	ShowInfo("  --replay-casts <file>\t\tReplays a battle cast set and exits (testing).\n");
+#endif
 	if( do_exit )
 		exit(EXIT_SUCCESS);
 }
@@ -3590,6 +3755,9 @@ static bool map_arg_next_value(const char* option, int i, int argc)
 int do_init(int argc, char *argv[])
 {
 	int i;
+#ifdef BATTLE_REPLAY
+	const char* replay_file = NULL;
+#endif
 
 #ifdef GCOLLECT
 	GC_enable_incremental();
@@ -3605,6 +3773,7 @@ int do_init(int argc, char *argv[])
 	GRF_PATH_FILENAME = "conf/grf-files.txt";
 
 	srand(gettick());
+	rnd_init();
 
 	for( i = 1; i < argc ; i++ )
 	{
@@ -3671,6 +3840,13 @@ int do_init(int argc, char *argv[])
 			{
 				runflag = SERVER_STATE_STOP;
 			}
+#ifdef BATTLE_REPLAY
+			else if( strcmp(arg, "replay-casts") == 0 )
+			{
+				if( map_arg_next_value(arg, i, argc) )
+					replay_file = argv[++i];
+			}
+#endif
 			else
 			{
 				ShowError("Unknown option '%s'.\n", argv[i]);
@@ -3779,6 +3955,16 @@ int do_init(int argc, char *argv[])
 		//##TODO invoke a CONSOLE_START plugin event
 	}
 
+#ifdef BATTLE_REPLAY
+	if( replay_file != NULL )
+	{
+		if( battle_replay(replay_file) != 0 )
+			exit(EXIT_FAILURE);
+		runflag = SERVER_STATE_STOP;
+		return 0;
+	}
+#endif
+
 	if (battle_config.pk_mode)
 		ShowNotice("Server is running on '"CL_WHITE"PK Mode"CL_RESET"'.\n");
 
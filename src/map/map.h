@@ -247,10 +247,32 @@ enum auto_trigger_flag {
 };
 
 struct block_list {
-	struct block_list *next,*prev;
+	struct block_list *prev; // not NULL while the object is on a map block
 	int id;
 	short m,x,y;
 	enum bl_type type;
+	int block_idx; // index of the object in its map_block
+};
+
+/// Objects on a block of BLOCK_SIZE x BLOCK_SIZE cells.
+/// The type and position of each object are kept in arrays of their own,
+/// so map_foreach* can filter a block without dereferencing its objects.
+struct map_block {
+	int count, max;
+	struct block_list** bl;
+	unsigned short* type; // enum bl_type
+	short* x;
+	short* y;
+};
+
+/// Objects returned by a map_query_* function.
+/// The objects stay allocated until map_query_end(), but the ones removed
+/// from the map in the meantime have prev == NULL and must be skipped.
+/// Queries may be nested, and must be ended in the reverse order.
+struct map_query {
+	struct block_list** bl;
+	int count;
+	int start; // position of the query on the shared object stack
 };
 
 
@@ -361,7 +383,7 @@ enum _look {
 	LOOK_ROBE,
 };
 
-// used by map_setcell()
+// used by map_setcell(); also the index of the matching cell plane (see map_data.cell)
 typedef enum {
 	CELL_WALKABLE,
 	CELL_SHOOTABLE,
@@ -372,6 +394,8 @@ typedef enum {
 	CELL_LANDPROTECTOR,
 	CELL_NOVENDING,
 	CELL_NOCHAT,
+
+	CELL_MAX
 } cell_t;
 
 // used by map_getcell()
@@ -395,26 +419,18 @@ typedef enum {
 	CELL_CHKNOCHAT,
 } cell_chk;
 
-struct mapcell
-{
-	// terrain flags
-	unsigned char
-		walkable : 1,
-		shootable : 1,
-		water : 1;
-
-	// dynamic flags
-	unsigned char
-		npc : 1,
-		basilica : 1,
-		landprotector : 1,
-		novending : 1,
-		nochat : 1;
-
 #ifdef CELL_NOSTACK
-	unsigned char cell_bl; //Holds amount of bls in this cell.
+#define CELL_NOSTACK_PLANE CELL_MAX // plane of the cells that reached the cell stacking limit
+#define CELL_PLANES (CELL_MAX+1)
+#else
+#define CELL_PLANES CELL_MAX
 #endif
-};
+
+/// Number of 64-bit words in one row of a cell plane.
+#define CELL_ROWWORDS(xs) (((xs)+63)/64)
+
+/// Word 'w' of row 'y' of a cell plane.
+#define CELL_WORD(md,plane,y,w) ( (md)->cell[((plane)*(md)->ys + (y))*(md)->cwords + (w)] )
 
 struct iwall_data {
 	char wall_name[50];
@@ -425,11 +441,18 @@ struct iwall_data {
 struct map_data {
 	char name[MAP_NAME_LENGTH];
 	unsigned short index; // The map index used by the mapindex* functions.
-	struct mapcell* cell; // Holds the information of each map cell (NULL if the map is not on this map-server).
-	struct block_list **block;
-	struct block_list **block_mob;
+	uint64* cell; // CELL_PLANES bit-planes of ys rows of cwords words, bit x%64 of word x/64 is cell x (NULL if the map is not on this map-server).
+#ifdef CELL_NOSTACK
+	unsigned char* cell_bl; // amount of chars on each cell
+#endif
+	unsigned int cellver; // changes whenever the cell planes do (results computed over them are stale)
+	struct map_block* block; // objects other than players and mobs, per block (see map_addblock)
+	struct map_block* block_mob; // mobs, per block
+	struct map_block* block_pc; // players, per block
+	struct npc_data ***npc_touch; // per block, NULL-terminated list of the npcs whose touch area overlaps it (see npc_setcells)
 	int m;
 	short xs,ys; // map dimensions (in cells)
+	short cwords; // words per cell plane row (see CELL_ROWWORDS)
 	short bxs,bys; // map dimensions (in blocks)
 	short bgscore_lion, bgscore_eagle; // Battleground ScoreBoard
 	int npc_num;
@@ -510,13 +533,14 @@ struct map_data {
 struct map_data_other_server {
 	char name[MAP_NAME_LENGTH];
 	unsigned short index; //Index is the map index used by the mapindex* functions.
-	struct mapcell* cell; // If this is NULL, the map is not on this map-server
+	uint64* cell; // If this is NULL, the map is not on this map-server
 	uint32 ip;
 	uint16 port;
 };
 
 int map_getcell(int,int,int,cell_chk);
 int map_getcellp(struct map_data*,int,int,cell_chk);
+uint64 map_getcellrow(struct map_data* md, int x, int y, cell_chk cellchk);
 void map_setcell(int m, int x, int y, cell_t cell, bool flag);
 void map_setgatcell(int m, int x, int y, int gat);
 
@@ -551,6 +575,15 @@ int map_freeblock_unlock(void);
 int map_addblock(struct block_list* bl);
 int map_delblock(struct block_list* bl);
 int map_moveblock(struct block_list *, int, int, unsigned int);
+void map_block_init(int m);
+void map_block_final(int m);
+void map_cell_final(int m);
+void map_cell_changed(int m);
+int map_query_inrange(struct map_query* q, struct block_list* center, int range, int type);
+int map_query_inshootrange(struct map_query* q, struct block_list* center, int range, int type);
+int map_query_inarea(struct map_query* q, int m, int x0, int y0, int x1, int y1, int type);
+int map_query_incell(struct map_query* q, int m, int x, int y, int type);
+void map_query_end(struct map_query* q);
 int map_foreachinrange(int (*func)(struct block_list*,va_list), struct block_list* center, int range, int type, ...);
 int map_foreachinshootrange(int (*func)(struct block_list*,va_list), struct block_list* center, int range, int type, ...);
 int map_foreachinarea(int (*func)(struct block_list*,va_list), int m, int x0, int y0, int x1, int y1, int type, ...);
@@ -11,6 +11,7 @@
 #include "../common/strlib.h"
 #include "../common/utils.h"
 #include "../common/socket.h"
+#include "../common/random.h"
 
 #include "map.h"
 #include "path.h"
@@ -1540,10 +1541,8 @@ static bool mob_ai_sub_hard(struct mob_data *md, unsigned int tick)
 	return true;
 }
 
-static int mob_ai_sub_hard_timer(struct block_list *bl,va_list ap)
+static int mob_ai_sub_hard_timer(struct mob_data *md, unsigned int tick)
 {
-	struct mob_data *md = (struct mob_data*)bl;
-	unsigned int tick = va_arg(ap, unsigned int);
 	if (mob_ai_sub_hard(md, tick)) 
 	{	//Hard AI triggered.
 		if(!md->state.spotted)
@@ -1558,9 +1557,16 @@ static int mob_ai_sub_hard_timer(struct block_list *bl,va_list ap)
  *------------------------------------------*/
 static int mob_ai_sub_foreachclient(struct map_session_data *sd,va_list ap)
 {
+	struct map_query q;
 	unsigned int tick;
+	int i;
 	tick=va_arg(ap,unsigned int);
-	map_foreachinrange(mob_ai_sub_hard_timer,&sd->bl, AREA_SIZE+ACTIVE_AI_RANGE, BL_MOB,tick);
+
+	map_query_inrange(&q, &sd->bl, AREA_SIZE+ACTIVE_AI_RANGE, BL_MOB);
+	for( i = 0; i < q.count; i++ )
+		if( q.bl[i]->prev )
+			mob_ai_sub_hard_timer((struct mob_data*)q.bl[i], tick);
+	map_query_end(&q);
 
 	return 0;
 }
@@ -1657,6 +1663,44 @@ static int mob_ai_hard(int tid, unsigned int tick, int id, intptr_t data)
 	return 0;
 }
 
+/// Converts a drop rate (1-10000) to the chance of a drop roll,
+/// the item drops when rnd() <= chance.
+static uint32 mob_drop_chance(int rate)
+{
+	if( rate >= 10000 )
+		return UINT32_MAX;
+	if( rate <= 0 )
+		return 0;
+	return (uint32)((((uint64)rate)<<32)/10000 - 1);
+}
+
+/// Rebuilds the drop table of a mob from its dropitem entries.
+/// Needs to be redone when the drop rates or drop_rate0item change.
+static void mob_drop_table(struct mob_db* db)
+{
+	int i;
+
+	db->drop_count = 0;
+	for( i = 0; i < MAX_MOB_DROP; i++ )
+	{
+		struct mob_drop* drop;
+		int rate = db->dropitem[i].p;
+
+		if( db->dropitem[i].nameid <= 0 )
+			continue;
+		if( rate <= 0 )
+		{
+			if( battle_config.drop_rate0item )
+				continue;
+			rate = 1;
+		}
+		drop = &db->drop[db->drop_count++];
+		drop->index = i;
+		drop->p = rate;
+		drop->chance = mob_drop_chance(rate);
+	}
+}
+
 /*==========================================
  * Initializes the delay drop structure for mob-dropped items.
  *------------------------------------------*/
@@ -2183,7 +2227,8 @@ int mob_dead(struct mob_data *md, struct block_list *src, int type)
 	{ // Item Drop
 		struct item_drop_list *dlist = ers_alloc(item_drop_list_ers, struct item_drop_list);
 		struct item_drop *ditem;
-		int drop_rate;
+		int drop_rate, luk = 0, boost = 0;
+		bool pk_bonus, modified;
 		dlist->m = md->bl.m;
 		dlist->x = md->bl.x;
 		dlist->y = md->bl.y;
@@ -2192,45 +2237,46 @@ int mob_dead(struct mob_data *md, struct block_list *src, int type)
 		dlist->third_charid = (third_sd ? third_sd->status.char_id : 0);
 		dlist->item = NULL;
 
-		for (i = 0; i < MAX_MOB_DROP; i++)
-		{
-			if (md->db->dropitem[i].nameid <= 0)
-				continue;
-			if (!itemdb_exists(md->db->dropitem[i].nameid))
-				continue;
-			drop_rate = md->db->dropitem[i].p;
-			if (drop_rate <= 0) {
-				if (battle_config.drop_rate0item)
-					continue;
-				drop_rate = 1;
-			}
+		// modifiers of this kill, the precomputed chances are used without them
+		if (src && (battle_config.drops_by_luk || battle_config.drops_by_luk2))
+			luk = status_get_luk(src);
+		pk_bonus = (sd && battle_config.pk_mode && (int)(md->level - sd->status.base_level) >= 20);
+		if (sd && sd->sc.data[SC_ITEMBOOST])
+			boost = sd->sc.data[SC_ITEMBOOST]->val1;
+		modified = (md->special_state.size || luk || pk_bonus || boost);
 
-			// change drops depending on monsters size [Valaris]
-			if(md->special_state.size==1 && drop_rate >= 2)
-				drop_rate/=2;
-			else if(md->special_state.size==2)
-				drop_rate*=2;
-			if (src) {
+		for (i = 0; i < md->db->drop_count; i++)
+		{
+			struct mob_drop* drop = &md->db->drop[i];
+			int nameid = md->db->dropitem[drop->index].nameid;
+			uint32 chance = drop->chance;
+
+			drop_rate = drop->p;
+			if (modified) {
+				// change drops depending on monsters size [Valaris]
+				if(md->special_state.size==1 && drop_rate >= 2)
+					drop_rate/=2;
+				else if(md->special_state.size==2)
+					drop_rate*=2;
 				//Drops affected by luk as a fixed increase [Valaris]
-				if (battle_config.drops_by_luk)
-					drop_rate += status_get_luk(src)*battle_config.drops_by_luk/100;
+				if (luk && battle_config.drops_by_luk)
+					drop_rate += luk*battle_config.drops_by_luk/100;
 				//Drops affected by luk as a % increase [Skotlex] 
-				if (battle_config.drops_by_luk2)
-					drop_rate += (int)(0.5+drop_rate*status_get_luk(src)*battle_config.drops_by_luk2/10000.);
+				if (luk && battle_config.drops_by_luk2)
+					drop_rate += (int)(0.5+drop_rate*luk*battle_config.drops_by_luk2/10000.);
+				if (pk_bonus)
+					drop_rate = (int)(drop_rate*1.25); // pk_mode increase drops if 20 level difference [Valaris]
+				// Increase drop rate if user has SC_ITEMBOOST
+				if (boost) // now rig the drop rate to never be over 90% unless it is originally >90%.
+					drop_rate = max(drop_rate,cap_value((int)(0.5+drop_rate*boost/100.),0,9000));
+				chance = mob_drop_chance(drop_rate);
 			}
-			if (sd && battle_config.pk_mode &&
-				(int)(md->level - sd->status.base_level) >= 20)
-				drop_rate = (int)(drop_rate*1.25); // pk_mode increase drops if 20 level difference [Valaris]
-
-			// Increase drop rate if user has SC_ITEMBOOST
-			if (sd && sd->sc.data[SC_ITEMBOOST]) // now rig the drop rate to never be over 90% unless it is originally >90%.
-				drop_rate = max(drop_rate,cap_value((int)(0.5+drop_rate*(sd->sc.data[SC_ITEMBOOST]->val1)/100.),0,9000));
 
 			// attempt to drop the item
-			if (rand() % 10000 >= drop_rate)
-					continue;
+			if (rnd() > chance || !itemdb_exists(nameid))
+				continue;
 
-			ditem = mob_setdropitem(md->db->dropitem[i].nameid, 1);
+			ditem = mob_setdropitem(nameid, 1);
 
 			//A Rare Drop Global Announce by Lupus
 			if( mvp_sd && drop_rate <= battle_config.rare_drop_announce )
@@ -2244,7 +2290,7 @@ int mob_dead(struct mob_data *md, struct block_list *src, int type)
 			}
 			// Announce first, or else ditem will be freed. [Lance]
 			// By popular demand, use base drop rate for autoloot code. [Skotlex]
-			mob_item_drop(md, dlist, ditem, 0, md->db->dropitem[i].p, homkillonly);
+			mob_item_drop(md, dlist, ditem, 0, md->db->dropitem[drop->index].p, homkillonly);
 		}
 
 		// Ore Discovery [Celest]
@@ -4275,6 +4321,8 @@ static bool mob_readdb_race2(char* fields[], int columns, int current)
 
 static void mob_load(void)
 {
+	int i;
+
 #ifndef TXT_ONLY
 	if(db_use_sqldbs)
 		mob_read_sqldb();
@@ -4287,6 +4335,10 @@ static void mob_load(void)
 	mob_readchatdb();
 	mob_readskilldb();
 	sv_readdb(db_path, "mob_race2_db.txt", ',', 2, 20, -1, &mob_readdb_race2);
+
+	for( i = 0; i <= MAX_MOB_DB; i++ )
+		if( mob_db_data[i] )
+			mob_drop_table(mob_db_data[i]);
 }
 
 void mob_reload(void)
@@ -4320,8 +4372,8 @@ int do_init_mob(void)
 	memset(mob_db_data,0,sizeof(mob_db_data)); //Clear the array
 	mob_db_data[0] = (struct mob_db*)aCalloc(1, sizeof (struct mob_db));	//This mob is used for random spawns
 	mob_makedummymobdb(0); //The first time this is invoked, it creates the dummy mob
-	item_drop_ers = ers_new(sizeof(struct item_drop));
-	item_drop_list_ers = ers_new(sizeof(struct item_drop_list));
+	item_drop_ers = ers_new(sizeof(struct item_drop), "mob.c::item_drop_ers");
+	item_drop_list_ers = ers_new(sizeof(struct item_drop_list), "mob.c::item_drop_list_ers");
 
 	mob_load();
 
@@ -86,6 +86,13 @@ struct spawn_info {
 	unsigned short qty;
 };
  
+/// Precomputed drop of a mob, rolled with rnd().
+struct mob_drop {
+	int index; // index in dropitem
+	int p; // effective rate (1-10000)
+	uint32 chance; // rnd() <= chance drops the item
+};
+
 struct mob_db {
 	char sprite[NAME_LENGTH],name[NAME_LENGTH],jname[NAME_LENGTH];
 	unsigned int base_exp,job_exp;
@@ -95,6 +102,8 @@ struct mob_db {
 	unsigned short lv;
 	struct { int nameid,p; } dropitem[MAX_MOB_DROP];
 	struct { int nameid,p; } mvpitem[3];
+	struct mob_drop drop[MAX_MOB_DROP]; // droppable entries of dropitem, see mob_drop_table
+	int drop_count;
 	struct status_data status;
 	struct view_data vd;
 	short option;
@@ -75,6 +75,7 @@ int npc_get_new_npc_id(void)
 }
 
 static DBMap* ev_db; // const char* event_name -> struct event_data*
+static DBMap* ev_label_db; // const char* "::label" (case-insensitive) -> struct event_label*
 DBMap* npcname_db; // const char* npc_name -> struct npc_data*
 
 struct event_data {
@@ -82,6 +83,13 @@ struct event_data {
 	int pos;
 };
 
+/// Names of the events ("npc::label") that share a label, in load order.
+/// Global events only run the events of their label instead of searching ev_db.
+struct event_label {
+	char* names;// count names of EVENT_NAME_LENGTH chars
+	int count, max;
+};
+
 static struct eri *timer_event_ers; //For the npc timer data. [Skotlex]
 
 //For holding the view data of npc classes. [Skotlex]
@@ -247,6 +255,55 @@ int npc_event_dequeue(struct map_session_data* sd)
 	return 1;
 }
 
+static void* create_event_label(DBKey key, va_list args)
+{
+	struct event_label* el;
+	CREATE(el, struct event_label, 1);
+	return el;
+}
+
+static int npc_event_label_final(DBKey key, void* data, va_list ap)
+{
+	struct event_label* el = (struct event_label*)data;
+	if( el->names )
+		aFree(el->names);
+	return 0;
+}
+
+/// Adds a new event of ev_db to the index of its label.
+static void npc_event_label_add(const char* eventname)
+{
+	struct event_label* el;
+	const char* label = strstr(eventname, "::");
+
+	if( label == NULL )
+		return;
+	el = (struct event_label*)ev_label_db->ensure(ev_label_db, db_str2key(label), create_event_label);
+	if( el->count == el->max )
+	{
+		el->max = ( el->max ? 2*el->max : 4 );
+		RECREATE(el->names, char, el->max*EVENT_NAME_LENGTH);
+	}
+	safestrncpy(el->names + el->count*EVENT_NAME_LENGTH, eventname, EVENT_NAME_LENGTH);
+	++el->count;
+}
+
+/// Removes an event of ev_db from the index of its label.
+static void npc_event_label_remove(const char* eventname)
+{
+	struct event_label* el;
+	const char* label = strstr(eventname, "::");
+	int i;
+
+	if( label == NULL || (el = (struct event_label*)strdb_get(ev_label_db, label)) == NULL )
+		return;
+	ARR_FIND(0, el->count, i, strcmp(el->names + i*EVENT_NAME_LENGTH, eventname) == 0);
+	if( i == el->count )
+		return;
+	--el->count;
+	memmove(el->names + i*EVENT_NAME_LENGTH, el->names + (i+1)*EVENT_NAME_LENGTH, (el->count - i)*EVENT_NAME_LENGTH);
+}
+
 /*==========================================
  * exports a npc event label
  * npc_parse_script->strdb_foreachĂ΂
@@ -274,7 +331,8 @@ int npc_event_export(char* lname, void* data, va_list ap)
 			*p = '\0';
 			snprintf(buf, ARRAYLENGTH(buf), "%s::%s", nd->exname, lname);
 			*p = ':';
-			strdb_put(ev_db, buf, ev);
+			if( strdb_put(ev_db, buf, ev) == NULL )
+				npc_event_label_add(buf);
 		}
 	}
 	return 0;
@@ -284,63 +342,50 @@ int npc_event_sub(struct map_session_data* sd, struct event_data* ev, const char
 /*==========================================
  * SĂNPCOn*Cxgs
  *------------------------------------------*/
-int npc_event_doall_sub(DBKey key, void* data, va_list ap)
+/// Runs the events with this label ("::label").
+/// If name is given, only the events that match it (case-insensitive) are run.
+static int npc_event_dolabel(const char* label, const char* name, int rid)
 {
-	const char* p = key.str;
+	struct event_label* el = (struct event_label*)strdb_get(ev_label_db, label);
 	struct event_data* ev;
-	int* c;
-	const char* name;
-	int rid;
+	char* names;
+	int i, count, c = 0;
 
-	nullpo_ret(ev = (struct event_data *)data);
-	nullpo_ret(c = va_arg(ap, int *));
-	nullpo_ret(name = va_arg(ap, const char *));
-	rid = va_arg(ap, int);
+	if( el == NULL || el->count == 0 )
+		return 0;
 
-	p = strchr(p, ':'); // match only the event name
-	if( p && strcmpi(name, p) == 0 /* && !ev->nd->src_id */ ) // Do not run on duplicates. [Paradox924X]
+	// scripts can load and unload events, run from a copy of the names
+	count = el->count;
+	names = (char*)aMalloc(count*EVENT_NAME_LENGTH);
+	memcpy(names, el->names, count*EVENT_NAME_LENGTH);
+	for( i = 0; i < count; ++i )
 	{
+		const char* eventname = names + i*EVENT_NAME_LENGTH;
+
+		if( name && strcmpi(name, eventname) != 0 )
+			continue;
+		if( (ev = (struct event_data*)strdb_get(ev_db, eventname)) == NULL )
+			continue;// unloaded
+
 		if(rid) // a player may only have 1 script running at the same time
-			npc_event_sub(map_id2sd(rid),ev,key.str);
+			npc_event_sub(map_id2sd(rid),ev,eventname);
 		else
 			run_script(ev->nd->u.scr.script,ev->pos,rid,ev->nd->bl.id);
-		(*c)++;
-	}
-
-	return 0;
-}
-
-static int npc_event_do_sub(DBKey key, void* data, va_list ap)
-{
-	const char* p = key.str;
-	struct event_data* ev;
-	int* c;
-	const char* name;
-
-	nullpo_ret(ev = (struct event_data *)data);
-	nullpo_ret(c = va_arg(ap, int *));
-	nullpo_ret(name = va_arg(ap, const char *));
-
-	if( p && strcmpi(name, p) == 0 )
-	{
-		run_script(ev->nd->u.scr.script,ev->pos,0,ev->nd->bl.id);
-		(*c)++;
+		c++;
 	}
+	aFree(names);
 
-	return 0;
+	return c;
 }
 
 // runs the specified event (supports both single-npc and global events)
 int npc_event_do(const char* name)
 {
-	int c = 0;
+	const char* label = strstr(name, "::");
 
-	if( name[0] == ':' && name[1] == ':' )
-		ev_db->foreach(ev_db,npc_event_doall_sub,&c,name,0);
-	else
-		ev_db->foreach(ev_db,npc_event_do_sub,&c,name);
-
-	return c;
+	if( label == NULL )
+		return 0;
+	return npc_event_dolabel(label, ( label == name ? NULL : name ), 0);
 }
 // runs the specified event (global only)
 int npc_event_doall(const char* name)
@@ -350,11 +395,9 @@ int npc_event_doall(const char* name)
 // runs the specified event, with a RID attached (global only)
 int npc_event_doall_id(const char* name, int rid)
 {
-	int c = 0;
 	char buf[64];
 	safesnprintf(buf, sizeof(buf), "::%s", name);
-	ev_db->foreach(ev_db,npc_event_doall_sub,&c,buf,rid);
-	return c;
+	return npc_event_dolabel(buf, NULL, rid);
 }
 
 
@@ -795,6 +838,133 @@ int npc_event(struct map_session_data* sd, const char* eventname, int ontouch)
 	return npc_event_sub(sd,ev,eventname);
 }
 
+/// Gets the touch area of the npc (warp or OnTouch).
+/// Returns false if the npc doesn't have one.
+static bool npc_toucharea(struct npc_data* nd, int* xs, int* ys)
+{
+	switch(nd->subtype)
+	{
+	case WARP:
+		*xs = nd->u.warp.xs;
+		*ys = nd->u.warp.ys;
+		break;
+	case SCRIPT:
+		*xs = nd->u.scr.xs;
+		*ys = nd->u.scr.ys;
+		break;
+	default:
+		return false; // Other types doesn't have touch area
+	}
+
+	return ( nd->bl.m >= 0 && *xs >= 0 && *ys >= 0 );
+}
+
+/// Adds the npc to the touch lists of the blocks its touch area overlaps.
+static void npc_touch_add(struct npc_data* nd)
+{
+	int m = nd->bl.m, xs, ys, bx, by, bx0, by0, bx1, by1, n;
+	struct npc_data*** list;
+
+	if( !npc_toucharea(nd, &xs, &ys) )
+		return;
+
+	bx0 = max(nd->bl.x - xs, 0) / BLOCK_SIZE;
+	by0 = max(nd->bl.y - ys, 0) / BLOCK_SIZE;
+	bx1 = min(nd->bl.x + xs, map[m].xs - 1) / BLOCK_SIZE;
+	by1 = min(nd->bl.y + ys, map[m].ys - 1) / BLOCK_SIZE;
+	if( map[m].npc_touch == NULL )
+		CREATE(map[m].npc_touch, struct npc_data**, map[m].bxs*map[m].bys);
+
+	for( by = by0; by <= by1; ++by )
+	{
+		for( bx = bx0; bx <= bx1; ++bx )
+		{
+			list = &map[m].npc_touch[bx + by*map[m].bxs];
+			for( n = 0; *list && (*list)[n]; ++n )
+				if( (*list)[n] == nd )
+					return; // already added
+			RECREATE(*list, struct npc_data*, n + 2);
+			(*list)[n] = nd;
+			(*list)[n+1] = NULL;
+		}
+	}
+}
+
+/// Removes the npc from the touch lists of the blocks its touch area overlaps.
+static void npc_touch_remove(struct npc_data* nd)
+{
+	int m = nd->bl.m, xs, ys, bx, by, bx0, by0, bx1, by1, i;
+	struct npc_data*** list;
+
+	if( !npc_toucharea(nd, &xs, &ys) || map[m].npc_touch == NULL )
+		return;
+
+	bx0 = max(nd->bl.x - xs, 0) / BLOCK_SIZE;
+	by0 = max(nd->bl.y - ys, 0) / BLOCK_SIZE;
+	bx1 = min(nd->bl.x + xs, map[m].xs - 1) / BLOCK_SIZE;
+	by1 = min(nd->bl.y + ys, map[m].ys - 1) / BLOCK_SIZE;
+
+	for( by = by0; by <= by1; ++by )
+	{
+		for( bx = bx0; bx <= bx1; ++bx )
+		{
+			list = &map[m].npc_touch[bx + by*map[m].bxs];
+			if( *list == NULL )
+				continue;
+			for( i = 0; (*list)[i] && (*list)[i] != nd; ++i );
+			for( ; (*list)[i]; ++i )
+				(*list)[i] = (*list)[i+1];
+			if( (*list)[0] == NULL )
+			{
+				aFree(*list);
+				*list = NULL;
+			}
+		}
+	}
+}
+
+/// Returns the first visible npc of the types in flag (&1: warps, &2: scripts)
+/// whose touch area intersects the area (x0,y0)-(x1,y1).
+/// Sets *hidden if an invisible npc was skipped.
+static struct npc_data* npc_touch_search(int flag, int m, int x0, int y0, int x1, int y1, bool* hidden)
+{
+	struct npc_data** list;
+	struct npc_data* nd;
+	int bx, by, xs, ys, i;
+
+	if( map[m].npc_touch == NULL )
+		return NULL;
+
+	x0 = max(x0, 0);
+	y0 = max(y0, 0);
+	x1 = min(x1, map[m].xs - 1);
+	y1 = min(y1, map[m].ys - 1);
+	for( by = y0/BLOCK_SIZE; by <= y1/BLOCK_SIZE; ++by )
+	{
+		for( bx = x0/BLOCK_SIZE; bx <= x1/BLOCK_SIZE; ++bx )
+		{
+			if( (list = map[m].npc_touch[bx + by*map[m].bxs]) == NULL )
+				continue;
+			for( i = 0; (nd = list[i]) != NULL; ++i )
+			{
+				if( !(flag&(nd->subtype == WARP ? 1 : 2)) || !npc_toucharea(nd, &xs, &ys) )
+					continue;
+				if( x1 < nd->bl.x-xs || x0 > nd->bl.x+xs || y1 < nd->bl.y-ys || y0 > nd->bl.y+ys )
+					continue;
+				if( nd->sc.option&OPTION_INVISIBLE )
+				{
+					if( hidden )
+						*hidden = true;
+					continue;
+				}
+				return nd;
+			}
+		}
+	}
+
+	return NULL;
+}
+
 int npc_touch_areanpc_sub(struct block_list *bl, va_list ap)
 {
 	struct map_session_data *sd;
@@ -850,9 +1020,8 @@ int npc_touchnext_areanpc(struct map_session_data* sd, bool leavemap)
  *------------------------------------------*/
 int npc_touch_areanpc(struct map_session_data* sd, int m, int x, int y)
 {
-	int xs,ys;
-	int f = 1;
-	int i;
+	struct npc_data* nd;
+	bool hidden = false;
 
 	nullpo_retr(1, sd);
 
@@ -860,43 +1029,20 @@ int npc_touch_areanpc(struct map_session_data* sd, int m, int x, int y)
 	//if(sd->npc_id)
 	//	return 1;
 
-	for(i=0;i<map[m].npc_num;i++)
+	if( (nd = npc_touch_search(1|2, m, x, y, x, y, &hidden)) == NULL )
 	{
-		if (map[m].npc[i]->sc.option&OPTION_INVISIBLE) {
-			f=0; // a npc was found, but it is disabled; don't print warning
-			continue;
-		}
-
-		switch(map[m].npc[i]->subtype) {
-		case WARP:
-			xs=map[m].npc[i]->u.warp.xs;
-			ys=map[m].npc[i]->u.warp.ys;
-			break;
-		case SCRIPT:
-			xs=map[m].npc[i]->u.scr.xs;
-			ys=map[m].npc[i]->u.scr.ys;
-			break;
-		default:
-			continue;
-		}
-		if( x >= map[m].npc[i]->bl.x-xs && x <= map[m].npc[i]->bl.x+xs
-		&&  y >= map[m].npc[i]->bl.y-ys && y <= map[m].npc[i]->bl.y+ys )
-			break;
-	}
-	if( i == map[m].npc_num )
-	{
-		if( f == 1 ) // no npc found
+		if( !hidden ) // no npc found (a disabled npc doesn't print the warning)
 			ShowError("npc_touch_areanpc : stray NPC cell on coordinates '%s',%d,%d\n", map[m].name, x, y);
 		return 1;
 	}
-	switch(map[m].npc[i]->subtype) {
+	switch(nd->subtype) {
 		case WARP:
 			if( pc_ishiding(sd) )
 				break; // hidden chars cannot use warps
-			pc_setpos(sd,map[m].npc[i]->u.warp.mapindex,map[m].npc[i]->u.warp.x,map[m].npc[i]->u.warp.y,CLR_OUTSIGHT);
+			pc_setpos(sd,nd->u.warp.mapindex,nd->u.warp.x,nd->u.warp.y,CLR_OUTSIGHT);
 			break;
 		case SCRIPT:
-			if( npc_ontouch_event(sd,map[m].npc[i]) > 0 && npc_ontouch2_event(sd,map[m].npc[i]) > 0 )
+			if( npc_ontouch_event(sd,nd) > 0 && npc_ontouch2_event(sd,nd) > 0 )
 			{ // failed to run OnTouch event, so just click the npc
 				struct unit_data *ud = unit_bl2ud(&sd->bl);
 				if( ud && ud->walkpath.path_pos < ud->walkpath.path_len )
@@ -904,8 +1050,8 @@ int npc_touch_areanpc(struct map_session_data* sd, int m, int x, int y)
 					clif_fixpos(&sd->bl);
 					ud->walkpath.path_pos = ud->walkpath.path_len;
 				}
-				sd->areanpc_id = map[m].npc[i]->bl.id;
-				npc_click(sd,map[m].npc[i]);
+				sd->areanpc_id = nd->bl.id;
+				npc_click(sd,nd);
 			}
 			break;
 	}
@@ -916,58 +1062,37 @@ int npc_touch_areanpc(struct map_session_data* sd, int m, int x, int y)
 // Return 1 if Warped
 int npc_touch_areanpc2(struct mob_data *md)
 {
-	int i, m = md->bl.m, x = md->bl.x, y = md->bl.y, id;
+	int m = md->bl.m, id;
 	char eventname[EVENT_NAME_LENGTH];
 	struct event_data* ev;
-	int xs, ys;
-
-	for( i = 0; i < map[m].npc_num; i++ )
-	{
-		if( map[m].npc[i]->sc.option&OPTION_INVISIBLE )
-			continue;
-
-		switch( map[m].npc[i]->subtype )
-		{
-			case WARP:
-				if( !( battle_config.mob_warp&1 ) )
-					continue;
-				xs = map[m].npc[i]->u.warp.xs;
-				ys = map[m].npc[i]->u.warp.ys;
-				break;
-			case SCRIPT:
-				xs = map[m].npc[i]->u.scr.xs;
-				ys = map[m].npc[i]->u.scr.ys;
-				break;
-			default:
-				continue; // Keep Searching
-		}
+	struct npc_data* nd;
+	int xs;
 
-		if( x >= map[m].npc[i]->bl.x-xs && x <= map[m].npc[i]->bl.x+xs && y >= map[m].npc[i]->bl.y-ys && y <= map[m].npc[i]->bl.y+ys )
-		{ // In the npc touch area
-			switch( map[m].npc[i]->subtype )
-			{
-				case WARP:
-					xs = map_mapindex2mapid(map[m].npc[i]->u.warp.mapindex);
-					if( m < 0 )
-						break; // Cannot Warp between map servers
-					if( unit_warp(&md->bl, xs, map[m].npc[i]->u.warp.x, map[m].npc[i]->u.warp.y, CLR_OUTSIGHT) == 0 )
-						return 1; // Warped
-					break;
-				case SCRIPT:
-					if( map[m].npc[i]->bl.id == md->areanpc_id )
-						break; // Already touch this NPC
-					snprintf(eventname, ARRAYLENGTH(eventname), "%s::OnTouchNPC", map[m].npc[i]->exname);
-					if( (ev = (struct event_data*)strdb_get(ev_db, eventname)) == NULL || ev->nd == NULL )
-						break; // No OnTouchNPC Event
-					md->areanpc_id = map[m].npc[i]->bl.id;
-					id = md->bl.id; // Stores Unique ID
-					run_script(ev->nd->u.scr.script, ev->pos, md->bl.id, ev->nd->bl.id);
-					if( map_id2md(id) == NULL ) return 1; // Not Warped, but killed
-					break;
-			}
+	nd = npc_touch_search(( battle_config.mob_warp&1 ? 1 : 0 )|2, m, md->bl.x, md->bl.y, md->bl.x, md->bl.y, NULL);
+	if( nd == NULL )
+		return 0;
 
-			return 0;
-		}
+	// In the npc touch area
+	switch( nd->subtype )
+	{
+		case WARP:
+			xs = map_mapindex2mapid(nd->u.warp.mapindex);
+			if( m < 0 )
+				break; // Cannot Warp between map servers
+			if( unit_warp(&md->bl, xs, nd->u.warp.x, nd->u.warp.y, CLR_OUTSIGHT) == 0 )
+				return 1; // Warped
+			break;
+		case SCRIPT:
+			if( nd->bl.id == md->areanpc_id )
+				break; // Already touch this NPC
+			snprintf(eventname, ARRAYLENGTH(eventname), "%s::OnTouchNPC", nd->exname);
+			if( (ev = (struct event_data*)strdb_get(ev_db, eventname)) == NULL || ev->nd == NULL )
+				break; // No OnTouchNPC Event
+			md->areanpc_id = nd->bl.id;
+			id = md->bl.id; // Stores Unique ID
+			run_script(ev->nd->u.scr.script, ev->pos, md->bl.id, ev->nd->bl.id);
+			if( map_id2md(id) == NULL ) return 1; // Not Warped, but killed
+			break;
 	}
 
 	return 0;
@@ -979,6 +1104,7 @@ int npc_touch_areanpc2(struct mob_data *md)
 //&2: NPCs with on-touch events.
 int npc_check_areanpc(int flag, int m, int x, int y, int range)
 {
+	struct npc_data* nd;
 	int i;
 	int x0,y0,x1,y1;
 	int xs,ys;
@@ -1000,37 +1126,8 @@ int npc_check_areanpc(int flag, int m, int x, int y, int range)
 	if (!i) return 0; //No NPC_CELLs.
 
 	//Now check for the actual NPC on said range.
-	for(i=0;i<map[m].npc_num;i++)
-	{
-		if (map[m].npc[i]->sc.option&OPTION_INVISIBLE)
-			continue;
-
-		switch(map[m].npc[i]->subtype)
-		{
-		case WARP:
-			if (!(flag&1))
-				continue;
-			xs=map[m].npc[i]->u.warp.xs;
-			ys=map[m].npc[i]->u.warp.ys;
-			break;
-		case SCRIPT:
-			if (!(flag&2))
-				continue;
-			xs=map[m].npc[i]->u.scr.xs;
-			ys=map[m].npc[i]->u.scr.ys;
-			break;
-		default:
-			continue;
-		}
-
-		if( x1 >= map[m].npc[i]->bl.x-xs && x0 <= map[m].npc[i]->bl.x+xs
-		&&  y1 >= map[m].npc[i]->bl.y-ys && y0 <= map[m].npc[i]->bl.y+ys )
-			break; // found a npc
-	}
-	if (i==map[m].npc_num)
-		return 0;
-
-	return (map[m].npc[i]->bl.id);
+	nd = npc_touch_search(flag, m, x0, y0, x1, y1, NULL);
+	return ( nd ? nd->bl.id : 0 );
 }
 
 struct npc_data* npc_checknear(struct map_session_data* sd, struct block_list* bl)
@@ -1558,6 +1655,7 @@ static int npc_unload_ev(DBKey key, void* data, va_list ap)
 	char* npcname = va_arg(ap, char *);
 
 	if(strcmp(ev->nd->exname,npcname)==0){
+		npc_event_label_remove(key.str);
 		db_remove(ev_db, key);
 		return 1;
 	}
@@ -1806,7 +1904,7 @@ struct npc_data* npc_add_warp(short from_mapid, short from_x, short from_y, shor
 	CREATE(nd, struct npc_data, 1);
 	nd->bl.id = npc_get_new_npc_id();
 	map_addnpc(from_mapid, nd);
-	nd->bl.prev = nd->bl.next = NULL;
+	nd->bl.prev = NULL;
 	nd->bl.m = from_mapid;
 	nd->bl.x = from_x;
 	nd->bl.y = from_y;
@@ -1827,11 +1925,11 @@ struct npc_data* npc_add_warp(short from_mapid, short from_x, short from_y, shor
 	nd->u.warp.xs = xs;
 	nd->u.warp.ys = xs;
 	nd->bl.type = BL_NPC;
+	status_change_init(&nd->bl);
 	nd->subtype = WARP;
 	npc_setcells(nd);
 	map_addblock(&nd->bl);
 	status_set_viewdata(&nd->bl, nd->class_);
-	status_change_init(&nd->bl);
 	unit_dataset(&nd->bl);
 	clif_spawn(&nd->bl);
 	strdb_put(npcname_db, nd->exname, nd);
@@ -1868,7 +1966,7 @@ static const char* npc_parse_warp(char* w1, char* w2, char* w3, char* w4, const
 
 	nd->bl.id = npc_get_new_npc_id();
 	map_addnpc(m, nd);
-	nd->bl.prev = nd->bl.next = NULL;
+	nd->bl.prev = NULL;
 	nd->bl.m = m;
 	nd->bl.x = x;
 	nd->bl.y = y;
@@ -1887,11 +1985,11 @@ static const char* npc_parse_warp(char* w1, char* w2, char* w3, char* w4, const
 	nd->u.warp.ys = ys;
 	npc_warp++;
 	nd->bl.type = BL_NPC;
+	status_change_init(&nd->bl);
 	nd->subtype = WARP;
 	npc_setcells(nd);
 	map_addblock(&nd->bl);
 	status_set_viewdata(&nd->bl, nd->class_);
-	status_change_init(&nd->bl);
 	unit_dataset(&nd->bl);
 	clif_spawn(&nd->bl);
 	strdb_put(npcname_db, nd->exname, nd);
@@ -1980,7 +2078,7 @@ static const char* npc_parse_shop(char* w1, char* w2, char* w3, char* w4, const
 	CREATE(nd->u.shop.shop_item, struct npc_item_list, i);
 	memcpy(nd->u.shop.shop_item, items, sizeof(struct npc_item_list)*i);
 	nd->u.shop.count = i;
-	nd->bl.prev = nd->bl.next = NULL;
+	nd->bl.prev = NULL;
 	nd->bl.m = m;
 	nd->bl.x = x;
 	nd->bl.y = y;
@@ -1991,13 +2089,13 @@ static const char* npc_parse_shop(char* w1, char* w2, char* w3, char* w4, const
 
 	++npc_shop;
 	nd->bl.type = BL_NPC;
+	status_change_init(&nd->bl);
 	nd->subtype = type;
 	if( m >= 0 )
 	{// normal shop npc
 		map_addnpc(m,nd);
 		map_addblock(&nd->bl);
 		status_set_viewdata(&nd->bl, nd->class_);
-		status_change_init(&nd->bl);
 		unit_dataset(&nd->bl);
 		nd->ud.dir = dir;
 		clif_spawn(&nd->bl);
@@ -2184,7 +2282,7 @@ static const char* npc_parse_script(char* w1, char* w2, char* w3, char* w4, cons
 		nd->u.scr.ys = -1;
 	}
 
-	nd->bl.prev = nd->bl.next = NULL;
+	nd->bl.prev = NULL;
 	nd->bl.m = m;
 	nd->bl.x = x;
 	nd->bl.y = y;
@@ -2198,12 +2296,12 @@ static const char* npc_parse_script(char* w1, char* w2, char* w3, char* w4, cons
 
 	++npc_script;
 	nd->bl.type = BL_NPC;
+	status_change_init(&nd->bl);
 	nd->subtype = SCRIPT;
 
 	if( m >= 0 )
 	{
 		map_addnpc(m, nd);
-		status_change_init(&nd->bl);
 		unit_dataset(&nd->bl);
 		nd->ud.dir = dir;
 		npc_setcells(nd);
@@ -2240,6 +2338,8 @@ static const char* npc_parse_script(char* w1, char* w2, char* w3, char* w4, cons
 			ev->pos = pos;
 			if( strdb_put(ev_db, buf, ev) != NULL )// There was already another event of the same name?
 				ShowWarning("npc_parse_script : duplicate event %s (%s)\n", buf, filepath);
+			else
+				npc_event_label_add(buf);
 		}
 	}
 
@@ -2340,7 +2440,7 @@ const char* npc_parse_duplicate(char* w1, char* w2, char* w3, char* w4, const ch
 
 	CREATE(nd, struct npc_data, 1);
 
-	nd->bl.prev = nd->bl.next = NULL;
+	nd->bl.prev = NULL;
 	nd->bl.m = m;
 	nd->bl.x = x;
 	nd->bl.y = y;
@@ -2350,6 +2450,7 @@ const char* npc_parse_duplicate(char* w1, char* w2, char* w3, char* w4, const ch
 	nd->speed = 200;
 	nd->src_id = src_id;
 	nd->bl.type = BL_NPC;
+	status_change_init(&nd->bl);
 	nd->subtype = (enum npc_subtype)type;
 	switch( type )
 	{
@@ -2387,7 +2488,6 @@ const char* npc_parse_duplicate(char* w1, char* w2, char* w3, char* w4, const ch
 	if( m >= 0 )
 	{
 		map_addnpc(m, nd);
-		status_change_init(&nd->bl);
 		unit_dataset(&nd->bl);
 		nd->ud.dir = dir;
 		npc_setcells(nd);
@@ -2428,6 +2528,8 @@ const char* npc_parse_duplicate(char* w1, char* w2, char* w3, char* w4, const ch
 			ev->pos = pos;
 			if( strdb_put(ev_db, buf, ev) != NULL )// There was already another event of the same name?
 				ShowWarning("npc_parse_duplicate : duplicate event %s (%s)\n", buf, filepath);
+			else
+				npc_event_label_add(buf);
 		}
 	}
 
@@ -2492,7 +2594,7 @@ int npc_duplicate4instance(struct npc_data *snd, int m)
 		CREATE(wnd, struct npc_data, 1);
 		wnd->bl.id = npc_get_new_npc_id();
 		map_addnpc(m, wnd);
-		wnd->bl.prev = wnd->bl.next = NULL;
+		wnd->bl.prev = NULL;
 		wnd->bl.m = m;
 		wnd->bl.x = snd->bl.x;
 		wnd->bl.y = snd->bl.y;
@@ -2506,11 +2608,11 @@ int npc_duplicate4instance(struct npc_data *snd, int m)
 		wnd->u.warp.xs = snd->u.warp.xs;
 		wnd->u.warp.ys = snd->u.warp.ys;
 		wnd->bl.type = BL_NPC;
+		status_change_init(&wnd->bl);
 		wnd->subtype = WARP;
 		npc_setcells(wnd);
 		map_addblock(&wnd->bl);
 		status_set_viewdata(&wnd->bl, wnd->class_);
-		status_change_init(&wnd->bl);
 		unit_dataset(&wnd->bl);
 		clif_spawn(&wnd->bl);
 		strdb_put(npcname_db, wnd->exname, wnd);
@@ -2535,26 +2637,12 @@ int npc_duplicate4instance(struct npc_data *snd, int m)
 	return 0;
 }
 
-void npc_setcells(struct npc_data* nd)
+static void npc_setcells_sub(struct npc_data* nd)
 {
 	int m = nd->bl.m, x = nd->bl.x, y = nd->bl.y, xs, ys;
 	int i,j;
 
-	switch(nd->subtype)
-	{
-	case WARP:
-		xs = nd->u.warp.xs;
-		ys = nd->u.warp.ys;
-		break;
-	case SCRIPT:
-		xs = nd->u.scr.xs;
-		ys = nd->u.scr.ys;
-		break;
-	default:
-		return; // Other types doesn't have touch area
-	}
-
-	if (m < 0 || xs < 0 || ys < 0)
+	if( !npc_toucharea(nd, &xs, &ys) )
 		return;
 
 	for (i = y-ys; i <= y+ys; i++) {
@@ -2566,12 +2654,18 @@ void npc_setcells(struct npc_data* nd)
 	}
 }
 
+void npc_setcells(struct npc_data* nd)
+{
+	npc_setcells_sub(nd);
+	npc_touch_add(nd);
+}
+
 int npc_unsetcells_sub(struct block_list* bl, va_list ap)
 {
 	struct npc_data *nd = (struct npc_data*)bl;
 	int id =  va_arg(ap,int);
 	if (nd->bl.id == id) return 0;
-	npc_setcells(nd);
+	npc_setcells_sub(nd);
 	return 1;
 }
 
@@ -2580,6 +2674,8 @@ void npc_unsetcells(struct npc_data* nd)
 	int m = nd->bl.m, x = nd->bl.x, y = nd->bl.y, xs, ys;
 	int i,j, x0, x1, y0, y1;
 
+	npc_touch_remove(nd);
+
 	if (nd->subtype == WARP) {
 		xs = nd->u.warp.xs;
 		ys = nd->u.warp.ys;
@@ -2681,9 +2777,7 @@ static const char* npc_parse_function(char* w1, char* w2, char* w3, char* w4, co
 	if( oldscript != NULL )
 	{
 		ShowInfo("npc_parse_function: Overwriting user function [%s] (%s:%d)\n", w3, filepath, strline(buffer,start-buffer));
-		script_free_vars(&oldscript->script_vars);
-		aFree(oldscript->script_buf);
-		aFree(oldscript);
+		script_free_code(oldscript);
 	}
 
 	return end;
@@ -3163,6 +3257,8 @@ void npc_parsesrcfile(const char* filepath)
 	}
 	fclose(fp);
 
+	script_cache_begin(filepath, buffer);
+
 	// parse buffer
 	for( p = skip_space(buffer); p && *p ; p = skip_space(p) )
 	{
@@ -3279,6 +3375,7 @@ void npc_parsesrcfile(const char* filepath)
 			p = strchr(p,'\n');// skip and continue
 		}
 	}
+	script_cache_end();
 	aFree(buffer);
 
 	return;
@@ -3403,6 +3500,7 @@ int npc_reload(void)
 
 	// clear npc-related data structures
 	ev_db->clear(ev_db,NULL);
+	ev_label_db->clear(ev_label_db,npc_event_label_final);
 	npcname_db->clear(npcname_db,NULL);
 	npc_warp = npc_shop = npc_script = 0;
 	npc_mob = npc_cache_mob = npc_delay_mob = 0;
@@ -3412,11 +3510,13 @@ int npc_reload(void)
 
 	//TODO: the following code is copy-pasted from do_init_npc(); clean it up
 	// Reloading npcs now
+	script_cache_open();
 	for (nsl = npc_src_files; nsl; nsl = nsl->next)
 	{
 		ShowStatus("Loading NPC file: %s"CL_CLL"\r", nsl->name);
 		npc_parsesrcfile(nsl->name);
 	}
+	script_cache_close();
 
 	ShowInfo ("Done loading '"CL_WHITE"%d"CL_RESET"' NPCs:"CL_CLL"\n"
 		"\t-'"CL_WHITE"%d"CL_RESET"' Warps\n"
@@ -3461,6 +3561,7 @@ int do_final_npc(void)
 	}
 
 	ev_db->destroy(ev_db, NULL);
+	ev_label_db->destroy(ev_label_db, npc_event_label_final);
 	//There is no free function for npcname_db because at this point there shouldn't be any npcs left!
 	//So if there is anything remaining, let the memory manager catch it and report it.
 	npcname_db->destroy(npcname_db, NULL);
@@ -3513,18 +3614,21 @@ int do_init_npc(void)
 	struct npc_src_list *file;
 
 	ev_db = strdb_alloc((DBOptions)(DB_OPT_DUP_KEY|DB_OPT_RELEASE_DATA),2*NAME_LENGTH+2+1);
+	ev_label_db = stridb_alloc((DBOptions)(DB_OPT_DUP_KEY|DB_OPT_RELEASE_DATA),EVENT_NAME_LENGTH);
 	npcname_db = strdb_alloc(DB_OPT_BASE,NAME_LENGTH);
 	npcview_db = idb_alloc(DB_OPT_RELEASE_DATA);
 
-	timer_event_ers = ers_new(sizeof(struct timer_event_data));
+	timer_event_ers = ers_new(sizeof(struct timer_event_data), "npc.c::timer_event_ers");
 
 	// process all npc files
 	ShowStatus("Loading NPCs...\r");
+	script_cache_open();
 	for( file = npc_src_files; file != NULL; file = file->next )
 	{
 		ShowStatus("Loading NPC file: %s"CL_CLL"\r", file->name);
 		npc_parsesrcfile(file->name);
 	}
+	script_cache_close();
 
 	ShowInfo ("Done loading '"CL_WHITE"%d"CL_RESET"' NPCs:"CL_CLL"\n"
 		"\t-'"CL_WHITE"%d"CL_RESET"' Warps\n"
@@ -3558,6 +3662,7 @@ int do_init_npc(void)
 	npc_script++;
 	fake_nd->bl.type = BL_NPC;
 	fake_nd->subtype = SCRIPT;
+	status_change_init(&fake_nd->bl);
 
 	strdb_put(npcname_db, fake_nd->exname, fake_nd);
 	fake_nd->u.scr.timerid = INVALID_TIMER;
@@ -19,6 +19,25 @@
 struct tmp_path { short x,y,dist,before,cost,flag;};
 #define calc_index(x,y) (((x)+(y)*MAX_WALKPATH) & (MAX_WALKPATH*MAX_WALKPATH-1))
 
+/// Search nodes, only the ones stamped with the current search are valid (the others read as zeroed).
+static struct tmp_path tp[MAX_WALKPATH*MAX_WALKPATH];
+static unsigned int tp_stamp[MAX_WALKPATH*MAX_WALKPATH];
+static unsigned int tp_search = 0;
+
+#define PATH_CACHE_SIZE 512 // must be a power of 2
+
+/// Recent path_search() results.
+/// An entry is valid while the map keeps the cell version it was computed with.
+struct path_cache_entry {
+	int m, x0, y0, x1, y1;
+	unsigned int cellver; // 0 = unused
+	unsigned char easy;
+	unsigned char cell;
+	bool found;
+	struct walkpath_data wpd;
+};
+static struct path_cache_entry path_cache[PATH_CACHE_SIZE];
+
 const char walk_choices [3][3] =
 {
 	{1,0,7},
@@ -113,6 +132,11 @@ static int add_path(int *heap,struct tmp_path *tp,int x,int y,int dist,int befor
 	int i;
 
 	i = calc_index(x,y);
+	if( tp_stamp[i] != tp_search )
+	{
+		memset(&tp[i], 0, sizeof(tp[i]));
+		tp_stamp[i] = tp_search;
+	}
 
 	if( tp[i].x == x && tp[i].y == y )
 	{
@@ -204,6 +228,8 @@ bool path_search_long(struct shootpath_data *spd,int m,int x0,int y0,int x1,int
 	int weight;
 	struct map_data *md;
 	struct shootpath_data s_spd;
+	uint64 row = 0; // checked cells rowx..rowx+63 of row rowy
+	int rowx, rowy;
 
 	if( spd == NULL )
 		spd = &s_spd; // use dummy output variable
@@ -219,6 +245,8 @@ bool path_search_long(struct shootpath_data *spd,int m,int x0,int y0,int x1,int
 		dx = -dx;
 	}
 	dy = (y1 - y0);
+	rowx = x0 - 64; // nothing fetched yet
+	rowy = y0;
 
 	spd->rx = spd->ry = 0;
 	spd->len = 1;
@@ -238,7 +266,12 @@ bool path_search_long(struct shootpath_data *spd,int m,int x0,int y0,int x1,int
 
 	while (x0 != x1 || y0 != y1)
 	{
-		if (map_getcellp(md,x0,y0,cell))
+		if (y0 != rowy || x0 >= rowx + 64) {
+			row = map_getcellrow(md,x0,y0,cell);
+			rowx = x0;
+			rowy = y0;
+		}
+		if ((row >> (x0 - rowx))&1)
 			return false;
 		wx += dx;
 		wy += dy;
@@ -265,26 +298,13 @@ bool path_search_long(struct shootpath_data *spd,int m,int x0,int y0,int x1,int
 }
 
 /*==========================================
- * path search (x0,y0)->(x1,y1)
- * wpd: path info will be written here
- * flag: &1 = easy path search only
- * cell: type of obstruction to check for
+ * path search (x0,y0)->(x1,y1) on a local map, see path_search
  *------------------------------------------*/
-bool path_search(struct walkpath_data *wpd,int m,int x0,int y0,int x1,int y1,int flag,cell_chk cell)
+static bool path_search_sub(struct walkpath_data *wpd,struct map_data *md,int x0,int y0,int x1,int y1,int flag,cell_chk cell)
 {
 	int heap[MAX_HEAP+1];
-	struct tmp_path tp[MAX_WALKPATH*MAX_WALKPATH];
 	register int i,j,len,x,y,dx,dy;
 	int rp,xs,ys;
-	struct map_data *md;
-	struct walkpath_data s_wpd;
-
-	if( wpd == NULL )
-		wpd = &s_wpd; // use dummy output variable
-
-	if( !map[m].cell )
-		return false;
-	md = &map[m];
 
 #ifdef CELL_NOSTACK
 	//Do not check starting cell as that would get you stuck.
@@ -331,9 +351,14 @@ bool path_search(struct walkpath_data *wpd,int m,int x0,int y0,int x1,int y1,int
 	if( flag&1 )
 		return false;
 
-	memset(tp,0,sizeof(tp));
+	if( ++tp_search == 0 )
+	{// stamps wrapped around
+		memset(tp_stamp,0,sizeof(tp_stamp));
+		tp_search = 1;
+	}
 
 	i=calc_index(x0,y0);
+	tp_stamp[i]=tp_search;
 	tp[i].x=x0;
 	tp[i].y=y0;
 	tp[i].dist=0;
@@ -348,6 +373,7 @@ bool path_search(struct walkpath_data *wpd,int m,int x0,int y0,int x1,int y1,int
 	for(;;)
 	{
 		int e=0,f=0,dist,cost,dc[4]={0,0,0,0};
+		uint64 r0,r1,r2; // checked cells x-1..x+1 of rows y-1, y and y+1 (bits 0..2)
 
 		if(heap[0]==0)
 			return false;
@@ -360,34 +386,38 @@ bool path_search(struct walkpath_data *wpd,int m,int x0,int y0,int x1,int y1,int
 		if(x==x1 && y==y1)
 			break;
 
+		r0 = map_getcellrow(md,x-1,y-1,cell);
+		r1 = map_getcellrow(md,x-1,y  ,cell);
+		r2 = map_getcellrow(md,x-1,y+1,cell);
+
 		// dc[0] : y++ ̎̃RXg
 		// dc[1] : x-- ̎̃RXg
 		// dc[2] : y-- ̎̃RXg
 		// dc[3] : x++ ̎̃RXg
 
-		if(y < ys && !map_getcellp(md,x  ,y+1,cell)) {
+		if(y < ys && !(r2&2)) {
 			f |= 1; dc[0] = (y >= y1 ? 20 : 0);
 			e+=add_path(heap,tp,x  ,y+1,dist,rp,cost+dc[0]); // (x,   y+1)
 		}
-		if(x > 0  && !map_getcellp(md,x-1,y  ,cell)) {
+		if(x > 0  && !(r1&1)) {
 			f |= 2; dc[1] = (x <= x1 ? 20 : 0);
 			e+=add_path(heap,tp,x-1,y  ,dist,rp,cost+dc[1]); // (x-1, y  )
 		}
-		if(y > 0  && !map_getcellp(md,x  ,y-1,cell)) {
+		if(y > 0  && !(r0&2)) {
 			f |= 4; dc[2] = (y <= y1 ? 20 : 0);
 			e+=add_path(heap,tp,x  ,y-1,dist,rp,cost+dc[2]); // (x  , y-1)
 		}
-		if(x < xs && !map_getcellp(md,x+1,y  ,cell)) {
+		if(x < xs && !(r1&4)) {
 			f |= 8; dc[3] = (x >= x1 ? 20 : 0);
 			e+=add_path(heap,tp,x+1,y  ,dist,rp,cost+dc[3]); // (x+1, y  )
 		}
-		if( (f & (2+1)) == (2+1) && !map_getcellp(md,x-1,y+1,cell))
+		if( (f & (2+1)) == (2+1) && !(r2&1))
 			e+=add_path(heap,tp,x-1,y+1,dist+4,rp,cost+dc[1]+dc[0]-6);		// (x-1, y+1)
-		if( (f & (2+4)) == (2+4) && !map_getcellp(md,x-1,y-1,cell))
+		if( (f & (2+4)) == (2+4) && !(r0&1))
 			e+=add_path(heap,tp,x-1,y-1,dist+4,rp,cost+dc[1]+dc[2]-6);		// (x-1, y-1)
-		if( (f & (8+4)) == (8+4) && !map_getcellp(md,x+1,y-1,cell))
+		if( (f & (8+4)) == (8+4) && !(r0&4))
 			e+=add_path(heap,tp,x+1,y-1,dist+4,rp,cost+dc[3]+dc[2]-6);		// (x+1, y-1)
-		if( (f & (8+1)) == (8+1) && !map_getcellp(md,x+1,y+1,cell))
+		if( (f & (8+1)) == (8+1) && !(r2&4))
 			e+=add_path(heap,tp,x+1,y+1,dist+4,rp,cost+dc[3]+dc[0]-6);		// (x+1, y+1)
 		tp[rp].flag=1;
 		if(e || heap[0]>=MAX_HEAP-5)
@@ -421,6 +451,48 @@ bool path_search(struct walkpath_data *wpd,int m,int x0,int y0,int x1,int y1,int
 }
 
 
+/*==========================================
+ * path search (x0,y0)->(x1,y1)
+ * wpd: path info will be written here
+ * flag: &1 = easy path search only
+ * cell: type of obstruction to check for
+ *------------------------------------------*/
+bool path_search(struct walkpath_data *wpd,int m,int x0,int y0,int x1,int y1,int flag,cell_chk cell)
+{
+	struct path_cache_entry* pc;
+	struct walkpath_data s_wpd;
+	unsigned int h;
+
+	if( wpd == NULL )
+		wpd = &s_wpd; // use dummy output variable
+
+	if( !map[m].cell )
+		return false;
+
+	h = (unsigned int)(((m*31 + x0)*31 + y0)*31 + x1)*31 + y1;
+	pc = &path_cache[(h*2654435761U >> 16) & (PATH_CACHE_SIZE-1)];
+	if( pc->cellver == map[m].cellver && pc->m == m && pc->x0 == x0 && pc->y0 == y0 && pc->x1 == x1 && pc->y1 == y1 &&
+		pc->easy == (flag&1) && pc->cell == cell )
+	{// same query on unchanged cells
+		if( pc->found )
+			memcpy(wpd, &pc->wpd, sizeof(*wpd));
+		return pc->found;
+	}
+
+	pc->found = path_search_sub(wpd,&map[m],x0,y0,x1,y1,flag,cell);
+	pc->m = m;
+	pc->x0 = x0;
+	pc->y0 = y0;
+	pc->x1 = x1;
+	pc->y1 = y1;
+	pc->easy = (flag&1);
+	pc->cell = (unsigned char)cell;
+	pc->cellver = map[m].cellver;
+	if( pc->found )
+		memcpy(&pc->wpd, wpd, sizeof(*wpd));
+	return pc->found;
+}
+
 //Distance functions, taken from http://www.flipcode.com/articles/article_fastdistance.shtml
 int check_distance(int dx, int dy, int distance)
 {
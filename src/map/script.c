@@ -8,11 +8,13 @@
 //#define DEBUG_DUMP_STACK
 
 #include "../common/cbasetypes.h"
+#include "../common/ers.h"
 #include "../common/malloc.h"
 #include "../common/md5calc.h"
 #include "../common/lock.h"
 #include "../common/nullpo.h"
 #include "../common/showmsg.h"
+#include "../common/socket.h" // RBUF*, WBUF*
 #include "../common/strlib.h"
 #include "../common/timer.h"
 #include "../common/utils.h"
@@ -238,6 +240,7 @@ struct Script_Config script_config = {
 	"OnPCJobLvUpEvent", //joblvup_event_name
 	"OnTouch_",	//ontouch_name (runs on first visible char to enter area, picks another char if the first char leaves)
 	"OnTouch",	//ontouch2_name (run whenever a char walks into the OnTouch area)
+	true, "db/npc_cache.dat", //cache/cache_file
 };
 
 static jmp_buf     error_jump;
@@ -300,13 +303,31 @@ typedef struct script_function {
 
 extern script_function buildin_func[];
 
-static struct linkdb_node* sleep_db;// int oid -> struct script_state*
+static int buildin_goto_ref = 0;// str_data id of 'goto' (see script_vm_lower)
+static int buildin_jump_zero_ref = 0;// str_data id of 'jump_zero' (see script_vm_lower)
+
+static DBMap* sleep_db;// int oid -> struct script_state* (list of the sleeping script states of the oid)
+static void script_sleep_remove(struct script_state* st);
+
+// Script states are run constantly (item use, equip bonuses, OnTouch, events),
+// so everything they need is recycled instead of going through the allocator.
+#define SCRIPT_STACK_SIZE 64 // initial capacity of a script stack
+#define SCRIPT_STACK_POOL_MAX 64 // maximum number of free stacks kept for reuse
+static ERS st_ers;// struct script_state
+static ERS retinfo_ers;// struct script_retinfo
+static ERS scope_ers;// struct linkdb_node* (head of the scope variables)
+static struct script_stack* stack_pool[SCRIPT_STACK_POOL_MAX];// free stacks, with their data and scope
+static int stack_pool_count = 0;
+static struct linkdb_node** script_alloc_scope(void);
+static void script_free_scope(struct linkdb_node** scope);
+static void script_free_stack(struct script_stack* stack);
 
 /*==========================================
  * [Jvg^Cv錾 (Kvȕ̂)
  *------------------------------------------*/
 const char* parse_subexpr(const char* p,int limit);
 int run_func(struct script_state *st);
+static int run_func_sub(struct script_state *st, int func);
 
 enum {
 	MF_NOMEMO,	//0
@@ -1944,6 +1965,9 @@ static void add_buildin_func(void)
 			str_data[n].type = C_FUNC;
 			str_data[n].val = i;
 			str_data[n].func = buildin_func[i].func;
+
+			if( strcmp(buildin_func[i].name, "goto") == 0 ) buildin_goto_ref = n;
+			else if( strcmp(buildin_func[i].name, "jump_zero") == 0 ) buildin_jump_zero_ref = n;
 		}
 	}
 }
@@ -2067,27 +2091,82 @@ void script_error(const char* src, const char* file, int start_line, const char*
 	StringBuf_Destroy(&buf);
 }
 
+//
+// Script cache
+//
+// Compiling the npc scripts takes most of the time of loading them, so the
+// compiled code of each npc file is cached in script_config.cache_file and
+// reused while the file and the names known to the compiler (buildin
+// commands, constants and params) don't change.
+//
+// File format (native byte order):
+//   header: "eANC" version(L) env_md5(16) sections(L)
+//   section: path(S) src_md5(16) entries(L) size(L) <entries>
+//   entry: line(L) options(L) script_size(L, -1 = no script) script_buf
+//          labels(L) { name(S) pos(L) }
+//          names(L) { name(S) refs(L) { offset(L) } }
+//   S = length(W, including the terminating NUL) + string
+// Names are stored by string and relocated to the str_data ids of this run.
+//
+
+#define SCRIPT_CACHE_VERSION 1
+
+struct script_cache_section {
+	const unsigned char* data;// entries of the section (in script_cache.data)
+	uint32 size;
+	uint32 count;
+	unsigned char md5[16];// of the source file
+};
+
+static struct {
+	bool open;// loading npc files (see script_cache_open)
+	bool changed;// cache_file needs to be written
+	unsigned char env_md5[16];// of the names known to the compiler
+
+	// old cache
+	unsigned char* data;
+	DBMap* sections;// const char* path -> struct script_cache_section*
+	int old_count;
+
+	// new cache
+	unsigned char* out;
+	uint32 out_len, out_max;
+	uint32 out_count;
+
+	// current npc file
+	struct script_cache_section* file;// cached section of the file, NULL if compiling
+	uint32 file_pos;// position of the next entry in file->data
+	uint32 file_start;// position of the section in out, or UINT32_MAX if it's not being written
+	uint32 file_count;
+	int hits, misses;
+} script_cache;
+
+static int parse_errors = 0;// number of scripts that failed to compile
+
+/// Makes sure the buildin commands and constants are known to the compiler.
+static void parse_script_init(void)
+{
+	static bool first = true;
+	if( first )
+	{
+		add_buildin_func();
+		read_constdb();
+		first = false;
+	}
+}
+
 /*==========================================
  * XNvg̉
  *------------------------------------------*/
-struct script_code* parse_script(const char *src,const char *file,int line,int options)
+static struct script_code* parse_script_sub(const char *src,const char *file,int line,int options)
 {
 	const char *p,*tmpp;
 	int i;
 	struct script_code* code = NULL;
-	static int first=1;
 	char end;
 	bool unresolved_names = false;
 
-	if( src == NULL )
-		return NULL;// empty script
-
 	memset(&syntax,0,sizeof(syntax));
-	if(first){
-		add_buildin_func();
-		read_constdb();
-		first=0;
-	}
 
 	script_buf=(unsigned char *)aMalloc(SCRIPT_BLOCK_SIZE*sizeof(unsigned char));
 	script_pos=0;
@@ -2105,6 +2184,7 @@ struct script_code* parse_script(const char *src,const char *file,int line,int o
 		const int size = ARRAYLENGTH(syntax.curly);
 		if( error_report )
 			script_error(src,file,line,error_msg,error_pos);
+		++parse_errors;
 		aFree( error_msg );
 		aFree( script_buf );
 		script_pos  = 0;
@@ -2257,6 +2337,477 @@ struct script_code* parse_script(const char *src,const char *file,int line,int o
 	code->script_buf  = script_buf;
 	code->script_size = script_size;
 	code->script_vars = NULL;
+	code->insn = NULL;
+	code->insn_count = 0;
+	return code;
+}
+
+/// Reserves space for len bytes at the end of the new cache.
+static unsigned char* script_cache_reserve(uint32 len)
+{
+	unsigned char* p;
+	if( script_cache.out_len + len > script_cache.out_max )
+	{
+		script_cache.out_max = max(script_cache.out_max*2, script_cache.out_len + len + 4096);
+		RECREATE(script_cache.out, unsigned char, script_cache.out_max);
+	}
+	p = script_cache.out + script_cache.out_len;
+	script_cache.out_len += len;
+	return p;
+}
+
+static void script_cache_putl(uint32 val)
+{
+	unsigned char* p = script_cache_reserve(4);
+	WBUFL(p,0) = val;
+}
+
+static void script_cache_puts(const char* str)
+{
+	uint16 len = (uint16)strlen(str) + 1;
+	unsigned char* p = script_cache_reserve(2 + len);
+	WBUFW(p,0) = len;
+	memcpy(p + 2, str, len);
+}
+
+/// Reads a number from the cache, returns false if there isn't enough data.
+static bool script_cache_getl(const unsigned char* data, uint32 size, uint32* pos, uint32* val)
+{
+	if( *pos + 4 > size )
+		return false;
+	*val = RBUFL(data,*pos);
+	*pos += 4;
+	return true;
+}
+
+/// Reads a string from the cache, returns NULL if it's invalid.
+static const char* script_cache_gets(const unsigned char* data, uint32 size, uint32* pos)
+{
+	const char* str;
+	uint16 len;
+
+	if( *pos + 2 > size )
+		return NULL;
+	len = RBUFW(data,*pos);
+	if( len == 0 || *pos + 2 + len > size || data[*pos + 2 + len - 1] != '\0' )
+		return NULL;
+	str = (const char*)data + *pos + 2;
+	*pos += 2 + len;
+	return str;
+}
+
+/// Sorts C_NAME references by name id.
+static int script_cache_cmpref(const void* a, const void* b)
+{
+	return ((const int*)a)[0] - ((const int*)b)[0];
+}
+
+/// Adds a compiled script to the cache of the current npc file.
+static void script_cache_record(int line, int options, struct script_code* code)
+{
+	DBIterator* iter;
+	unsigned char* p;
+	int* refs;
+	int nrefs = 0;
+	int pos = 0;
+	int i, j;
+	uint32 count_pos;
+	uint32 count = 0;
+	void* data;
+	DBKey key;
+
+	script_cache_putl((uint32)line);
+	script_cache_putl((uint32)options);
+	if( code == NULL )
+	{
+		script_cache_putl((uint32)-1);
+		script_cache_putl(0);
+		script_cache_putl(0);
+		++script_cache.file_count;
+		return;
+	}
+	script_cache_putl((uint32)code->script_size);
+	p = script_cache_reserve(code->script_size);
+	memcpy(p, code->script_buf, code->script_size);
+
+	// labels
+	count_pos = script_cache.out_len;
+	script_cache_putl(0);
+	if( options&SCRIPT_USE_LABEL_DB )
+	{
+		iter = scriptlabel_db->iterator(scriptlabel_db);
+		for( data = iter->first(iter,&key); iter->exists(iter); data = iter->next(iter,&key) )
+		{
+			script_cache_puts(key.str);
+			script_cache_putl((uint32)(intptr_t)data);
+			++count;
+		}
+		iter->destroy(iter);
+	}
+	WBUFL(script_cache.out,count_pos) = count;
+
+	// names, as pairs of name id and offset of the reference
+	CREATE(refs, int, 2*(code->script_size/4 + 1));
+	while( pos < code->script_size )
+	{
+		enum c_op c = get_com(code->script_buf, &pos);
+		switch( c )
+		{
+		case C_INT: get_num(code->script_buf, &pos); break;
+		case C_POS: pos += 3; break;
+		case C_STR: while( code->script_buf[pos++] ); break;
+		case C_NAME:
+			refs[2*nrefs] = GETVALUE(code->script_buf, pos);
+			refs[2*nrefs+1] = pos;
+			++nrefs;
+			pos += 3;
+			break;
+		default: break;
+		}
+	}
+	qsort(refs, nrefs, 2*sizeof(int), script_cache_cmpref);
+	count_pos = script_cache.out_len;
+	script_cache_putl(0);
+	count = 0;
+	for( i = 0; i < nrefs; i = j )
+	{
+		for( j = i; j < nrefs && refs[2*j] == refs[2*i]; ++j );
+		script_cache_puts(get_str(refs[2*i]));
+		script_cache_putl((uint32)(j - i));
+		for( ; i < j; ++i )
+			script_cache_putl((uint32)refs[2*i+1]);
+		++count;
+	}
+	WBUFL(script_cache.out,count_pos) = count;
+	aFree(refs);
+
+	++script_cache.file_count;
+}
+
+/// Skips an entry of the cache, returns false if it's invalid.
+static bool script_cache_skip(const unsigned char* data, uint32 size, uint32* pos)
+{
+	uint32 script_size, n, refs;
+
+	if( *pos + 8 > size )
+		return false;
+	*pos += 8;// line, options
+	if( !script_cache_getl(data, size, pos, &script_size) )
+		return false;
+	if( script_size != (uint32)-1 )
+	{
+		if( *pos + script_size > size )
+			return false;
+		*pos += script_size;
+	}
+	if( !script_cache_getl(data, size, pos, &n) )
+		return false;
+	while( n-- > 0 )
+		if( script_cache_gets(data, size, pos) == NULL || (*pos += 4) > size )
+			return false;
+	if( !script_cache_getl(data, size, pos, &n) )
+		return false;
+	while( n-- > 0 )
+		if( script_cache_gets(data, size, pos) == NULL || !script_cache_getl(data, size, pos, &refs) || (*pos += 4*refs) > size )
+			return false;
+	return true;
+}
+
+/// Loads the script at the line of the current npc file from the cache.
+/// Returns false if it isn't cached.
+static bool script_cache_load(int line, int options, struct script_code** out)
+{
+	struct script_cache_section* file = script_cache.file;
+	const unsigned char* data = file->data;
+	uint32 size = file->size;
+	uint32 pos = script_cache.file_pos;
+	uint32 start, script_size, n, refs, val, i;
+	struct script_code* code;
+	const char* name;
+	int id;
+
+	// entries are in the order the scripts were compiled, search from the last one
+	for( i = 0; i < file->count; ++i )
+	{
+		if( pos >= size )
+			pos = 0;// wrap around
+		start = pos;
+		if( !script_cache_skip(data, size, &pos) )
+			return false;// corrupted
+		if( RBUFL(data,start) == (uint32)line && RBUFL(data,start+4) == (uint32)options )
+			break;
+	}
+	if( i == file->count )
+		return false;
+
+	pos = start + 8;
+	if( !script_cache_getl(data, size, &pos, &script_size) )
+		return false;
+	if( script_size == (uint32)-1 )
+	{
+		code = NULL;
+		pos += 8;// no labels, no names
+	}
+	else
+	{
+		if( options&SCRIPT_USE_LABEL_DB )
+			scriptlabel_db->clear(scriptlabel_db, NULL);
+		CREATE(code, struct script_code, 1);
+		code->script_size = script_size;
+		code->script_buf = (unsigned char*)aMalloc(script_size);
+		memcpy(code->script_buf, data + pos, script_size);
+		code->script_vars = NULL;
+		code->insn = NULL;
+		code->insn_count = 0;
+		pos += script_size;
+
+		if( !script_cache_getl(data, size, &pos, &n) )
+			goto corrupted;
+		while( n-- > 0 )
+		{
+			if( (name = script_cache_gets(data, size, &pos)) == NULL || !script_cache_getl(data, size, &pos, &val) )
+				goto corrupted;
+			if( options&SCRIPT_USE_LABEL_DB )
+				strdb_put(scriptlabel_db, get_str(add_str(name)), (void*)(intptr_t)val);
+		}
+		if( !script_cache_getl(data, size, &pos, &n) )
+			goto corrupted;
+		while( n-- > 0 )
+		{
+			if( (name = script_cache_gets(data, size, &pos)) == NULL )
+				goto corrupted;
+			id = add_str(name);
+			if( str_data[id].type == C_NOP )
+			{// default unknown references to variables (see parse_script)
+				str_data[id].type = C_NAME;
+				str_data[id].label = id;
+			}
+			if( !script_cache_getl(data, size, &pos, &refs) )
+				goto corrupted;
+			while( refs-- > 0 )
+			{
+				if( !script_cache_getl(data, size, &pos, &val) )
+					goto corrupted;
+				if( val + 3 <= script_size )
+					SETVALUE(code->script_buf, val, id);
+			}
+		}
+	}
+
+	if( script_cache.file_start != UINT32_MAX )
+	{// copy the entry to the new cache
+		memcpy(script_cache_reserve(pos - start), data + start, pos - start);
+		++script_cache.file_count;
+	}
+	script_cache.file_pos = pos;
+	*out = code;
+	return true;
+
+corrupted:
+	script_free_code(code);
+	return false;
+}
+
+/// Computes the md5 of the names known to the compiler.
+static void script_cache_env(unsigned char* md5)
+{
+	StringBuf buf;
+	int i;
+
+	StringBuf_Init(&buf);
+	StringBuf_Printf(&buf, "%d %d\n", SCRIPT_CACHE_VERSION, (int)sizeof(int));
+	for( i = LABEL_START; i < str_num; ++i )
+		if( str_data[i].type == C_INT || str_data[i].type == C_PARAM || str_data[i].type == C_FUNC )
+			StringBuf_Printf(&buf, "%s %d %d\n", get_str(i), str_data[i].type, str_data[i].val);
+	MD5_Binary(StringBuf_Value(&buf), md5);
+	StringBuf_Destroy(&buf);
+}
+
+/// Starts loading npc files, reads the cache.
+void script_cache_open(void)
+{
+	unsigned char env_md5[16];
+	struct script_cache_section* section;
+	const char* path;
+	uint32 pos = 0, count = 0, i;
+	size_t size;
+	FILE* fp;
+
+	if( !script_config.cache || script_cache.open )
+		return;
+
+	parse_script_init();
+	memset(&script_cache, 0, sizeof(script_cache));
+	script_cache.open = true;
+	script_cache.file_start = UINT32_MAX;
+	script_cache.sections = strdb_alloc(DB_OPT_RELEASE_DATA, 0);
+	script_cache_env(script_cache.env_md5);
+
+	// new cache header (section count is set when closing)
+	memcpy(script_cache_reserve(4), "eANC", 4);
+	script_cache_putl(SCRIPT_CACHE_VERSION);
+	memcpy(script_cache_reserve(16), script_cache.env_md5, 16);
+	script_cache_putl(0);
+
+	fp = fopen(script_config.cache_file, "rb");
+	if( fp == NULL )
+	{
+		script_cache.changed = true;
+		return;
+	}
+	size = filesize(fp);
+	script_cache.data = (unsigned char*)aMalloc(size + 1);
+	size = fread(script_cache.data, 1, size, fp);
+	fclose(fp);
+
+	memcpy(env_md5, script_cache.env_md5, 16);
+	if( size < 28 || memcmp(script_cache.data, "eANC", 4) != 0 || RBUFL(script_cache.data,4) != SCRIPT_CACHE_VERSION || memcmp(script_cache.data + 8, env_md5, 16) != 0 )
+	{// different compiler
+		script_cache.changed = true;
+		return;
+	}
+	pos = 28;
+	count = RBUFL(script_cache.data,24);
+	for( i = 0; i < count; ++i )
+	{
+		CREATE(section, struct script_cache_section, 1);
+		if( (path = script_cache_gets(script_cache.data, size, &pos)) == NULL || pos + 24 > size )
+		{
+			aFree(section);
+			break;
+		}
+		memcpy(section->md5, script_cache.data + pos, 16);
+		section->count = RBUFL(script_cache.data,pos+16);
+		section->size = RBUFL(script_cache.data,pos+20);
+		section->data = script_cache.data + pos + 24;
+		pos += 24;
+		if( pos + section->size > size )
+		{
+			aFree(section);
+			break;
+		}
+		pos += section->size;
+		strdb_put(script_cache.sections, path, section);
+	}
+	if( i < count )
+	{
+		ShowWarning("script_cache_open: '%s' is corrupted, recompiling all scripts.\n", script_config.cache_file);
+		script_cache.sections->clear(script_cache.sections, NULL);
+		script_cache.changed = true;
+	}
+	script_cache.old_count = i;
+}
+
+/// Starts loading an npc file, compiled scripts are taken from the cache if the file didn't change.
+void script_cache_begin(const char* path, const char* src)
+{
+	struct script_cache_section* section;
+	unsigned char md5[16];
+
+	if( !script_cache.open )
+		return;
+
+	MD5_Binary(src, md5);
+	section = (struct script_cache_section*)strdb_get(script_cache.sections, path);
+	if( section && memcmp(section->md5, md5, 16) == 0 )
+		script_cache.file = section;
+	else
+	{
+		script_cache.file = NULL;
+		script_cache.changed = true;
+	}
+	script_cache.file_pos = 0;
+	script_cache.file_count = 0;
+	script_cache.file_start = script_cache.out_len;
+	script_cache_puts(path);
+	memcpy(script_cache_reserve(16), md5, 16);
+	script_cache_putl(0);// entries
+	script_cache_putl(0);// size
+}
+
+/// Finishes loading an npc file.
+void script_cache_end(void)
+{
+	uint32 start = script_cache.file_start;
+	uint32 header;
+
+	if( !script_cache.open )
+		return;
+
+	if( start != UINT32_MAX )
+	{
+		header = start + 2 + RBUFW(script_cache.out,start) + 16;
+		if( script_cache.file && script_cache.file_count != script_cache.file->count )
+			script_cache.changed = true;// some scripts were not used
+		WBUFL(script_cache.out,header) = script_cache.file_count;
+		WBUFL(script_cache.out,header+4) = script_cache.out_len - (header + 8);
+		++script_cache.out_count;
+	}
+	else
+		script_cache.changed = true;// section was dropped
+	script_cache.file = NULL;
+	script_cache.file_start = UINT32_MAX;
+}
+
+/// Finishes loading npc files, writes the cache if it changed.
+void script_cache_close(void)
+{
+	FILE* fp;
+
+	if( !script_cache.open )
+		return;
+
+	if( script_cache.out_count != script_cache.old_count )
+		script_cache.changed = true;
+	if( script_cache.changed )
+	{
+		WBUFL(script_cache.out,24) = script_cache.out_count;
+		fp = fopen(script_config.cache_file, "wb");
+		if( fp == NULL || fwrite(script_cache.out, 1, script_cache.out_len, fp) != script_cache.out_len )
+			ShowError("script_cache_close: Failed to write '%s'.\n", script_config.cache_file);
+		if( fp )
+			fclose(fp);
+	}
+	ShowInfo("Script cache: '"CL_WHITE"%d"CL_RESET"' scripts loaded, '"CL_WHITE"%d"CL_RESET"' compiled.\n", script_cache.hits, script_cache.misses);
+
+	db_destroy(script_cache.sections);
+	if( script_cache.data )
+		aFree(script_cache.data);
+	aFree(script_cache.out);
+	memset(&script_cache, 0, sizeof(script_cache));
+}
+
+/// Compiles a script.
+/// Inside npc files, the compiled script is taken from or added to the cache.
+struct script_code* parse_script(const char *src,const char *file,int line,int options)
+{
+	struct script_code* code;
+	int errors;
+
+	if( src == NULL )
+		return NULL;// empty script
+
+	parse_script_init();
+	if( script_cache.file && script_cache_load(line, options, &code) )
+	{
+		++script_cache.hits;
+		return code;
+	}
+
+	errors = parse_errors;
+	code = parse_script_sub(src, file, line, options);
+	if( script_cache.open && script_cache.file_start != UINT32_MAX )
+	{
+		++script_cache.misses;
+		script_cache.changed = true;
+		if( parse_errors != errors )
+		{// don't cache the file, so the errors are shown again
+			script_cache.out_len = script_cache.file_start;
+			script_cache.file_start = UINT32_MAX;
+		}
+		else
+			script_cache_record(line, options, code);
+	}
 	return code;
 }
 
@@ -2734,11 +3285,8 @@ void pop_stack(struct script_state* st, int start, int end)
 		{
 			struct script_retinfo* ri = data->u.ri;
 			if( ri->var_function )
-			{
-				script_free_vars(ri->var_function);
-				aFree(ri->var_function);
-			}
-			aFree(ri);
+				script_free_scope(ri->var_function);
+			ers_free(retinfo_ers, ri);
 		}
 		data->type = C_NOP;
 	}
@@ -2783,6 +3331,10 @@ void script_free_code(struct script_code* code)
 {
 	script_free_vars( &code->script_vars );
 	aFree( code->script_buf );
+	if( code->insn )
+		aFree( code->insn );
+	if( code->bonus )
+		aFree( code->bonus );
 	aFree( code );
 }
 
@@ -2796,13 +3348,19 @@ void script_free_code(struct script_code* code)
 struct script_state* script_alloc_state(struct script_code* script, int pos, int rid, int oid)
 {
 	struct script_state* st;
-	CREATE(st, struct script_state, 1);
-	st->stack = (struct script_stack*)aMalloc(sizeof(struct script_stack));
+	st = ers_alloc(st_ers, struct script_state);
+	memset(st, 0, sizeof(struct script_state));
+	if( stack_pool_count > 0 )
+		st->stack = stack_pool[--stack_pool_count];
+	else
+	{
+		CREATE(st->stack, struct script_stack, 1);
+		st->stack->sp_max = SCRIPT_STACK_SIZE;
+		CREATE(st->stack->stack_data, struct script_data, st->stack->sp_max);
+		st->stack->var_function = script_alloc_scope();
+	}
 	st->stack->sp = 0;
-	st->stack->sp_max = 64;
-	CREATE(st->stack->stack_data, struct script_data, st->stack->sp_max);
 	st->stack->defsp = st->stack->sp;
-	CREATE(st->stack->var_function, struct linkdb_node*, 1);
 	st->state = RUN;
 	st->script = script;
 	//st->scriptroot = script;
@@ -2823,14 +3381,41 @@ void script_free_state(struct script_state* st)
 		ShowDebug("script_free_state: Previous script state lost (rid=%d, oid=%d, state=%d, bk_npcid=%d).\n", st->bk_st->rid, st->bk_st->oid, st->bk_st->state, st->bk_npcid);
 	}
 	if( st->sleep.timer != INVALID_TIMER )
+	{
 		delete_timer(st->sleep.timer, run_script_timer);
+		script_sleep_remove(st);
+	}
 	script_free_vars(st->stack->var_function);
-	aFree(st->stack->var_function);
 	pop_stack(st, 0, st->stack->sp);
-	aFree(st->stack->stack_data);
-	aFree(st->stack);
+	if( stack_pool_count < SCRIPT_STACK_POOL_MAX && st->stack->sp_max == SCRIPT_STACK_SIZE )
+		stack_pool[stack_pool_count++] = st->stack;// keep it for the next script state
+	else
+		script_free_stack(st->stack);
 	st->pos = -1;
-	aFree(st);
+	ers_free(st_ers, st);
+}
+
+/// Frees a script stack that isn't used anymore.
+static void script_free_stack(struct script_stack* stack)
+{
+	script_free_scope(stack->var_function);
+	aFree(stack->stack_data);
+	aFree(stack);
+}
+
+/// Creates an empty scope for scope variables (.@var).
+static struct linkdb_node** script_alloc_scope(void)
+{
+	struct linkdb_node** scope = ers_alloc(scope_ers, struct linkdb_node*);
+	*scope = NULL;
+	return scope;
+}
+
+/// Frees a scope and its variables.
+static void script_free_scope(struct linkdb_node** scope)
+{
+	script_free_vars(scope);
+	ers_free(scope_ers, scope);
 }
 
 //
@@ -3228,6 +3813,12 @@ int run_func(struct script_state *st)
 		return 1;
 	}
 
+	return run_func_sub(st, func);
+}
+
+/// Executes the buildin command func, with the arguments in [st->start,st->end[.
+static int run_func_sub(struct script_state *st, int func)
+{
 	if( script_config.warn_func_mismatch_argtypes )
 	{
 		script_check_buildin_argtype(st, func);
@@ -3261,8 +3852,7 @@ int run_func(struct script_state *st)
 			st->state = END;
 			return 1;
 		}
-		script_free_vars( st->stack->var_function );
-		aFree(st->stack->var_function);
+		script_free_scope(st->stack->var_function);
 
 		ri = st->stack->stack_data[st->stack->defsp-1].u.ri;
 		nargs = ri->nargs;
@@ -3297,36 +3887,39 @@ void run_script(struct script_code *rootscript,int pos,int rid,int oid)
 	run_script_main(st);
 }
 
-void script_stop_sleeptimers(int id)
+/// Adds a sleeping script state to the sleep registry.
+static void script_sleep_insert(struct script_state* st)
 {
-	struct script_state* st;
-	for(;;)
-	{
-		st = (struct script_state*)linkdb_erase(&sleep_db,(void*)id);
-		if( st == NULL )
-			break; // no more sleep timers
-		script_free_state(st);
-	}
+	struct script_state* head = (struct script_state*)idb_get(sleep_db, st->oid);
+
+	st->sleep.prev = NULL;
+	st->sleep.next = head;
+	if( head )
+		head->sleep.prev = st;
+	idb_put(sleep_db, st->oid, st);
 }
 
-/*==========================================
- * wm[hsleep_db폜
- *------------------------------------------*/
-struct linkdb_node* script_erase_sleepdb(struct linkdb_node *n)
+/// Removes a sleeping script state from the sleep registry.
+static void script_sleep_remove(struct script_state* st)
 {
-	struct linkdb_node *retnode;
-
-	if( n == NULL)
-		return NULL;
-	if( n->prev == NULL )
-		sleep_db = n->next;
+	if( st->sleep.prev )
+		st->sleep.prev->sleep.next = st->sleep.next;
+	else if( st->sleep.next )
+		idb_put(sleep_db, st->oid, st->sleep.next);
 	else
-		n->prev->next = n->next;
-	if( n->next )
-		n->next->prev = n->prev;
-	retnode = n->next;
-	aFree( n );
-	return retnode;		// ̃m[hԂ
+		idb_remove(sleep_db, st->oid);
+	if( st->sleep.next )
+		st->sleep.next->sleep.prev = st->sleep.prev;
+	st->sleep.prev = st->sleep.next = NULL;
+}
+
+/// Stops and frees all the sleeping script states of the object.
+void script_stop_sleeptimers(int id)
+{
+	struct script_state* st;
+
+	while( (st = (struct script_state*)idb_get(sleep_db, id)) != NULL )
+		script_free_state(st); // removes it from the sleep registry
 }
 
 /*==========================================
@@ -3335,7 +3928,6 @@ struct linkdb_node* script_erase_sleepdb(struct linkdb_node *n)
 int run_script_timer(int tid, unsigned int tick, int id, intptr_t data)
 {
 	struct script_state *st     = (struct script_state *)data;
-	struct linkdb_node *node    = (struct linkdb_node *)sleep_db;
 	TBL_PC *sd = map_id2sd(st->rid);
 
 	if((sd && sd->status.char_id != id) || (st->rid && !sd))
@@ -3343,13 +3935,9 @@ int run_script_timer(int tid, unsigned int tick, int id, intptr_t data)
 		st->rid = 0;
 		st->state = END;
 	}
-	while( node && st->sleep.timer != INVALID_TIMER ) {
-		if( (int)node->key == st->oid && ((struct script_state *)node->data)->sleep.timer == st->sleep.timer ) {
-			script_erase_sleepdb(node);
-			st->sleep.timer = INVALID_TIMER;
-			break;
-		}
-		node = node->next;
+	if( st->sleep.timer != INVALID_TIMER ) {
+		script_sleep_remove(st);
+		st->sleep.timer = INVALID_TIMER;
 	}
 	if(st->state != RERUNLINE)
 		st->sleep.tick = 0;
@@ -3414,73 +4002,215 @@ static void script_attach_state(struct script_state* st)
 	}
 }
 
-/*==========================================
- * XNvg̎sC
- *------------------------------------------*/
-void run_script_main(struct script_state *st)
+//
+// Script VM
+//
+// The bytecode in script_buf is compact but slow to run: every operation has
+// to be decoded, names of buildin commands are resolved and their arguments
+// searched for on every call. Before a script_code is first run, it is lowered
+// into an array of fixed-width instructions with decoded operands, buildin
+// commands bound by id and argument count, and 'goto'/'jump_zero' replaced by
+// jumps to instruction indexes. st->pos keeps pointing into script_buf, so
+// labels, events, callsub/callfunc and sleeping scripts work as before.
+//
+
+/// Operations of the lowered code.
+enum script_vm_op {
+	VM_EOL,// end of line, pops unused values
+	VM_INT,// pushes the number val
+	VM_POS,// pushes the label val
+	VM_NAME,// pushes the reference val
+	VM_STR,// pushes the constant string at script_buf+val
+	VM_ARG,// pushes the argument marker
+	VM_FUNC,// calls the buildin command val with arg arguments (val=-1: unknown command, arg=-1: unknown argument count)
+	VM_JMP,// jumps to instruction arg (label val)
+	VM_JZ,// pops a value and jumps to instruction arg (label val) if it's zero
+	VM_OP1,// unary operator val
+	VM_OP2,// binary operator val
+	VM_OP3,// ternary operator
+	VM_END,// ends the script
+	VM_BAD,// invalid command val
+	VM_MAX
+};
+
+/// Instruction of the lowered code.
+struct script_insn {
+	const void* addr;// address of the handler in script_vm_run (direct threading)
+	int op;// enum script_vm_op
+	int val;// operand
+	int arg;// jump target or argument count
+	int pos;// position of the instruction in script_buf
+};
+
+#define SCRIPT_VM_MAX_CALLS 32 // maximum nesting of buildin calls tracked by script_vm_lower
+
+#if defined(__GNUC__) && !defined(SCRIPT_VM_SWITCH)
+#define SCRIPT_VM_THREADED // dispatch with computed gotos
+#endif
+
+/// Addresses of the handlers of each operation, NULL when dispatching with a switch.
+static const void* const* script_vm_handlers = NULL;
+
+/// Appends an instruction to the lowered code.
+static struct script_insn* script_vm_emit(struct script_insn* insn, int* count, enum script_vm_op op, int val, int pos)
 {
-	int cmdcount=script_config.check_cmdcount;
-	int gotocount=script_config.check_gotocount;
-	TBL_PC *sd;
-	struct script_stack *stack=st->stack;
-	struct npc_data *nd;
+	struct script_insn* ip = &insn[(*count)++];
 
-	script_attach_state(st);
+	ip->addr = NULL;
+	ip->op = op;
+	ip->val = val;
+	ip->arg = 0;
+	ip->pos = pos;
+	return ip;
+}
 
-	nd = map_id2nd(st->oid);
-	if( nd && map[nd->bl.m].instance_id > 0 )
-		st->instance_id = map[nd->bl.m].instance_id;
+/// Returns the index of the instruction at position pos of script_buf, or -1 if there is none.
+static int script_vm_find(struct script_code* code, int pos)
+{
+	int min = 0, max = code->insn_count - 1;
 
-	if(st->state == RERUNLINE) {
-		run_func(st);
-		if(st->state == GOTO)
-			st->state = RUN;
-	} else if(st->state != END)
-		st->state = RUN;
+	while( min <= max )
+	{
+		int mid = (min + max)/2;
+		if( code->insn[mid].pos < pos )
+			min = mid + 1;
+		else if( code->insn[mid].pos > pos )
+			max = mid - 1;
+		else
+			return mid;
+	}
+	return -1;
+}
 
-	while(st->state == RUN)
+/// Lowers the bytecode of the script into instructions for script_vm_run.
+///
+/// The stack depth is tracked to know the argument count of each buildin
+/// command. The count is only a hint, since commands may return nothing;
+/// script_vm_run checks it against the stack before using it.
+static void script_vm_lower(struct script_code* code)
+{
+	struct {
+		int func;// str_data id of the command, -1 if not a buildin command
+		int first;// index of the first instruction (C_NAME)
+		int pos;// position of the first instruction
+		int depth;// stack depth before the call
+	} calls[SCRIPT_VM_MAX_CALLS];
+	unsigned char* buf = code->script_buf;
+	struct script_insn* insn;
+	struct script_insn* ip;
+	int ncalls = 0, untracked = 0;
+	int depth = 0;
+	int last = -1;// position after the last VM_INT
+	int count = 0;
+	int pos = 0;
+	int i;
+
+	CREATE(insn, struct script_insn, code->script_size + 1);
+	while( pos < code->script_size )
 	{
-		enum c_op c = get_com(st->script->script_buf,&st->pos);
-		switch(c){
+		int start = pos;
+		enum c_op c = get_com(buf, &pos);
+		int val;
+
+		switch( c )
+		{
 		case C_EOL:
-			if( stack->defsp > stack->sp )
-				ShowError("script:run_script_main: unexpected stack position (defsp=%d sp=%d). please report this!!!\n", stack->defsp, stack->sp);
-			else
-				pop_stack(st, stack->defsp, stack->sp);// pop unused stack data. (unused return value)
+			script_vm_emit(insn, &count, VM_EOL, 0, start);
+			depth = 0;
+			ncalls = untracked = 0;
 			break;
 		case C_INT:
-			push_val(stack,C_INT,get_num(st->script->script_buf,&st->pos));
+			val = get_num(buf, &pos);
+			script_vm_emit(insn, &count, VM_INT, val, start);
+			last = pos;
+			++depth;
 			break;
 		case C_POS:
+			val = GETVALUE(buf, pos);
+			pos += 3;
+			script_vm_emit(insn, &count, VM_POS, val, start);
+			++depth;
+			break;
 		case C_NAME:
-			push_val(stack,c,GETVALUE(st->script->script_buf,st->pos));
-			st->pos+=3;
+			val = GETVALUE(buf, pos);
+			pos += 3;
+			i = pos;
+			if( pos < code->script_size && get_com(buf, &i) == C_ARG )
+			{// start of a call
+				if( ncalls < SCRIPT_VM_MAX_CALLS )
+				{
+					calls[ncalls].func = ( val < str_num && str_data[val].type == C_FUNC ) ? val : -1;
+					calls[ncalls].first = count;
+					calls[ncalls].pos = start;
+					calls[ncalls].depth = depth;
+					++ncalls;
+				}
+				else
+					++untracked;
+			}
+			script_vm_emit(insn, &count, VM_NAME, val, start);
+			++depth;
 			break;
 		case C_ARG:
-			push_val(stack,c,0);
+			script_vm_emit(insn, &count, VM_ARG, 0, start);
+			++depth;
 			break;
 		case C_STR:
-			push_str(stack,C_CONSTSTR,(char*)(st->script->script_buf+st->pos));
-			while(st->script->script_buf[st->pos++]);
+			val = pos;
+			while( buf[pos++] );
+			script_vm_emit(insn, &count, VM_STR, val, start);
+			++depth;
 			break;
 		case C_FUNC:
-			run_func(st);
-			if(st->state==GOTO){
-				st->state = RUN;
-				if( gotocount>0 && (--gotocount)<=0 ){
-					ShowError("run_script: infinity loop !\n");
-					script_reportsrc(st);
-					st->state=END;
+			if( untracked > 0 || ncalls == 0 )
+			{// unknown call
+				if( untracked > 0 )
+					--untracked;
+				ip = script_vm_emit(insn, &count, VM_FUNC, -1, start);
+				ip->arg = -1;
+			}
+			else
+			{
+				int func = calls[--ncalls].func;
+				int first = calls[ncalls].first;
+				int nargs = depth - calls[ncalls].depth - 2;
+
+				depth = calls[ncalls].depth;
+				if( func == buildin_goto_ref && count - first == 3 && insn[count-1].op == VM_POS )
+				{// goto <label>; => jump
+					val = insn[count-1].val;
+					count = first;
+					script_vm_emit(insn, &count, VM_JMP, val, calls[ncalls].pos);
+				}
+				else if( func == buildin_jump_zero_ref && nargs == 2 && insn[count-1].op == VM_POS )
+				{// jump_zero <condition>,<label>; => <condition> conditional jump
+					int label = insn[count-1].val;
+					int label_pos = insn[count-1].pos;
+
+					memmove(&insn[first], &insn[first+2], (count-first-3)*sizeof(insn[0]));
+					count -= 3;
+					insn[first].pos = calls[ncalls].pos;// labels point to the start of the call
+					script_vm_emit(insn, &count, VM_JZ, label, label_pos);
+				}
+				else
+				{
+					ip = script_vm_emit(insn, &count, VM_FUNC, func, start);
+					ip->arg = nargs;
+					++depth;// assume it returns a value
 				}
 			}
 			break;
-
 		case C_NEG:
+			if( count > 0 && insn[count-1].op == VM_INT && last == start )
+			{// negative constant
+				insn[count-1].val = -insn[count-1].val;
+				break;
+			}
+			// fall through
 		case C_NOT:
 		case C_LNOT:
-			op_1(st ,c);
+			script_vm_emit(insn, &count, VM_OP1, c, start);
 			break;
-
 		case C_ADD:
 		case C_SUB:
 		case C_MUL:
@@ -3499,29 +4229,282 @@ void run_script_main(struct script_state *st)
 		case C_LOR:
 		case C_R_SHIFT:
 		case C_L_SHIFT:
-			op_2(st, c);
+			script_vm_emit(insn, &count, VM_OP2, c, start);
+			--depth;
 			break;
-
 		case C_OP3:
-			op_3(st, c);
+			script_vm_emit(insn, &count, VM_OP3, c, start);
+			depth -= 2;
 			break;
-
 		case C_NOP:
-			st->state=END;
+			script_vm_emit(insn, &count, VM_END, 0, start);
 			break;
-
-		default:
-			ShowError("unknown command : %d @ %d\n",c,st->pos);
-			st->state=END;
+		default:// can't decode the rest
+			script_vm_emit(insn, &count, VM_BAD, c, start);
+			pos = code->script_size;
 			break;
 		}
-		if( cmdcount>0 && (--cmdcount)<=0 ){
-			ShowError("run_script: infinity loop !\n");
+	}
+	script_vm_emit(insn, &count, VM_END, 0, code->script_size);// sentinel
+
+	RECREATE(insn, struct script_insn, count);
+	code->insn = insn;
+	code->insn_count = count;
+
+	// resolve jumps and bind the handlers
+	for( i = 0; i < count; ++i )
+	{
+		ip = &insn[i];
+		if( ip->op == VM_JMP || ip->op == VM_JZ )
+		{
+			ip->arg = script_vm_find(code, ip->val);
+			if( ip->arg < 0 )
+			{
+				ShowError("script_vm_lower: invalid jump target %d at position %d\n", ip->val, ip->pos);
+				ip->op = VM_BAD;
+			}
+		}
+		if( script_vm_handlers )
+			ip->addr = script_vm_handlers[ip->op];
+	}
+}
+
+/// Runs the script from st->pos until it stops, ends or waits.
+/// Called with NULL to initialize script_vm_handlers.
+static void script_vm_run(struct script_state* st)
+{
+	int cmdcount = script_config.check_cmdcount;
+	int gotocount = script_config.check_gotocount;
+	struct script_stack* stack;
+	struct script_code* code;
+	struct script_insn* ip;
+	struct script_data* data;
+	int i;
+
+#ifdef SCRIPT_VM_THREADED
+	static const void* const handlers[VM_MAX] = {
+		&&vm_eol, &&vm_int, &&vm_pos, &&vm_name, &&vm_str, &&vm_arg, &&vm_func,
+		&&vm_jmp, &&vm_jz, &&vm_op1, &&vm_op2, &&vm_op3, &&vm_end, &&vm_bad
+	};
+	#define VM_OP(op,label) label:
+	#define VM_DISPATCH() goto *ip->addr
+#else
+	#define VM_OP(op,label) case op:
+	#define VM_DISPATCH() continue
+#endif
+	#define VM_CONTINUE() if( cmdcount > 0 && --cmdcount == 0 ) goto vm_infinity_loop; VM_DISPATCH()
+	#define VM_NEXT() ++ip; VM_CONTINUE()
+
+	if( st == NULL )
+	{
+#ifdef SCRIPT_VM_THREADED
+		script_vm_handlers = handlers;
+#endif
+		return;
+	}
+
+	stack = st->stack;
+
+vm_jump:// continue at st->pos of st->script
+	code = st->script;
+	if( code->insn == NULL )
+		script_vm_lower(code);
+	i = script_vm_find(code, st->pos);
+	if( i < 0 )
+	{
+		ShowError("run_script: invalid script position %d\n", st->pos);
+		script_reportsrc(st);
+		st->state = END;
+		return;
+	}
+	ip = &code->insn[i];
+
+#ifdef SCRIPT_VM_THREADED
+	VM_DISPATCH();
+#else
+	for(;;) switch( ip->op ) {
+#endif
+
+	VM_OP(VM_EOL, vm_eol)
+	{
+		if( stack->defsp > stack->sp )
+			ShowError("script:run_script_main: unexpected stack position (defsp=%d sp=%d). please report this!!!\n", stack->defsp, stack->sp);
+		else
+			pop_stack(st, stack->defsp, stack->sp);// pop unused stack data. (unused return value)
+		VM_NEXT();
+	}
+	VM_OP(VM_INT, vm_int)
+	{
+		push_val(stack, C_INT, ip->val);
+		VM_NEXT();
+	}
+	VM_OP(VM_POS, vm_pos)
+	{
+		push_val(stack, C_POS, ip->val);
+		VM_NEXT();
+	}
+	VM_OP(VM_NAME, vm_name)
+	{
+		push_val(stack, C_NAME, ip->val);
+		VM_NEXT();
+	}
+	VM_OP(VM_STR, vm_str)
+	{
+		push_str(stack, C_CONSTSTR, (char*)(code->script_buf + ip->val));
+		VM_NEXT();
+	}
+	VM_OP(VM_ARG, vm_arg)
+	{
+		push_val(stack, C_ARG, 0);
+		VM_NEXT();
+	}
+	VM_OP(VM_FUNC, vm_func)
+	{
+		st->pos = ip->pos + 1;// continue after C_FUNC
+		i = stack->sp - ip->arg - 2;// C_NAME of the command
+		if( ip->arg >= 0 && i >= 0 &&
+			stack->stack_data[i].type == C_NAME && stack->stack_data[i].u.num == ip->val &&
+			stack->stack_data[i+1].type == C_ARG )
+		{// argument count is right
+			st->start = i;
+			st->end = stack->sp;
+			run_func_sub(st, ip->val);
+		}
+		else
+			run_func(st);
+		if( st->state == RUN )
+		{
+			VM_NEXT();
+		}
+		if( st->state != GOTO )
+			return;
+		st->state = RUN;
+		if( gotocount > 0 && --gotocount <= 0 )
+			goto vm_infinity_loop;
+		goto vm_jump;
+	}
+	VM_OP(VM_JMP, vm_jmp)
+	{
+		if( gotocount > 0 && --gotocount <= 0 )
+			goto vm_infinity_loop;
+		ip = &code->insn[ip->arg];
+		VM_CONTINUE();
+	}
+	VM_OP(VM_JZ, vm_jz)
+	{
+		if( stack->sp <= stack->defsp )
+		{
+			ShowError("script:jump_zero: condition not found\n");
+			st->pos = ip->pos;
 			script_reportsrc(st);
-			st->state=END;
+			st->state = END;
+			return;
+		}
+		data = &stack->stack_data[stack->sp-1];
+		if( data_isint(data) )
+		{
+			i = data->u.num;
+			--stack->sp;
+		}
+		else
+		{
+			st->pos = ip->pos;
+			i = conv_num(st, data);
+			pop_stack(st, stack->sp-1, stack->sp);
 		}
+		if( i )
+		{
+			VM_NEXT();
+		}
+		if( gotocount > 0 && --gotocount <= 0 )
+			goto vm_infinity_loop;
+		ip = &code->insn[ip->arg];
+		VM_CONTINUE();
+	}
+	VM_OP(VM_OP1, vm_op1)
+	{
+		st->pos = ip->pos;
+		op_1(st, ip->val);
+		if( st->state != RUN )
+			return;
+		VM_NEXT();
+	}
+	VM_OP(VM_OP2, vm_op2)
+	{
+		st->pos = ip->pos;
+		data = &stack->stack_data[stack->sp-2];
+		if( data[0].type == C_INT && data[1].type == C_INT )
+		{// numbers, nothing to resolve or free
+			stack->sp -= 2;
+			op_2num(st, ip->val, data[0].u.num, data[1].u.num);
+		}
+		else
+			op_2(st, ip->val);
+		if( st->state != RUN )
+			return;
+		VM_NEXT();
+	}
+	VM_OP(VM_OP3, vm_op3)
+	{
+		st->pos = ip->pos;
+		op_3(st, ip->val);
+		if( st->state != RUN )
+			return;
+		VM_NEXT();
+	}
+	VM_OP(VM_END, vm_end)
+	{
+		st->pos = ip->pos;
+		st->state = END;
+		return;
+	}
+	VM_OP(VM_BAD, vm_bad)
+	{
+		ShowError("unknown command : %d @ %d\n", ip->val, ip->pos);
+		st->pos = ip->pos;
+		st->state = END;
+		return;
 	}
 
+#ifndef SCRIPT_VM_THREADED
+	}
+#endif
+
+vm_infinity_loop:
+	ShowError("run_script: infinity loop !\n");
+	script_reportsrc(st);
+	st->state = END;
+
+	#undef VM_OP
+	#undef VM_DISPATCH
+	#undef VM_CONTINUE
+	#undef VM_NEXT
+}
+
+/*==========================================
+ * XNvg̎sC
+ *------------------------------------------*/
+void run_script_main(struct script_state *st)
+{
+	TBL_PC *sd;
+	struct npc_data *nd;
+
+	script_attach_state(st);
+
+	nd = map_id2nd(st->oid);
+	if( nd && map[nd->bl.m].instance_id > 0 )
+		st->instance_id = map[nd->bl.m].instance_id;
+
+	if(st->state == RERUNLINE) {
+		run_func(st);
+		if(st->state == GOTO)
+			st->state = RUN;
+	} else if(st->state != END)
+		st->state = RUN;
+
+	if(st->state == RUN)
+		script_vm_run(st);
+
 	if(st->sleep.tick > 0) {
 		//Restore previous script
 		script_detach_state(st, false);
@@ -3530,7 +4513,7 @@ void run_script_main(struct script_state *st)
 		st->sleep.charid = sd?sd->status.char_id:0;
 		st->sleep.timer  = add_timer(gettick()+st->sleep.tick,
 			run_script_timer, st->sleep.charid, (intptr_t)st);
-		linkdb_insert(&sleep_db, (void*)st->oid, st);
+		script_sleep_insert(st);
 	}
 	else if(st->state != END && st->rid){
 		//Resume later (st is already attached to player).
@@ -3603,6 +4586,12 @@ int script_config_read(char *cfgName)
 		else if(strcmpi(w1,"warn_func_mismatch_argtypes")==0) {
 			script_config.warn_func_mismatch_argtypes = config_switch(w2);
 		}
+		else if(strcmpi(w1,"script_cache")==0) {
+			script_config.cache = (bool)config_switch(w2);
+		}
+		else if(strcmpi(w1,"script_cache_file")==0) {
+			safestrncpy(script_config.cache_file, w2, sizeof(script_config.cache_file));
+		}
 		else if(strcmpi(w1,"import")==0){
 			script_config_read(w2);
 		}
@@ -3615,11 +4604,8 @@ int script_config_read(char *cfgName)
 static int do_final_userfunc_sub (DBKey key,void *data,va_list ap)
 {
 	struct script_code *code = (struct script_code *)data;
-	if(code){
-		script_free_vars( &code->script_vars );
-		aFree( code->script_buf );
-		aFree( code );
-	}
+	if(code)
+		script_free_code(code);
 	return 0;
 }
 
@@ -3633,6 +4619,23 @@ static int do_final_autobonus_sub (DBKey key,void *data,va_list ap)
 	return 0;
 }
 
+/// Frees the sleeping script states of an object, without touching the sleep registry.
+static int script_sleep_final_sub(DBKey key, void* data, va_list ap)
+{
+	struct script_state* st = (struct script_state*)data;
+	struct script_state* next;
+
+	for( ; st != NULL; st = next )
+	{
+		next = st->sleep.next;
+		delete_timer(st->sleep.timer, run_script_timer);
+		st->sleep.timer = INVALID_TIMER;
+		st->sleep.prev = st->sleep.next = NULL;
+		script_free_state(st);
+	}
+	return 0;
+}
+
 void script_run_autobonus(const char *autobonus, int id, int pos)
 {
 	struct script_code *script = (struct script_code *)strdb_get(autobonus_db, autobonus);
@@ -3788,15 +4791,12 @@ int do_final_script()
 	scriptlabel_db->destroy(scriptlabel_db,NULL);
 	userfunc_db->destroy(userfunc_db,do_final_userfunc_sub);
 	autobonus_db->destroy(autobonus_db, do_final_autobonus_sub);
-	if(sleep_db) {
-		struct linkdb_node *n = (struct linkdb_node *)sleep_db;
-		while(n) {
-			struct script_state *st = (struct script_state *)n->data;
-			script_free_state(st);
-			n = n->next;
-		}
-		linkdb_final(&sleep_db);
-	}
+	sleep_db->destroy(sleep_db, script_sleep_final_sub);
+	while( stack_pool_count > 0 )
+		script_free_stack(stack_pool[--stack_pool_count]);
+	ers_destroy(st_ers);
+	ers_destroy(retinfo_ers);
+	ers_destroy(scope_ers);
 
 	if (str_data)
 		aFree(str_data);
@@ -3810,9 +4810,14 @@ int do_final_script()
  *------------------------------------------*/
 int do_init_script()
 {
+	sleep_db = idb_alloc(DB_OPT_BASE);
+	st_ers = ers_new(sizeof(struct script_state), "script.c::st_ers");
+	retinfo_ers = ers_new(sizeof(struct script_retinfo), "script.c::retinfo_ers");
+	scope_ers = ers_new(sizeof(struct linkdb_node*), "script.c::scope_ers");
 	userfunc_db=strdb_alloc(DB_OPT_DUP_KEY,0);
 	scriptlabel_db=strdb_alloc((DBOptions)(DB_OPT_DUP_KEY|DB_OPT_ALLOW_NULL_DATA),50);
 	autobonus_db = strdb_alloc(DB_OPT_DUP_KEY,0);
+	script_vm_run(NULL);// initializes the handlers of the script VM
 
 	mapreg_init();
 	
@@ -3824,15 +4829,7 @@ int script_reload()
 	userfunc_db->clear(userfunc_db,do_final_userfunc_sub);
 	scriptlabel_db->clear(scriptlabel_db, NULL);
 
-	if(sleep_db) {
-		struct linkdb_node *n = (struct linkdb_node *)sleep_db;
-		while(n) {
-			struct script_state *st = (struct script_state *)n->data;
-			script_free_state(st);
-			n = n->next;
-		}
-		linkdb_final(&sleep_db);
-	}
+	sleep_db->clear(sleep_db, script_sleep_final_sub);
 
 	mapreg_reload();
 	return 0;
@@ -4261,7 +5258,8 @@ BUILDIN_FUNC(callfunc)
 		}
 	}
 
-	CREATE(ri, struct script_retinfo, 1);
+	ri = ers_alloc(retinfo_ers, struct script_retinfo);
+	memset(ri, 0, sizeof(struct script_retinfo));
 	ri->script       = st->script;// script code
 	ri->var_function = st->stack->var_function;// scope variables
 	ri->pos          = st->pos;// script location
@@ -4273,7 +5271,7 @@ BUILDIN_FUNC(callfunc)
 	st->script = scr;
 	st->stack->defsp = st->stack->sp;
 	st->state = GOTO;
-	st->stack->var_function = (struct linkdb_node**)aCalloc(1, sizeof(struct linkdb_node*));
+	st->stack->var_function = script_alloc_scope();
 
 	return 0;
 }
@@ -4305,7 +5303,8 @@ BUILDIN_FUNC(callsub)
 		}
 	}
 
-	CREATE(ri, struct script_retinfo, 1);
+	ri = ers_alloc(retinfo_ers, struct script_retinfo);
+	memset(ri, 0, sizeof(struct script_retinfo));
 	ri->script       = st->script;// script code
 	ri->var_function = st->stack->var_function;// scope variables
 	ri->pos          = st->pos;// script location
@@ -4316,7 +5315,7 @@ BUILDIN_FUNC(callsub)
 	st->pos = pos;
 	st->stack->defsp = st->stack->sp;
 	st->state = GOTO;
-	st->stack->var_function = (struct linkdb_node**)aCalloc(1, sizeof(struct linkdb_node*));
+	st->stack->var_function = script_alloc_scope();
 
 	return 0;
 }
@@ -7105,6 +8104,104 @@ BUILDIN_FUNC(bonus)
 	return 0;
 }
 
+/// Compiles a script that is a sequence of bonus/bonus2/.../bonus5 calls
+/// with constant numeric arguments into bonus records, so status_calc_pc
+/// can apply them without the VM (see run_script_bonus).
+/// Scripts with anything else (conditions, variables, strings, other
+/// commands) are left to the VM.
+void script_bonus_compile(struct script_code* code)
+{
+	struct script_bonus* bonus = NULL;
+	struct script_insn* ip;
+	bool lowered = false;
+	int count = 0, i, n;
+
+	if( code == NULL )
+		return;
+	if( code->bonus )
+		aFree(code->bonus);
+	code->bonus = NULL;
+	code->bonus_count = 0;
+	code->bonus_only = false;
+
+	if( code->insn == NULL )
+	{
+		script_vm_lower(code);
+		lowered = true;
+	}
+
+	// count the bonus calls: NAME ARG (INT|constant)* FUNC EOL ... END
+	for( ip = code->insn; ip->op != VM_END; ++count )
+	{
+		if( ip[0].op != VM_NAME || ip[1].op != VM_ARG )
+			break;
+		for( n = 0; ip[2+n].op == VM_INT || (ip[2+n].op == VM_NAME && ip[2+n].val < str_num && str_data[ip[2+n].val].type == C_INT); ++n );
+		ip += 2+n;
+		if( ip[0].op != VM_FUNC || ip[0].val < 0 || str_data[ip[0].val].func != buildin_bonus || ip[0].arg != n || n < 2 || n > 6 || ip[1].op != VM_EOL )
+			break;
+		ip += 2;
+	}
+
+	if( ip->op == VM_END )
+	{
+		if( count > 0 )
+			CREATE(bonus, struct script_bonus, count);
+		for( ip = code->insn, i = 0; i < count; ++i )
+		{
+			ip += 2;// NAME ARG
+			for( n = 0; ip->op != VM_FUNC; ++n, ++ip )
+			{
+				int val = ( ip->op == VM_INT ) ? ip->val : str_data[ip->val].val;
+				if( n == 0 )
+					bonus[i].type = val;
+				else
+					bonus[i].val[n-1] = val;
+			}
+			bonus[i].count = n-1;
+			ip += 2;// FUNC EOL
+		}
+		code->bonus = bonus;
+		code->bonus_count = count;
+		code->bonus_only = true;
+	}
+
+	if( lowered )
+	{// the VM lowers it again when it is first run
+		aFree(code->insn);
+		code->insn = NULL;
+		code->insn_count = 0;
+	}
+}
+
+/// Runs an item bonus script on a player.
+/// Compiled scripts (see script_bonus_compile) are applied directly, the others are run by the VM.
+void run_script_bonus(struct script_code* code, struct map_session_data* sd)
+{
+	struct script_bonus* b;
+	int i;
+
+	if( code == NULL )
+		return;
+	if( !code->bonus_only )
+	{
+		run_script(code,0,sd->bl.id,0);
+		return;
+	}
+
+	for( i = 0; i < code->bonus_count; ++i )
+	{
+		b = &code->bonus[i];
+		switch( b->count )
+		{
+		case 1: pc_bonus(sd, b->type, b->val[0]); break;
+		case 2: pc_bonus2(sd, b->type, b->val[0], b->val[1]); break;
+		case 3: pc_bonus3(sd, b->type, b->val[0], b->val[1], b->val[2]); break;
+		case 4: pc_bonus4(sd, b->type, b->val[0], b->val[1], b->val[2], b->val[3]); break;
+		case 5: pc_bonus5(sd, b->type, b->val[0], b->val[1], b->val[2], b->val[3], b->val[4]); break;
+		}
+	}
+}
+
 BUILDIN_FUNC(autobonus)
 {
 	unsigned int dur;
@@ -11550,6 +12647,8 @@ BUILDIN_FUNC(atcommand)
 		fd = 0;
 
 		memset(&dummy_sd, 0, sizeof(TBL_PC));
+		dummy_sd.bl.type = BL_PC;
+		status_change_init(&dummy_sd.bl);
 		if (st->oid)
 		{
 			struct block_list* bl = map_id2bl(st->oid);
@@ -11588,6 +12687,8 @@ BUILDIN_FUNC(charcommand)
 		fd = 0;
 
 		memset(&dummy_sd, 0, sizeof(TBL_PC));
+		dummy_sd.bl.type = BL_PC;
+		status_change_init(&dummy_sd.bl);
 		if (st->oid)
 		{
 			struct block_list* bl = map_id2bl(st->oid);
@@ -11824,9 +12925,8 @@ BUILDIN_FUNC(jump_zero)
 BUILDIN_FUNC(getmapmobs)
 {
 	const char *str=NULL;
-	int m=-1,bx,by;
+	int m=-1,b;
 	int count=0;
-	struct block_list *bl;
 
 	str=script_getstr(st,2);
 
@@ -11846,11 +12946,8 @@ BUILDIN_FUNC(getmapmobs)
 		return 0;
 	}
 
-	for(by=0;by<=(map[m].ys-1)/BLOCK_SIZE;by++)
-		for(bx=0;bx<=(map[m].xs-1)/BLOCK_SIZE;bx++)
-			for( bl = map[m].block_mob[bx+by*map[m].bxs] ; bl != NULL ; bl = bl->next )
-				if(bl->x>=0 && bl->x<=map[m].xs-1 && bl->y>=0 && bl->y<=map[m].ys-1)
-					count++;
+	for(b=0;b<map[m].bxs*map[m].bys;b++)
+		count += map[m].block_mob[b].count;
 
 	script_pushint(st,count);
 	return 0;
@@ -13533,6 +14630,8 @@ BUILDIN_FUNC(setitemscript)
 		script_free_code(*dstscript);
 
 	*dstscript = script[0] ? parse_script(script, "script_setitemscript", 0, 0) : NULL;
+	if( dstscript == &i_data->script )
+		script_bonus_compile(*dstscript);
 	script_pushint(st,1);
 	return 0;
 }
@@ -14167,7 +15266,8 @@ BUILDIN_FUNC(sleep2)
 BUILDIN_FUNC(awake)
 {
 	struct npc_data* nd;
-	struct linkdb_node *node = (struct linkdb_node *)sleep_db;
+	struct script_state* tst;
+	struct script_state* next;
 
 	nd = npc_name2id(script_getstr(st, 2));
 	if( nd == NULL ) {
@@ -14175,35 +15275,24 @@ BUILDIN_FUNC(awake)
 		return 1;
 	}
 
-	while( node )
-	{
-		if( (int)node->key == nd->bl.id )
-		{// sleep timer for the npc
-			struct script_state* tst = (struct script_state*)node->data;
-			TBL_PC* sd = map_id2sd(tst->rid);
+	// states that fall asleep again are added to the head of the list, so they aren't awaken twice
+	for( tst = (struct script_state*)idb_get(sleep_db, nd->bl.id); tst != NULL; tst = next )
+	{// sleep timer for the npc
+		TBL_PC* sd = map_id2sd(tst->rid);
 
-			if( tst->sleep.timer == INVALID_TIMER )
-			{// already awake ???
-				node = node->next;
-				continue;
-			}
-			if( (sd && sd->status.char_id != tst->sleep.charid) || (tst->rid && !sd))
-			{// char not online anymore / another char of the same account is online - Cancel execution
-				tst->state = END;
-				tst->rid = 0;
-			}
-
-			delete_timer(tst->sleep.timer, run_script_timer);
-			node = script_erase_sleepdb(node);
-			tst->sleep.timer = INVALID_TIMER;
-			if(tst->state != RERUNLINE)
-				tst->sleep.tick = 0;
-			run_script_main(tst);
-		}
-		else
-		{
-			node = node->next;
+		next = tst->sleep.next;
+		if( (sd && sd->status.char_id != tst->sleep.charid) || (tst->rid && !sd))
+		{// char not online anymore / another char of the same account is online - Cancel execution
+			tst->state = END;
+			tst->rid = 0;
 		}
+
+		delete_timer(tst->sleep.timer, run_script_timer);
+		script_sleep_remove(tst);
+		tst->sleep.timer = INVALID_TIMER;
+		if(tst->state != RERUNLINE)
+			tst->sleep.tick = 0;
+		run_script_main(tst);
 	}
 	return 0;
 }
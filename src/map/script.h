@@ -31,6 +31,9 @@ extern struct Script_Config {
 
 	const char* ontouch_name;
 	const char* ontouch2_name;
+
+	bool cache;// cache compiled npc scripts in cache_file
+	char cache_file[256];
 } script_config;
 
 typedef enum c_op {
@@ -91,12 +94,24 @@ struct script_data {
 	struct linkdb_node** ref;
 };
 
+/// Constant bonus call of a compiled script (see script_bonus_compile).
+struct script_bonus {
+	int type;// bonus type (SP_*)
+	int val[5];
+	int count;// number of values (1 for bonus, 2 for bonus2, ...)
+};
+
 // Moved defsp from script_state to script_stack since
 // it must be saved when script state is RERUNLINE. [Eoe / jA 1094]
 struct script_code {
 	int script_size;
 	unsigned char* script_buf;
 	struct linkdb_node* script_vars;
+	struct script_insn* insn;// lowered code, created when the script is first run (see script_vm_lower)
+	int insn_count;
+	struct script_bonus* bonus;// bonus calls of the script, when bonus_only
+	int bonus_count;
+	bool bonus_only;// the script only makes bonus calls with constant arguments (see run_script_bonus)
 };
 
 struct script_stack {
@@ -122,6 +137,7 @@ struct script_state {
 	struct script_code *script, *scriptroot;
 	struct sleep_data {
 		int tick,timer,charid;
+		struct script_state *prev, *next; // other sleeping script states of the same oid (see sleep_db)
 	} sleep;
 	int instance_id;
 	//For backing up purposes
@@ -149,8 +165,14 @@ const char* skip_space(const char* p);
 void script_error(const char* src, const char* file, int start_line, const char* error_msg, const char* error_pos);
 
 struct script_code* parse_script(const char* src,const char* file,int line,int options);
+void script_cache_open(void);
+void script_cache_begin(const char* path, const char* src);
+void script_cache_end(void);
+void script_cache_close(void);
 void run_script_sub(struct script_code *rootscript,int pos,int rid,int oid, char* file, int lineno);
 void run_script(struct script_code*,int,int,int);
+void run_script_bonus(struct script_code* code, struct map_session_data* sd);
+void script_bonus_compile(struct script_code* code);
 
 int set_var(struct map_session_data *sd, char *name, void *val);
 int conv_num(struct script_state *st,struct script_data *data);
@@ -159,7 +181,6 @@ int run_script_timer(int tid, unsigned int tick, int id, intptr_t data);
 void run_script_main(struct script_state *st);
 
 void script_stop_sleeptimers(int id);
-struct linkdb_node* script_erase_sleepdb(struct linkdb_node *n);
 void script_free_code(struct script_code* code);
 void script_free_vars(struct linkdb_node **node);
 struct script_state* script_alloc_state(struct script_code* script, int pos, int rid, int oid);
@@ -51,6 +51,7 @@
 
 static struct eri *skill_unit_ers = NULL; //For handling skill_unit's [Skotlex]
 static struct eri *skill_timer_ers = NULL; //For handling skill_timerskills [Skotlex]
+static ARENA skill_scratch = NULL; //Scratch data of skill unit group moves, released at the end of each move
 
 DBMap* skillunit_db = NULL; // int id -> struct skill_unit*
 
@@ -1965,6 +1966,24 @@ int skill_attack (int attack_type, struct block_list* src, struct block_list *ds
  *------------------------------------------*/
 static int skill_area_temp[8];
 typedef int (*SkillFunc)(struct block_list *, struct block_list *, int, int, unsigned int, int);
+
+/// Applies func to bl if it is a target of the skill.
+static int skill_area_target(struct block_list *bl, struct block_list *src, int skill_id, int skill_lv, unsigned int tick, int flag, SkillFunc func)
+{
+	if(battle_check_target(src,bl,flag) > 0)
+	{
+		// several splash skills need this initial dummy packet to display correctly
+		if (flag&SD_PREAMBLE && skill_area_temp[2] == 0)
+			clif_skill_damage(src,bl,tick, status_get_amotion(src), 0, -30000, 1, skill_id, skill_lv, 6);
+
+		if (flag&(SD_SPLASH|SD_PREAMBLE))
+			skill_area_temp[2]++;
+
+		return func(src,bl,skill_id,skill_lv,tick,flag);
+	}
+	return 0;
+}
+
 int skill_area_sub (struct block_list *bl, va_list ap)
 {
 	struct block_list *src;
@@ -1981,18 +2000,62 @@ int skill_area_sub (struct block_list *bl, va_list ap)
 	flag=va_arg(ap,int);
 	func=va_arg(ap,SkillFunc);
 
-	if(battle_check_target(src,bl,flag) > 0)
-	{
-		// several splash skills need this initial dummy packet to display correctly
-		if (flag&SD_PREAMBLE && skill_area_temp[2] == 0)
-			clif_skill_damage(src,bl,tick, status_get_amotion(src), 0, -30000, 1, skill_id, skill_lv, 6);
+	return skill_area_target(bl,src,skill_id,skill_lv,tick,flag,func);
+}
 
-		if (flag&(SD_SPLASH|SD_PREAMBLE))
-			skill_area_temp[2]++;
+/// Applies func to the objects of a query that are targets of the skill,
+/// the way skill_area_sub does for each object of a map_foreach* call.
+static int skill_area_apply(struct map_query* q, struct block_list *src, int skill_id, int skill_lv, unsigned int tick, int flag, SkillFunc func)
+{
+	struct battle_cast bc;
+	int i, count = 0;
 
-		return func(src,bl,skill_id,skill_lv,tick,flag);
-	}
-	return 0;
+	if( q->count == 0 )
+		return 0;
+
+	battle_cast_begin(&bc, src, skill_id, skill_lv);
+	for( i = 0; i < q->count; ++i )
+		if( q->bl[i]->prev )
+			count += skill_area_target(q->bl[i],src,skill_id,skill_lv,tick,flag,func);
+	battle_cast_end(&bc);
+
+	return count;
+}
+
+/// Applies func to the targets of the skill in range of center.
+static int skill_area_inrange(struct block_list *center, int range, int type, struct block_list *src, int skill_id, int skill_lv, unsigned int tick, int flag, SkillFunc func)
+{
+	struct map_query q;
+	int count;
+
+	map_query_inrange(&q, center, range, type);
+	count = skill_area_apply(&q, src, skill_id, skill_lv, tick, flag, func);
+	map_query_end(&q);
+	return count;
+}
+
+/// Applies func to the targets of the skill in the area (x0,y0)-(x1,y1).
+static int skill_area_inarea(int m, int x0, int y0, int x1, int y1, int type, struct block_list *src, int skill_id, int skill_lv, unsigned int tick, int flag, SkillFunc func)
+{
+	struct map_query q;
+	int count;
+
+	map_query_inarea(&q, m, x0, y0, x1, y1, type);
+	count = skill_area_apply(&q, src, skill_id, skill_lv, tick, flag, func);
+	map_query_end(&q);
+	return count;
+}
+
+/// Applies func to the targets of the skill on the cell (x,y).
+static int skill_area_incell(int m, int x, int y, int type, struct block_list *src, int skill_id, int skill_lv, unsigned int tick, int flag, SkillFunc func)
+{
+	struct map_query q;
+	int count;
+
+	map_query_incell(&q, m, x, y, type);
+	count = skill_area_apply(&q, src, skill_id, skill_lv, tick, flag, func);
+	map_query_end(&q);
+	return count;
 }
 
 static int skill_check_unit_range_sub (struct block_list *bl, va_list ap)
@@ -2310,10 +2373,10 @@ static int skill_timerskill(int tid, unsigned int tick, int id, intptr_t data)
 						skl->x+range,skl->y+range,BL_CHAR,src,skl->skill_id,skl->skill_lv,tick);
 					break;
 				case NPC_EARTHQUAKE:
-					skill_area_temp[0] = map_foreachinrange(skill_area_sub, src, skill_get_splash(skl->skill_id, skl->skill_lv), BL_CHAR, src, skl->skill_id, skl->skill_lv, tick, BCT_ENEMY, skill_area_sub_count);
+					skill_area_temp[0] = skill_area_inrange(src, skill_get_splash(skl->skill_id, skl->skill_lv), BL_CHAR, src, skl->skill_id, skl->skill_lv, tick, BCT_ENEMY, skill_area_sub_count);
 					skill_area_temp[1] = src->id;
 					skill_area_temp[2] = 0;
-					map_foreachinrange(skill_area_sub, src, skill_get_splash(skl->skill_id, skl->skill_lv), splash_target(src), src, skl->skill_id, skl->skill_lv, tick, skl->flag, skill_castend_damage_id);
+					skill_area_inrange(src, skill_get_splash(skl->skill_id, skl->skill_lv), splash_target(src), src, skl->skill_id, skl->skill_lv, tick, skl->flag, skill_castend_damage_id);
 					if( skl->type > 1 )
 						skill_addtimerskill(src,tick+250,src->id,0,0,skl->skill_id,skl->skill_lv,skl->type-1,skl->flag);
 					break;
@@ -2577,7 +2640,7 @@ int skill_castend_damage_id (struct block_list* src, struct block_list *bl, int
 	case MO_COMBOFINISH:
 		if (!(flag&1) && sc && sc->data[SC_SPIRIT] && sc->data[SC_SPIRIT]->val2 == SL_MONK)
 		{	//Becomes a splash attack when Soul Linked.
-			map_foreachinrange(skill_area_sub, bl,
+			skill_area_inrange(bl,
 				skill_get_splash(skillid, skilllv),splash_target(src),
 				src,skillid,skilllv,tick, flag|BCT_ENEMY|1,
 				skill_castend_damage_id);
@@ -2784,10 +2847,10 @@ int skill_castend_damage_id (struct block_list* src, struct block_list *bl, int
 			//SD_LEVEL -> Forced splash damage for Auto Blitz-Beat -> count targets
 			//special case: Venom Splasher uses a different range for searching than for splashing
 			if( flag&SD_LEVEL || skill_get_nk(skillid)&NK_SPLASHSPLIT )
-				skill_area_temp[0] = map_foreachinrange(skill_area_sub, bl, (skillid == AS_SPLASHER)?1:skill_get_splash(skillid, skilllv), BL_CHAR, src, skillid, skilllv, tick, BCT_ENEMY, skill_area_sub_count);
+				skill_area_temp[0] = skill_area_inrange(bl, (skillid == AS_SPLASHER)?1:skill_get_splash(skillid, skilllv), BL_CHAR, src, skillid, skilllv, tick, BCT_ENEMY, skill_area_sub_count);
 
 			// recursive invocation of skill_castend_damage_id() with flag|1
-			map_foreachinrange(skill_area_sub, bl, skill_get_splash(skillid, skilllv), splash_target(src), src, skillid, skilllv, tick, flag|BCT_ENEMY|SD_SPLASH|1, skill_castend_damage_id);
+			skill_area_inrange(bl, skill_get_splash(skillid, skilllv), splash_target(src), src, skillid, skilllv, tick, flag|BCT_ENEMY|SD_SPLASH|1, skill_castend_damage_id);
 
 			//FIXME: Isn't EarthQuake a ground skill after all?
 			if( skillid == NPC_EARTHQUAKE )
@@ -2829,13 +2892,13 @@ int skill_castend_damage_id (struct block_list* src, struct block_list *bl, int
 			for(i=0;i<c;i++){
 				if (!skill_blown(src,bl,1,(unit_getdir(src)+4)%8,0x1))
 					break; //Can't knockback
-				skill_area_temp[0] = map_foreachinrange(skill_area_sub, bl, skill_get_splash(skillid, skilllv), BL_CHAR, src, skillid, skilllv, tick, flag|BCT_ENEMY, skill_area_sub_count);
+				skill_area_temp[0] = skill_area_inrange(bl, skill_get_splash(skillid, skilllv), BL_CHAR, src, skillid, skilllv, tick, flag|BCT_ENEMY, skill_area_sub_count);
 				if( skill_area_temp[0] > 1 ) break; // collision
 			}
 			clif_blown(bl); //Update target pos.
 			if (i!=c) { //Splash
 				skill_area_temp[1] = bl->id;
-				map_foreachinrange(skill_area_sub, bl, skill_get_splash(skillid, skilllv), splash_target(src), src, skillid, skilllv, tick, flag|BCT_ENEMY|1, skill_castend_damage_id);
+				skill_area_inrange(bl, skill_get_splash(skillid, skilllv), splash_target(src), src, skillid, skilllv, tick, flag|BCT_ENEMY|1, skill_castend_damage_id);
 			}
 			//Weirdo dual-hit property, two attacks for 500%
 			skill_attack(BF_WEAPON,src,src,bl,skillid,skilllv,tick,0);
@@ -2858,7 +2921,7 @@ int skill_castend_damage_id (struct block_list* src, struct block_list *bl, int
 			if (skill_attack(BF_WEAPON,src,src,bl,skillid,skilllv,tick,0))
 				skill_blown(src,bl,skill_area_temp[2],-1,0);
 			for (i=0;i<4;i++) {
-				map_foreachincell(skill_area_sub,bl->m,x,y,BL_CHAR,
+				skill_area_incell(bl->m,x,y,BL_CHAR,
 					src,skillid,skilllv,tick,flag|BCT_ENEMY|1,skill_castend_damage_id);
 				x += dirx[dir];
 				y += diry[dir];
@@ -2871,7 +2934,7 @@ int skill_castend_damage_id (struct block_list* src, struct block_list *bl, int
 	{
 		skill_area_temp[1] = bl->id; //NOTE: This is used in skill_castend_nodamage_id to avoid affecting the target.
 		if (skill_attack(BF_WEAPON,src,src,bl,skillid,skilllv,tick,flag))
-			map_foreachinrange(skill_area_sub,bl,
+			skill_area_inrange(bl,
 				skill_get_splash(skillid, skilllv),BL_CHAR,
 				src,skillid,skilllv,tick,flag|BCT_ENEMY|1,
 				skill_castend_nodamage_id);
@@ -3056,7 +3119,7 @@ int skill_castend_damage_id (struct block_list* src, struct block_list *bl, int
 					skill_attack(BF_WEAPON, src, src, bl, skillid, skilllv, tick, SD_LEVEL|flag);
 			} else {
 				skill_area_temp[1] = bl->id;
-				map_foreachinrange(skill_area_sub, bl,
+				skill_area_inrange(bl,
 					sd->splash_range, BL_CHAR,
 					src, skillid, skilllv, tick, flag | BCT_ENEMY | 1,
 					skill_castend_damage_id);
@@ -3298,7 +3361,7 @@ int skill_castend_nodamage_id (struct block_list *src, struct block_list *bl, in
 		if (flag&1)
 			sc_start(bl,type, 23+skilllv*4 +status_get_lv(src) -status_get_lv(bl), skilllv,skill_get_time(skillid,skilllv));
 		else {
-			map_foreachinrange(skill_area_sub, src, skill_get_splash(skillid, skilllv), BL_CHAR,
+			skill_area_inrange(src, skill_get_splash(skillid, skilllv), BL_CHAR,
 				src, skillid, skilllv, tick, flag|BCT_ENEMY|1, skill_castend_nodamage_id);
 			clif_skill_nodamage(src, bl, skillid, skilllv, 1);
 		}
@@ -3579,7 +3642,7 @@ int skill_castend_nodamage_id (struct block_list *src, struct block_list *bl, in
 	case SM_MAGNUM:
 	case MS_MAGNUM:
 		skill_area_temp[1] = 0;
-		map_foreachinrange(skill_area_sub, src, skill_get_splash(skillid, skilllv), BL_SKILL|BL_CHAR,
+		skill_area_inrange(src, skill_get_splash(skillid, skilllv), BL_SKILL|BL_CHAR,
 			src,skillid,skilllv,tick, flag|BCT_ENEMY|1, skill_castend_damage_id);
 		clif_skill_nodamage (src,src,skillid,skilllv,1);
 		//Initiate 10% of your damage becomes fire element.
@@ -3686,7 +3749,7 @@ int skill_castend_nodamage_id (struct block_list *src, struct block_list *bl, in
 			sc_start(bl,type,100,skilllv,skill_get_time(skillid,skilllv));
 		else
 		{
-			map_foreachinrange(skill_area_sub, bl,
+			skill_area_inrange(bl,
 				skill_get_splash(skillid, skilllv), BL_PC,
 				src, skillid, skilllv, tick, flag|BCT_ALL|1,
 				skill_castend_nodamage_id);
@@ -3920,7 +3983,7 @@ int skill_castend_nodamage_id (struct block_list *src, struct block_list *bl, in
 	case RG_RAID:
 		skill_area_temp[1] = 0;
 		clif_skill_nodamage(src,bl,skillid,skilllv,1);
-		map_foreachinrange(skill_area_sub, bl,
+		skill_area_inrange(bl,
 			skill_get_splash(skillid, skilllv), splash_target(src),
 			src,skillid,skilllv,tick, flag|BCT_ENEMY|1,
 			skill_castend_damage_id);
@@ -3931,7 +3994,7 @@ int skill_castend_nodamage_id (struct block_list *src, struct block_list *bl, in
 	case GS_SPREADATTACK:
 		skill_area_temp[1] = 0;
 		clif_skill_nodamage(src,bl,skillid,skilllv,1);
-		map_foreachinrange(skill_area_sub, bl, skill_get_splash(skillid, skilllv), splash_target(src), 
+		skill_area_inrange(bl, skill_get_splash(skillid, skilllv), splash_target(src),
 			src, skillid, skilllv, tick, flag|BCT_ENEMY|SD_SPLASH|1, skill_castend_damage_id);
 		break;
 
@@ -3951,7 +4014,7 @@ int skill_castend_nodamage_id (struct block_list *src, struct block_list *bl, in
 		//Passive side of the attack.
 		status_change_end(src, SC_SIGHT, INVALID_TIMER);
 		clif_skill_nodamage(src,bl,skillid,skilllv,1);
-		map_foreachinrange(skill_area_sub,src,
+		skill_area_inrange(src,
 			skill_get_splash(skillid, skilllv),BL_CHAR|BL_SKILL,
 			src,skillid,skilllv,tick, flag|BCT_ENEMY|1,
 			skill_castend_damage_id);
@@ -3975,7 +4038,7 @@ int skill_castend_nodamage_id (struct block_list *src, struct block_list *bl, in
 			BCT_ENEMY:BCT_ALL;
 		clif_skill_nodamage(src, src, skillid, -1, 1);
 		map_delblock(src); //Required to prevent chain-self-destructions hitting back.
-		map_foreachinrange(skill_area_sub, bl,
+		skill_area_inrange(bl,
 			skill_get_splash(skillid, skilllv), splash_target(src),
 			src, skillid, skilllv, tick, flag|i,
 			skill_castend_damage_id);
@@ -4626,10 +4689,8 @@ int skill_castend_nodamage_id (struct block_list *src, struct block_list *bl, in
 			}
 			if(status_isimmune(bl) || !tsc || !tsc->count)
 				break;
-			for(i=0;i<SC_MAX;i++)
+			for( i = status_next_sc(tsc, SC_NONE); i != SC_NONE; i = status_next_sc(tsc, i) )
 			{
-				if (!tsc->data[i])
-					continue;
 				switch (i) {
 				case SC_WEIGHT50:		case SC_WEIGHT90:		case SC_HALLUCINATION:
 				case SC_STRIPWEAPON:	case SC_STRIPSHIELD:	case SC_STRIPARMOR:
@@ -4672,7 +4733,7 @@ int skill_castend_nodamage_id (struct block_list *src, struct block_list *bl, in
 			break;
 		}
 		//Affect all targets on splash area.
-		map_foreachinrange(skill_area_sub, bl, i, BL_CHAR,
+		skill_area_inrange(bl, i, BL_CHAR,
 			src, skillid, skilllv, tick, flag|1,
 			skill_castend_damage_id);
 		break;
@@ -5407,7 +5468,7 @@ int skill_castend_nodamage_id (struct block_list *src, struct block_list *bl, in
 				sc_start(bl,type,100,skilllv,skill_get_time(skillid, skilllv));
 		} else if (status_get_guild_id(src)) {
 			clif_skill_nodamage(src,bl,skillid,skilllv,1);
-			map_foreachinrange(skill_area_sub, src,
+			skill_area_inrange(src,
 				skill_get_splash(skillid, skilllv), BL_PC,
 				src,skillid,skilllv,tick, flag|BCT_GUILD|1,
 				skill_castend_nodamage_id);
@@ -5421,7 +5482,7 @@ int skill_castend_nodamage_id (struct block_list *src, struct block_list *bl, in
 				sc_start(bl,type,100,skilllv,skill_get_time(skillid, skilllv));
 		} else if (status_get_guild_id(src)) {
 			clif_skill_nodamage(src,bl,skillid,skilllv,1);
-			map_foreachinrange(skill_area_sub, src,
+			skill_area_inrange(src,
 				skill_get_splash(skillid, skilllv), BL_PC,
 				src,skillid,skilllv,tick, flag|BCT_GUILD|1,
 				skill_castend_nodamage_id);
@@ -5435,7 +5496,7 @@ int skill_castend_nodamage_id (struct block_list *src, struct block_list *bl, in
 				clif_skill_nodamage(src,bl,AL_HEAL,status_percent_heal(bl,90,90),1);
 		} else if (status_get_guild_id(src)) {
 			clif_skill_nodamage(src,bl,skillid,skilllv,1);
-			map_foreachinrange(skill_area_sub, src,
+			skill_area_inrange(src,
 				skill_get_splash(skillid, skilllv), BL_PC,
 				src,skillid,skilllv,tick, flag|BCT_GUILD|1,
 				skill_castend_nodamage_id);
@@ -5612,7 +5673,7 @@ int skill_castend_nodamage_id (struct block_list *src, struct block_list *bl, in
 		else {
 			skill_area_temp[2] = 0; //For SD_PREAMBLE
 			clif_skill_nodamage(src,bl,skillid,skilllv,1);
-			map_foreachinrange(skill_area_sub, bl,
+			skill_area_inrange(bl,
 				skill_get_splash(skillid, skilllv),BL_CHAR,
 				src,skillid,skilllv,tick, flag|BCT_ENEMY|SD_PREAMBLE|1,
 				skill_castend_nodamage_id);
@@ -5624,7 +5685,7 @@ int skill_castend_nodamage_id (struct block_list *src, struct block_list *bl, in
 		else {
 			skill_area_temp[2] = 0; //For SD_PREAMBLE
 			clif_skill_nodamage(src,bl,skillid,skilllv,1);
-			map_foreachinrange(skill_area_sub, bl,
+			skill_area_inrange(bl,
 				skill_get_splash(skillid, skilllv),BL_CHAR,
 				src,skillid,skilllv,tick, flag|BCT_ENEMY|SD_PREAMBLE|1,
 				skill_castend_nodamage_id);
@@ -6146,11 +6207,11 @@ int skill_castend_pos2(struct block_list* src, int x, int y, int skillid, int sk
 	case PR_BENEDICTIO:
 		skill_area_temp[1] = src->id;
 		i = skill_get_splash(skillid, skilllv);
-		map_foreachinarea(skill_area_sub,
+		skill_area_inarea(
 			src->m, x-i, y-i, x+i, y+i, BL_PC,
 			src, skillid, skilllv, tick, flag|BCT_ALL|1,
 			skill_castend_nodamage_id);
-		map_foreachinarea(skill_area_sub,
+		skill_area_inarea(
 			src->m, x-i, y-i, x+i, y+i, BL_CHAR,
 			src, skillid, skilllv, tick, flag|BCT_ENEMY|1,
 			skill_castend_damage_id);
@@ -6158,7 +6219,7 @@ int skill_castend_pos2(struct block_list* src, int x, int y, int skillid, int sk
 
 	case BS_HAMMERFALL:
 		i = skill_get_splash(skillid, skilllv);
-		map_foreachinarea (skill_area_sub,
+		skill_area_inarea(
 			src->m, x-i, y-i, x+i, y+i, BL_CHAR,
 			src, skillid, skilllv, tick, flag|BCT_ENEMY|2,
 			skill_castend_nodamage_id);
@@ -6390,7 +6451,7 @@ int skill_castend_pos2(struct block_list* src, int x, int y, int skillid, int sk
 
 			if(potion_hp > 0 || potion_sp > 0) {
 				i = skill_get_splash(skillid, skilllv);
-				map_foreachinarea(skill_area_sub,
+				skill_area_inarea(
 					src->m,x-i,y-i,x+i,y+i,BL_CHAR,
 					src,skillid,skilllv,tick,flag|BCT_PARTY|BCT_GUILD|1,
 					skill_castend_nodamage_id);
@@ -6412,7 +6473,7 @@ int skill_castend_pos2(struct block_list* src, int x, int y, int skillid, int sk
 
 			if(potion_hp > 0 || potion_sp > 0) {
 				i = skill_get_splash(skillid, skilllv);
-				map_foreachinarea(skill_area_sub,
+				skill_area_inarea(
 					src->m,x-i,y-i,x+i,y+i,BL_CHAR,
 					src,skillid,skilllv,tick,flag|BCT_PARTY|BCT_GUILD|1,
 						skill_castend_nodamage_id);
@@ -9233,7 +9294,7 @@ void skill_brandishspear(struct block_list* src, struct block_list* bl, int skil
 
 	if(skilllv > 9){
 		for(c=1;c<4;c++){
-			map_foreachincell(skill_area_sub,
+			skill_area_incell(
 				bl->m,tc.val1[c],tc.val2[c],BL_CHAR,
 				src,skillid,skilllv,tick, flag|BCT_ENEMY|n,
 				skill_castend_damage_id);
@@ -9249,7 +9310,7 @@ void skill_brandishspear(struct block_list* src, struct block_list* bl, int skil
 
 	if(skilllv > 3){
 		for(c=0;c<5;c++){
-			map_foreachincell(skill_area_sub,
+			skill_area_incell(
 				bl->m,tc.val1[c],tc.val2[c],BL_CHAR,
 				src,skillid,skilllv,tick, flag|BCT_ENEMY|n,
 				skill_castend_damage_id);
@@ -9261,7 +9322,7 @@ void skill_brandishspear(struct block_list* src, struct block_list* bl, int skil
 	}
 	for(c=0;c<10;c++){
 		if(c==0||c==5) skill_brandishspear_dir(&tc,dir,-1);
-		map_foreachincell(skill_area_sub,
+		skill_area_incell(
 			bl->m,tc.val1[c%5],tc.val2[c%5],BL_CHAR,
 			src,skillid,skilllv,tick, flag|BCT_ENEMY|1,
 			skill_castend_damage_id);
@@ -10296,11 +10357,9 @@ struct skill_unit_group_tickset *skill_unitgrouptickset_search (struct block_lis
 /*==========================================
  *
  *------------------------------------------*/
-int skill_unit_timer_sub_onplace (struct block_list* bl, va_list ap)
+static int skill_unit_timer_sub_onplace (struct block_list* bl, struct skill_unit* unit, unsigned int tick)
 {
-	struct skill_unit* unit = va_arg(ap,struct skill_unit *);
 	struct skill_unit_group* group = unit->group;
-	unsigned int tick = va_arg(ap,unsigned int);
 
 	if( !unit->alive || bl->prev == NULL )
 		return 0;
@@ -10451,10 +10510,24 @@ static int skill_unit_timer_sub (DBKey key, void* data, va_list ap)
 
 	if( unit->range >= 0 && group->interval != -1 )
 	{
+		struct map_query q;
+		struct battle_cast bc;
+		struct block_list* ss;
+		int i;
+
 		if( battle_config.skill_wall_check )
-			map_foreachinshootrange(skill_unit_timer_sub_onplace, bl, unit->range, group->bl_flag, bl,tick);
+			map_query_inshootrange(&q, bl, unit->range, group->bl_flag);
+		else
+			map_query_inrange(&q, bl, unit->range, group->bl_flag);
+		if( q.count && (ss = map_id2bl(group->src_id)) != NULL )
+			battle_cast_begin(&bc, ss, group->skill_id, group->skill_lv);
 		else
-			map_foreachinrange(skill_unit_timer_sub_onplace, bl, unit->range, group->bl_flag, bl,tick);
+			ss = NULL;
+		for( i = 0; i < q.count; ++i )
+			skill_unit_timer_sub_onplace(q.bl[i], unit, tick);
+		if( ss )
+			battle_cast_end(&bc);
+		map_query_end(&q);
 
 		if(unit->range == -1) //Unit disabled, but it should not be deleted yet.
 			group->unit_id = UNT_USED_TRAPS;
@@ -10637,6 +10710,7 @@ int skill_unit_move_unit_group (struct skill_unit_group *group, int m, int dx, i
 	int i,j;
 	unsigned int tick = gettick();
 	int *m_flag;
+	size_t mark;
 	struct skill_unit *unit1;
 	struct skill_unit *unit2;
 
@@ -10653,7 +10727,8 @@ int skill_unit_move_unit_group (struct skill_unit_group *group, int m, int dx, i
 	if( group->unit_id == UNT_ICEWALL )
 		return 0; //Icewalls don't get knocked back
 
-	m_flag = (int *) aCalloc(group->unit_count, sizeof(int));
+	mark = arena_mark(skill_scratch); // moving the cells can move other groups in between
+	m_flag = (int *) arena_calloc(skill_scratch, group->unit_count, sizeof(int));
 	//    m_flag
 	//		0: Neither of the following (skill_unit_onplace & skill_unit_onout are needed)
 	//		1: Unit will move to a slot that had another unit of the same group (skill_unit_onplace not needed)
@@ -10717,7 +10792,7 @@ int skill_unit_move_unit_group (struct skill_unit_group *group, int m, int dx, i
 			map_foreachincell(skill_unit_effect,unit1->bl.m,unit1->bl.x,unit1->bl.y,group->bl_flag,&unit1->bl,tick,1);
 		}
 	}
-	aFree(m_flag);
+	arena_rewind(skill_scratch, mark);
 	return 0;
 }
 
@@ -11876,8 +11951,9 @@ int do_init_skill (void)
 
 	group_db = idb_alloc(DB_OPT_BASE);
 	skillunit_db = idb_alloc(DB_OPT_BASE);
-	skill_unit_ers = ers_new(sizeof(struct skill_unit_group));
-	skill_timer_ers  = ers_new(sizeof(struct skill_timerskill));
+	skill_unit_ers = ers_new(sizeof(struct skill_unit_group), "skill.c::skill_unit_ers");
+	skill_timer_ers  = ers_new(sizeof(struct skill_timerskill), "skill.c::skill_timer_ers");
+	skill_scratch = arena_create("skill.c::skill_scratch", 4096);
 
 	add_timer_func_list(skill_unit_timer,"skill_unit_timer");
 	add_timer_func_list(skill_castend_id,"skill_castend_id");
@@ -11897,5 +11973,6 @@ int do_final_skill(void)
 	db_destroy(skillunit_db);
 	ers_destroy(skill_unit_ers);
 	ers_destroy(skill_timer_ers);
+	arena_destroy(skill_scratch);
 	return 0;
 }
@@ -59,6 +59,13 @@ static int atkmods[3][MAX_WEAPON_TYPE];	// 
 static char job_bonus[CLASS_COUNT][MAX_LEVEL];
 
 static struct eri *sc_data_ers; //For sc_data entries
+static struct eri *sc_table_ers; //For the sc_data tables of units with active statuses
+
+/// Per-unit sc_data table, allocated on the first status change a unit receives.
+struct sc_table {
+	struct status_change_entry *data[SC_MAX];
+};
+static struct status_change_entry *sc_data_empty[SC_MAX]; //Shared by all units without status changes
 static struct status_data dummy_status;
 
 int current_equip_item_index; //Contains inventory index of an equipped item. To pass it into the EQUP_SCRIPT [Lupus]
@@ -1929,10 +1936,10 @@ int status_calc_pc_(struct map_session_data* sd, bool first)
 			if(sd->inventory_data[index]->script) {
 				if (wd == &sd->left_weapon) {
 					sd->state.lr_flag = 1;
-					run_script(sd->inventory_data[index]->script,0,sd->bl.id,0);
+					run_script_bonus(sd->inventory_data[index]->script,sd);
 					sd->state.lr_flag = 0;
 				} else
-					run_script(sd->inventory_data[index]->script,0,sd->bl.id,0);
+					run_script_bonus(sd->inventory_data[index]->script,sd);
 				if (!calculating) //Abort, run_script retriggered this. [Skotlex]
 					return 1;
 			}
@@ -1951,7 +1958,7 @@ int status_calc_pc_(struct map_session_data* sd, bool first)
 		else if(sd->inventory_data[index]->type == IT_ARMOR) {
 			refinedef += sd->status.inventory[index].refine*refinebonus[0][0];
 			if(sd->inventory_data[index]->script) {
-				run_script(sd->inventory_data[index]->script,0,sd->bl.id,0);
+				run_script_bonus(sd->inventory_data[index]->script,sd);
 				if (!calculating) //Abort, run_script retriggered this. [Skotlex]
 					return 1;
 			}
@@ -1963,7 +1970,7 @@ int status_calc_pc_(struct map_session_data* sd, bool first)
 		if(sd->inventory_data[index]){		// Arrows
 			sd->arrow_atk += sd->inventory_data[index]->atk;
 			sd->state.lr_flag = 2;
-			run_script(sd->inventory_data[index]->script,0,sd->bl.id,0);
+			run_script_bonus(sd->inventory_data[index]->script,sd);
 			sd->state.lr_flag = 0;
 			if (!calculating) //Abort, run_script retriggered status_calc_pc. [Skotlex]
 				return 1;
@@ -2025,10 +2032,10 @@ int status_calc_pc_(struct map_session_data* sd, bool first)
 				if(i == EQI_HAND_L && sd->status.inventory[index].equip == EQP_HAND_L)
 				{	//Left hand status.
 					sd->state.lr_flag = 1;
-					run_script(data->script,0,sd->bl.id,0);
+					run_script_bonus(data->script,sd);
 					sd->state.lr_flag = 0;
 				} else
-					run_script(data->script,0,sd->bl.id,0);
+					run_script_bonus(data->script,sd);
 				if (!calculating) //Abort, run_script his function. [Skotlex]
 					return 1;
 			}
@@ -2039,7 +2046,7 @@ int status_calc_pc_(struct map_session_data* sd, bool first)
 	{
 		struct item_data *data = itemdb_exists(sc->data[SC_ITEMSCRIPT]->val1);
 		if( data && data->script )
-			run_script(data->script,0,sd->bl.id,0);
+			run_script_bonus(data->script,sd);
 	}
 
 	if( sd->pd )
@@ -3110,6 +3117,8 @@ void status_calc_bl_(struct block_list* bl, enum scb_flag flag, bool first)
 	status = status_get_status_data(bl);
 	memcpy(&b_status, status, sizeof(struct status_data));
 
+	battle_cast_reset(bl); // the terms of its casts in progress may change
+
 	if( flag&SCB_BASE )
 	{// calculate the object's base status too
 		switch( bl->type )
@@ -4561,6 +4570,47 @@ void status_change_init(struct block_list *bl)
 	struct status_change *sc = status_get_sc(bl);
 	nullpo_retv(sc);
 	memset(sc, 0, sizeof (struct status_change));
+	sc->data = sc_data_empty;
+}
+
+/// Returns the lowest active status change after type, or SC_NONE.
+/// Starting from SC_NONE walks every active status in ascending order.
+sc_type status_next_sc(struct status_change *sc, int type)
+{
+	int i = type + 1;
+	uint64 b;
+
+	if( i >= SC_MAX )
+		return SC_NONE;
+	b = sc->active[i/64] & (~UINT64_C(0) << (i%64));
+	i /= 64;
+	while( !b )
+	{
+		if( ++i >= SC_ACTIVE_WORDS )
+			return SC_NONE;
+		b = sc->active[i];
+	}
+	// index of the lowest set bit
+	b = (b & (~b + 1)) - 1;
+	b = b - ((b >> 1) & UINT64_C(0x5555555555555555));
+	b = (b & UINT64_C(0x3333333333333333)) + ((b >> 2) & UINT64_C(0x3333333333333333));
+	b = (b + (b >> 4)) & UINT64_C(0x0F0F0F0F0F0F0F0F);
+	return (sc_type)(i*64 + (int)((b * UINT64_C(0x0101010101010101)) >> 56));
+}
+
+/// Unlinks a status change entry from the unit and returns its table to the pool once the last one is gone.
+static void status_change_unset(struct status_change *sc, enum sc_type type)
+{
+	int i;
+
+	sc->data[type] = NULL;
+	sc->active[type/64] &= ~(UINT64_C(1) << (type%64));
+	ARR_FIND(0, SC_ACTIVE_WORDS, i, sc->active[i] != 0);
+	if( i == SC_ACTIVE_WORDS && sc->data != sc_data_empty )
+	{
+		ers_free(sc_table_ers, (struct sc_table*)sc->data);
+		sc->data = sc_data_empty;
+	}
 }
 
 //Applies SC defense to a given status change.
@@ -6294,7 +6344,14 @@ int status_change_start(struct block_list* bl,enum sc_type type,int rate,int val
 	else
 	{// new sc
 		++(sc->count);
+		if( sc->data == sc_data_empty )
+		{
+			struct sc_table* table = ers_alloc(sc_table_ers, struct sc_table);
+			memset(table, 0, sizeof(struct sc_table));
+			sc->data = table->data;
+		}
 		sce = sc->data[type] = ers_alloc(sc_data_ers, struct status_change_entry);
+		sc->active[type/64] |= UINT64_C(1) << (type%64);
 	}
 	sce->val1 = val1;
 	sce->val2 = val2;
@@ -6386,11 +6443,8 @@ int status_change_clear(struct block_list* bl, int type)
 	if (!sc || !sc->count)
 		return 0;
 
-	for(i = 0; i < SC_MAX; i++)
+	for( i = status_next_sc(sc, SC_NONE); i != SC_NONE; i = status_next_sc(sc, i) )
 	{
-		if(!sc->data[i])
-		  continue;
-
 		if(type == 0)
 		switch (i)
 		{	//Type 0: PC killed -> Place here statuses that do not dispel on death.
@@ -6431,7 +6485,7 @@ int status_change_clear(struct block_list* bl, int type)
 			if (sc->data[i]->timer != INVALID_TIMER)
 				delete_timer(sc->data[i]->timer, status_change_timer);
 			ers_free(sc_data_ers, sc->data[i]);
-			sc->data[i] = NULL;
+			status_change_unset(sc, (sc_type)i);
 		}
 	}
 
@@ -6498,7 +6552,7 @@ int status_change_end_(struct block_list* bl, enum sc_type type, int tid, const
 		}
 	}
 
-	sc->data[type] = NULL;
+	status_change_unset(sc, type);
 	(sc->count)--;
 
 	vd = status_get_viewdata(bl);
@@ -7429,11 +7483,8 @@ int status_change_clear_buffs (struct block_list* bl, int type)
 		status_change_end(bl, (sc_type)i, INVALID_TIMER);
 	}
 
-	for( i = SC_COMMON_MAX+1; i < SC_MAX; i++ )
+	for( i = status_next_sc(sc, SC_COMMON_MAX); i != SC_NONE; i = status_next_sc(sc, i) )
 	{
-		if(!sc->data[i])
-			continue;
-		
 		switch (i) {
 			//Stuff that cannot be removed
 			case SC_WEIGHT50:
@@ -7843,11 +7894,13 @@ int do_init_status(void)
 	status_readdb();
 	status_calc_sigma();
 	natural_heal_prev_tick = gettick();
-	sc_data_ers = ers_new(sizeof(struct status_change_entry));
+	sc_data_ers = ers_new(sizeof(struct status_change_entry), "status.c::sc_data_ers");
+	sc_table_ers = ers_new(sizeof(struct sc_table), "status.c::sc_table_ers");
 	add_timer_interval(natural_heal_prev_tick + NATURAL_HEAL_INTERVAL, status_natural_heal_timer, 0, 0, NATURAL_HEAL_INTERVAL);
 	return 0;
 }
 void do_final_status(void)
 {
 	ers_destroy(sc_data_ers);
+	ers_destroy(sc_table_ers);
 }
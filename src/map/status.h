@@ -1218,6 +1218,9 @@ struct regen_data {
 	struct regen_data_sub *sregen, *ssregen;
 };
 
+/// Number of 64-bit words in the status_change active mask.
+#define SC_ACTIVE_WORDS ((SC_MAX+63)/64)
+
 struct status_change_entry {
 	int timer;
 	int val1,val2,val3,val4;
@@ -1234,7 +1237,8 @@ struct status_change {
 	unsigned short mp_matk_min, mp_matk_max; //Previous matk min/max for ground spells (Amplify magic power)
 	int sg_id; //ID of the previous Storm gust that hit you
 	unsigned char sg_counter; //Storm gust counter (previous hits from storm gust)
-	struct status_change_entry *data[SC_MAX];
+	uint64 active[SC_ACTIVE_WORDS]; ///< bit set for every sc_type with an entry in data
+	struct status_change_entry **data; ///< SC_MAX entries, shared all-NULL table while no status is active
 };
 
 // for looking up associated data
@@ -1314,6 +1318,7 @@ int status_get_race2(struct block_list *bl);
 struct view_data *status_get_viewdata(struct block_list *bl);
 void status_set_viewdata(struct block_list *bl, int class_);
 void status_change_init(struct block_list *bl);
+sc_type status_next_sc(struct status_change *sc, int type);
 struct status_change *status_get_sc(struct block_list *bl);
 
 int status_isdead(struct block_list *bl);
@@ -0,0 +1,438 @@
+// Copyright (c) Athena Dev Teams - Licensed under GNU GPL
+// For more information, see LICENCE in the main folder
+
+// Battle cast replay.
+// Replays a recorded set of casts against a group of target mobs. Every cast
+// is computed twice from the same random seed: once target by target without
+// a battle_cast, and once with all targets inside battle_cast_begin() and
+// battle_cast_end(). The two must give identical results.
+
+#include "../common/cbasetypes.h"
+#include "../common/db.h"
+#include "../common/malloc.h"
+#include "../common/showmsg.h"
+#include "../common/strlib.h"
+#include "../common/timer.h"
+#include "../map/battle.h"
+#include "../map/itemdb.h"
+#include "../map/map.h"
+#include "../map/mob.h"
+#include "../map/pc.h"
+#include "../map/skill.h"
+#include "../map/status.h"
+#include "../map/unit.h"
+#include "battle_replay.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define REPLAY_MAX_TARGETS 64
+#define REPLAY_MAX_CASTERS 8
+#define REPLAY_MAX_SKILLS 256
+#define REPLAY_ACCOUNT_ID 2000000
+
+static int replay_m = -1;
+static short replay_x, replay_y;
+static struct block_list* replay_target[REPLAY_MAX_TARGETS];
+static int replay_target_count;
+static struct block_list* replay_caster[REPLAY_MAX_CASTERS];
+static int replay_caster_count;
+static int replay_skill[REPLAY_MAX_SKILLS];
+static int replay_skill_count;
+static int replay_errors;
+
+static int replay_casts, replay_results, replay_diffs;
+static unsigned int replay_plain_time, replay_shared_time;
+
+
+/// Returns the skill id of a skill name or number, or -1 if unknown.
+static int battle_replay_skill(const char* str)
+{
+	int skill_num;
+
+	if( ISDIGIT(str[0]) )
+		skill_num = atoi(str);
+	else
+		skill_num = skill_name2id(str);
+
+	if( skill_num < 0 || (skill_num > 0 && skill_get_max(skill_num) <= 0) || (skill_num == 0 && strcmp(str, "0") != 0) )
+		return -1;
+	return skill_num;
+}
+
+
+/// map,<map name>,<x>,<y>
+static bool battle_replay_read_map(char* fields[], int columns)
+{
+	if( columns != 4 )
+		return false;
+
+	replay_m = map_mapname2mapid(fields[1]);
+	if( replay_m < 0 )
+	{
+		ShowError("battle_replay: Map '%s' is not loaded.\n", fields[1]);
+		return false;
+	}
+	replay_x = atoi(fields[2]);
+	replay_y = atoi(fields[3]);
+	return true;
+}
+
+
+/// target,<mob id>{,<amount>}
+static bool battle_replay_read_target(char* fields[], int columns)
+{
+	int class_ = atoi(fields[1]);
+	int amount = ( columns > 2 ) ? atoi(fields[2]) : 1;
+
+	if( mobdb_checkid(class_) == 0 )
+	{
+		ShowError("battle_replay: Unknown mob %d.\n", class_);
+		return false;
+	}
+
+	while( amount-- > 0 )
+	{
+		int n = replay_target_count;
+		int id;
+
+		if( n == REPLAY_MAX_TARGETS )
+		{
+			ShowError("battle_replay: More than %d targets.\n", REPLAY_MAX_TARGETS);
+			return false;
+		}
+
+		id = mob_once_spawn(NULL, replay_m, replay_x + n%5 - 2, replay_y + (n/5)%5 - 2, "--ja--", class_, 1, "");
+		if( (replay_target[n] = map_id2bl(id)) == NULL )
+		{
+			ShowError("battle_replay: Failed to spawn mob %d.\n", class_);
+			return false;
+		}
+		replay_target_count++;
+	}
+	return true;
+}
+
+
+/// mob,<mob id>
+static bool battle_replay_read_mob(char* fields[], int columns)
+{
+	int class_ = atoi(fields[1]);
+	int id;
+
+	if( mobdb_checkid(class_) == 0 )
+	{
+		ShowError("battle_replay: Unknown mob %d.\n", class_);
+		return false;
+	}
+
+	id = mob_once_spawn(NULL, replay_m, replay_x, replay_y, "--ja--", class_, 1, "");
+	if( (replay_caster[replay_caster_count] = map_id2bl(id)) == NULL )
+	{
+		ShowError("battle_replay: Failed to spawn mob %d.\n", class_);
+		return false;
+	}
+	replay_caster_count++;
+	return true;
+}
+
+
+/// pc,<job id>,<base level>,<job level>,<str>,<agi>,<vit>,<int>,<dex>,<luk>,<weapon id>{,<ammo id>}
+/// The player is not on the map and has every skill of its job at max level.
+static bool battle_replay_read_pc(char* fields[], int columns)
+{
+	struct map_session_data* sd;
+	int i;
+
+	if( columns < 11 )
+		return false;
+	if( pc_jobid2mapid(atoi(fields[1])) == -1 )
+	{
+		ShowError("battle_replay: Unknown job %d.\n", atoi(fields[1]));
+		return false;
+	}
+
+	CREATE(sd, struct map_session_data, 1);
+	sd->bl.id = REPLAY_ACCOUNT_ID + replay_caster_count;
+	sd->bl.type = BL_PC;
+	sd->bl.m = replay_m;
+	sd->bl.x = replay_x;
+	sd->bl.y = replay_y;
+	sd->status.account_id = sd->bl.id;
+	sd->status.char_id = sd->bl.id;
+	sd->status.sex = 1;
+	sd->status.class_ = atoi(fields[1]);
+	sd->class_ = pc_jobid2mapid(sd->status.class_);
+	sd->status.base_level = atoi(fields[2]);
+	sd->status.job_level = atoi(fields[3]);
+	sd->status.str = atoi(fields[4]);
+	sd->status.agi = atoi(fields[5]);
+	sd->status.vit = atoi(fields[6]);
+	sd->status.int_ = atoi(fields[7]);
+	sd->status.dex = atoi(fields[8]);
+	sd->status.luk = atoi(fields[9]);
+	sd->status.hp = sd->status.sp = 999999;
+	for( i = 0; i < ARRAYLENGTH(sd->autobonus); i++ )
+		sd->autobonus[i].active = INVALID_TIMER;
+	for( i = 0; i < ARRAYLENGTH(sd->autobonus2); i++ )
+		sd->autobonus2[i].active = INVALID_TIMER;
+	for( i = 0; i < ARRAYLENGTH(sd->autobonus3); i++ )
+		sd->autobonus3[i].active = INVALID_TIMER;
+
+	for( i = 10; i < columns; i++ )
+	{// equipped weapon and ammo
+		int nameid = atoi(fields[i]);
+		struct item_data* id;
+
+		if( nameid == 0 )
+			continue;
+		if( (id = itemdb_exists(nameid)) == NULL )
+		{
+			ShowError("battle_replay: Unknown item %d.\n", nameid);
+			aFree(sd);
+			return false;
+		}
+		sd->status.inventory[i-10].nameid = nameid;
+		sd->status.inventory[i-10].amount = 1;
+		sd->status.inventory[i-10].identify = 1;
+		sd->status.inventory[i-10].equip = id->equip;
+	}
+
+	for( i = 1; i < MAX_SKILL; i++ )
+		sd->status.skill[i].lv = skill_get_max(i);
+
+	pc_setinventorydata(sd);
+	pc_setequipindex(sd);
+	status_change_init(&sd->bl);
+	unit_dataset(&sd->bl);
+	status_calc_pc(sd, true);
+
+	replay_caster[replay_caster_count++] = &sd->bl;
+	return true;
+}
+
+
+/// skillatk,<skill>,<rate> and skillblown,<skill>,<count>
+/// Gives the last player caster a bonus, as if from its equipment.
+static bool battle_replay_read_bonus(char* fields[], int columns)
+{
+	struct map_session_data* sd;
+	int skill_num, i;
+
+	if( columns != 3 )
+		return false;
+	if( replay_caster_count == 0 || (sd = BL_CAST(BL_PC, replay_caster[replay_caster_count-1])) == NULL )
+	{
+		ShowError("battle_replay: '%s' needs a player caster.\n", fields[0]);
+		return false;
+	}
+	if( (skill_num = battle_replay_skill(fields[1])) <= 0 )
+	{
+		ShowError("battle_replay: Unknown skill '%s'.\n", fields[1]);
+		return false;
+	}
+
+	if( strcmp(fields[0], "skillatk") == 0 )
+	{
+		ARR_FIND(0, ARRAYLENGTH(sd->skillatk), i, sd->skillatk[i].id == 0);
+		if( i == ARRAYLENGTH(sd->skillatk) )
+			return false;
+		sd->skillatk[i].id = skill_num;
+		sd->skillatk[i].val = atoi(fields[2]);
+	}
+	else
+	{
+		ARR_FIND(0, ARRAYLENGTH(sd->skillblown), i, sd->skillblown[i].id == 0);
+		if( i == ARRAYLENGTH(sd->skillblown) )
+			return false;
+		sd->skillblown[i].id = skill_num;
+		sd->skillblown[i].val = atoi(fields[2]);
+	}
+	return true;
+}
+
+
+/// cast,<skill>
+/// Skill 0 is the normal attack.
+static bool battle_replay_read_cast(char* fields[], int columns)
+{
+	int skill_num;
+
+	if( columns != 2 )
+		return false;
+	if( (skill_num = battle_replay_skill(fields[1])) < 0 )
+	{
+		ShowError("battle_replay: Unknown skill '%s'.\n", fields[1]);
+		return false;
+	}
+	if( replay_skill_count == REPLAY_MAX_SKILLS )
+	{
+		ShowError("battle_replay: More than %d casts.\n", REPLAY_MAX_SKILLS);
+		return false;
+	}
+	replay_skill[replay_skill_count++] = skill_num;
+	return true;
+}
+
+
+static bool battle_replay_readdb_sub(char* fields[], int columns, int current)
+{
+	bool ok;
+
+	if( strcmp(fields[0], "map") == 0 )
+		ok = battle_replay_read_map(fields, columns);
+	else if( replay_m < 0 )
+	{
+		ShowError("battle_replay: '%s' before the map.\n", fields[0]);
+		ok = false;
+	}
+	else if( strcmp(fields[0], "target") == 0 )
+		ok = battle_replay_read_target(fields, columns);
+	else if( strcmp(fields[0], "mob") == 0 || strcmp(fields[0], "pc") == 0 )
+	{
+		if( replay_caster_count == REPLAY_MAX_CASTERS )
+		{
+			ShowError("battle_replay: More than %d casters.\n", REPLAY_MAX_CASTERS);
+			ok = false;
+		}
+		else if( fields[0][0] == 'm' )
+			ok = battle_replay_read_mob(fields, columns);
+		else
+			ok = battle_replay_read_pc(fields, columns);
+	}
+	else if( strcmp(fields[0], "skillatk") == 0 || strcmp(fields[0], "skillblown") == 0 )
+		ok = battle_replay_read_bonus(fields, columns);
+	else if( strcmp(fields[0], "cast") == 0 )
+		ok = battle_replay_read_cast(fields, columns);
+	else
+	{
+		ShowError("battle_replay: Unknown entry '%s'.\n", fields[0]);
+		ok = false;
+	}
+
+	if( !ok )
+		replay_errors++;
+	return ok;
+}
+
+
+static bool battle_replay_same(const struct Damage* a, const struct Damage* b)
+{
+	return( a->damage == b->damage && a->damage2 == b->damage2 && a->type == b->type && a->div_ == b->div_
+		&& a->amotion == b->amotion && a->dmotion == b->dmotion && a->blewcount == b->blewcount
+		&& a->flag == b->flag && a->dmg_lv == b->dmg_lv );
+}
+
+
+/// Replays one cast against all targets, uncached and then shared.
+static void battle_replay_cast(struct block_list* src, int skill_num, int skill_lv, int attack_type)
+{
+	static struct Damage plain[REPLAY_MAX_TARGETS], shared[REPLAY_MAX_TARGETS];
+	struct status_data* status = status_get_status_data(src);
+	unsigned int hp = status->hp, sp = status->sp;
+	struct battle_cast bc;
+	unsigned int seed = 777 + skill_num*31 + skill_lv;
+	unsigned int tick;
+	int plain_rand, shared_rand;
+	int i;
+
+	srand(seed);
+	tick = gettick_nocache();
+	for( i = 0; i < replay_target_count; i++ )
+		plain[i] = battle_calc_attack(attack_type, src, replay_target[i], skill_num, skill_lv, replay_target_count);
+	replay_plain_time += gettick_nocache() - tick;
+	plain_rand = rand();
+
+	// both passes start from the same HP and SP (Asura Strike uses up the SP)
+	status->hp = hp;
+	status->sp = sp;
+	srand(seed);
+	tick = gettick_nocache();
+	battle_cast_begin(&bc, src, skill_num, skill_lv);
+	for( i = 0; i < replay_target_count; i++ )
+		shared[i] = battle_calc_attack(attack_type, src, replay_target[i], skill_num, skill_lv, replay_target_count);
+	battle_cast_end(&bc);
+	replay_shared_time += gettick_nocache() - tick;
+	shared_rand = rand();
+	status->hp = hp;
+	status->sp = sp;
+
+	replay_casts++;
+	for( i = 0; i < replay_target_count; i++ )
+	{
+		replay_results++;
+		if( battle_replay_same(&plain[i], &shared[i]) )
+			continue;
+		replay_diffs++;
+		ShowError("battle_replay: Skill %d lv %d of %d on %d: uncached %d/%d div %d blew %d flag 0x%x, shared %d/%d div %d blew %d flag 0x%x.\n",
+			skill_num, skill_lv, src->id, replay_target[i]->id,
+			plain[i].damage, plain[i].damage2, plain[i].div_, plain[i].blewcount, plain[i].flag,
+			shared[i].damage, shared[i].damage2, shared[i].div_, shared[i].blewcount, shared[i].flag);
+	}
+	if( plain_rand != shared_rand )
+	{// a different number of random rolls
+		replay_diffs++;
+		ShowError("battle_replay: Skill %d lv %d of %d: the random state differs after the cast.\n", skill_num, skill_lv, src->id);
+	}
+}
+
+
+int battle_replay(const char* filename)
+{
+	char directory[1024];
+	const char* name;
+	int i, j, skill_lv;
+
+	// sv_readdb wants the directory and the file name apart
+	name = strrchr(filename, '/');
+	if( name == NULL )
+	{
+		safestrncpy(directory, ".", sizeof(directory));
+		name = filename;
+	}
+	else
+	{
+		safestrncpy(directory, filename, min(sizeof(directory), (size_t)(name - filename + 1)));
+		name++;
+	}
+
+	if( !sv_readdb(directory, name, ',', 2, 12, -1, &battle_replay_readdb_sub) )
+		return 1;
+	if( replay_errors == 0 && (replay_target_count == 0 || replay_caster_count == 0 || replay_skill_count == 0) )
+	{
+		ShowError("battle_replay: '%s' needs targets, casters and casts.\n", filename);
+		replay_errors++;
+	}
+
+	if( replay_errors == 0 )
+	{
+		for( i = 0; i < replay_caster_count; i++ )
+		{
+			for( j = 0; j < replay_skill_count; j++ )
+			{
+				int skill_num = replay_skill[j];
+				int attack_type = skill_num ? skill_get_type(skill_num) : BF_WEAPON;
+				int max_lv = skill_num ? skill_get_max(skill_num) : 1;
+
+				if( attack_type != BF_WEAPON && attack_type != BF_MAGIC && attack_type != BF_MISC )
+				{
+					ShowWarning("battle_replay: Skill %d does not deal damage, skipped.\n", skill_num);
+					continue;
+				}
+				for( skill_lv = 1; skill_lv <= max_lv; skill_lv++ )
+					battle_replay_cast(replay_caster[i], skill_num, skill_lv, attack_type);
+			}
+		}
+		ShowInfo("battle_replay: %d casts, %d results, %d differences (uncached %u ms, shared %u ms).\n",
+			replay_casts, replay_results, replay_diffs, replay_plain_time, replay_shared_time);
+	}
+
+	for( i = 0; i < replay_caster_count; i++ )
+	{// the player casters are not on the map, mobs are cleared with it
+		if( replay_caster[i]->type == BL_PC )
+			aFree(replay_caster[i]);
+	}
+
+	return replay_diffs + replay_errors;
+}
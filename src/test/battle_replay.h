@@ -0,0 +1,12 @@
+// Copyright (c) Athena Dev Teams - Licensed under GNU GPL
+// For more information, see LICENCE in the main folder
+
+#ifndef _BATTLE_REPLAY_H_
+#define _BATTLE_REPLAY_H_
+
+/// Replays the casts of a cast set file and compares the damage of each cast
+/// computed with and without a battle_cast.
+/// Returns the number of differences and errors, 0 if everything matched.
+int battle_replay(const char* filename);
+
+#endif /* _BATTLE_REPLAY_H_ */
@@ -0,0 +1,1292 @@
+// Copyright (c) Athena Dev Teams - Licensed under GNU GPL
+// For more information, see LICENCE in the main folder
+
+// Headless bot client.
+// Logs bots in through the login, char and map servers over the network like
+// real clients, keeps them busy with scripted behaviour (walk, attack, chat,
+// vend, skill spam) and reports latency percentiles, packet rates and the cpu
+// time of the servers, so changes to the servers can be measured.
+
+#include "../common/cbasetypes.h"
+#include "../common/core.h"
+#include "../common/db.h"
+#include "../common/malloc.h"
+#include "../common/mmo.h"
+#include "../common/random.h"
+#include "../common/showmsg.h"
+#include "../common/socket.h"
+#include "../common/strlib.h"
+#include "../common/timer.h"
+#include "../common/utils.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifndef _WIN32
+#include <unistd.h>
+#endif
+
+#define BOT_CONF_NAME "conf/botclient.conf"
+
+#define MAX_BOTS 4096
+#define MAX_BOT_TARGETS 16
+#define MAX_LOGIN_COMMANDS 16
+#define MAX_SERVER_PIDS 8
+
+#define MAX_PACKET_DB 0xf00
+#define MAX_PACKET_POS 20
+#define BOT_CHAT_SIZE (255 + 1)
+
+/// Latency histogram: 1ms buckets up to LATENCY_BUCKETS ms, last bucket is for the rest.
+#define LATENCY_BUCKETS 2000
+
+/// Skill used to open a shop.
+#define MC_VENDING 41
+
+enum bot_state
+{
+	BOT_IDLE,     // not started yet
+	BOT_LOGIN,    // authenticating with the login server
+	BOT_CHAR,     // selecting the character in the char server
+	BOT_MAPAUTH,  // waiting for the map server to accept the character
+	BOT_ONLINE,   // on the map
+	BOT_OFFLINE,  // disconnected (failed or done)
+};
+
+enum bot_action
+{
+	ACT_WALK,
+	ACT_ATTACK,
+	ACT_CHAT,
+	ACT_VEND,
+	ACT_SKILL,
+	ACT_MAX
+};
+
+/// Client packets used by the bots, their layout comes from the packet database.
+enum bot_packet
+{
+	BP_WANTTOCONNECTION,
+	BP_LOADENDACK,
+	BP_TICKSEND,
+	BP_WALKTOXY,
+	BP_GLOBALMESSAGE,
+	BP_ACTIONREQUEST,
+	BP_USESKILLTOID,
+	BP_USESKILLTOPOS,
+	BP_OPENVENDING,
+	BP_CLOSEVENDING,
+	BP_MAX
+};
+
+static const char* bot_packet_name[BP_MAX] = {
+	"wanttoconnection",
+	"loadendack",
+	"ticksend",
+	"walktoxy",
+	"globalmessage",
+	"actionrequest",
+	"useskilltoid",
+	"useskilltopos",
+	"openvending",
+	"closevending",
+};
+
+struct bot_packet_data
+{
+	int cmd;
+	int len;
+	short pos[MAX_PACKET_POS];
+};
+
+struct bot
+{
+	int id;
+	enum bot_state state;
+	int fd;
+	char userid[NAME_LENGTH];
+	char name[NAME_LENGTH];
+	bool registering; // logging in with the _M suffix
+
+	int account_id;
+	int char_id;
+	uint32 login_id1;
+	uint32 login_id2;
+	uint8 sex;
+	uint32 ip; // address of the next server
+	uint16 port;
+	bool skip_account_id; // char server sends the account id before the first packet
+
+	short x, y;
+	int login_command; // next login command to send
+	unsigned int start_tick; // tick when the bot started logging in
+	unsigned int char_tick; // tick of the pending char server request
+	unsigned int next_action;
+	unsigned int next_ping;
+	unsigned int ping_tick; // tick of the pending latency probe, 0 when none
+	unsigned int walk_tick;
+	unsigned int chat_tick;
+	bool vending;
+
+	int targets[MAX_BOT_TARGETS]; // units seen by the bot
+	int target_count;
+};
+
+struct latency
+{
+	const char* name;
+	uint32 bucket[LATENCY_BUCKETS+1];
+	uint32 count;
+	uint32 max;
+	uint64 sum;
+};
+
+struct traffic
+{
+	uint32 packets_sent;
+	uint32 packets_recv;
+	uint64 bytes_sent;
+	uint64 bytes_recv;
+};
+
+static struct {
+	uint32 login_ip;
+	uint16 login_port;
+	uint32 client_version;
+	int packet_ver;
+	char packet_db[256];
+	int bot_count;
+	char userid[NAME_LENGTH];
+	char passwd[NAME_LENGTH];
+	bool register_accounts;
+	int char_slot;
+	char char_name[NAME_LENGTH];
+	int login_interval;
+	uint32 random_seed;
+	int duration;
+	int report_interval;
+	char report_file[256];
+	int server_pid[MAX_SERVER_PIDS];
+	int server_pid_count;
+	int ping_interval;
+	int action_interval;
+	int action_rate[ACT_MAX];
+	int walk_range;
+	char chat_message[BOT_CHAT_SIZE];
+	int skill_id;
+	int skill_lv;
+	char login_command[MAX_LOGIN_COMMANDS][BOT_CHAT_SIZE];
+	int login_command_count;
+} bot_config;
+
+static struct bot* bots = NULL;
+static struct bot* fd_bot[FD_SETSIZE]; // bot that owns each session
+
+static int packet_len_table[MAX_PACKET_DB+1];
+static struct bot_packet_data bot_packets[BP_MAX];
+
+static struct latency lat_login = { "login" }; // from the first connection to the map
+static struct latency lat_chars = { "chars" }; // char server connection until the character list arrives
+static struct latency lat_load  = { "load" };  // character selection until the char server sends the map server
+static struct latency lat_ping  = { "tick" };  // tick request round-trip
+static struct latency lat_walk  = { "walk" };  // walk request until it is accepted
+static struct latency lat_chat  = { "chat" };  // chat message until it is echoed
+
+static struct traffic traffic_interval, traffic_total;
+static int bots_started = 0;
+static int bots_online = 0;
+static int bots_failed = 0;
+
+static unsigned int start_tick;
+static unsigned int report_tick;
+static uint64 server_cputime_start[MAX_SERVER_PIDS];
+static uint64 server_cputime_last[MAX_SERVER_PIDS];
+
+static int login_timer = INVALID_TIMER;
+
+static int bot_parse_login(int fd);
+static int bot_parse_char(int fd);
+static int bot_parse_map(int fd);
+static void bot_disconnect(struct bot* b, const char* reason);
+
+
+/*==========================================
+ * Statistics
+ *------------------------------------------*/
+
+static void latency_add(struct latency* lat, unsigned int from, unsigned int to)
+{
+	unsigned int diff = ( DIFF_TICK(to, from) > 0 ) ? (unsigned int)DIFF_TICK(to, from) : 0;
+
+	lat->bucket[min(diff, LATENCY_BUCKETS)]++;
+	lat->count++;
+	lat->sum += diff;
+	if( diff > lat->max )
+		lat->max = diff;
+}
+
+/// Returns the latency (ms) below which pct percent of the samples are.
+static unsigned int latency_percentile(const struct latency* lat, int pct)
+{
+	uint64 want, seen = 0;
+	int i;
+
+	if( lat->count == 0 )
+		return 0;
+
+	want = ((uint64)lat->count * pct + 99) / 100;
+	for( i = 0; i <= LATENCY_BUCKETS; ++i )
+	{
+		seen += lat->bucket[i];
+		if( seen >= want )
+			return ( i == LATENCY_BUCKETS ) ? lat->max : (unsigned int)i;
+	}
+	return lat->max;
+}
+
+static void latency_show(const struct latency* lat)
+{
+	if( lat->count == 0 )
+		return;
+
+	ShowMessage("  %-6s latency: count %u, avg %u ms, p50 %u ms, p90 %u ms, p99 %u ms, max %u ms\n",
+		lat->name, lat->count, (unsigned int)(lat->sum/lat->count),
+		latency_percentile(lat, 50), latency_percentile(lat, 90), latency_percentile(lat, 99), lat->max);
+}
+
+static void latency_write(FILE* fp, const struct latency* lat)
+{
+	fprintf(fp, " %s_count=%u %s_p50=%u %s_p90=%u %s_p99=%u %s_max=%u",
+		lat->name, lat->count,
+		lat->name, latency_percentile(lat, 50),
+		lat->name, latency_percentile(lat, 90),
+		lat->name, latency_percentile(lat, 99),
+		lat->name, lat->max);
+}
+
+/// Returns the cpu time (ms) used by a process so far, 0 if unknown.
+static uint64 server_cputime(int pid)
+{
+#ifndef _WIN32
+	char path[64], line[1024];
+	char* p;
+	unsigned long utime, stime;
+	long hz = sysconf(_SC_CLK_TCK);
+	FILE* fp;
+
+	sprintf(path, "/proc/%d/stat", pid);
+	if( (fp = fopen(path, "r")) == NULL )
+		return 0;
+	if( fgets(line, sizeof(line), fp) == NULL || (p = strrchr(line, ')')) == NULL
+	||  sscanf(p+2, "%*c %*d %*d %*d %*d %*d %*u %*u %*u %*u %*u %lu %lu", &utime, &stime) < 2 || hz <= 0 )
+	{
+		fclose(fp);
+		return 0;
+	}
+	fclose(fp);
+	return (uint64)(utime + stime) * 1000 / hz;
+#else
+	return 0;
+#endif
+}
+
+static void bot_report(unsigned int tick, bool final)
+{
+	int i;
+	unsigned int elapsed = DIFF_TICK(tick, report_tick) > 0 ? DIFF_TICK(tick, report_tick) : 1;
+	const struct traffic* t = final ? &traffic_total : &traffic_interval;
+	FILE* fp;
+
+	if( final )
+		elapsed = DIFF_TICK(tick, start_tick) > 0 ? DIFF_TICK(tick, start_tick) : 1;
+
+	ShowMessage(CL_BOLD"Bot client %s (%u s):\n"CL_NORMAL, final ? "final report" : "report", (unsigned int)(DIFF_TICK(tick, start_tick)/1000));
+	ShowMessage("  bots: %d started, %d online, %d failed\n", bots_started, bots_online, bots_failed);
+	ShowMessage("  packets: %u sent/s, %u received/s (%u KB/s out, %u KB/s in)\n",
+		(unsigned int)((uint64)t->packets_sent*1000/elapsed), (unsigned int)((uint64)t->packets_recv*1000/elapsed),
+		(unsigned int)(t->bytes_sent*1000/1024/elapsed), (unsigned int)(t->bytes_recv*1000/1024/elapsed));
+	latency_show(&lat_login);
+	latency_show(&lat_chars);
+	latency_show(&lat_load);
+	latency_show(&lat_ping);
+	latency_show(&lat_walk);
+	latency_show(&lat_chat);
+	for( i = 0; i < bot_config.server_pid_count; ++i )
+	{
+		uint64 cputime = server_cputime(bot_config.server_pid[i]);
+		uint64 used = cputime - ( final ? server_cputime_start[i] : server_cputime_last[i] );
+
+		ShowMessage("  server %d: %u ms cpu time (%u.%u%% cpu)\n", bot_config.server_pid[i],
+			(unsigned int)used, (unsigned int)(used*100/elapsed), (unsigned int)(used*1000/elapsed%10));
+		server_cputime_last[i] = cputime;
+	}
+
+	if( bot_config.report_file[0] && (fp = fopen(bot_config.report_file, "a")) != NULL )
+	{
+		fprintf(fp, "%s time=%u bots=%d online=%d failed=%d sent_pps=%u recv_pps=%u",
+			final ? "final" : "interval", (unsigned int)(DIFF_TICK(tick, start_tick)/1000), bots_started, bots_online, bots_failed,
+			(unsigned int)((uint64)t->packets_sent*1000/elapsed), (unsigned int)((uint64)t->packets_recv*1000/elapsed));
+		latency_write(fp, &lat_login);
+		latency_write(fp, &lat_chars);
+		latency_write(fp, &lat_load);
+		latency_write(fp, &lat_ping);
+		latency_write(fp, &lat_walk);
+		latency_write(fp, &lat_chat);
+		for( i = 0; i < bot_config.server_pid_count; ++i )
+			fprintf(fp, " cpu_%d=%u", bot_config.server_pid[i], (unsigned int)(server_cputime_last[i] - server_cputime_start[i]));
+		fprintf(fp, "\n");
+		fclose(fp);
+	}
+
+	memset(&traffic_interval, 0, sizeof(traffic_interval));
+	report_tick = tick;
+}
+
+
+/*==========================================
+ * Packets
+ *------------------------------------------*/
+
+/// Reads the packet lengths and the layout of the client packets for the configured packet version.
+/// Every packet version inherits the definitions of the previous version, like in the map server.
+static bool bot_read_packetdb(void)
+{
+	char line[1024], w1[256], w2[256];
+	char* str[4];
+	char* p;
+	int packet_ver = 0, db_ver = 0, last_ver = 0;
+	int cmd, i, j;
+	FILE* fp;
+
+	if( (fp = fopen(bot_config.packet_db, "r")) == NULL )
+	{
+		ShowError("Bot client: can't read %s\n", bot_config.packet_db);
+		return false;
+	}
+
+	// find the version to use
+	while( fgets(line, sizeof(line), fp) )
+	{
+		if( sscanf(line, "%255[^:]: %255[^\r\n]", w1, w2) != 2 )
+			continue;
+		if( strcmpi(w1, "packet_ver") == 0 )
+			last_ver = atoi(w2);
+		else if( strcmpi(w1, "packet_db_ver") == 0 && strcmpi(w2, "default") != 0 )
+			db_ver = atoi(w2);
+	}
+	if( bot_config.packet_ver == 0 )
+		bot_config.packet_ver = ( db_ver ? db_ver : last_ver );
+
+	memset(packet_len_table, 0, sizeof(packet_len_table));
+	memset(bot_packets, 0, sizeof(bot_packets));
+	rewind(fp);
+	while( fgets(line, sizeof(line), fp) )
+	{
+		if( line[0] == '/' && line[1] == '/' )
+			continue;
+		if( sscanf(line, "%255[^:]: %255[^\r\n]", w1, w2) == 2 )
+		{
+			if( strcmpi(w1, "packet_ver") == 0 )
+			{
+				packet_ver = atoi(w2);
+				continue;
+			}
+			if( strcmpi(w1, "packet_db_ver") == 0 )
+				continue;
+		}
+		if( packet_ver > bot_config.packet_ver )
+			continue; // newer version
+
+		memset(str, 0, sizeof(str));
+		for( j = 0, p = line; j < 4 && p; ++j )
+		{
+			str[j] = p;
+			p = strchr(p, ',');
+			if( p ) *p++ = 0;
+		}
+		if( str[0] == NULL || str[1] == NULL )
+			continue;
+		cmd = strtol(str[0], NULL, 0);
+		if( cmd <= 0 || cmd > MAX_PACKET_DB )
+			continue;
+		packet_len_table[cmd] = atoi(str[1]);
+
+		if( str[2] == NULL || str[3] == NULL )
+			continue;
+		ARR_FIND(0, BP_MAX, i, strcmp(str[2], bot_packet_name[i]) == 0);
+		if( i == BP_MAX )
+			continue;
+		bot_packets[i].cmd = cmd;
+		bot_packets[i].len = packet_len_table[cmd];
+		memset(bot_packets[i].pos, 0, sizeof(bot_packets[i].pos));
+		for( j = 0, p = str[3]; p && j < MAX_PACKET_POS; ++j )
+		{
+			bot_packets[i].pos[j] = (short)atoi(p);
+			p = strchr(p, ':');
+			if( p ) ++p;
+		}
+	}
+	fclose(fp);
+
+	for( i = 0; i < BP_MAX; ++i )
+	{
+		if( bot_packets[i].cmd == 0 && i != BP_OPENVENDING && i != BP_CLOSEVENDING )
+		{
+			ShowError("Bot client: packet '%s' not found for packet version %d.\n", bot_packet_name[i], bot_config.packet_ver);
+			return false;
+		}
+	}
+	ShowStatus("Bot client: using packet version "CL_WHITE"%d"CL_RESET".\n", bot_config.packet_ver);
+	return true;
+}
+
+static void bot_packet_sent(int len)
+{
+	traffic_interval.packets_sent++;
+	traffic_interval.bytes_sent += len;
+	traffic_total.packets_sent++;
+	traffic_total.bytes_sent += len;
+}
+
+static void bot_packet_recv(int len)
+{
+	traffic_interval.packets_recv++;
+	traffic_interval.bytes_recv += len;
+	traffic_total.packets_recv++;
+	traffic_total.bytes_recv += len;
+}
+
+/// Starts a client packet of the configured packet version.
+/// Returns the packet layout.
+static const struct bot_packet_data* bot_packet_start(int fd, enum bot_packet type, int len)
+{
+	const struct bot_packet_data* packet = &bot_packets[type];
+
+	if( len <= 0 )
+		len = packet->len;
+	WFIFOHEAD(fd, len);
+	memset(WFIFOP(fd,0), 0, len);
+	WFIFOW(fd,0) = packet->cmd;
+	return packet;
+}
+
+static void bot_packet_end(int fd, int len)
+{
+	WFIFOSET(fd, len);
+	bot_packet_sent(len);
+}
+
+/// Returns the length of the packet at the start of the buffer, 0 if incomplete, -1 if unknown.
+static int bot_packet_length(int fd)
+{
+	int cmd, len;
+
+	if( RFIFOREST(fd) < 2 )
+		return 0;
+	cmd = RFIFOW(fd,0);
+	if( cmd > MAX_PACKET_DB || (len = packet_len_table[cmd]) == 0 )
+		return -1;
+	if( len == -1 )
+	{// variable-length packet
+		if( RFIFOREST(fd) < 4 )
+			return 0;
+		len = RFIFOW(fd,2);
+		if( len < 4 )
+			return -1;
+	}
+	if( (int)RFIFOREST(fd) < len )
+		return 0;
+	return len;
+}
+
+
+/*==========================================
+ * Bot life cycle
+ *------------------------------------------*/
+
+static bool bot_connect(struct bot* b, uint32 ip, uint16 port, ParseFunc func)
+{
+	int fd = make_connection(ip, port);
+
+	if( fd == -1 )
+		return false;
+	session[fd]->func_parse = func;
+	realloc_fifo(fd, FIFOSIZE_SERVERLINK, FIFOSIZE_SERVERLINK);
+	fd_bot[fd] = b;
+	b->fd = fd;
+	return true;
+}
+
+static void bot_close(struct bot* b)
+{
+	if( b->fd > 0 )
+	{
+		fd_bot[b->fd] = NULL;
+		do_close(b->fd);
+		b->fd = 0;
+	}
+}
+
+static void bot_disconnect(struct bot* b, const char* reason)
+{
+	if( b->state == BOT_ONLINE )
+		bots_online--;
+	if( reason )
+	{
+		ShowWarning("Bot client: bot '%s' disconnected (%s).\n", b->userid, reason);
+		bots_failed++;
+	}
+	bot_close(b);
+	b->state = BOT_OFFLINE;
+}
+
+static void bot_login(struct bot* b)
+{
+	char userid[NAME_LENGTH];
+
+	b->start_tick = gettick();
+	if( !bot_connect(b, bot_config.login_ip, bot_config.login_port, bot_parse_login) )
+	{
+		bot_disconnect(b, "can't connect to the login server");
+		return;
+	}
+	b->state = BOT_LOGIN;
+
+	if( b->registering )
+		safesnprintf(userid, sizeof(userid), "%s_M", b->userid);
+	else
+		safestrncpy(userid, b->userid, sizeof(userid));
+
+	// S 0064 <version>.L <username>.24B <password>.24B <clienttype>.B
+	WFIFOHEAD(b->fd, 55);
+	WFIFOW(b->fd,0) = 0x64;
+	WFIFOL(b->fd,2) = bot_config.client_version;
+	safestrncpy((char*)WFIFOP(b->fd,6), userid, NAME_LENGTH);
+	safestrncpy((char*)WFIFOP(b->fd,30), bot_config.passwd, NAME_LENGTH);
+	WFIFOB(b->fd,54) = 0;
+	bot_packet_end(b->fd, 55);
+}
+
+static int bot_login_timer(int tid, unsigned int tick, int id, intptr_t data)
+{
+	struct bot* b;
+
+	if( bots_started >= bot_config.bot_count )
+	{
+		delete_timer(login_timer, bot_login_timer);
+		login_timer = INVALID_TIMER;
+		return 0;
+	}
+
+	b = &bots[bots_started++];
+	b->registering = bot_config.register_accounts;
+	bot_login(b);
+	return 0;
+}
+
+/// Enters the map.
+static void bot_online(struct bot* b, int fd)
+{
+	unsigned int tick = gettick();
+
+	b->state = BOT_ONLINE;
+	bots_online++;
+	latency_add(&lat_login, b->start_tick, tick);
+	b->next_ping = tick + rnd_roll(bot_config.ping_interval+1);
+	b->next_action = tick + rnd_roll(bot_config.action_interval+1);
+
+	bot_packet_start(fd, BP_LOADENDACK, 0);
+	bot_packet_end(fd, bot_packets[BP_LOADENDACK].len);
+}
+
+
+/*==========================================
+ * Parsers
+ *------------------------------------------*/
+
+static int bot_parse_login(int fd)
+{
+	struct bot* b = fd_bot[fd];
+
+	if( b == NULL )
+	{
+		do_close(fd);
+		return 0;
+	}
+	if( session[fd]->flag.eof )
+	{
+		if( b->state == BOT_LOGIN )
+			bot_disconnect(b, "login server closed the connection");
+		else
+			bot_close(b);
+		return 0;
+	}
+
+	while( RFIFOREST(fd) >= 2 )
+	{
+		int cmd = RFIFOW(fd,0);
+
+		switch( cmd )
+		{
+		case 0x69: // R 0069 <len>.W <login id1>.L <account id>.L <login id2>.L <unused>.L <unused>.24B <unused>.W <sex>.B { <ip>.L <port>.W <name>.20B <users>.W <type>.W <new>.W }*
+			if( RFIFOREST(fd) < 4 || RFIFOREST(fd) < RFIFOW(fd,2) )
+				return 0;
+			bot_packet_recv(RFIFOW(fd,2));
+			if( RFIFOW(fd,2) < 47+32 )
+			{
+				bot_disconnect(b, "no char server available");
+				return 0;
+			}
+			b->login_id1 = RFIFOL(fd,4);
+			b->account_id = RFIFOL(fd,8);
+			b->login_id2 = RFIFOL(fd,12);
+			b->sex = RFIFOB(fd,46);
+			b->ip = ntohl(RFIFOL(fd,47));
+			b->port = RFIFOW(fd,51); // [!] LE byte order here [!]
+			RFIFOSKIP(fd, RFIFOW(fd,2));
+
+			bot_close(b);
+			if( !bot_connect(b, b->ip, b->port, bot_parse_char) )
+			{
+				bot_disconnect(b, "can't connect to the char server");
+				return 0;
+			}
+			b->state = BOT_CHAR;
+			b->skip_account_id = true;
+			b->char_tick = gettick();
+
+			// S 0065 <account id>.L <login id1>.L <login id2>.L <unknown>.W <sex>.B
+			WFIFOHEAD(b->fd, 17);
+			WFIFOW(b->fd,0) = 0x65;
+			WFIFOL(b->fd,2) = b->account_id;
+			WFIFOL(b->fd,6) = b->login_id1;
+			WFIFOL(b->fd,10) = b->login_id2;
+			WFIFOW(b->fd,14) = 0;
+			WFIFOB(b->fd,16) = b->sex;
+			bot_packet_end(b->fd, 17);
+			return 0;
+
+		case 0x6a: // R 006a <error code>.B <unblock time>.20B
+			if( RFIFOREST(fd) < 23 )
+				return 0;
+			bot_packet_recv(23);
+			RFIFOSKIP(fd, 23);
+			if( b->registering )
+			{// account already exists, log in normally
+				bot_close(b);
+				b->registering = false;
+				bot_login(b);
+			}
+			else
+				bot_disconnect(b, "login refused");
+			return 0;
+
+		default:
+			bot_disconnect(b, "unknown packet from the login server");
+			return 0;
+		}
+	}
+	return 0;
+}
+
+static int bot_parse_char(int fd)
+{
+	struct bot* b = fd_bot[fd];
+
+	if( b == NULL )
+	{
+		do_close(fd);
+		return 0;
+	}
+	if( session[fd]->flag.eof )
+	{
+		if( b->state == BOT_CHAR )
+			bot_disconnect(b, "char server closed the connection");
+		else
+			bot_close(b);
+		return 0;
+	}
+
+	if( b->skip_account_id )
+	{// the account id is sent before any packet
+		if( RFIFOREST(fd) < 4 )
+			return 0;
+		RFIFOSKIP(fd, 4);
+		b->skip_account_id = false;
+	}
+
+	while( RFIFOREST(fd) >= 2 )
+	{
+		int cmd = RFIFOW(fd,0);
+
+		switch( cmd )
+		{
+		case 0x6b: // R 006b <len>.W ... (character list)
+			if( RFIFOREST(fd) < 4 || RFIFOREST(fd) < RFIFOW(fd,2) )
+				return 0;
+			bot_packet_recv(RFIFOW(fd,2));
+			RFIFOSKIP(fd, RFIFOW(fd,2));
+			latency_add(&lat_chars, b->char_tick, gettick());
+
+			// The layout of the character list depends on the version of the char server,
+			// so instead of looking for the character, try to create it.
+			// S 0067 <name>.24B <str>.B <agi>.B <vit>.B <int>.B <dex>.B <luk>.B <slot>.B <hair color>.W <hair style>.W
+			WFIFOHEAD(fd, 37);
+			WFIFOW(fd,0) = 0x67;
+			safestrncpy((char*)WFIFOP(fd,2), b->name, NAME_LENGTH);
+			memset(WFIFOP(fd,26), 5, 6);
+			WFIFOB(fd,32) = bot_config.char_slot;
+			WFIFOW(fd,33) = 1;
+			WFIFOW(fd,35) = 1;
+			bot_packet_end(fd, 37);
+			break;
+
+		case 0x6d: // R 006d <character info>.?B (character created)
+			// The size of the character info depends on the version of the char server, but
+			// nothing else is sent until the character is selected, so skip everything.
+			bot_packet_recv(RFIFOREST(fd));
+			RFIFOSKIP(fd, RFIFOREST(fd));
+			// fall through
+		case 0x6e: // R 006e <error code>.B (character not created, it probably exists)
+			if( cmd == 0x6e )
+			{
+				if( RFIFOREST(fd) < 3 )
+					return 0;
+				bot_packet_recv(3);
+				RFIFOSKIP(fd, 3);
+			}
+			// S 0066 <slot>.B
+			WFIFOHEAD(fd, 3);
+			WFIFOW(fd,0) = 0x66;
+			WFIFOB(fd,2) = bot_config.char_slot;
+			bot_packet_end(fd, 3);
+			b->char_tick = gettick();
+			break;
+
+		case 0x6c: // R 006c <error code>.B
+			if( RFIFOREST(fd) < 3 )
+				return 0;
+			bot_packet_recv(3);
+			RFIFOSKIP(fd, 3);
+			bot_disconnect(b, "character selection refused");
+			return 0;
+
+		case 0x71: // R 0071 <char id>.L <map name>.16B <ip>.L <port>.W
+		{
+			const struct bot_packet_data* packet;
+
+			if( RFIFOREST(fd) < 28 )
+				return 0;
+			bot_packet_recv(28);
+			b->char_id = RFIFOL(fd,2);
+			b->ip = ntohl(RFIFOL(fd,22));
+			b->port = RFIFOW(fd,26); // [!] LE byte order here [!]
+			RFIFOSKIP(fd, 28);
+			latency_add(&lat_load, b->char_tick, gettick());
+
+			bot_close(b);
+			if( !bot_connect(b, b->ip, b->port, bot_parse_map) )
+			{
+				bot_disconnect(b, "can't connect to the map server");
+				return 0;
+			}
+			b->state = BOT_MAPAUTH;
+
+			packet = bot_packet_start(b->fd, BP_WANTTOCONNECTION, 0);
+			WFIFOL(b->fd, packet->pos[0]) = b->account_id;
+			WFIFOL(b->fd, packet->pos[1]) = b->char_id;
+			WFIFOL(b->fd, packet->pos[2]) = b->login_id1;
+			WFIFOL(b->fd, packet->pos[3]) = gettick();
+			WFIFOB(b->fd, packet->pos[4]) = b->sex;
+			bot_packet_end(b->fd, packet->len);
+			return 0;
+		}
+
+		case 0x20d: // R 020d <len>.W { <char id>.L <expire date>.20B }* (blocked characters)
+			if( RFIFOREST(fd) < 4 || RFIFOREST(fd) < RFIFOW(fd,2) )
+				return 0;
+			bot_packet_recv(RFIFOW(fd,2));
+			RFIFOSKIP(fd, RFIFOW(fd,2));
+			break;
+
+		default:
+			bot_disconnect(b, "unknown packet from the char server");
+			return 0;
+		}
+	}
+	return 0;
+}
+
+static void bot_add_target(struct bot* b, int id)
+{
+	int i;
+
+	if( id == b->account_id )
+		return;
+	ARR_FIND(0, b->target_count, i, b->targets[i] == id);
+	if( i < b->target_count )
+		return;
+	if( b->target_count < MAX_BOT_TARGETS )
+		b->targets[b->target_count++] = id;
+	else
+		b->targets[rnd_roll(MAX_BOT_TARGETS)] = id;
+}
+
+static void bot_remove_target(struct bot* b, int id)
+{
+	int i;
+
+	ARR_FIND(0, b->target_count, i, b->targets[i] == id);
+	if( i < b->target_count )
+		b->targets[i] = b->targets[--b->target_count];
+}
+
+static int bot_parse_map(int fd)
+{
+	struct bot* b = fd_bot[fd];
+	unsigned int tick = gettick();
+	int len;
+
+	if( b == NULL )
+	{
+		do_close(fd);
+		return 0;
+	}
+	if( session[fd]->flag.eof )
+	{
+		bot_disconnect(b, "map server closed the connection");
+		return 0;
+	}
+
+	while( (len = bot_packet_length(fd)) != 0 )
+	{
+		int cmd = RFIFOW(fd,0);
+
+		if( len < 0 )
+		{
+			ShowError("Bot client: bot '%s' received unknown packet 0x%04x, check packet_ver.\n", b->userid, cmd);
+			bot_disconnect(b, "unknown packet from the map server");
+			return 0;
+		}
+		bot_packet_recv(len);
+
+		switch( cmd )
+		{
+		case 0x73:  // R 0073 <start time>.L <position>.3B <x size>.B <y size>.B
+		case 0x2eb: // R 02eb <start time>.L <position>.3B <x size>.B <y size>.B <font>.W
+			if( b->state == BOT_MAPAUTH )
+			{
+				b->x = ( RFIFOB(fd,6) << 2 ) | ( RFIFOB(fd,7) >> 6 );
+				b->y = ( ( RFIFOB(fd,7) & 0x3f ) << 4 ) | ( RFIFOB(fd,8) >> 4 );
+				bot_online(b, fd);
+			}
+			break;
+		case 0x74: // R 0074 <error code>.B
+		case 0x81: // R 0081 <error code>.B
+			RFIFOSKIP(fd, len);
+			bot_disconnect(b, "map server refused the connection");
+			return 0;
+		case 0x7f: // R 007f <time>.L (tick reply)
+			if( b->ping_tick )
+			{
+				latency_add(&lat_ping, b->ping_tick, tick);
+				b->ping_tick = 0;
+			}
+			break;
+		case 0x87: // R 0087 <walk start time>.L <walk data>.6B (walk accepted)
+			if( b->walk_tick )
+			{
+				latency_add(&lat_walk, b->walk_tick, tick);
+				b->walk_tick = 0;
+			}
+			// assume the destination is reached
+			b->x = ( ( RFIFOB(fd,8) & 0x0f ) << 6 ) | ( RFIFOB(fd,9) >> 2 );
+			b->y = ( ( RFIFOB(fd,9) & 0x03 ) << 8 ) | RFIFOB(fd,10);
+			break;
+		case 0x8e: // R 008e <len>.W <message>.?B (own public message)
+			if( b->chat_tick )
+			{
+				latency_add(&lat_chat, b->chat_tick, tick);
+				b->chat_tick = 0;
+			}
+			break;
+		case 0x80: // R 0080 <id>.L <type>.B (unit vanished)
+			bot_remove_target(b, RFIFOL(fd,2));
+			break;
+		case 0x78: case 0x79: case 0x7b: case 0x7c: // unit appeared/spawned/walking
+		case 0x1d8: case 0x1d9: case 0x1da:
+		case 0x22a: case 0x22b: case 0x22c:
+		case 0x2ee: case 0x2ef: case 0x2ed:
+			bot_add_target(b, RFIFOL(fd,2));
+			break;
+		case 0x7f7: case 0x7f8: case 0x7f9: // R 07f? <len>.W <object type>.B <id>.L ...
+		case 0x857: case 0x858: case 0x856:
+			bot_add_target(b, RFIFOL(fd,5));
+			break;
+		case 0x12d: // R 012d <num>.W (vending window)
+			if( bot_packets[BP_OPENVENDING].cmd )
+			{// open a shop with the first cart items
+				int i, count = min(RFIFOW(fd,2), 3);
+				int plen = 85 + 8*count;
+				const struct bot_packet_data* packet = bot_packet_start(fd, BP_OPENVENDING, plen);
+
+				WFIFOW(fd, packet->pos[0]) = plen;
+				safesnprintf((char*)WFIFOP(fd, packet->pos[1]), 80, "%s's shop", b->name);
+				WFIFOB(fd, packet->pos[2]) = 1;
+				for( i = 0; i < count; ++i )
+				{
+					WFIFOW(fd, packet->pos[3] + 8*i + 0) = i + 2; // cart index
+					WFIFOW(fd, packet->pos[3] + 8*i + 2) = 1; // amount
+					WFIFOL(fd, packet->pos[3] + 8*i + 4) = 1000; // price
+				}
+				bot_packet_end(fd, plen);
+				b->vending = true;
+			}
+			break;
+		}
+		RFIFOSKIP(fd, len);
+	}
+	return 0;
+}
+
+
+/*==========================================
+ * Behaviour
+ *------------------------------------------*/
+
+static void bot_say(struct bot* b, const char* message)
+{
+	char text[BOT_CHAT_SIZE];
+	int len;
+
+	safesnprintf(text, sizeof(text), "%s : %s", b->name, message);
+	len = 4 + (int)strlen(text) + 1;
+	bot_packet_start(b->fd, BP_GLOBALMESSAGE, len);
+	WFIFOW(b->fd, 2) = len;
+	memcpy(WFIFOP(b->fd, 4), text, len - 4);
+	bot_packet_end(b->fd, len);
+}
+
+static void bot_act(struct bot* b, unsigned int tick)
+{
+	const struct bot_packet_data* packet;
+	int fd = b->fd;
+	int i, roll, total = 0;
+	short x, y;
+
+	if( b->login_command < bot_config.login_command_count )
+	{// prepare the character first
+		bot_say(b, bot_config.login_command[b->login_command++]);
+		return;
+	}
+
+	for( i = 0; i < ACT_MAX; ++i )
+		total += bot_config.action_rate[i];
+	if( total <= 0 )
+		return;
+	roll = rnd_roll(total);
+	for( i = 0; i < ACT_MAX-1 && roll >= bot_config.action_rate[i]; ++i )
+		roll -= bot_config.action_rate[i];
+
+	if( b->vending && i != ACT_VEND && bot_packets[BP_CLOSEVENDING].cmd )
+	{// close the shop to do something else
+		bot_packet_start(fd, BP_CLOSEVENDING, 0);
+		bot_packet_end(fd, bot_packets[BP_CLOSEVENDING].len);
+		b->vending = false;
+	}
+
+	x = cap_value(b->x + rnd_value(-bot_config.walk_range, bot_config.walk_range), 0, 1023);
+	y = cap_value(b->y + rnd_value(-bot_config.walk_range, bot_config.walk_range), 0, 1023);
+
+	switch( i )
+	{
+	case ACT_WALK:
+		packet = bot_packet_start(fd, BP_WALKTOXY, 0);
+		WFIFOB(fd, packet->pos[0]+0) = (uint8)(x>>2);
+		WFIFOB(fd, packet->pos[0]+1) = (uint8)((x<<6) | ((y>>4)&0x3f));
+		WFIFOB(fd, packet->pos[0]+2) = (uint8)(y<<4);
+		bot_packet_end(fd, packet->len);
+		b->walk_tick = tick;
+		break;
+	case ACT_ATTACK:
+		if( b->target_count == 0 )
+			break;
+		packet = bot_packet_start(fd, BP_ACTIONREQUEST, 0);
+		WFIFOL(fd, packet->pos[0]) = b->targets[rnd_roll(b->target_count)];
+		WFIFOB(fd, packet->pos[1]) = 7; // continuous attack
+		bot_packet_end(fd, packet->len);
+		break;
+	case ACT_CHAT:
+		bot_say(b, bot_config.chat_message);
+		b->chat_tick = tick;
+		break;
+	case ACT_VEND:
+		if( b->vending )
+			break;
+		packet = bot_packet_start(fd, BP_USESKILLTOID, 0);
+		WFIFOW(fd, packet->pos[0]) = 1;
+		WFIFOW(fd, packet->pos[1]) = MC_VENDING;
+		WFIFOL(fd, packet->pos[2]) = b->account_id;
+		bot_packet_end(fd, packet->len);
+		break;
+	case ACT_SKILL:
+		packet = bot_packet_start(fd, BP_USESKILLTOPOS, 0);
+		WFIFOW(fd, packet->pos[0]) = bot_config.skill_lv;
+		WFIFOW(fd, packet->pos[1]) = bot_config.skill_id;
+		WFIFOW(fd, packet->pos[2]) = x;
+		WFIFOW(fd, packet->pos[3]) = y;
+		bot_packet_end(fd, packet->len);
+		break;
+	}
+}
+
+static int bot_action_timer(int tid, unsigned int tick, int id, intptr_t data)
+{
+	int i;
+
+	for( i = 0; i < bots_started; ++i )
+	{
+		struct bot* b = &bots[i];
+		const struct bot_packet_data* packet;
+
+		if( b->state != BOT_ONLINE )
+			continue;
+
+		if( DIFF_TICK(tick, b->next_ping) >= 0 && b->ping_tick == 0 )
+		{// latency probe
+			packet = bot_packet_start(b->fd, BP_TICKSEND, 0);
+			WFIFOL(b->fd, packet->pos[0]) = tick;
+			bot_packet_end(b->fd, packet->len);
+			b->ping_tick = tick;
+			b->next_ping = tick + bot_config.ping_interval;
+		}
+
+		if( DIFF_TICK(tick, b->next_action) >= 0 )
+		{
+			bot_act(b, tick);
+			b->next_action = tick + bot_config.action_interval;
+		}
+	}
+	return 0;
+}
+
+static int bot_report_timer(int tid, unsigned int tick, int id, intptr_t data)
+{
+	bot_report(tick, false);
+	return 0;
+}
+
+static int bot_duration_timer(int tid, unsigned int tick, int id, intptr_t data)
+{
+	runflag = SERVER_STATE_STOP;
+	return 0;
+}
+
+
+/*==========================================
+ * Configuration
+ *------------------------------------------*/
+
+static void bot_config_default(void)
+{
+	memset(&bot_config, 0, sizeof(bot_config));
+	bot_config.login_ip = str2ip("127.0.0.1");
+	bot_config.login_port = 6900;
+	bot_config.client_version = 20;
+	safestrncpy(bot_config.packet_db, "db/packet_db.txt", sizeof(bot_config.packet_db));
+	bot_config.bot_count = 100;
+	safestrncpy(bot_config.userid, "bot%04d", sizeof(bot_config.userid));
+	safestrncpy(bot_config.passwd, "botpass", sizeof(bot_config.passwd));
+	bot_config.register_accounts = true;
+	safestrncpy(bot_config.char_name, "Bot%04d", sizeof(bot_config.char_name));
+	bot_config.login_interval = 50;
+	bot_config.random_seed = 1;
+	bot_config.duration = 300;
+	bot_config.report_interval = 10;
+	bot_config.ping_interval = 1000;
+	bot_config.action_interval = 1000;
+	bot_config.action_rate[ACT_WALK] = 50;
+	bot_config.action_rate[ACT_ATTACK] = 20;
+	bot_config.action_rate[ACT_CHAT] = 10;
+	bot_config.action_rate[ACT_VEND] = 5;
+	bot_config.action_rate[ACT_SKILL] = 15;
+	bot_config.walk_range = 10;
+	safestrncpy(bot_config.chat_message, "Hello, I'm a bot!", sizeof(bot_config.chat_message));
+	bot_config.skill_id = 83;
+	bot_config.skill_lv = 10;
+}
+
+static int bot_config_read(const char* cfgName)
+{
+	char line[1024], w1[1024], w2[1024];
+	FILE* fp;
+
+	fp = fopen(cfgName, "r");
+	if( fp == NULL )
+	{
+		ShowError("Configuration file (%s) not found.\n", cfgName);
+		return 1;
+	}
+	while( fgets(line, sizeof(line), fp) )
+	{
+		if( line[0] == '/' && line[1] == '/' )
+			continue;
+		if( sscanf(line, "%[^:]: %[^\r\n]", w1, w2) < 2 )
+			continue;
+
+		if( strcmpi(w1, "login_ip") == 0 )
+			bot_config.login_ip = host2ip(w2);
+		else if( strcmpi(w1, "login_port") == 0 )
+			bot_config.login_port = (uint16)atoi(w2);
+		else if( strcmpi(w1, "client_version") == 0 )
+			bot_config.client_version = (uint32)strtoul(w2, NULL, 10);
+		else if( strcmpi(w1, "packet_ver") == 0 )
+			bot_config.packet_ver = atoi(w2);
+		else if( strcmpi(w1, "packet_db") == 0 )
+			safestrncpy(bot_config.packet_db, w2, sizeof(bot_config.packet_db));
+		else if( strcmpi(w1, "bot_count") == 0 )
+			bot_config.bot_count = cap_value(atoi(w2), 0, MAX_BOTS);
+		else if( strcmpi(w1, "userid") == 0 )
+			safestrncpy(bot_config.userid, w2, sizeof(bot_config.userid));
+		else if( strcmpi(w1, "passwd") == 0 )
+			safestrncpy(bot_config.passwd, w2, sizeof(bot_config.passwd));
+		else if( strcmpi(w1, "register") == 0 )
+			bot_config.register_accounts = (bool)config_switch(w2);
+		else if( strcmpi(w1, "char_slot") == 0 )
+			bot_config.char_slot = cap_value(atoi(w2), 0, MAX_CHARS-1);
+		else if( strcmpi(w1, "char_name") == 0 )
+			safestrncpy(bot_config.char_name, w2, sizeof(bot_config.char_name));
+		else if( strcmpi(w1, "login_interval") == 0 )
+			bot_config.login_interval = max(atoi(w2), 1);
+		else if( strcmpi(w1, "random_seed") == 0 )
+			bot_config.random_seed = (uint32)strtoul(w2, NULL, 10);
+		else if( strcmpi(w1, "duration") == 0 )
+			bot_config.duration = max(atoi(w2), 0);
+		else if( strcmpi(w1, "report_interval") == 0 )
+			bot_config.report_interval = max(atoi(w2), 1);
+		else if( strcmpi(w1, "report_file") == 0 )
+			safestrncpy(bot_config.report_file, w2, sizeof(bot_config.report_file));
+		else if( strcmpi(w1, "server_pid") == 0 )
+		{
+			if( bot_config.server_pid_count < MAX_SERVER_PIDS )
+				bot_config.server_pid[bot_config.server_pid_count++] = atoi(w2);
+		}
+		else if( strcmpi(w1, "ping_interval") == 0 )
+			bot_config.ping_interval = max(atoi(w2), 1);
+		else if( strcmpi(w1, "action_interval") == 0 )
+			bot_config.action_interval = max(atoi(w2), 1);
+		else if( strcmpi(w1, "walk_rate") == 0 )
+			bot_config.action_rate[ACT_WALK] = max(atoi(w2), 0);
+		else if( strcmpi(w1, "attack_rate") == 0 )
+			bot_config.action_rate[ACT_ATTACK] = max(atoi(w2), 0);
+		else if( strcmpi(w1, "chat_rate") == 0 )
+			bot_config.action_rate[ACT_CHAT] = max(atoi(w2), 0);
+		else if( strcmpi(w1, "vend_rate") == 0 )
+			bot_config.action_rate[ACT_VEND] = max(atoi(w2), 0);
+		else if( strcmpi(w1, "skill_rate") == 0 )
+			bot_config.action_rate[ACT_SKILL] = max(atoi(w2), 0);
+		else if( strcmpi(w1, "walk_range") == 0 )
+			bot_config.walk_range = cap_value(atoi(w2), 1, 30);
+		else if( strcmpi(w1, "chat_message") == 0 )
+			safestrncpy(bot_config.chat_message, w2, sizeof(bot_config.chat_message));
+		else if( strcmpi(w1, "skill_id") == 0 )
+			bot_config.skill_id = atoi(w2);
+		else if( strcmpi(w1, "skill_lv") == 0 )
+			bot_config.skill_lv = atoi(w2);
+		else if( strcmpi(w1, "login_command") == 0 )
+		{
+			if( bot_config.login_command_count < MAX_LOGIN_COMMANDS )
+				safestrncpy(bot_config.login_command[bot_config.login_command_count++], w2, BOT_CHAT_SIZE);
+		}
+		else if( strcmpi(w1, "console_silent") == 0 )
+			msg_silent = atoi(w2);
+		else if( strcmpi(w1, "import") == 0 )
+			bot_config_read(w2);
+		else
+			ShowWarning("Unknown setting '%s' in file %s\n", w1, cfgName);
+	}
+	fclose(fp);
+	return 0;
+}
+
+
+/*==========================================
+ * Core
+ *------------------------------------------*/
+
+int do_init(int argc, char** argv)
+{
+	int i;
+
+	bot_config_default();
+	bot_config_read( (argc > 1) ? argv[1] : BOT_CONF_NAME );
+
+	if( bot_config.random_seed )
+		rnd_seed(bot_config.random_seed);
+	else
+		rnd_init();
+
+	if( !bot_read_packetdb() )
+	{
+		runflag = SERVER_STATE_STOP;
+		return 0;
+	}
+
+	CREATE(bots, struct bot, max(bot_config.bot_count, 1));
+	for( i = 0; i < bot_config.bot_count; ++i )
+	{
+		bots[i].id = i;
+		safesnprintf(bots[i].userid, NAME_LENGTH, bot_config.userid, i);
+		safesnprintf(bots[i].name, NAME_LENGTH, bot_config.char_name, i);
+	}
+
+	start_tick = report_tick = gettick();
+	for( i = 0; i < bot_config.server_pid_count; ++i )
+		server_cputime_start[i] = server_cputime_last[i] = server_cputime(bot_config.server_pid[i]);
+
+	add_timer_func_list(bot_login_timer, "bot_login_timer");
+	add_timer_func_list(bot_action_timer, "bot_action_timer");
+	add_timer_func_list(bot_report_timer, "bot_report_timer");
+	add_timer_func_list(bot_duration_timer, "bot_duration_timer");
+	login_timer = add_timer_interval(gettick() + 1000, bot_login_timer, 0, 0, bot_config.login_interval);
+	add_timer_interval(gettick() + 100, bot_action_timer, 0, 0, 100);
+	add_timer_interval(gettick() + bot_config.report_interval*1000, bot_report_timer, 0, 0, bot_config.report_interval*1000);
+	if( bot_config.duration )
+		add_timer(gettick() + bot_config.duration*1000, bot_duration_timer, 0, 0);
+
+	ShowStatus("Bot client is "CL_GREEN"ready"CL_RESET", starting %d bots.\n", bot_config.bot_count);
+	return 0;
+}
+
+void do_final(void)
+{
+	int i;
+
+	if( bots == NULL )
+		return;
+
+	bot_report(gettick(), true);
+	for( i = 0; i < bot_config.bot_count; ++i )
+		bot_close(&bots[i]);
+	aFree(bots);
+	bots = NULL;
+}
+
+int parse_console(const char* buf)
+{
+	if( strcmpi("report", buf) == 0 )
+		bot_report(gettick(), false);
+	else if( strcmpi("shutdown", buf) == 0 || strcmpi("exit", buf) == 0 || strcmpi("quit", buf) == 0 )
+		runflag = SERVER_STATE_STOP;
+	return 0;
+}
+
+void set_server_type(void) { }
+
+void do_shutdown(void)
+{
+	runflag = SERVER_STATE_STOP;
+}
+
+void do_abort(void) { }